@@ -0,0 +1,316 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "AdvertData.h"
+
+// Folds rotating random addresses into logical devices. Phones change their
+// resolvable private address every few minutes; without this every rotation
+// looks like a new device. Adverts from random addresses are fingerprinted
+// by the payload fields that stay put across rotations, and a new address
+// whose fingerprint matches a cluster that has gone quiet, at a similar
+// signal strength, is taken to be the same device.
+//
+// Devices of one model share a fingerprint, so a new address can match a
+// neighbour that is only between adverts. The link is provisional until the
+// old address has stayed quiet for CLUSTER_STOP_INTERVALS of its advert
+// interval; if the old address is heard first, the link is undone and the
+// new address looks for its cluster again on its next advert.
+//
+// The radio only hears the adverts sent while it listens, so with the scan
+// duty cut (ScanScheduler.h) a device can go unheard for many of its advert
+// intervals. A cluster's interval follows the shortest gaps it is heard at,
+// and at the duty set with setDuty() the quiet a link needs is scaled down
+// and the time it waits for the old address scaled up.
+//
+// A cluster's identity is the first address it was seen with, so it can be
+// stored anywhere a MAC can. State is a fixed table; expire() frees clusters
+// that can no longer be continued, and the stalest is reused only when every
+// slot is live. Clusters are not persisted.
+
+enum AddressKind {
+    ADDRESS_PUBLIC,
+    ADDRESS_RANDOM_STATIC,
+    ADDRESS_RESOLVABLE,     // Rotates; resolvable by bonded peers
+    ADDRESS_NON_RESOLVABLE  // Rotates
+};
+
+// The top two bits of a random address give its sub-type
+inline AddressKind addressKind(uint64_t mac, bool randomAddress) {
+    if (!randomAddress) return ADDRESS_PUBLIC;
+    switch ((mac >> 46) & 0x3) {
+        case 0x3: return ADDRESS_RANDOM_STATIC;
+        case 0x1: return ADDRESS_RESOLVABLE;
+        default:  return ADDRESS_NON_RESOLVABLE;
+    }
+}
+
+inline bool addressRotates(AddressKind kind) {
+    return kind == ADDRESS_RESOLVABLE || kind == ADDRESS_NON_RESOLVABLE;
+}
+
+#define FINGERPRINT_MANUFACTURER_PREFIX 2 // Manufacturer data bytes after the company ID
+
+inline uint32_t fnv1a(uint32_t hash, const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+inline uint32_t fnv1a16(uint32_t hash, uint16_t value) {
+    uint8_t bytes[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+    return fnv1a(hash, bytes, 2);
+}
+
+// Hash of the advert fields that survive an address rotation: the
+// manufacturer data prefix, service UUIDs, TX power, appearance and name.
+// Returns 0 if the advert carries none of them.
+inline uint32_t advertFingerprint(const AdvertData& advert) {
+    uint32_t hash = 2166136261u;
+    bool stable = false;
+    uint8_t uuid16Count = advert.uuid16Count < ADVERT_MAX_UUID16 ? advert.uuid16Count : ADVERT_MAX_UUID16;
+    for (uint8_t i = 0; i < uuid16Count; i++) {
+        hash = fnv1a16(hash, advert.uuid16[i]);
+        stable = true;
+    }
+    uint8_t uuid128Count = advert.uuid128Count < ADVERT_MAX_UUID128 ? advert.uuid128Count : ADVERT_MAX_UUID128;
+    for (uint8_t i = 0; i < uuid128Count; i++) {
+        hash = fnv1a(hash, advert.uuid128[i], 16);
+        stable = true;
+    }
+    if (advert.has(ADVERT_HAS_NAME)) {
+        hash = fnv1a(hash, (const uint8_t*)advert.name, advert.nameLength);
+        stable = true;
+    }
+    if (advert.has(ADVERT_HAS_TX_POWER)) {
+        hash = fnv1a(hash, (const uint8_t*)&advert.txPower, 1);
+        stable = true;
+    }
+    if (advert.has(ADVERT_HAS_APPEARANCE)) {
+        hash = fnv1a16(hash, advert.appearance);
+        stable = true;
+    }
+    if (advert.has(ADVERT_HAS_SERVICE_DATA)) {
+        hash = fnv1a16(hash, advert.serviceDataUuid);
+        stable = true;
+    }
+    if (advert.has(ADVERT_HAS_MANUFACTURER)) {
+        hash = fnv1a16(hash, advert.company);
+        size_t prefix = advert.manufacturerDataLength < FINGERPRINT_MANUFACTURER_PREFIX
+                            ? advert.manufacturerDataLength : FINGERPRINT_MANUFACTURER_PREFIX;
+        hash = fnv1a(hash, advert.manufacturerData, prefix);
+        stable = true;
+    }
+    if (!stable) return 0;
+    return hash != 0 ? hash : 1;
+}
+
+#define CLUSTER_NONE           0xFFFF
+#define CLUSTER_LINK_WINDOW    1200000 // ms a quiet cluster can still be continued
+#define CLUSTER_RSSI_TOLERANCE 12      // dB between a cluster and its next address
+#define CLUSTER_MAX_INTERVAL   10000   // ms; longer gaps are not advert intervals
+#define CLUSTER_STOP_INTERVALS 6       // Quiet intervals of the old address that confirm a link
+
+template <uint16_t Capacity>
+class AddressClusters {
+public:
+    AddressClusters() { clear(); }
+
+    void clear() {
+        memset(clusters, 0, sizeof(clusters));
+        count = 0;
+        duty = 100;
+        folded = 0;
+        undone = 0;
+        freed = 0;
+        reused = 0;
+    }
+
+    uint16_t size() const { return count; }
+    uint16_t capacity() const { return Capacity; }
+    unsigned long rotationsFolded() const { return folded; }
+    unsigned long linksUndone() const { return undone; }
+    unsigned long clustersFreed() const { return freed; }
+    unsigned long clustersReused() const { return reused; }
+
+    // The percentage of the time the radio is listening
+    void setDuty(uint32_t percent) { duty = (uint8_t)(percent < 1 ? 1 : percent > 100 ? 100 : percent); }
+
+    // Returns the identity for an advert from a rotating address. slot is
+    // the cluster last returned for this address, or CLUSTER_NONE, and is
+    // updated.
+    uint64_t resolve(uint16_t& slot, uint64_t mac, uint32_t fingerprint, int8_t rssi, uint32_t now) {
+        if (slot >= Capacity || !clusters[slot].used || clusters[slot].mac != mac) {
+            slot = find(mac);
+        }
+        if (slot < Capacity) {
+            Cluster& cluster = clusters[slot];
+            if (cluster.mac != mac) {
+                // The address this cluster was linked away from is still
+                // advertising, so the new address belongs to another device
+                cluster.mac = mac;
+                cluster.lastSeen = cluster.previousSeen;
+                cluster.previousMac = 0;
+                cluster.linked = false;
+                cluster.rotations--;
+                folded--;
+                undone++;
+            }
+            update(cluster, rssi, now);
+            settle(cluster, now);
+            return cluster.identity;
+        }
+
+        int best = continuation(fingerprint, rssi, now);
+        if (best >= 0) {
+            Cluster& cluster = clusters[best];
+            cluster.previousMac = cluster.mac;
+            cluster.previousSeen = cluster.lastSeen;
+            cluster.linked = true;
+            cluster.mac = mac;
+            cluster.rotations++;
+            cluster.lastSeen = now;
+            cluster.rssi = rssi;
+            folded++;
+            slot = (uint16_t)best;
+            return cluster.identity;
+        }
+
+        slot = allocate(now);
+        Cluster& cluster = clusters[slot];
+        cluster.used = true;
+        cluster.linked = false;
+        cluster.previousMac = 0;
+        cluster.identity = mac;
+        cluster.mac = mac;
+        cluster.fingerprint = fingerprint;
+        cluster.lastSeen = now;
+        cluster.interval = 0;
+        cluster.rssi = rssi;
+        cluster.rotations = 0;
+        count++;
+        return mac;
+    }
+
+    // Frees the clusters quiet for longer than the link window, which no
+    // new address can continue any more
+    void expire(uint32_t now) {
+        for (uint16_t i = 0; i < Capacity; i++) {
+            if (clusters[i].used && now - clusters[i].lastSeen > CLUSTER_LINK_WINDOW) {
+                clusters[i].used = false;
+                count--;
+                freed++;
+            }
+        }
+    }
+
+    // The identity resolve() last returned for this address and slot
+    uint64_t identityOf(uint16_t slot, uint64_t mac) const {
+        if (slot < Capacity && clusters[slot].used && clusters[slot].mac == mac) return clusters[slot].identity;
+        return mac;
+    }
+
+private:
+    struct Cluster {
+        uint64_t identity;    // First address seen
+        uint64_t mac;         // Current address
+        uint64_t previousMac; // Address before the last link, 0 if none
+        uint32_t fingerprint;
+        uint32_t lastSeen;    // millis()
+        uint32_t previousSeen; // When previousMac was last heard
+        uint16_t interval;    // Smoothed advert interval in ms, 0 if unknown
+        int8_t rssi;          // Smoothed
+        bool used;
+        bool linked;          // Last link not yet confirmed
+        uint16_t rotations;
+    };
+
+    void update(Cluster& cluster, int8_t rssi, uint32_t now) const {
+        uint32_t gap = now - cluster.lastSeen;
+        if (gap > 0 && gap < CLUSTER_MAX_INTERVAL) {
+            // Falls quickly and rises slowly, so adverts missed while the
+            // radio was not listening don't stretch it
+            if (cluster.interval == 0 || gap < cluster.interval) {
+                cluster.interval = cluster.interval == 0 ? gap : (uint16_t)((cluster.interval + gap) / 2);
+            } else {
+                cluster.interval = (uint16_t)(cluster.interval + (gap - cluster.interval) / 16);
+            }
+        }
+        cluster.rssi = (int8_t)((cluster.rssi * 3 + rssi) / 4);
+        cluster.lastSeen = now;
+    }
+
+    // Confirms a provisional link once the old address has been quiet for
+    // several of its advert intervals, more at a lower duty as fewer of its
+    // adverts are heard
+    void settle(Cluster& cluster, uint32_t now) const {
+        uint32_t interval = cluster.interval > 0 ? cluster.interval : CLUSTER_MAX_INTERVAL;
+        if (cluster.linked && now - cluster.previousSeen >= interval * CLUSTER_STOP_INTERVALS * 100 / duty) {
+            cluster.linked = false;
+        }
+    }
+
+    // The cluster currently using mac, or whose last link left it. A rotated
+    // address is never heard again, so one that is heard again was taken
+    // for a rotation in error, even after the link was confirmed.
+    uint16_t find(uint64_t mac) const {
+        for (uint16_t i = 0; i < Capacity; i++) {
+            const Cluster& cluster = clusters[i];
+            if (cluster.used && (cluster.mac == mac || cluster.previousMac == mac)) return i;
+        }
+        return CLUSTER_NONE;
+    }
+
+    // The cluster a new address most likely continues: same fingerprint, seen
+    // within the link window at a similar RSSI, not already linked to an
+    // address of its own that is still provisional, and quiet for at least
+    // half an advert interval, less at a lower duty (a device still
+    // advertising under its old address is a different device). Closest RSSI
+    // wins; of equally close ones, the one whose silence is nearest a single
+    // advert interval, as a rotation's is.
+    int continuation(uint32_t fingerprint, int8_t rssi, uint32_t now) {
+        int best = -1;
+        int bestDistance = CLUSTER_RSSI_TOLERANCE + 1;
+        uint32_t bestOverdue = 0;
+        for (int i = 0; i < Capacity; i++) {
+            Cluster& cluster = clusters[i];
+            if (!cluster.used || cluster.fingerprint != fingerprint) continue;
+            uint32_t quiet = now - cluster.lastSeen;
+            if (quiet > CLUSTER_LINK_WINDOW) continue;
+            if (cluster.interval > 0 && quiet < (uint32_t)cluster.interval * duty / 200) continue;
+            settle(cluster, now);
+            if (cluster.linked) continue;
+            int distance = rssi > cluster.rssi ? rssi - cluster.rssi : cluster.rssi - rssi;
+            uint32_t overdue = quiet > cluster.interval ? quiet - cluster.interval : cluster.interval - quiet;
+            if (distance < bestDistance || (distance == bestDistance && overdue < bestOverdue)) {
+                best = i;
+                bestDistance = distance;
+                bestOverdue = overdue;
+            }
+        }
+        return best;
+    }
+
+    // A free slot, or the stalest cluster when every slot is live
+    uint16_t allocate(uint32_t now) {
+        uint16_t stalest = 0;
+        for (uint16_t i = 0; i < Capacity; i++) {
+            if (!clusters[i].used) return i;
+            if (now - clusters[i].lastSeen > now - clusters[stalest].lastSeen) stalest = i;
+        }
+        clusters[stalest].used = false;
+        count--;
+        reused++;
+        return stalest;
+    }
+
+    Cluster clusters[Capacity];
+    uint16_t count; // Clusters in use
+    uint8_t duty;   // Percent
+    unsigned long folded;
+    unsigned long undone;
+    unsigned long freed;
+    unsigned long reused;
+};
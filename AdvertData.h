@@ -0,0 +1,184 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Allocation-free decoder for the advertising data in an advert or scan
+// response. The payload is a run of AD structures, each a length byte, a
+// type byte and length - 1 bytes of data. The decoder walks them in place and
+// fills a fixed-size record; the name, UUIDs and manufacturer data are views
+// into the payload, so the record is only valid while the payload is.
+//
+// A zero length byte ends the data (the rest is padding). Malformed input is
+// never read past its length: a structure running off the end stops the walk
+// and marks the record truncated.
+
+// AD types
+#define AD_FLAGS                0x01
+#define AD_UUID16_INCOMPLETE    0x02
+#define AD_UUID16_COMPLETE      0x03
+#define AD_UUID32_INCOMPLETE    0x04
+#define AD_UUID32_COMPLETE      0x05
+#define AD_UUID128_INCOMPLETE   0x06
+#define AD_UUID128_COMPLETE     0x07
+#define AD_NAME_SHORT           0x08
+#define AD_NAME_COMPLETE        0x09
+#define AD_TX_POWER             0x0A
+#define AD_SERVICE_DATA16       0x16
+#define AD_APPEARANCE           0x19
+#define AD_MANUFACTURER_DATA    0xFF
+
+#define ADVERT_MAX_UUID16  8  // 16-bit service UUIDs kept; the rest are counted only
+#define ADVERT_MAX_UUID128 2  // 128-bit service UUIDs kept
+#define ADVERT_MAX_NAME    31 // Longest name an AD structure can carry
+
+#define COMPANY_NONE 0xFFFF // Reserved by the SIG for testing, never assigned
+
+// Present bits
+#define ADVERT_HAS_FLAGS        0x01
+#define ADVERT_HAS_TX_POWER     0x02
+#define ADVERT_HAS_APPEARANCE   0x04
+#define ADVERT_HAS_MANUFACTURER 0x08
+#define ADVERT_HAS_SERVICE_DATA 0x10
+#define ADVERT_HAS_NAME         0x20
+#define ADVERT_NAME_COMPLETE    0x40 // The name is the complete rather than shortened one
+#define ADVERT_TRUNCATED        0x80 // The walk stopped at a malformed structure
+
+// One AD structure
+struct AdField {
+    uint8_t type;
+    uint8_t length; // Of data
+    const uint8_t* data;
+};
+
+// Steps over the AD structure at pos. Returns false at the end of the
+// payload or at a structure that does not fit; pos is left there.
+inline bool nextAdField(const uint8_t* payload, size_t length, size_t& pos, AdField& field) {
+    if (payload == nullptr || pos >= length) return false;
+    uint8_t fieldLength = payload[pos];
+    if (fieldLength == 0 || pos + 1 + fieldLength > length) return false;
+    field.type = payload[pos + 1];
+    field.length = fieldLength - 1;
+    field.data = payload + pos + 2;
+    pos += 1 + fieldLength;
+    return true;
+}
+
+inline uint16_t readLe16(const uint8_t* data) {
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+struct AdvertData {
+    uint8_t present;         // ADVERT_HAS_* bits
+    uint8_t flags;
+    int8_t txPower;          // dBm
+    uint16_t appearance;
+    uint16_t company;        // Manufacturer data company ID, or COMPANY_NONE
+    uint16_t serviceDataUuid;
+    const uint8_t* manufacturerData; // After the company ID
+    uint8_t manufacturerDataLength;
+    const char* name;        // Not terminated
+    uint8_t nameLength;
+    uint8_t uuid16Count;     // Including any beyond ADVERT_MAX_UUID16
+    uint8_t uuid128Count;    // Including any beyond ADVERT_MAX_UUID128
+    uint8_t uuid32Count;     // Counted only
+    uint16_t uuid16[ADVERT_MAX_UUID16];
+    const uint8_t* uuid128[ADVERT_MAX_UUID128]; // 16 bytes each, least significant first
+
+    bool has(uint8_t bits) const { return (present & bits) == bits; }
+};
+
+// Decodes payload into out. A complete name wins over a shortened one, and
+// the first manufacturer data and service data structures are the ones kept.
+inline void parseAdvert(const uint8_t* payload, size_t length, AdvertData& out) {
+    out.present = 0;
+    out.flags = 0;
+    out.txPower = 0;
+    out.appearance = 0;
+    out.company = COMPANY_NONE;
+    out.serviceDataUuid = 0;
+    out.manufacturerData = nullptr;
+    out.manufacturerDataLength = 0;
+    out.name = nullptr;
+    out.nameLength = 0;
+    out.uuid16Count = 0;
+    out.uuid128Count = 0;
+    out.uuid32Count = 0;
+
+    size_t pos = 0;
+    AdField field;
+    while (nextAdField(payload, length, pos, field)) {
+        switch (field.type) {
+            case AD_FLAGS:
+                if (field.length >= 1) {
+                    out.flags = field.data[0];
+                    out.present |= ADVERT_HAS_FLAGS;
+                }
+                break;
+            case AD_UUID16_INCOMPLETE:
+            case AD_UUID16_COMPLETE:
+                for (uint8_t i = 0; i + 2 <= field.length && out.uuid16Count < 255; i += 2) {
+                    if (out.uuid16Count < ADVERT_MAX_UUID16) out.uuid16[out.uuid16Count] = readLe16(field.data + i);
+                    out.uuid16Count++;
+                }
+                break;
+            case AD_UUID32_INCOMPLETE:
+            case AD_UUID32_COMPLETE:
+                out.uuid32Count += field.length / 4;
+                break;
+            case AD_UUID128_INCOMPLETE:
+            case AD_UUID128_COMPLETE:
+                for (uint8_t i = 0; i + 16 <= field.length && out.uuid128Count < 255; i += 16) {
+                    if (out.uuid128Count < ADVERT_MAX_UUID128) out.uuid128[out.uuid128Count] = field.data + i;
+                    out.uuid128Count++;
+                }
+                break;
+            case AD_NAME_SHORT:
+            case AD_NAME_COMPLETE:
+                if (field.length > 0 && !out.has(ADVERT_NAME_COMPLETE)) {
+                    out.name = (const char*)field.data;
+                    out.nameLength = field.length < ADVERT_MAX_NAME ? field.length : ADVERT_MAX_NAME;
+                    out.present |= ADVERT_HAS_NAME;
+                    if (field.type == AD_NAME_COMPLETE) out.present |= ADVERT_NAME_COMPLETE;
+                }
+                break;
+            case AD_TX_POWER:
+                if (field.length >= 1) {
+                    out.txPower = (int8_t)field.data[0];
+                    out.present |= ADVERT_HAS_TX_POWER;
+                }
+                break;
+            case AD_APPEARANCE:
+                if (field.length >= 2) {
+                    out.appearance = readLe16(field.data);
+                    out.present |= ADVERT_HAS_APPEARANCE;
+                }
+                break;
+            case AD_SERVICE_DATA16:
+                if (field.length >= 2 && !out.has(ADVERT_HAS_SERVICE_DATA)) {
+                    out.serviceDataUuid = readLe16(field.data);
+                    out.present |= ADVERT_HAS_SERVICE_DATA;
+                }
+                break;
+            case AD_MANUFACTURER_DATA:
+                if (field.length >= 2 && !out.has(ADVERT_HAS_MANUFACTURER)) {
+                    out.company = readLe16(field.data);
+                    out.manufacturerData = field.data + 2;
+                    out.manufacturerDataLength = field.length - 2;
+                    out.present |= ADVERT_HAS_MANUFACTURER;
+                }
+                break;
+        }
+    }
+    if (payload != nullptr && pos < length && payload[pos] != 0) out.present |= ADVERT_TRUNCATED;
+}
+
+// Copies the name into out, terminated and cut to size bytes
+inline void copyAdvertName(const AdvertData& advert, char* out, size_t size) {
+    if (size == 0) return;
+    size_t length = advert.nameLength < size - 1 ? advert.nameLength : size - 1;
+    for (size_t i = 0; i < length; i++) {
+        out[i] = advert.name[i] != '\0' ? advert.name[i] : ' ';
+    }
+    out[length] = '\0';
+}
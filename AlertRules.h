@@ -0,0 +1,413 @@
+#pragma once
+
+#include <FS.h>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "AdvertData.h"
+
+// Shields-up alert rules, loaded from a text file on flash:
+//
+//   # Our own fleet never alerts
+//   allow mac 24:0a:c4:12:34:56
+//   allow oui 24:0a:c4
+//   # Known trackers alert even if seen before
+//   alert service 0xfd5a
+//   alert company 0x004c rssi -60 dwell 30
+//   # Anything else: new devices stronger than -70 dBm (the built-in default)
+//   default rssi -70 new
+//
+// Selectors are mac, oui (public addresses only), company (manufacturer
+// data) and service (16-bit service UUID). Options: "rssi N" alerts only
+// above N dBm, "dwell S" only once the device has been present S seconds,
+// "new" only for devices never seen before. "default off" disables the
+// default rule.
+//
+// Every selector value goes into one open-addressing hash table of tagged
+// keys, fronted by a Bloom filter so most adverts are turned away without a
+// probe. Matching is a fixed number of lookups (address, OUI, company and up
+// to ADVERT_MAX_UUID16 services) however many entries are loaded. The most
+// specific match decides: MAC, then OUI, then service, then company; an
+// advert matching nothing falls to the default rule. Rule options are small
+// structs checked against a bitmask of facts about the device.
+//
+// The tables are allocated once when loading and are read-only afterwards,
+// so the radio task can match without locks as long as rules are loaded
+// before scanning starts.
+
+#define ALERT_RULES_PATH  "/rules.txt"
+#define ALERT_RULES_MAX   32 // Distinct option sets; entries sharing one share a rule
+#define ALERT_RULE_LINE   96 // Longest line read
+#define RULE_DEFAULT      0  // Rule index of the default rule
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_HASHES      4
+
+// Facts about a device, matched against a rule's requirements
+#define ALERT_FACT_NEW 0x01 // Not in the known-device memory when it appeared
+
+enum RuleAction {
+    RULE_ALLOW, // Never alert
+    RULE_ALERT
+};
+
+struct AlertRule {
+    uint8_t action;   // RuleAction
+    uint8_t require;  // ALERT_FACT_* bits that must all hold
+    int8_t minRssi;   // Alert only above this, dBm; -128 for any
+    uint16_t dwell;   // Seconds present before alerting
+};
+
+// Key tags, in the top byte of a table key
+#define RULE_KEY_MAC     1ULL
+#define RULE_KEY_OUI     2ULL
+#define RULE_KEY_SERVICE 3ULL
+#define RULE_KEY_COMPANY 4ULL
+
+class AlertRules {
+public:
+    AlertRules() : keys(nullptr), values(nullptr), bloom(nullptr) { clear(); }
+    ~AlertRules() { release(); }
+
+    // Back to the default rule only
+    void clear() {
+        release();
+        tableMask = 0;
+        bloomMask = 0;
+        entries = 0;
+        ruleCount = 1;
+        rules[RULE_DEFAULT] = builtInDefault();
+        lookups = 0;
+        bloomPasses = 0;
+    }
+
+    // Loads rules from path, replacing the current ones. Lines that don't
+    // parse, or are longer than ALERT_RULE_LINE, are skipped; errorLine is
+    // the first of them (0 if none). Returns
+    // false if the file is missing or the tables couldn't be allocated, in
+    // which case only the default rule applies.
+    bool load(fs::FS& fs, const char* path, uint32_t& errorLine) {
+        clear();
+        errorLine = 0;
+
+        // First pass sizes the tables, the second fills them
+        uint32_t selectors = 0;
+        if (!forEachLine(fs, path, [&](char* line, uint32_t) {
+                if (line == nullptr) return;
+                line += strspn(line, " \t");
+                if (strncmp(line, "allow", 5) == 0 || strncmp(line, "alert", 5) == 0) selectors++;
+            })) {
+            return false;
+        }
+        if (!allocate(selectors)) {
+            clear();
+            return false;
+        }
+        forEachLine(fs, path, [&](char* line, uint32_t number) {
+            if ((line == nullptr || !parseLine(line)) && errorLine == 0) errorLine = number;
+        });
+        return true;
+    }
+
+    // Radio task: the rule deciding an advert. Public addresses also match
+    // their OUI.
+    uint8_t match(uint64_t mac, bool publicAddress, const AdvertData& advert) {
+        lookups++;
+        if (entries == 0) return RULE_DEFAULT;
+        uint8_t rule;
+        if (find(key(RULE_KEY_MAC, mac), rule)) return rule;
+        if (publicAddress && find(key(RULE_KEY_OUI, mac >> 24), rule)) return rule;
+        uint8_t services = advert.uuid16Count < ADVERT_MAX_UUID16 ? advert.uuid16Count : ADVERT_MAX_UUID16;
+        for (uint8_t i = 0; i < services; i++) {
+            if (find(key(RULE_KEY_SERVICE, advert.uuid16[i]), rule)) return rule;
+        }
+        if (advert.company != COMPANY_NONE && find(key(RULE_KEY_COMPANY, advert.company), rule)) return rule;
+        return RULE_DEFAULT;
+    }
+
+    // Scan task: whether a device matched to rule should alert now
+    bool alerts(uint8_t ruleIndex, uint8_t facts, int8_t rssi, uint32_t presentMillis) const {
+        const AlertRule& rule = rules[ruleIndex < ruleCount ? ruleIndex : RULE_DEFAULT];
+        if (rule.action != RULE_ALERT) return false;
+        if ((facts & rule.require) != rule.require) return false;
+        if (rssi <= rule.minRssi) return false;
+        return presentMillis >= (uint32_t)rule.dwell * 1000;
+    }
+
+    // Whether rule is an allow rule: our own devices, never suspicious
+    bool allows(uint8_t ruleIndex) const {
+        return rules[ruleIndex < ruleCount ? ruleIndex : RULE_DEFAULT].action == RULE_ALLOW;
+    }
+
+    uint32_t entryCount() const { return entries; }
+    uint8_t ruleSetCount() const { return ruleCount; }
+    unsigned long lookupCount() const { return lookups; }
+    unsigned long bloomPassCount() const { return bloomPasses; } // Keys that needed a probe
+
+private:
+    static AlertRule builtInDefault() {
+        AlertRule rule;
+        rule.action = RULE_ALERT;
+        rule.require = ALERT_FACT_NEW;
+        rule.minRssi = -70;
+        rule.dwell = 0;
+        return rule;
+    }
+
+    static AlertRule blankRule(RuleAction action) {
+        AlertRule rule;
+        rule.action = action;
+        rule.require = 0;
+        rule.minRssi = -128;
+        rule.dwell = 0;
+        return rule;
+    }
+
+    static uint64_t key(uint64_t tag, uint64_t value) {
+        return (tag << 56) | (value & 0xFFFFFFFFFFFFULL);
+    }
+
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xFF51AFD7ED558CCDULL;
+        x ^= x >> 33;
+        x *= 0xC4CEB9FE1A85EC53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    bool allocate(uint32_t selectors) {
+        if (selectors == 0) return true;
+        uint32_t slots = 16;
+        while (slots < selectors + selectors / 3) slots <<= 1; // Load factor at most 3/4
+        uint32_t bloomBits = 512;
+        while (bloomBits < selectors * BLOOM_BITS_PER_KEY) bloomBits <<= 1;
+
+        keys = new (std::nothrow) uint64_t[slots];
+        values = new (std::nothrow) uint8_t[slots];
+        bloom = new (std::nothrow) uint32_t[bloomBits / 32];
+        if (keys == nullptr || values == nullptr || bloom == nullptr) return false;
+        memset(keys, 0, slots * sizeof(uint64_t)); // Tagged keys are never 0
+        memset(bloom, 0, bloomBits / 8);
+        tableMask = slots - 1;
+        bloomMask = bloomBits - 1;
+        return true;
+    }
+
+    void release() {
+        delete[] keys;
+        delete[] values;
+        delete[] bloom;
+        keys = nullptr;
+        values = nullptr;
+        bloom = nullptr;
+    }
+
+    // Double hashing over one 64-bit hash: bit i is h1 + i * h2
+    bool bloomMayContain(uint64_t hash) const {
+        uint32_t h1 = (uint32_t)hash;
+        uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+        for (uint32_t i = 0; i < BLOOM_HASHES; i++) {
+            uint32_t bit = (h1 + i * h2) & bloomMask;
+            if ((bloom[bit >> 5] & (1U << (bit & 31))) == 0) return false;
+        }
+        return true;
+    }
+
+    void bloomAdd(uint64_t hash) {
+        uint32_t h1 = (uint32_t)hash;
+        uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+        for (uint32_t i = 0; i < BLOOM_HASHES; i++) {
+            uint32_t bit = (h1 + i * h2) & bloomMask;
+            bloom[bit >> 5] |= 1U << (bit & 31);
+        }
+    }
+
+    bool find(uint64_t k, uint8_t& rule) {
+        uint64_t hash = mix(k);
+        if (!bloomMayContain(hash)) return false;
+        bloomPasses++;
+        for (uint32_t slot = (uint32_t)(hash >> 20) & tableMask;; slot = (slot + 1) & tableMask) {
+            if (keys[slot] == 0) return false;
+            if (keys[slot] == k) {
+                rule = values[slot];
+                return true;
+            }
+        }
+    }
+
+    // First entry wins when a selector is listed twice; only the first is
+    // counted. Returns false if a new selector finds the table at its load
+    // limit.
+    bool insert(uint64_t k, uint8_t rule) {
+        uint64_t hash = mix(k);
+        for (uint32_t slot = (uint32_t)(hash >> 20) & tableMask;; slot = (slot + 1) & tableMask) {
+            if (keys[slot] == k) return true;
+            if (keys[slot] == 0) {
+                if (entries + 1 > (tableMask + 1) / 4 * 3) return false;
+                keys[slot] = k;
+                values[slot] = rule;
+                entries++;
+                bloomAdd(hash);
+                return true;
+            }
+        }
+    }
+
+    // Index of the rule with these options, adding it if new; -1 if full
+    int intern(const AlertRule& rule) {
+        for (uint8_t i = 1; i < ruleCount; i++) {
+            const AlertRule& existing = rules[i];
+            if (existing.action == rule.action && existing.require == rule.require &&
+                existing.minRssi == rule.minRssi && existing.dwell == rule.dwell) {
+                return i;
+            }
+        }
+        if (ruleCount >= ALERT_RULES_MAX) return -1;
+        rules[ruleCount] = rule;
+        return ruleCount++;
+    }
+
+    // "aa:bb:cc:dd:ee:ff" (6 octets) or "aa:bb:cc" (3)
+    static bool parseOctets(const char* text, int octets, uint64_t& value) {
+        value = 0;
+        for (int i = 0; i < octets; i++) {
+            char* end;
+            unsigned long octet = strtoul(text, &end, 16);
+            if (end == text || end - text > 2 || octet > 0xFF) return false;
+            value = (value << 8) | octet;
+            if (i < octets - 1 && *end != ':') return false;
+            if (i == octets - 1 && *end != '\0') return false;
+            text = end + 1;
+        }
+        return true;
+    }
+
+    static bool parseNumber(const char* text, long low, long high, long& value) {
+        char* end;
+        value = strtol(text, &end, 0);
+        return end != text && *end == '\0' && value >= low && value <= high;
+    }
+
+    // Options after the selector; words is the remaining tokens
+    static bool parseOptions(char** words, int count, AlertRule& rule) {
+        for (int i = 0; i < count; i++) {
+            long value;
+            if (strcmp(words[i], "new") == 0) {
+                rule.require |= ALERT_FACT_NEW;
+            } else if (strcmp(words[i], "rssi") == 0 && i + 1 < count && parseNumber(words[i + 1], -127, 20, value)) {
+                rule.minRssi = (int8_t)value;
+                i++;
+            } else if (strcmp(words[i], "dwell") == 0 && i + 1 < count && parseNumber(words[i + 1], 0, 65535, value)) {
+                rule.dwell = (uint16_t)value;
+                i++;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool parseLine(char* line) {
+        char* words[8];
+        int count = 0;
+        for (char* word = strtok(line, " \t"); word != nullptr; word = strtok(nullptr, " \t")) {
+            if (count == 8) return false; // More words than any rule takes
+            words[count++] = word;
+        }
+        if (count == 0) return true;
+
+        if (strcmp(words[0], "default") == 0) {
+            if (count == 2 && strcmp(words[1], "off") == 0) {
+                rules[RULE_DEFAULT].action = RULE_ALLOW;
+                return true;
+            }
+            AlertRule rule = blankRule(RULE_ALERT);
+            if (!parseOptions(words + 1, count - 1, rule)) return false;
+            rules[RULE_DEFAULT] = rule;
+            return true;
+        }
+
+        if (count < 3) return false;
+        AlertRule rule;
+        if (strcmp(words[0], "allow") == 0) {
+            rule = blankRule(RULE_ALLOW);
+        } else if (strcmp(words[0], "alert") == 0) {
+            rule = blankRule(RULE_ALERT);
+        } else {
+            return false;
+        }
+
+        uint64_t value;
+        long number;
+        uint64_t tag;
+        if (strcmp(words[1], "mac") == 0 && parseOctets(words[2], 6, value)) {
+            tag = RULE_KEY_MAC;
+        } else if (strcmp(words[1], "oui") == 0 && parseOctets(words[2], 3, value)) {
+            tag = RULE_KEY_OUI;
+        } else if (strcmp(words[1], "company") == 0 && parseNumber(words[2], 0, 0xFFFE, number)) {
+            tag = RULE_KEY_COMPANY;
+            value = (uint64_t)number;
+        } else if (strcmp(words[1], "service") == 0 && parseNumber(words[2], 0, 0xFFFF, number)) {
+            tag = RULE_KEY_SERVICE;
+            value = (uint64_t)number;
+        } else {
+            return false;
+        }
+        if (!parseOptions(words + 3, count - 3, rule)) return false;
+
+        int index = intern(rule);
+        if (index < 0 || keys == nullptr) return false;
+        return insert(key(tag, value), (uint8_t)index);
+    }
+
+    // Calls fn(line, number) for each line with comments and the line end
+    // stripped. Lines longer than ALERT_RULE_LINE come through as nullptr
+    // rather than cut, which could change a number.
+    template <typename Fn>
+    static bool forEachLine(fs::FS& fs, const char* path, Fn fn) {
+        File file = fs.open(path, "r");
+        if (!file) return false;
+        uint8_t buffer[128];
+        char line[ALERT_RULE_LINE + 1];
+        size_t length = 0;
+        uint32_t number = 0;
+        bool comment = false;
+        bool tooLong = false;
+        size_t bytes;
+        while ((bytes = file.read(buffer, sizeof(buffer))) > 0) {
+            for (size_t i = 0; i < bytes; i++) {
+                char c = (char)buffer[i];
+                if (c == '\n') {
+                    line[length] = '\0';
+                    fn(tooLong ? nullptr : line, ++number);
+                    length = 0;
+                    comment = false;
+                    tooLong = false;
+                } else if (c == '#') {
+                    comment = true;
+                } else if (!comment && c != '\r') {
+                    if (length < ALERT_RULE_LINE) line[length++] = c;
+                    else tooLong = true;
+                }
+            }
+        }
+        if (length > 0) { // Last line without a newline
+            line[length] = '\0';
+            fn(tooLong ? nullptr : line, ++number);
+        }
+        file.close();
+        return true;
+    }
+
+    AlertRule rules[ALERT_RULES_MAX];
+    uint8_t ruleCount;
+    uint64_t* keys;   // 0 marks an empty slot
+    uint8_t* values;  // Rule index per slot
+    uint32_t* bloom;
+    uint32_t tableMask;
+    uint32_t bloomMask;
+    uint32_t entries;
+    unsigned long lookups;
+    unsigned long bloomPasses;
+};
@@ -1,23 +1,29 @@
 #include <Arduino.h>
-#include <SPI.h>
 #include <TFT_eSPI.h>
-#include <XPT2046_Touchscreen.h>
-#include <BLEDevice.h>
-#include <BLEScan.h>
-#include <BLEAdvertisedDevice.h>
-#include <set>
-
-// The CYD touch uses some non-default SPI pins
-#define XPT2046_IRQ 36
-#define XPT2046_MOSI 32
-#define XPT2046_MISO 39
-#define XPT2046_CLK 25
-#define XPT2046_CS 33
-
-// Define TOUCH_CS for TFT_eSPI library
-#ifndef TOUCH_CS
-#define TOUCH_CS XPT2046_CS
-#endif
+#include <LittleFS.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <ESPAsyncWebServer.h>
+#include <memory>
+#include "AddressClusters.h"
+#include "AdvertData.h"
+#include "AlertRules.h"
+#include "CaptureStream.h"
+#include "DeviceJson.h"
+#include "DeviceListView.h"
+#include "DeviceTable.h"
+#include "FollowerTracker.h"
+#include "Hal.h"
+#include "HyperLogLog.h"
+#include "KnownDeviceStore.h"
+#include "MacSet.h"
+#include "NodeReport.h"
+#include "OuiTable.h"
+#include "PerfCounters.h"
+#include "ScanScheduler.h"
+#include "SightingQueue.h"
+#include "TieredHistory.h"
+#include "TouchGestures.h"
 
 // Colors (Bluetooth theme)
 #define BT_BLUE       tft.color565(0, 103, 198)
@@ -31,306 +37,1258 @@
 #define TITLE_FONT  4
 #define TEXT_FONT   2
 
-// Screen dimensions
-#define SCREEN_WIDTH  320
-#define SCREEN_HEIGHT 240
-
-// Initialize SPI for touch screen
-SPIClass spi_touch(VSPI);
-
-// Initialize touch screen
-XPT2046_Touchscreen ts(XPT2046_CS, XPT2046_IRQ);
+// Board inputs (Hal.h)
+ScanSource& scanSource = boardScanSource();
+TouchInput& touchInput = boardTouchInput();
 
 // Initialize display
 TFT_eSPI tft = TFT_eSPI();
 
 // Bluetooth scanning variables
 int scanTime = 5; // In seconds
-BLEScan* pBLEScan;
-int totalDevices = 0;
-String allDevicesList = "";
+DeviceTable deviceTable;
+
+// List screens
+#define LIST_TOP              40
+#define LIST_ROW_HEIGHT       24
+#define LIST_VISIBLE_ROWS     8
+#define LIST_REFRESH_INTERVAL 1000 // ms between redraws caused by new sightings
+#define LIST_SCROLLBAR_X      (SCREEN_WIDTH - 20) // Touches right of this are on the scroll bar
+DeviceListView deviceListView(deviceTable);
+bool deviceListOpen = false; // Tells the scan task to keep deviceListView up to date
+
+struct ListScreen {
+    uint8_t filter;
+    const char* title;
+    bool alertStyle;
+    int scrollPosition; // First visible row
+    int maxScrollPosition;
+    bool caughtFling;   // The current stroke stopped a fling, so its tap does not close the list
+    bool thumbDrag;     // The current stroke started on the scroll bar
+    int thumbDragOffset; // Scroll offset when it did
+    bool redrawHeader;
+    bool redrawRows;
+    unsigned long lastRowsDrawTime;
+};
+ListScreen listScreen = {};
+KineticScroll listScroll; // In pixels, LIST_ROW_HEIGHT per row
+const char* const sortLabels[SORT_COUNT] = {"RSSI", "Last seen", "Maker"};
+
+// Sightings handed from the BLE callback to the scan task
+#define SIGHTING_QUEUE_SIZE 256
+#define SIGHTING_BATCH_SIZE 32
+SpscQueue<Sighting, SIGHTING_QUEUE_SIZE> sightingQueue;
 
-// Touch coordinates
-uint16_t touchX = 0;
-uint16_t touchY = 0;
+// Touch strokes from the driver's sample queue, turned into taps, drags and swipes
+TouchGestures touchGestures;
 
 // Scanning state
 bool isScanning = false;
 
 // New variables
-int usableDevices = 0;
-int alertDevices = 0;
-String usableDevicesList = "";
-String alertDevicesList = "";
+#define USABLE_RSSI -70
 bool shieldsUp = false;
 unsigned long lastAlertBlinkTime = 0;
 bool alertBlinkState = false;
 float triangleAngle = 0;
-std::set<String> allKnownDevices;  // Stores all devices ever seen
-std::set<String> sessionDevices;   // Stores devices seen in the current session
+// Known-device sets are fixed size; the stalest addresses are evicted once full
+#define KNOWN_DEVICE_CAPACITY   2048
+#define SESSION_DEVICE_CAPACITY 512
+MacSet<KNOWN_DEVICE_CAPACITY> allKnownDevices;    // Stores all devices ever seen
+MacSet<SESSION_DEVICE_CAPACITY> sessionDevices;   // Stores devices seen in the current session
+
+// Shields-up alerting follows the rules in ALERT_RULES_PATH on flash
+// (AlertRules.h); without the file, new devices above USABLE_RSSI alert.
+// Each logical device alerts at most once per session.
+#define ALERTED_DEVICE_CAPACITY 512
+AlertRules alertRules;
+MacSet<ALERTED_DEVICE_CAPACITY> alertedDevices;
+
+// Rotating random addresses are folded into the logical device they continue
+// before the known and session sets see them, so a phone changing its
+// address does not count as a new device
+#ifndef ADDRESS_CLUSTERING
+#define ADDRESS_CLUSTERING true
+#endif
+#define ADDRESS_CLUSTER_CAPACITY 256
+AddressClusters<ADDRESS_CLUSTER_CAPACITY> addressClusters;
+bool addressClustering = ADDRESS_CLUSTERING;
+
+// Devices that stay with us or keep coming back raise a following alert
+// (FollowerTracker.h). The scan task marks presence; loop() runs the detector
+// a batch at a time and queues what it finds back to the scan task, which
+// owns the rows.
+#ifndef FOLLOWER_CAPACITY
+#define FOLLOWER_CAPACITY 1024 // Identities tracked, a power of two; 16 bytes each
+#endif
+#define FOLLOWER_QUEUE_SIZE  16  // Findings waiting for the scan task, a power of two
+#define FOLLOWER_SWEEP_INTERVAL 5000 // ms between detector sweeps of the whole table
+FollowerTracker<FOLLOWER_CAPACITY> followers;
+SpscQueue<FollowerEvidence, FOLLOWER_QUEUE_SIZE> followerQueue; // UI loop to scan task
+unsigned long lastFollowerSweepTime = 0;
+uint32_t followerSweepLeft = 0; // Entries the current sweep has yet to examine
+
+// allKnownDevices is persisted so shields up still recognises devices after a
+// reboot. New devices are written in batches at most once per interval.
+#define KNOWN_STORE_FLUSH_INTERVAL 60000 // ms
+KnownDeviceStore knownDeviceStore(LittleFS);
+bool knownStoreReady = false;
+
+// Serial port. Text logging from the scan task is rate limited, so a busy
+// area cannot stall it on the UART. Sending 'c' starts a binary capture of
+// every advert (CaptureStream.h) at CAPTURE_BAUD, 's' stops it; while it
+// runs, log lines travel inside the stream.
+#ifndef SERIAL_BAUD
+#define SERIAL_BAUD 115200
+#endif
+#ifndef CAPTURE_BAUD
+#define CAPTURE_BAUD 921600
+#endif
+#define SERIAL_TX_BUFFER      4096 // Bytes, so writes rarely wait for the UART
+#define LOG_LINES_PER_SECOND  10
+#define LOG_BURST             12   // Lines that may go out back to back; fits the capture text ring
+#define CAPTURE_TASK_CORE     1
+#define CAPTURE_TASK_STACK    3072
+#define CAPTURE_TASK_PRIORITY 1
+#define CAPTURE_WRITE_PERIOD  5 // ms
+CaptureWriter capture;
+TaskHandle_t captureTaskHandle = nullptr;
+bool captureBaudActive = false; // Writer side: the port is at CAPTURE_BAUD
+uint32_t logTokens = LOG_BURST;
+unsigned long logRefillTime = 0;
+unsigned long logSuppressed = 0;
+unsigned long logSuppressedReported = 0;
+
+// Web API. Set WIFI_SSID (e.g. -DWIFI_SSID=\"name\" in platformio.ini) to join
+// a network and serve JSON at /api/status, /api/devices and /api/history,
+// plus a Server-Sent Events stream of new devices and alerts at /events.
+#ifndef WIFI_SSID
+#define WIFI_SSID ""
+#endif
+#ifndef WIFI_PASSWORD
+#define WIFI_PASSWORD ""
+#endif
+#define WEB_SERVER_PORT      80
+#define WEB_EVENT_QUEUE_SIZE 64
+#define WEB_EVENT_BATCH_SIZE 8 // Events sent per UI loop pass
+
+enum WebEventType {
+    WEB_EVENT_SIGHTING, // A device became present
+    WEB_EVENT_ALERT,
+    WEB_EVENT_FOLLOWING
+};
+
+// Snapshot of a row, queued by the scan task for the UI loop to send
+struct WebEvent {
+    WebEventType type;
+    uint64_t mac;
+    int8_t rssi;
+    uint8_t flags;
+    uint16_t manufacturer;
+    uint32_t firstSeen;
+    uint32_t lastSeen;
+    char name[DEVICE_NAME_LENGTH];
+};
+
+AsyncWebServer webServer(WEB_SERVER_PORT);
+AsyncEventSource webEvents("/events");
+SpscQueue<WebEvent, WEB_EVENT_QUEUE_SIZE> webEventQueue;
+bool webEnabled = false;
+
+// Fleet reporting (NodeReport.h). Set COLLECTOR_HOST, as well as WIFI_SSID, to
+// send tools/collector.py a report of the devices heard every
+// NODE_REPORT_INTERVAL. NODE_ID 0 takes the ID from the board's MAC address.
+#ifndef COLLECTOR_HOST
+#define COLLECTOR_HOST ""
+#endif
+#ifndef COLLECTOR_PORT
+#define COLLECTOR_PORT 47800
+#endif
+#ifndef NODE_ID
+#define NODE_ID 0
+#endif
+#define NODE_REPORT_INTERVAL 2000  // ms
+#define NODE_SKETCH_INTERVAL 60000 // ms between distinct device sketches
+#define NODE_REPORT_QUEUE    4    // Datagrams waiting for the UI loop, a power of two
+#define NODE_REPORT_BATCH    2    // Datagrams sent per UI loop pass
+
+struct NodeDatagram {
+    uint16_t length;
+    uint8_t data[NODE_REPORT_DATAGRAM];
+};
+
+struct NodeReportStats {
+    unsigned long reports;
+    unsigned long datagrams;
+    unsigned long records;
+    unsigned long deferred;   // Reports cut short by a full queue; the rest waits
+    unsigned long sendFailed; // Datagrams lost before the network
+};
+
+const char* collectorHost = COLLECTOR_HOST; // The native harness sets these before setup()
+uint16_t collectorPort = COLLECTOR_PORT;
+uint16_t nodeId = NODE_ID;
+bool collectorEnabled = false;
+WiFiUDP collectorUdp;
+SpscQueue<NodeDatagram, NODE_REPORT_QUEUE> nodeReportQueue; // Scan task to UI loop
+NodeDatagram nodeDatagram; // Scan task: the datagram being filled
+uint32_t nodeReportSequence = 0;
+unsigned long lastNodeReportTime = 0;
+unsigned long lastNodeSketchTime = 0;
+int nodeSketchesPending = 0; // Windows still to send, one per report
+NodeReportStats nodeReportStats = {};
 
 // Asynchronous scanning variables
 bool scanInProgress = false;
 unsigned long scanStartTime = 0;
 const unsigned long scanDuration = 5000; // 5 seconds scan duration
 
+// Continuous mode keeps the radio scanning and tracks presence with a sliding
+// window instead of restarting the counts with every scan. A device counts as
+// present (and usable) if it was seen (above USABLE_RSSI) within the window.
+#define CONTINUOUS_SCAN         true
+#define PRESENCE_WINDOW         60000 // ms
+#define PRESENCE_SWEEP_INTERVAL 1000  // ms
+#define SUMMARY_LOG_INTERVAL    10000 // ms
+bool continuousScan = CONTINUOUS_SCAN;
+
+// Scan window, interval and active scanning follow the load (ScanScheduler.h)
+ScanScheduler scanScheduler;
+
 // Function prototypes
 void drawInterface();
 void handleTouch();
 void scanDevices();
-void displayDeviceList(String devices, String title);
-void drawGradientBackground();
+void startScanSource();
+void stopScanSource();
+void displayDeviceList(uint8_t filter, const char* title);
+void updateDeviceList();
+void closeDeviceList();
+void handleMainTouch(int touchX, int touchY);
+void handleListTouch(const TouchEvent& event);
+void displayDiagnostics();
+void updateDiagnostics();
+void closeDiagnostics();
+void serviceSerialCommands();
+void scanTask(void* parameter);
 void toggleShields();
 void displayAlertList();
-void drawAlertTriangles();
-void drawRotatedTriangle(int centerX, int centerY, int size, float angle);
-String getManufacturer(const String& macAddress);
+void initRenderer();
+void markDirty(uint16_t widgets);
+void renderInterface();
+void formatDeviceLine(int index, char* out, size_t length);
+void drainSightings();
+
+// Retained-mode renderer. The main screen is a fixed set of widgets; only
+// widgets whose content changed are repainted. Each dirty region is drawn into
+// a small sprite tile and sent with SPI DMA while the next tile is drawn.
+#define RENDER_TILE_WIDTH  160
+#define RENDER_TILE_HEIGHT 32
+#define RENDER_INTERVAL    100 // Minimum ms between partial frames
+
+enum WidgetId {
+    WIDGET_TITLE, WIDGET_TOTAL, WIDGET_TOTAL_GRAPH, WIDGET_USABLE, WIDGET_USABLE_GRAPH,
+    WIDGET_ALERTS, WIDGET_BUTTON, WIDGET_STATUS, WIDGET_TRIANGLE_LEFT, WIDGET_TRIANGLE_RIGHT,
+    WIDGET_COUNT
+};
+#define WIDGET_BIT(id)    (1 << (id))
+#define WIDGET_GRAPHS     (WIDGET_BIT(WIDGET_TOTAL_GRAPH) | WIDGET_BIT(WIDGET_USABLE_GRAPH))
+#define WIDGET_TRIANGLES  (WIDGET_BIT(WIDGET_TRIANGLE_LEFT) | WIDGET_BIT(WIDGET_TRIANGLE_RIGHT))
+#define WIDGET_ALL        (WIDGET_BIT(WIDGET_COUNT) - 1)
+
+#define BUTTON_WIDTH  173
+#define BUTTON_HEIGHT 60
+#define BUTTON_X      ((SCREEN_WIDTH - BUTTON_WIDTH) / 2)
+#define BUTTON_Y      (SCREEN_HEIGHT - 80)
+
+struct RenderStats {
+    unsigned long frames;
+    unsigned long lastFrameMicros;
+    unsigned long lastFrameBytes;
+    unsigned long totalBytes;
+};
+RenderStats renderStats = {0, 0, 0, 0};
+
+// Instrumentation (PerfCounters.h), left on in production. Shown on the
+// hidden diagnostics screen (tap the title three times) and dumped as one
+// JSON line whenever 'p' arrives on the serial port.
+PerfHistogram perfAdvert("advert");  // onAdvert, on the radio task
+PerfHistogram perfScan("scan");      // One scan task pass
+PerfHistogram perfRender("render");  // Main screen frames
+PerfHistogram perfList("list");      // List screen row redraws
+PerfHistogram perfTouch("touch");    // Handling of a gesture event
+PerfHistogram perfInput("input");    // Panel read to event handled, the input latency
+PerfHistogram perfFollow("follow");  // One follower detector batch
+PerfHistogram* const perfHistograms[] = {&perfAdvert, &perfScan, &perfRender, &perfList, &perfTouch, &perfInput,
+                                         &perfFollow};
+#define PERF_HISTOGRAM_COUNT (sizeof(perfHistograms) / sizeof(perfHistograms[0]))
+#define PERF_STACK_SAMPLE_MASK 0xFF // Radio task stack sampled every 256 adverts
+uint32_t radioStackFree = 0;        // Bytes, lowest seen; 0 until sampled
+
+TFT_eSprite renderTileA(&tft);
+TFT_eSprite renderTileB(&tft);
+TFT_eSprite* renderTiles[2] = {&renderTileA, &renderTileB};
+uint16_t* renderTilePixels[2] = {nullptr, nullptr};
+int renderTileIndex = 0;
+bool renderUseDMA = false;
+uint16_t gradientColors[SCREEN_HEIGHT];
+uint16_t dirtyWidgets = WIDGET_ALL;
+unsigned long lastRenderTime = 0;
+
+// Values the widgets were last drawn with, to detect changes
+struct RenderedState {
+    int total;
+    int usable;
+    int alerts;
+    bool shieldsUp;
+    bool scanning;
+    uint32_t historyVersion;
+    HistoryTier graphTier;
+    uint32_t distinct; // For the graph's window
+};
+RenderedState renderedState = {-1, -1, -1, false, false, 0, TIER_MINUTE, 0};
+
+// Device count history at minute, quarter hour, hour and day resolution.
+// The graphs show the newest GRAPH_POINTS samples of one tier; tapping a
+// graph switches to the next tier.
+#define HISTORY_READING_INTERVAL 1000  // ms between count readings
+#define HISTORY_MINUTE           60000 // ms
+#define GRAPH_POINTS             30
+TieredHistory history;
+HistoryTier graphTier = TIER_MINUTE;
+unsigned long lastHistoryReadingTime = 0;
+unsigned long lastHistoryMinuteTime = 0;
+const char* const tierLabels[TIER_COUNT] = {"1m", "15m", "1h", "1d"};
+
+// Distinct devices seen in the last hour, day and week (HyperLogLog.h), by
+// logical identity. The total graph shows the window that matches its tier.
+#define DISTINCT_ESTIMATE_INTERVAL 5000 // ms
+RollingDistinct<DISTINCT_PRECISION> distinctDevices;
+uint32_t distinctCounts[DISTINCT_WINDOWS] = {};
+unsigned long lastDistinctEstimateTime = 0;
+const char* const distinctLabels[DISTINCT_WINDOWS] = {"1h", "1d", "1w"};
+const DistinctWindow tierDistinctWindows[TIER_COUNT] = {DISTINCT_HOUR, DISTINCT_DAY, DISTINCT_WEEK, DISTINCT_WEEK};
+
+// Work is split across the two cores. The scan task runs next to the
+// Bluetooth stack on core 0 and owns scanning, the device table and history;
+// the UI runs in loop() on core 1. The UI sends commands through
+// commandQueue and reads a status snapshot from statusQueue, so neither side
+// ever waits on the other. tableMutex is only taken to read list rows.
+#define SCAN_TASK_CORE     0
+#define SCAN_TASK_STACK    6144
+#define SCAN_TASK_PRIORITY 2
+#define SCAN_TASK_PERIOD   10 // ms
+
+enum ScanCommand {
+    COMMAND_SHIELDS_UP,
+    COMMAND_SHIELDS_DOWN,
+    COMMAND_NEXT_GRAPH_TIER
+};
 
-#define HISTORY_LENGTH 15
-int totalDevicesHistory[HISTORY_LENGTH] = {0};
-int usableDevicesHistory[HISTORY_LENGTH] = {0};
-int historyIndex = 0;
-unsigned long lastHistoryUpdateTime = 0;
+struct ScanStatus {
+    int total;
+    int usable;
+    int alerts;
+    bool shieldsUp;
+    bool scanning;
+    uint8_t scanLevel;
+    bool scanActive;
+    uint32_t advertRate;
+    uint32_t alertEvents; // Bumped whenever new alerts appear while shields are up
+    uint32_t historyVersion;
+    HistoryTier graphTier;
+    int graphPoints;
+    HistoryPoint graph[HISTORY_SERIES][GRAPH_POINTS]; // Oldest first
+    uint32_t distinct[DISTINCT_WINDOWS];
+};
+
+QueueHandle_t commandQueue;
+QueueHandle_t statusQueue; // Length 1, always holds the latest status
+SemaphoreHandle_t tableMutex;
+TaskHandle_t scanTaskHandle;
+ScanStatus scanStatus = {}; // UI copy of the latest status
+uint32_t alertEvents = 0;
+
+// UI screens
+enum UiScreen {
+    SCREEN_MAIN,
+    SCREEN_LIST,
+    SCREEN_DIAGNOSTICS
+};
+UiScreen uiScreen = SCREEN_MAIN;
+#define DIAG_TITLE_TAPS 3    // Taps on the title that open the diagnostics screen
+#define DIAG_TAP_WINDOW 2000 // ms for the taps
 
 void updateDeviceHistory() {
-    if (millis() - lastHistoryUpdateTime >= 60000) { // Update every minute
-        totalDevicesHistory[historyIndex] = totalDevices;
-        usableDevicesHistory[historyIndex] = usableDevices;
-        historyIndex = (historyIndex + 1) % HISTORY_LENGTH;
-        lastHistoryUpdateTime = millis();
+    unsigned long now = millis();
+    if (now - lastHistoryReadingTime >= HISTORY_READING_INTERVAL) {
+        uint16_t counts[HISTORY_SERIES] = {
+            (uint16_t)deviceTable.countWith(DEVICE_SEEN),
+            (uint16_t)deviceTable.countWith(DEVICE_USABLE)
+        };
+        history.addReading(counts);
+        lastHistoryReadingTime = now;
+    }
+    if (now - lastHistoryMinuteTime >= HISTORY_MINUTE) { // Update every minute
+        history.closeMinute();
+        lastHistoryMinuteTime = now;
     }
 }
 
-void drawGraph(int x, int y, int w, int h, int* data, int dataSize, uint16_t color) {
-    int maxVal = 1; // Avoid division by zero
-    for (int i = 0; i < dataSize; i++) {
-        if (data[i] > maxVal) maxVal = data[i];
+// Scan task: rolls the distinct count windows and refreshes their estimates
+void updateDistinctCounts() {
+    unsigned long now = millis();
+    distinctDevices.advance(now);
+    if (now - lastDistinctEstimateTime >= DISTINCT_ESTIMATE_INTERVAL) {
+        for (int w = 0; w < DISTINCT_WINDOWS; w++) {
+            distinctCounts[w] = distinctDevices.estimate((DistinctWindow)w);
+        }
+        lastDistinctEstimateTime = now;
+    }
+}
+
+// Runs on the Bluedroid task: only queue the sighting, everything else
+// happens in the scan task
+void onAdvert(const Advert& advert) {
+    PerfTimer timer(perfAdvert);
+    if ((perfAdvert.count & PERF_STACK_SAMPLE_MASK) == 0) {
+        radioStackFree = uxTaskGetStackHighWaterMark(nullptr);
     }
+    Sighting sighting;
+    sighting.mac = advert.mac;
+    sighting.timestamp = millis();
+    sighting.rssi = advert.rssi;
+    AdvertData data;
+    parseAdvert(advert.payload, advert.payloadLength, data);
+    AddressKind kind = addressKind(advert.mac, advert.randomAddress);
+    sighting.addressKind = kind;
+    sighting.fingerprint = addressRotates(kind) ? advertFingerprint(data) : 0;
+    sighting.company = data.company;
+    sighting.rule = alertRules.match(advert.mac, kind == ADDRESS_PUBLIC, data);
+    copyAdvertName(data, sighting.name, SIGHTING_NAME_LENGTH);
+    sightingQueue.push(sighting);
+    if (capture.capturing()) capture.captureAdvert(advert);
+}
 
-    for (int i = 0; i < dataSize - 1; i++) {
-        int x1 = x + i * w / (dataSize - 1);
-        int y1 = y + h - (data[i] * h / maxVal);
-        int x2 = x + (i + 1) * w / (dataSize - 1);
-        int y2 = y + h - (data[(i + 1) % dataSize] * h / maxVal);
-        tft.drawLine(x1, y1, x2, y2, color);
+// Scan task: takes one line from the log budget, counting the lines that
+// did not fit
+bool takeLogToken() {
+    unsigned long now = millis();
+    uint32_t refill = (now - logRefillTime) * LOG_LINES_PER_SECOND / 1000;
+    if (refill > 0 || logTokens >= LOG_BURST) {
+        logTokens = min((uint32_t)LOG_BURST, logTokens + refill);
+        logRefillTime = logTokens >= LOG_BURST ? now : logRefillTime + refill * 1000 / LOG_LINES_PER_SECOND;
+    }
+    if (logTokens == 0) {
+        logSuppressed++;
+        return false;
     }
+    logTokens--;
+    return true;
 }
 
-class MyAdvertisedDeviceCallbacks: public BLEAdvertisedDeviceCallbacks {
-    void onResult(BLEAdvertisedDevice advertisedDevice) {
-        String deviceAddress = advertisedDevice.getAddress().toString().c_str();
-        String manufacturer = getManufacturer(deviceAddress);
-        String deviceName = advertisedDevice.getName().c_str();
-        String deviceInfo = deviceName.isEmpty() ? manufacturer : deviceName + " (" + manufacturer + ")";
-        deviceInfo += " [";
-        deviceInfo += deviceAddress;
-        deviceInfo += "]";
+#define LOG_SUPPRESSED_FORMAT "(%lu log lines suppressed)"
 
-        Serial.print("Device found: ");
-        Serial.print(deviceInfo);
-        Serial.print(" RSSI: ");
-        Serial.println(advertisedDevice.getRSSI());
+void writeLogLine(const char* line) {
+    char note[sizeof(LOG_SUPPRESSED_FORMAT) + 3 * sizeof(unsigned long)]; // Up to 3 digits per byte of the count
+    if (logSuppressed != logSuppressedReported) {
+        snprintf(note, sizeof(note), LOG_SUPPRESSED_FORMAT, logSuppressed - logSuppressedReported);
+        logSuppressedReported = logSuppressed;
+    } else {
+        note[0] = '\0';
+    }
+    if (capture.capturing()) {
+        if (note[0] != '\0') capture.captureText(note);
+        capture.captureText(line);
+    } else {
+        if (note[0] != '\0') Serial.println(note);
+        Serial.println(line);
+    }
+}
 
-        // Always add to allKnownDevices, regardless of RSSI
-        bool isNewDevice = allKnownDevices.insert(deviceAddress).second;
+// Scan task text log
+void logLine(const char* format, ...) {
+    if (!takeLogToken()) return;
+    char line[CAPTURE_MAX_TEXT];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    writeLogLine(line);
+}
+
+// Scan task: queues a row for the event stream; dropped if the UI loop is behind
+void queueWebEvent(WebEventType type, int index) {
+    if (!webEnabled) return;
+    const DeviceRecord& record = deviceTable.at(index);
+    WebEvent event;
+    event.type = type;
+    event.mac = record.mac;
+    event.rssi = record.rssi;
+    event.flags = record.flags;
+    event.manufacturer = record.manufacturer;
+    event.firstSeen = record.firstSeen;
+    event.lastSeen = record.lastSeen;
+    memcpy(event.name, deviceTable.name(index), DEVICE_NAME_LENGTH);
+    webEventQueue.push(event);
+}
+
+void processSighting(const Sighting& sighting) {
+    bool added;
+    int index = deviceTable.upsert(sighting.mac, sighting.rssi, sighting.timestamp, added);
+    if (index < 0) {
+        // Table full; counted in deviceTable.droppedCount(). The distinct
+        // counts and the follower tracker still see it, by address as there
+        // is no row to cluster.
+        distinctDevices.add(sighting.mac);
+        followers.mark(sighting.mac, sighting.timestamp, alertRules.allows(sighting.rule));
+        return;
+    }
+    if (added) scanScheduler.noteNewDevice(sighting.name[0] != '\0');
+    // The advertised company ID is a better guess than the OUI, which random
+    // addresses don't have at all
+    if (added && sighting.addressKind == ADDRESS_PUBLIC) {
+        deviceTable.at(index).manufacturer = lookupOui(sighting.mac >> 24);
+    }
+    if (sighting.company != COMPANY_NONE && !deviceTable.hasFlags(index, DEVICE_COMPANY)) {
+        uint16_t manufacturer = lookupCompany(sighting.company);
+        if (manufacturer != 0) {
+            deviceTable.at(index).manufacturer = manufacturer;
+            deviceTable.setFlags(index, DEVICE_COMPANY);
+        }
+    }
+    deviceTable.setName(index, sighting.name);
+
+    // Log only devices that were not already present, not every repeat advert
+    bool appeared = !deviceTable.hasFlags(index, DEVICE_SEEN);
+    if (appeared && takeLogToken()) {
+        char deviceLine[96];
+        char line[CAPTURE_MAX_TEXT];
+        formatDeviceLine(index, deviceLine, sizeof(deviceLine));
+        snprintf(line, sizeof(line), "Device found: %s", deviceLine);
+        writeLogLine(line);
+    }
+    deviceTable.setFlags(index, DEVICE_SEEN);
+    if (appeared) {
+        queueWebEvent(WEB_EVENT_SIGHTING, index);
+    }
+
+    // Known and session sets track logical devices: a rotating address is
+    // recorded as the first address of its cluster
+    uint64_t identity = sighting.mac;
+    if (addressClustering && sighting.fingerprint != 0) {
+        identity = addressClusters.resolve(deviceTable.at(index).cluster, sighting.mac, sighting.fingerprint,
+                                           sighting.rssi, sighting.timestamp);
+    }
+
+    distinctDevices.add(identity);
+    followers.mark(identity, sighting.timestamp, alertRules.allows(sighting.rule));
+
+    // Always add to allKnownDevices, regardless of RSSI
+    bool isNewDevice = allKnownDevices.insert(identity, sighting.timestamp);
+    if (isNewDevice && knownStoreReady) {
+        knownDeviceStore.record(identity);
+    }
+    if (isNewDevice && shieldsUp) {
+        deviceTable.setFlags(index, DEVICE_NEW);
+    }
+
+    // Consider devices with RSSI > USABLE_RSSI as usable
+    if (sighting.rssi > USABLE_RSSI) {
+        deviceTable.at(index).lastUsable = sighting.timestamp;
+        deviceTable.setFlags(index, DEVICE_USABLE);
+
+        bool isNewSessionDevice = sessionDevices.insert(identity, sighting.timestamp);
+        if (shieldsUp && isNewSessionDevice) {
+            deviceTable.setFlags(index, DEVICE_SESSION);
+        }
+    }
+
+    if (shieldsUp && !deviceTable.hasFlags(index, DEVICE_ALERT)) {
+        uint8_t facts = deviceTable.hasFlags(index, DEVICE_NEW) ? ALERT_FACT_NEW : 0;
+        uint32_t present = sighting.timestamp - deviceTable.at(index).firstSeen;
+        if (alertRules.alerts(sighting.rule, facts, sighting.rssi, present) &&
+            !alertedDevices.contains(identity)) {
+            alertedDevices.insert(identity, sighting.timestamp);
+            deviceTable.setFlags(index, DEVICE_ALERT);
+            logLine("New alert device detected! (rule %u)", sighting.rule);
+            queueWebEvent(WEB_EVENT_ALERT, index);
+        }
+    }
+
+    if (deviceListOpen) {
+        deviceListView.rowChanged(index);
+    }
+}
+
+// Scan task: turns the detector's findings into following alerts on the rows
+// of the device, whatever other alert they raised
+void raiseFollowerAlerts() {
+    FollowerEvidence evidence;
+    while (followerQueue.pop(evidence)) {
+        if (!shieldsUp) continue;
+        for (int i = 0; i < deviceTable.size(); i++) {
+            const DeviceRecord& row = deviceTable.at(i);
+            if (addressClusters.identityOf(row.cluster, row.mac) != evidence.identity) continue;
+            deviceTable.setFlags(i, DEVICE_ALERT | DEVICE_FOLLOWING);
+            queueWebEvent(WEB_EVENT_FOLLOWING, i);
+            if (deviceListOpen) deviceListView.rowChanged(i);
+        }
+        alertedDevices.insert(evidence.identity, millis());
+        char address[MAC_STRING_LENGTH];
+        formatMac(evidence.identity, address);
+        logLine("Following alert: %s%s%s%s, present %u of %u slots, %u appearances, %u places", address,
+                evidence.reasons & FOLLOWER_PERSISTENT ? " persistent" : "",
+                evidence.reasons & FOLLOWER_RECURRING ? " recurring" : "",
+                evidence.reasons & FOLLOWER_TRAVELLING ? " travelling" : "", evidence.slots, FOLLOWER_SLOTS,
+                evidence.sessions, evidence.places);
+    }
+}
+
+// Process queued sightings, a bounded batch at a time so the UI stays responsive
+void drainSightings() {
+    Sighting sighting;
+    int processed = 0;
+    while (processed < SIGHTING_BATCH_SIZE && sightingQueue.pop(sighting)) {
+        processSighting(sighting);
+        processed++;
+    }
+    scanScheduler.noteAdverts(processed);
+}
+
+// Label shown for a row: the advertised name, or the manufacturer if there is none
+const char* deviceLabel(int index) {
+    const char* name = deviceTable.name(index);
+    return name[0] != '\0' ? name : manufacturerName(deviceTable.at(index).manufacturer);
+}
+
+// Everything after the label: "(Manufacturer) [aa:bb:cc:dd:ee:ff] RSSI: -60"
+void formatDeviceDetails(int index, char* out, size_t length) {
+    const DeviceRecord& record = deviceTable.at(index);
+    char address[MAC_STRING_LENGTH];
+    formatMac(record.mac, address);
+    if (deviceTable.name(index)[0] != '\0') {
+        snprintf(out, length, "(%s) [%s] RSSI: %d", manufacturerName(record.manufacturer), address, (int)record.rssi);
+    } else {
+        snprintf(out, length, "[%s] RSSI: %d", address, (int)record.rssi);
+    }
+}
+
+void formatDeviceLine(int index, char* out, size_t length) {
+    char details[64];
+    formatDeviceDetails(index, details, sizeof(details));
+    snprintf(out, length, "%s %s", deviceLabel(index), details);
+}
+
+// Restores allKnownDevices from flash. Runs before the scan task starts.
+void loadKnownDevices() {
+    allKnownDevices.clear();
+    if (!LittleFS.begin(true)) {
+        Serial.println("Flash filesystem unavailable; known devices will not persist");
+        return;
+    }
+    knownStoreReady = true;
+
+    unsigned long start = micros();
+    uint32_t now = millis();
+    uint32_t records = knownDeviceStore.load([now](uint64_t mac) {
+        allKnownDevices.insert(mac, now);
+    });
+    Serial.printf("Loaded %u known devices (%u records) in %lu us\n",
+                  allKnownDevices.size(), records, micros() - start);
+}
 
-        // Consider devices with RSSI > -70 as usable
-        if (advertisedDevice.getRSSI() > -70) {
-            usableDevices++;
-            usableDevicesList += deviceInfo + " RSSI: " + String(advertisedDevice.getRSSI()) + "\n";
+// Rules are optional; the built-in default applies without the file
+void loadAlertRules() {
+    if (!knownStoreReady) return; // Filesystem not mounted
+    unsigned long start = micros();
+    uint32_t errorLine;
+    if (!alertRules.load(LittleFS, ALERT_RULES_PATH, errorLine)) {
+        Serial.println("No alert rules loaded; using the default rule");
+        return;
+    }
+    Serial.printf("Loaded %u alert rule entries (%u option sets) in %lu us\n",
+                  alertRules.entryCount(), alertRules.ruleSetCount(), micros() - start);
+    if (errorLine != 0) {
+        Serial.printf("Alert rules: skipped lines that did not parse, the first is line %u\n", errorLine);
+    }
+}
 
-            bool isNewSessionDevice = sessionDevices.insert(deviceAddress).second;
+// Scan task: writes newly known devices once a batch is due
+void saveKnownDevices() {
+    if (!knownStoreReady || !knownDeviceStore.shouldFlush(millis(), KNOWN_STORE_FLUSH_INTERVAL)) return;
+    if (!knownDeviceStore.flush(allKnownDevices, millis())) {
+        logLine("Failed to save known devices");
+    }
+}
 
-            if (shieldsUp && isNewDevice && isNewSessionDevice) {
-                alertDevices++;
-                alertDevicesList += deviceInfo + " RSSI: " + String(advertisedDevice.getRSSI()) + "\n";
-                Serial.println("New alert device detected!");
+// Web handlers run on the async TCP task. Status comes from the latest
+// snapshot; devices and history are streamed in chunks, each formatted under
+// tableMutex, so a slow client never holds the table.
+void startWebServer() {
+    if (strlen(WIFI_SSID) == 0) {
+        Serial.println("Web API disabled (WIFI_SSID not set)");
+        return;
+    }
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+
+    webServer.on("/api/status", HTTP_GET, [](AsyncWebServerRequest* request) {
+        ScanStatus status;
+        if (xQueuePeek(statusQueue, &status, 0) != pdTRUE) {
+            request->send(503);
+            return;
+        }
+        char json[288];
+        snprintf(json, sizeof(json),
+                 "{\"total\":%d,\"usable\":%d,\"alerts\":%d,\"shieldsUp\":%s,\"scanning\":%s,"
+                 "\"scanLevel\":%u,\"scanActive\":%s,\"advertRate\":%lu,"
+                 "\"distinct\":{\"hour\":%lu,\"day\":%lu,\"week\":%lu},\"uptime\":%lu}",
+                 status.total, status.usable, status.alerts, status.shieldsUp ? "true" : "false",
+                 status.scanning ? "true" : "false", status.scanLevel, status.scanActive ? "true" : "false",
+                 (unsigned long)status.advertRate, (unsigned long)status.distinct[DISTINCT_HOUR],
+                 (unsigned long)status.distinct[DISTINCT_DAY], (unsigned long)status.distinct[DISTINCT_WEEK], millis());
+        request->send(200, "application/json", json);
+    });
+
+    // ?filter=seen (default), usable or alert
+    webServer.on("/api/devices", HTTP_GET, [](AsyncWebServerRequest* request) {
+        uint8_t filter = DEVICE_SEEN;
+        if (request->hasParam("filter")) {
+            const String& value = request->getParam("filter")->value();
+            if (value == "usable") filter = DEVICE_USABLE;
+            else if (value == "alert") filter = DEVICE_ALERT;
+            else if (!(value == "seen")) {
+                request->send(400);
+                return;
+            }
+        }
+        std::shared_ptr<DeviceJsonCursor> cursor(new DeviceJsonCursor(filter));
+        request->send(request->beginChunkedResponse("application/json",
+            [cursor](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+                (void)index;
+                xSemaphoreTake(tableMutex, portMAX_DELAY);
+                size_t length = cursor->fill(deviceTable, (char*)buffer, maxLen);
+                xSemaphoreGive(tableMutex);
+                return length;
+            }));
+    });
+
+    // ?tier=1m (default), 15m, 1h or 1d
+    webServer.on("/api/history", HTTP_GET, [](AsyncWebServerRequest* request) {
+        HistoryTier tier = TIER_MINUTE;
+        if (request->hasParam("tier")) {
+            const String& value = request->getParam("tier")->value();
+            int t = 0;
+            while (t < TIER_COUNT && !(value == tierLabels[t])) t++;
+            if (t == TIER_COUNT) {
+                request->send(400);
+                return;
             }
+            tier = (HistoryTier)t;
         }
+        std::shared_ptr<HistoryJsonCursor> cursor(new HistoryJsonCursor(tier, tierLabels[tier]));
+        request->send(request->beginChunkedResponse("application/json",
+            [cursor](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+                (void)index;
+                xSemaphoreTake(tableMutex, portMAX_DELAY);
+                size_t length = cursor->fill(history, (char*)buffer, maxLen);
+                xSemaphoreGive(tableMutex);
+                return length;
+            }));
+    });
+
+    webServer.addHandler(&webEvents);
+    webServer.onNotFound([](AsyncWebServerRequest* request) {
+        request->send(404);
+    });
+    webServer.begin();
+    webEnabled = true;
+    Serial.printf("Web API starting, joining %s\n", WIFI_SSID);
+}
+
+// UI loop: forwards queued sightings and alerts to event stream clients
+void serviceWebEvents() {
+    if (!webEnabled) return;
 
-        // Always add to total devices list
-        totalDevices++;
-        allDevicesList += deviceInfo + " RSSI: " + String(advertisedDevice.getRSSI()) + "\n";
+    static bool announced = false;
+    if (!announced && WiFi.status() == WL_CONNECTED && !capture.capturing()) {
+        announced = true;
+        Serial.print("Web API at http://");
+        Serial.println(WiFi.localIP().toString());
     }
-};
 
-String getManufacturer(const String& macAddress) {
-    String oui = macAddress.substring(0, 8);
-    oui.toUpperCase();
-
-    if (oui == "D0:03:4B") return "Apple";
-    if (oui == "AC:DE:48") return "Apple";
-    if (oui == "00:25:00") return "Apple";
-    if (oui == "3C:E0:72") return "Apple";
-    if (oui == "B8:27:EB") return "Raspberry Pi";
-    if (oui == "00:1A:7D") return "Xiaomi";
-    if (oui == "F8:A7:63") return "Xiaomi";
-    if (oui == "00:50:F2") return "Microsoft";
-    if (oui == "00:15:5D") return "Microsoft";
-    if (oui == "28:11:A5") return "Google";
-    if (oui == "00:1A:11") return "Google";
-    if (oui == "D8:3A:DD") return "Google";
-    if (oui == "00:1B:44") return "Samsung";
-    if (oui == "00:15:99") return "Samsung";
-    if (oui == "94:35:0A") return "Samsung";
-    
-    return "Unknown";
+    static uint32_t eventId = 0;
+    WebEvent event;
+    for (int i = 0; i < WEB_EVENT_BATCH_SIZE && webEventQueue.pop(event); i++) {
+        if (webEvents.count() == 0) continue;
+        char json[JSON_PIECE_LENGTH];
+        formatDeviceJson(json, sizeof(json), event.mac, event.name, event.manufacturer, event.rssi,
+                         event.flags, event.firstSeen, event.lastSeen);
+        const char* const names[] = {"sighting", "alert", "following"};
+        webEvents.send(json, names[event.type], ++eventId);
+    }
+}
+
+// UI loop: the follower detector. Every FOLLOWER_SWEEP_INTERVAL it looks over
+// the whole tracker, FOLLOWER_SWEEP_BATCH entries per pass, so the table lock
+// is held for a bounded time however many devices are tracked.
+void serviceFollowers() {
+    if (followerSweepLeft == 0) {
+        if (millis() - lastFollowerSweepTime < FOLLOWER_SWEEP_INTERVAL) return;
+        lastFollowerSweepTime = millis();
+        followerSweepLeft = followers.capacity();
+    }
+    // The sweep waits while the scan task catches up, rather than lose findings
+    if (followerQueue.size() >= followerQueue.capacity() / 2) return;
+    PerfTimer timer(perfFollow);
+    xSemaphoreTake(tableMutex, portMAX_DELAY);
+    uint32_t budget = min((uint32_t)FOLLOWER_SWEEP_BATCH, followerSweepLeft);
+    uint32_t examined = followers.sweep(budget, [](const FollowerEvidence& evidence) {
+        followerQueue.push(evidence);
+    });
+    xSemaphoreGive(tableMutex);
+    followerSweepLeft = examined == 0 ? 0 : followerSweepLeft - examined;
+}
+
+// Fleet reporting needs the network the web API joins
+void startCollector() {
+    if (collectorHost[0] == '\0') return;
+    if (WiFi.getMode() == WIFI_OFF) {
+        Serial.println("Collector reporting disabled (WIFI_SSID not set)");
+        return;
+    }
+    if (nodeId == 0) {
+        nodeId = (uint16_t)(ESP.getEfuseMac() >> 32); // Last two octets of the MAC
+        if (nodeId == 0) nodeId = 1;
+    }
+    collectorUdp.begin(collectorPort);
+    collectorEnabled = true;
+    Serial.printf("Reporting to collector %s:%u as node %u\n", collectorHost, collectorPort, nodeId);
+}
+
+// UI loop: sends queued reports. Datagrams that cannot go out are dropped;
+// the collector sees the sequence gap.
+void serviceCollector() {
+    if (!collectorEnabled) return;
+    NodeDatagram datagram;
+    for (int i = 0; i < NODE_REPORT_BATCH && nodeReportQueue.pop(datagram); i++) {
+        if (WiFi.status() != WL_CONNECTED || !collectorUdp.beginPacket(collectorHost, collectorPort)) {
+            nodeReportStats.sendFailed++;
+            continue;
+        }
+        collectorUdp.write(datagram.data, datagram.length);
+        if (!collectorUdp.endPacket()) nodeReportStats.sendFailed++;
+    }
 }
 
 void setup() {
-    Serial.begin(115200);
+    Serial.setTxBufferSize(SERIAL_TX_BUFFER);
+    Serial.begin(SERIAL_BAUD);
     Serial.println("BLE Monitor starting up...");
 
-    // Initialize SPI for touch screen
-    spi_touch.begin(XPT2046_CLK, XPT2046_MISO, XPT2046_MOSI, XPT2046_CS);
-
     // Initialize touch screen
-    ts.begin(spi_touch);
-    ts.setRotation(1);
+    touchInput.begin();
 
     // Initialize TFT display
     tft.begin();
     tft.setRotation(1);
     tft.fillScreen(BT_BLACK);
+    initRenderer();
 
-    // Initialize Bluetooth
-    BLEDevice::init("");
-    pBLEScan = BLEDevice::getScan();
-    pBLEScan->setAdvertisedDeviceCallbacks(new MyAdvertisedDeviceCallbacks());
-    pBLEScan->setActiveScan(true);
-    pBLEScan->setInterval(100);
-    pBLEScan->setWindow(99);
+    commandQueue = xQueueCreate(8, sizeof(ScanCommand));
+    statusQueue = xQueueCreate(1, sizeof(ScanStatus));
+    tableMutex = xSemaphoreCreateMutex();
+
+    // Initialize Bluetooth. Continuous mode needs every advert, not just the
+    // first per device, to keep last-seen fresh.
+    scanSource.begin(onAdvert, continuousScan);
+    scanScheduler.reset(millis());
+    scanSource.configure(scanScheduler.settings());
+    addressClusters.setDuty(scanLevelDuty(scanScheduler.level()));
+
+    startWebServer();
+    startCollector();
 
     // Initialize the triangle angle
     triangleAngle = 0;
 
-    allKnownDevices.clear();
+    loadKnownDevices();
+    loadAlertRules(); // Before the scan task starts the radio
     sessionDevices.clear();
 
-    for (int i = 0; i < HISTORY_LENGTH; i++) {
-        totalDevicesHistory[i] = 0;
-        usableDevicesHistory[i] = 0;
-    }
+    history.clear();
+
+    xTaskCreatePinnedToCore(scanTask, "scan", SCAN_TASK_STACK, nullptr, SCAN_TASK_PRIORITY,
+                            &scanTaskHandle, SCAN_TASK_CORE);
 
     // Initial display
     drawInterface();
 }
 
+// UI loop, core 1. Never blocks: each pass handles input and redraws
+// whatever the current screen needs.
 void loop() {
+    xQueueReceive(statusQueue, &scanStatus, 0);
     handleTouch();
-    updateDeviceHistory();
+    serviceWebEvents();
+    serviceCollector();
+    serviceFollowers();
+    serviceSerialCommands();
+
+    if (uiScreen == SCREEN_DIAGNOSTICS) {
+        updateDiagnostics();
+    } else if (uiScreen == SCREEN_LIST) {
+        updateDeviceList();
+    } else {
+        // Show the alert list when a scan turned up new alerts
+        static uint32_t shownAlertEvents = 0;
+        if (scanStatus.alertEvents != shownAlertEvents) {
+            shownAlertEvents = scanStatus.alertEvents;
+            if (scanStatus.shieldsUp) {
+                displayAlertList();
+                return;
+            }
+        }
 
-    static unsigned long lastScanTime = 0;
-    if ((millis() - lastScanTime > 10000) && !isScanning && !scanInProgress && !shieldsUp) {
-        lastScanTime = millis();
-        scanDevices();
+        // Blink and rotate alert triangles if there are alerts
+        if (scanStatus.alerts > 0) {
+            if (millis() - lastAlertBlinkTime > 500) {
+                lastAlertBlinkTime = millis();
+                alertBlinkState = !alertBlinkState;
+                triangleAngle += 15;
+                if (triangleAngle >= 360) triangleAngle -= 360;
+                markDirty(WIDGET_TRIANGLES);
+            }
+        }
+
+        if (millis() - lastRenderTime >= RENDER_INTERVAL) {
+            renderInterface();
+        }
     }
 
-    // Handle ongoing scan
-    if (scanInProgress) {
-        if (millis() - scanStartTime >= scanDuration) {
-            pBLEScan->stop();
-            scanInProgress = false;
-            isScanning = false;
-            Serial.println("BLE scan completed.");
-            Serial.printf("Total devices: %d, Usable devices: %d, Alert devices: %d\n", 
-                          totalDevices, usableDevices, alertDevices);
+    delay(5);
+}
 
-            drawInterface();
+void handleScanCommands() {
+    ScanCommand command;
+    while (xQueueReceive(commandQueue, &command, 0) == pdTRUE) {
+        if (command == COMMAND_NEXT_GRAPH_TIER) {
+            graphTier = (HistoryTier)((graphTier + 1) % TIER_COUNT);
+            continue;
+        }
 
-            if (shieldsUp && alertDevices > 0) {
-                displayAlertList();
-            }
-            
-            // Immediately start a new scan if shields are up
-            if (shieldsUp) {
-                scanDevices();
+        bool up = command == COMMAND_SHIELDS_UP;
+        if (up == shieldsUp) continue;
+        shieldsUp = up;
+
+        xSemaphoreTake(tableMutex, portMAX_DELAY);
+        deviceTable.resetFlags(DEVICE_ALERT | DEVICE_SESSION | DEVICE_NEW | DEVICE_FOLLOWING, DEVICE_SEEN);
+        sessionDevices.clear();  // Clear session devices, but keep allKnownDevices
+        alertedDevices.clear();
+        if (up) followers.startSession(millis());
+        xSemaphoreGive(tableMutex);
+
+        if (shieldsUp) {
+            logLine("Shields UP");
+            scanDevices(); // Start scanning immediately when shields are up
+        } else {
+            logLine("Shields DOWN");
+            if (scanInProgress && !continuousScan) {
+                stopScanSource(); // Stop scanning if shields are turned off
+                scanInProgress = false;
+                isScanning = false;
+                logLine("Scanning stopped due to shields down");
             }
         }
     }
+}
+
+void logScanSummary() {
+    logLine("Total devices: %d, Usable devices: %d, Alert devices: %d",
+            deviceTable.countWith(DEVICE_SEEN), deviceTable.countWith(DEVICE_USABLE),
+            deviceTable.countWith(DEVICE_ALERT));
+    logLine("Dropped sightings: queue %u, table %lu",
+            sightingQueue.droppedCount(), deviceTable.droppedCount());
+    logLine("Render: %lu frames, last frame %lu us, %lu bytes pushed",
+            renderStats.frames, renderStats.lastFrameMicros, renderStats.lastFrameBytes);
+    logLine("Known devices: %u, stored %u, pending %u, %lu writes, %lu compactions",
+            allKnownDevices.size(), knownDeviceStore.logRecords(), knownDeviceStore.pendingRecords(),
+            knownDeviceStore.writeCount(), knownDeviceStore.compactionCount());
+    logLine("Distinct devices: %lu in the last hour, %lu day, %lu week",
+            (unsigned long)distinctCounts[DISTINCT_HOUR], (unsigned long)distinctCounts[DISTINCT_DAY],
+            (unsigned long)distinctCounts[DISTINCT_WEEK]);
+    logLine("Followers: %u tracked, %lu moves, %lu found, %lu evicted", followers.size(),
+            followers.moveTotal(), followers.foundTotal(), followers.evictions());
+    logLine("Address clusters: %u, rotations folded %lu, %lu undone, clusters freed %lu, reused %lu",
+            addressClusters.size(), addressClusters.rotationsFolded(), addressClusters.linksUndone(),
+            addressClusters.clustersFreed(), addressClusters.clustersReused());
+    logLine("Alert rules: %u entries, %lu lookups, %lu past the Bloom filter",
+            alertRules.entryCount(), alertRules.lookupCount(), alertRules.bloomPassCount());
+    const ScanSchedulerStats& scan = scanScheduler.stats();
+    ScanSettings settings = scanScheduler.settings();
+    logLine("Scan: level %u (%u/%u ms, %s), %lu adverts/s, %lu new/min, backlog %u%%",
+            scanScheduler.level(), settings.window, settings.interval, settings.active ? "active" : "passive",
+            (unsigned long)scan.advertRate, (unsigned long)scan.newDeviceRate, scan.backlogPeak);
+    logLine("Scan decisions: %lu changes, %lu throttles, %lu boosts, %lu quiet steps, %lu active bursts, %lu drops",
+            scan.changes, scan.throttles, scan.boosts, scan.quietSteps, scan.activeBursts, scan.drops);
+}
+
+// Scan task: applies new scheduler settings, restarting a running scan so
+// they take effect
+void applyScanSettings() {
+    ScanSettings settings = scanScheduler.settings();
+    logLine("Scan settings: %u/%u ms, %s", settings.window, settings.interval, settings.active ? "active" : "passive");
+    scanSource.configure(settings);
+    addressClusters.setDuty(scanLevelDuty(scanScheduler.level())); // Cluster timing follows what the radio hears
+    if (scanInProgress) {
+        stopScanSource();
+        startScanSource();
+    }
+}
+
+// Periodic mode only: ends the current scan
+void finishScan() {
+    stopScanSource();
+    scanInProgress = false;
+    isScanning = false;
+
+    xSemaphoreTake(tableMutex, portMAX_DELAY);
+    while (sightingQueue.size() > 0) {
+        drainSightings();
+    }
+    xSemaphoreGive(tableMutex);
+
+    logLine("BLE scan completed.");
+    logScanSummary();
+
+    // Immediately start a new scan if shields are up
+    if (shieldsUp) {
+        scanDevices();
+    }
+}
+
+// Continuous mode only: ages devices out of the presence window
+void expirePresence() {
+    xSemaphoreTake(tableMutex, portMAX_DELAY);
+    deviceTable.expire(millis(), PRESENCE_WINDOW, DEVICE_SEEN | DEVICE_ALERT);
+    addressClusters.expire(millis());
+    xSemaphoreGive(tableMutex);
+}
+
+// Signals the UI when new alerts have appeared while shields are up
+void checkAlerts() {
+    static int lastAlerts = 0;
+    int alerts = deviceTable.countWith(DEVICE_ALERT);
+    if (shieldsUp && alerts > lastAlerts) {
+        alertEvents++;
+    }
+    lastAlerts = alerts;
+}
 
-    // Blink and rotate alert triangles if there are alerts
-    if (alertDevices > 0) {
-        if (millis() - lastAlertBlinkTime > 500) {
-            lastAlertBlinkTime = millis();
-            alertBlinkState = !alertBlinkState;
-            triangleAngle += 15;
-            if (triangleAngle >= 360) triangleAngle -= 360;
-            drawInterface();
+void publishStatus() {
+    ScanStatus status;
+    status.total = deviceTable.countWith(DEVICE_SEEN);
+    status.usable = deviceTable.countWith(DEVICE_USABLE);
+    status.alerts = deviceTable.countWith(DEVICE_ALERT);
+    status.shieldsUp = shieldsUp;
+    status.scanning = scanInProgress;
+    status.scanLevel = scanScheduler.level();
+    status.scanActive = scanScheduler.scanningActively();
+    status.advertRate = scanScheduler.stats().advertRate;
+    status.alertEvents = alertEvents;
+    status.historyVersion = history.version();
+    status.graphTier = graphTier;
+    status.graphPoints = min((int)history.count(graphTier), GRAPH_POINTS);
+    for (int s = 0; s < HISTORY_SERIES; s++) {
+        for (int i = 0; i < status.graphPoints; i++) {
+            status.graph[s][i] = history.get(graphTier, s, status.graphPoints - 1 - i);
         }
     }
+    memcpy(status.distinct, distinctCounts, sizeof(status.distinct));
+    xQueueOverwrite(statusQueue, &status);
 }
 
-void drawGradientBackground() {
-    for (int y = 0; y < SCREEN_HEIGHT; y++) {
-        uint16_t color = tft.color565(10, 20, 50 + (y * 150 / SCREEN_HEIGHT));
-        tft.drawFastHLine(0, y, SCREEN_WIDTH, color);
+// Scan task: queues a report of the rows heard since the last one. Rows that
+// do not fit in the free queue slots keep their counts for the next report.
+bool beginNodeDatagram(NodeReportEncoder& encoder) {
+    if (nodeReportQueue.size() >= nodeReportQueue.capacity()) {
+        nodeReportStats.deferred++;
+        return false;
     }
+    encoder.begin(nodeDatagram.data, sizeof(nodeDatagram.data), nodeId, nodeReportSequence++, millis(),
+                  shieldsUp ? NODE_REPORT_SHIELDS_UP : 0);
+    return true;
 }
 
-void drawInterface() {
-    drawGradientBackground();
+void sendNodeDatagram(NodeReportEncoder& encoder) {
+    nodeDatagram.length = (uint16_t)encoder.finish();
+    nodeReportQueue.push(nodeDatagram);
+    nodeReportStats.datagrams++;
+}
 
-    tft.setTextColor(BT_WHITE, BT_BACKGROUND);
-    tft.setTextSize(1);
-    tft.setTextDatum(MC_DATUM);
-    tft.drawString("Bluetooth Scanner", SCREEN_WIDTH / 2, 15, TITLE_FONT);
-
-    // Total Devices
-    tft.setTextColor(BT_LIGHT_BLUE, BT_BACKGROUND);
-    tft.setTextSize(2);
-    tft.drawString("T " + String(totalDevices), 60, 50, TEXT_FONT);
-    tft.drawRect(120, 35, 180, 30, BT_LIGHT_BLUE);
-    drawGraph(122, 37, 176, 26, totalDevicesHistory, HISTORY_LENGTH, BT_LIGHT_BLUE);
-
-    // Usable Devices
-    tft.drawString("U " + String(usableDevices), 60, 80, TEXT_FONT);
-    tft.drawRect(120, 65, 180, 30, BT_LIGHT_BLUE);
-    drawGraph(122, 67, 176, 26, usableDevicesHistory, HISTORY_LENGTH, BT_LIGHT_BLUE);
-
-    // Alerts
-    if (alertDevices > 0) {
-        tft.fillRect(0, 110, SCREEN_WIDTH, 30, TFT_RED);
-        tft.setTextColor(TFT_WHITE, TFT_RED);
-    } else {
-        tft.setTextColor(BT_LIGHT_BLUE, BT_BACKGROUND);
+void queueNodeReport() {
+    NodeReportEncoder encoder;
+    // One distinct device sketch per report while they are due. It goes
+    // first: rows that do not fit this time keep accumulating for the next.
+    if (millis() - lastNodeSketchTime >= NODE_SKETCH_INTERVAL) {
+        lastNodeSketchTime = millis();
+        nodeSketchesPending = DISTINCT_WINDOWS;
     }
-    tft.drawString("Alerts (" + String(alertDevices) + ")", SCREEN_WIDTH / 2, 125, TEXT_FONT);
-    tft.setTextSize(1);
+    if (nodeSketchesPending > 0 && beginNodeDatagram(encoder)) {
+        DistinctWindow window = (DistinctWindow)(DISTINCT_WINDOWS - nodeSketchesPending);
+        uint8_t* registers = encoder.beginSketch(window, DISTINCT_PRECISION, distinctDevices.windowLength(window));
+        if (registers != nullptr) distinctDevices.unionInto(window, registers);
+        sendNodeDatagram(encoder);
+        nodeSketchesPending--;
+    }
+    bool open = false;
+    uint32_t now = millis();
+    xSemaphoreTake(tableMutex, portMAX_DELAY);
+    for (int i = 0; i < deviceTable.size(); i++) {
+        DeviceRecord& row = deviceTable.at(i);
+        if (row.reportAdverts == 0) continue;
+        NodeReportRecord record;
+        record.address = row.mac;
+        record.identity = addressClusters.identityOf(row.cluster, row.mac);
+        record.flags = (row.flags & DEVICE_ALERT ? NODE_RECORD_ALERT : 0) |
+                       (row.flags & DEVICE_NEW ? NODE_RECORD_NEW : 0) |
+                       (row.flags & DEVICE_USABLE ? NODE_RECORD_USABLE : 0);
+        record.adverts = row.reportAdverts;
+        record.rssi = (int8_t)(row.reportRssiSum / row.reportAdverts);
+        record.rssiMax = row.reportRssiMax;
+        record.age = now - row.lastSeen;
+        if (!open) {
+            open = beginNodeDatagram(encoder);
+            if (!open) break;
+        }
+        if (!encoder.add(record)) {
+            sendNodeDatagram(encoder);
+            open = beginNodeDatagram(encoder);
+            if (!open) break;
+            encoder.add(record);
+        }
+        row.reportAdverts = 0;
+        nodeReportStats.records++;
+    }
+    xSemaphoreGive(tableMutex);
+    if (open) sendNodeDatagram(encoder);
+    nodeReportStats.reports++;
+}
 
-    int buttonWidth = 173;
-    int buttonHeight = 60;
-    int buttonX = (SCREEN_WIDTH - buttonWidth) / 2;
-    int buttonY = SCREEN_HEIGHT - 80;
+// Scan task, core 0. Owns the scan schedule, the device table and history,
+// so the scan duty cycle does not depend on what the UI is doing.
+unsigned long lastScanTime = 0;
+unsigned long lastSweepTime = 0;
+unsigned long lastSummaryTime = 0;
+
+// One pass of the scan task. The native build calls this directly.
+void runScanCycle() {
+    PerfTimer timer(perfScan);
+    handleScanCommands();
+
+    scanScheduler.noteBacklog(sightingQueue.size(), sightingQueue.capacity());
+    scanScheduler.noteDropped(sightingQueue.droppedCount());
+    xSemaphoreTake(tableMutex, portMAX_DELAY);
+    drainSightings();
+    followers.advance(millis());
+    raiseFollowerAlerts();
+    updateDeviceHistory();
+    xSemaphoreGive(tableMutex);
+    updateDistinctCounts();
 
-    tft.fillRoundRect(buttonX, buttonY, buttonWidth, buttonHeight, 10, shieldsUp ? TFT_RED : BT_BLUE);
-    tft.fillRoundRect(buttonX + 5, buttonY + 5, buttonWidth - 10, buttonHeight - 10, 8, BT_BLACK);
-    tft.fillRoundRect(buttonX + 3, buttonY + 3, buttonWidth - 6, buttonHeight - 6, 9, shieldsUp ? TFT_RED : BT_BLUE);
+    if (scanScheduler.update(millis())) {
+        applyScanSettings();
+    }
 
-    tft.setTextColor(BT_WHITE, shieldsUp ? TFT_RED : BT_BLUE);
-    tft.setTextDatum(MC_DATUM);
-    tft.setTextSize(2);
-    tft.drawString(shieldsUp ? "SHIELDS UP" : "SHIELDS DOWN", SCREEN_WIDTH / 2, SCREEN_HEIGHT - 50, TEXT_FONT);
-    tft.setTextSize(1);
+    if (continuousScan) {
+        // The radio never stops; restart it only if something stopped it
+        if (!scanInProgress) {
+            scanDevices();
+        }
+        if (millis() - lastSweepTime >= PRESENCE_SWEEP_INTERVAL) {
+            lastSweepTime = millis();
+            expirePresence();
+        }
+        if (millis() - lastSummaryTime >= SUMMARY_LOG_INTERVAL) {
+            lastSummaryTime = millis();
+            logScanSummary();
+        }
+    } else {
+        if ((millis() - lastScanTime > 10000) && !isScanning && !scanInProgress && !shieldsUp) {
+            lastScanTime = millis();
+            scanDevices();
+        }
+
+        // Handle ongoing scan
+        if (scanInProgress && millis() - scanStartTime >= scanDuration) {
+            finishScan();
+        }
+    }
+
+    if (collectorEnabled && millis() - lastNodeReportTime >= NODE_REPORT_INTERVAL) {
+        lastNodeReportTime = millis();
+        queueNodeReport();
+    }
 
-    // Draw alert triangles
-    if (alertDevices > 0) {
-        drawAlertTriangles();
+    saveKnownDevices();
+    checkAlerts();
+    publishStatus();
+}
+
+void scanTask(void* parameter) {
+    (void)parameter;
+    while (true) {
+        runScanCycle();
+        vTaskDelay(pdMS_TO_TICKS(SCAN_TASK_PERIOD));
     }
 }
 
-void drawAlertTriangles() {
-    int triangleSize = 20;
-    int margin = 10;
+typedef void (*WidgetDrawFn)(TFT_eSPI& g, int ox, int oy);
 
-    // Left triangle
-    drawRotatedTriangle(margin + triangleSize/2, margin + triangleSize/2, triangleSize, triangleAngle);
+struct Widget {
+    int16_t x, y, w, h;
+    WidgetDrawFn draw;
+};
+
+void markDirty(uint16_t widgets) {
+    dirtyWidgets |= widgets;
+}
+
+// Plots the averages as a line; coarser tiers also show each sample's
+// min-max range as a bar behind it
+void drawGraph(TFT_eSPI& g, int x, int y, int w, int h, int series, uint16_t color) {
+    int points = scanStatus.graphPoints;
+    const HistoryPoint* data = scanStatus.graph[series];
+    int maxVal = 1; // Avoid division by zero
+    for (int i = 0; i < points; i++) {
+        if (data[i].max > maxVal) maxVal = data[i].max;
+    }
+
+    if (scanStatus.graphTier != TIER_MINUTE) {
+        for (int i = 0; i < points; i++) {
+            int bx = x + i * w / max(1, GRAPH_POINTS - 1);
+            int top = y + h - (data[i].max * h / maxVal);
+            int bottom = y + h - (data[i].min * h / maxVal);
+            g.drawFastVLine(bx, top, bottom - top + 1, BT_DARK_BLUE);
+        }
+    }
+
+    for (int i = 0; i < points - 1; i++) {
+        int x1 = x + i * w / (GRAPH_POINTS - 1);
+        int y1 = y + h - (data[i].avg * h / maxVal);
+        int x2 = x + (i + 1) * w / (GRAPH_POINTS - 1);
+        int y2 = y + h - (data[i + 1].avg * h / maxVal);
+        g.drawLine(x1, y1, x2, y2, color);
+    }
 
-    // Right triangle
-    drawRotatedTriangle(SCREEN_WIDTH - margin - triangleSize/2, margin + triangleSize/2, triangleSize, triangleAngle);
+    g.setTextColor(color);
+    g.setTextDatum(TR_DATUM);
+    g.setTextSize(1);
+    g.drawString(tierLabels[scanStatus.graphTier], x + w - 1, y + 1, 1);
 }
 
-void drawRotatedTriangle(int centerX, int centerY, int size, float angle) {
+void drawRotatedTriangle(TFT_eSPI& g, int centerX, int centerY, int size, float angle) {
     float rad = angle * PI / 180.0;
     int x1 = centerX + size/2 * cos(rad);
     int y1 = centerY + size/2 * sin(rad);
@@ -340,258 +1298,720 @@ void drawRotatedTriangle(int centerX, int centerY, int size, float angle) {
     int y3 = centerY + size/2 * sin(rad + 4.18879020479);
 
     uint16_t color = alertBlinkState ? TFT_RED : TFT_WHITE;
-    tft.fillTriangle(x1, y1, x2, y2, x3, y3, color);
+    g.fillTriangle(x1, y1, x2, y2, x3, y3, color);
 }
 
-void handleTouch() {
-    if (ts.touched()) {
-        TS_Point p = ts.getPoint();
-        touchX = map(p.x, 200, 3800, 0, SCREEN_WIDTH);
-        touchY = map(p.y, 200, 3800, 0, SCREEN_HEIGHT);
-        delay(200);
-
-        if (touchY > 40 && touchY < 60) {
-            displayDeviceList(allDevicesList, "All Devices");
-        } else if (touchY > 70 && touchY < 90) {
-            displayDeviceList(usableDevicesList, "Usable Devices");
-        } else if (touchY > 110 && touchY < 140) {
-            displayAlertList();
-        } else {
-            int buttonWidth = 173;
-            int buttonHeight = 60;
-            int buttonX = (SCREEN_WIDTH - buttonWidth) / 2;
-            int buttonY = SCREEN_HEIGHT - 80;
-
-            if (touchX > buttonX && touchX < buttonX + buttonWidth &&
-                touchY > buttonY && touchY < buttonY + buttonHeight) {
-                toggleShields();
+// Widget painters draw in screen coordinates shifted by (ox, oy), the origin
+// of the tile being rendered; the tile clips anything outside it.
+
+void drawTitleWidget(TFT_eSPI& g, int ox, int oy) {
+    g.setTextColor(BT_WHITE, BT_BACKGROUND);
+    g.setTextSize(1);
+    g.setTextDatum(MC_DATUM);
+    g.drawString("Bluetooth Scanner", SCREEN_WIDTH / 2 - ox, 15 - oy, TITLE_FONT);
+}
+
+void drawCounter(TFT_eSPI& g, int ox, int oy, const char* prefix, int value, int y) {
+    char label[16];
+    snprintf(label, sizeof(label), "%s %d", prefix, value);
+    g.setTextColor(BT_LIGHT_BLUE, BT_BACKGROUND);
+    g.setTextSize(2);
+    g.setTextDatum(MC_DATUM);
+    g.drawString(label, 60 - ox, y - oy, TEXT_FONT);
+    g.setTextSize(1);
+}
+
+void drawTotalWidget(TFT_eSPI& g, int ox, int oy) {
+    drawCounter(g, ox, oy, "T", renderedState.total, 50);
+}
+
+void drawUsableWidget(TFT_eSPI& g, int ox, int oy) {
+    drawCounter(g, ox, oy, "U", renderedState.usable, 80);
+}
+
+void drawTotalGraphWidget(TFT_eSPI& g, int ox, int oy) {
+    g.drawRect(120 - ox, 35 - oy, 180, 30, BT_LIGHT_BLUE);
+    drawGraph(g, 122 - ox, 37 - oy, 176, 26, 0, BT_LIGHT_BLUE);
+
+    // Distinct devices over the window the graph covers
+    char label[24];
+    snprintf(label, sizeof(label), "%lu in %s", (unsigned long)renderedState.distinct,
+             distinctLabels[tierDistinctWindows[renderedState.graphTier]]);
+    g.setTextDatum(TL_DATUM);
+    g.drawString(label, 123 - ox, 38 - oy, 1);
+}
+
+void drawUsableGraphWidget(TFT_eSPI& g, int ox, int oy) {
+    g.drawRect(120 - ox, 65 - oy, 180, 30, BT_LIGHT_BLUE);
+    drawGraph(g, 122 - ox, 67 - oy, 176, 26, 1, BT_LIGHT_BLUE);
+}
+
+void drawAlertsWidget(TFT_eSPI& g, int ox, int oy) {
+    if (renderedState.alerts > 0) {
+        g.fillRect(0 - ox, 110 - oy, SCREEN_WIDTH, 30, TFT_RED);
+        g.setTextColor(TFT_WHITE, TFT_RED);
+    } else {
+        g.setTextColor(BT_LIGHT_BLUE, BT_BACKGROUND);
+    }
+    char label[24];
+    snprintf(label, sizeof(label), "Alerts (%d)", renderedState.alerts);
+    g.setTextSize(2);
+    g.setTextDatum(MC_DATUM);
+    g.drawString(label, SCREEN_WIDTH / 2 - ox, 125 - oy, TEXT_FONT);
+    g.setTextSize(1);
+}
+
+void drawButtonWidget(TFT_eSPI& g, int ox, int oy) {
+    uint16_t color = renderedState.shieldsUp ? TFT_RED : BT_BLUE;
+    int x = BUTTON_X - ox;
+    int y = BUTTON_Y - oy;
+    g.fillRoundRect(x, y, BUTTON_WIDTH, BUTTON_HEIGHT, 10, color);
+    g.fillRoundRect(x + 5, y + 5, BUTTON_WIDTH - 10, BUTTON_HEIGHT - 10, 8, BT_BLACK);
+    g.fillRoundRect(x + 3, y + 3, BUTTON_WIDTH - 6, BUTTON_HEIGHT - 6, 9, color);
+
+    g.setTextColor(BT_WHITE, color);
+    g.setTextDatum(MC_DATUM);
+    g.setTextSize(2);
+    g.drawString(renderedState.shieldsUp ? "SHIELDS UP" : "SHIELDS DOWN", SCREEN_WIDTH / 2 - ox, SCREEN_HEIGHT - 50 - oy, TEXT_FONT);
+    g.setTextSize(1);
+}
+
+void drawStatusWidget(TFT_eSPI& g, int ox, int oy) {
+    if (!renderedState.scanning) return;
+    g.setTextColor(BT_LIGHT_BLUE, BT_BACKGROUND);
+    g.setTextDatum(MC_DATUM);
+    g.drawString("Scanning...", SCREEN_WIDTH / 2 - ox, SCREEN_HEIGHT - 10 - oy, TEXT_FONT);
+}
+
+#define TRIANGLE_SIZE   20
+#define TRIANGLE_MARGIN 10
+
+void drawLeftTriangleWidget(TFT_eSPI& g, int ox, int oy) {
+    if (renderedState.alerts == 0) return;
+    drawRotatedTriangle(g, TRIANGLE_MARGIN + TRIANGLE_SIZE/2 - ox, TRIANGLE_MARGIN + TRIANGLE_SIZE/2 - oy, TRIANGLE_SIZE, triangleAngle);
+}
+
+void drawRightTriangleWidget(TFT_eSPI& g, int ox, int oy) {
+    if (renderedState.alerts == 0) return;
+    drawRotatedTriangle(g, SCREEN_WIDTH - TRIANGLE_MARGIN - TRIANGLE_SIZE/2 - ox, TRIANGLE_MARGIN + TRIANGLE_SIZE/2 - oy, TRIANGLE_SIZE, triangleAngle);
+}
+
+// Indexed by WidgetId; later entries paint over earlier ones where they overlap
+const Widget widgets[WIDGET_COUNT] = {
+    {40, 0, 240, 30, drawTitleWidget},
+    {0, 34, 120, 32, drawTotalWidget},
+    {120, 35, 180, 30, drawTotalGraphWidget},
+    {0, 64, 120, 32, drawUsableWidget},
+    {120, 65, 180, 30, drawUsableGraphWidget},
+    {0, 110, SCREEN_WIDTH, 30, drawAlertsWidget},
+    {BUTTON_X, BUTTON_Y, BUTTON_WIDTH, BUTTON_HEIGHT, drawButtonWidget},
+    {0, SCREEN_HEIGHT - 20, SCREEN_WIDTH, 20, drawStatusWidget},
+    {TRIANGLE_MARGIN - 2, TRIANGLE_MARGIN - 2, TRIANGLE_SIZE + 4, TRIANGLE_SIZE + 4, drawLeftTriangleWidget},
+    {SCREEN_WIDTH - TRIANGLE_MARGIN - TRIANGLE_SIZE - 2, TRIANGLE_MARGIN - 2, TRIANGLE_SIZE + 4, TRIANGLE_SIZE + 4, drawRightTriangleWidget},
+};
+
+void initRenderer() {
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        gradientColors[y] = tft.color565(10, 20, 50 + (y * 150 / SCREEN_HEIGHT));
+    }
+
+    for (int i = 0; i < 2; i++) {
+        renderTiles[i]->setColorDepth(16);
+        renderTilePixels[i] = (uint16_t*)renderTiles[i]->createSprite(RENDER_TILE_WIDTH, RENDER_TILE_HEIGHT);
+    }
+    renderUseDMA = renderTilePixels[0] != nullptr && renderTilePixels[1] != nullptr;
+    if (renderUseDMA) {
+        tft.initDMA();
+    } else {
+        Serial.println("Renderer: no memory for sprite tiles, drawing directly");
+    }
+}
+
+void drawGradientRect(TFT_eSPI& g, int x, int y, int w, int h, int oy) {
+    for (int row = 0; row < h; row++) {
+        g.drawFastHLine(x, row + y, w, gradientColors[row + y + oy]);
+    }
+}
+
+bool overlaps(const Widget& widget, int x, int y, int w, int h) {
+    return widget.x < x + w && x < widget.x + widget.w &&
+           widget.y < y + h && y < widget.y + widget.h;
+}
+
+// Renders one screen tile: gradient, then every widget that touches it
+void renderTile(int x, int y, int w, int h) {
+    if (!renderUseDMA) {
+        drawGradientRect(tft, x, y, w, h, 0);
+        for (int i = 0; i < WIDGET_COUNT; i++) {
+            if (overlaps(widgets[i], x, y, w, h)) widgets[i].draw(tft, 0, 0);
+        }
+        renderStats.lastFrameBytes += w * h * 2;
+        return;
+    }
+
+    TFT_eSprite& tile = *renderTiles[renderTileIndex];
+    uint16_t* pixels = renderTilePixels[renderTileIndex];
+    drawGradientRect(tile, 0, 0, RENDER_TILE_WIDTH, h, y);
+    for (int i = 0; i < WIDGET_COUNT; i++) {
+        if (overlaps(widgets[i], x, y, w, h)) widgets[i].draw(tile, x, y);
+    }
+
+    // DMA needs a contiguous w x h image; close up the rows of narrow tiles
+    if (w < RENDER_TILE_WIDTH) {
+        for (int row = 1; row < h; row++) {
+            memmove(pixels + row * w, pixels + row * RENDER_TILE_WIDTH, w * sizeof(uint16_t));
+        }
+    }
+
+    // The other tile's transfer must finish before this one starts; this
+    // tile is then drawn into again only after the next wait
+    tft.dmaWait();
+    tft.pushImageDMA(x, y, w, h, pixels);
+    renderTileIndex ^= 1;
+    renderStats.lastFrameBytes += w * h * 2;
+}
+
+void renderRegion(int x, int y, int w, int h) {
+    for (int ty = y; ty < y + h; ty += RENDER_TILE_HEIGHT) {
+        int th = min(RENDER_TILE_HEIGHT, y + h - ty);
+        for (int tx = x; tx < x + w; tx += RENDER_TILE_WIDTH) {
+            int tw = min(RENDER_TILE_WIDTH, x + w - tx);
+            renderTile(tx, ty, tw, th);
+        }
+    }
+}
+
+void updateDirtyWidgets() {
+    int total = scanStatus.total;
+    int usable = scanStatus.usable;
+    int alerts = scanStatus.alerts;
+
+    if (total != renderedState.total) markDirty(WIDGET_BIT(WIDGET_TOTAL));
+    if (usable != renderedState.usable) markDirty(WIDGET_BIT(WIDGET_USABLE));
+    if (alerts != renderedState.alerts) markDirty(WIDGET_BIT(WIDGET_ALERTS));
+    if ((alerts > 0) != (renderedState.alerts > 0)) markDirty(WIDGET_TRIANGLES);
+    if (scanStatus.shieldsUp != renderedState.shieldsUp) markDirty(WIDGET_BIT(WIDGET_BUTTON));
+    if (scanStatus.scanning != renderedState.scanning) markDirty(WIDGET_BIT(WIDGET_STATUS));
+    if (scanStatus.historyVersion != renderedState.historyVersion ||
+        scanStatus.graphTier != renderedState.graphTier) markDirty(WIDGET_GRAPHS);
+    uint32_t distinct = scanStatus.distinct[tierDistinctWindows[scanStatus.graphTier]];
+    if (distinct != renderedState.distinct) markDirty(WIDGET_BIT(WIDGET_TOTAL_GRAPH));
+
+    renderedState.total = total;
+    renderedState.usable = usable;
+    renderedState.alerts = alerts;
+    renderedState.shieldsUp = scanStatus.shieldsUp;
+    renderedState.scanning = scanStatus.scanning;
+    renderedState.historyVersion = scanStatus.historyVersion;
+    renderedState.graphTier = scanStatus.graphTier;
+    renderedState.distinct = distinct;
+}
+
+// Repaints whatever changed since the last frame
+void renderInterface() {
+    updateDirtyWidgets();
+    if (dirtyWidgets == 0) return;
+    PerfTimer timer(perfRender);
+
+    unsigned long start = micros();
+    renderStats.lastFrameBytes = 0;
+
+    if (renderUseDMA) tft.startWrite();
+    if (dirtyWidgets == WIDGET_ALL) {
+        renderRegion(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    } else {
+        for (int i = 0; i < WIDGET_COUNT; i++) {
+            if (dirtyWidgets & WIDGET_BIT(i)) {
+                renderRegion(widgets[i].x, widgets[i].y, widgets[i].w, widgets[i].h);
             }
         }
     }
+    if (renderUseDMA) {
+        tft.dmaWait();
+        tft.endWrite();
+    }
+    dirtyWidgets = 0;
+    lastRenderTime = millis();
+
+    renderStats.frames++;
+    renderStats.lastFrameMicros = micros() - start;
+    renderStats.totalBytes += renderStats.lastFrameBytes;
 }
 
-void toggleShields() {
-    shieldsUp = !shieldsUp;
-    if (shieldsUp) {
-        Serial.println("Shields UP");
-        alertDevicesList = "";
-        alertDevices = 0;
-        sessionDevices.clear();  // Clear session devices, but keep allKnownDevices
-        scanDevices(); // Start scanning immediately when shields are up
+// Full repaint, e.g. after returning from a list screen
+void drawInterface() {
+    markDirty(WIDGET_ALL);
+    renderInterface();
+}
+
+// Drains the touch driver's queue. The driver debounces and keeps sampling
+// while this loop renders, so a pass only turns the queued samples into
+// gestures and acts on them.
+void handleTouch() {
+    TouchSample sample;
+    while (touchInput.read(sample)) {
+        TouchEvent event;
+        if (!touchGestures.feed(sample, event)) continue;
+
+        PerfTimer timer(perfTouch);
+        // In cycles like the other timers; 32 bits of them is under 18 s at
+        // 240 MHz, and a sample held through a long redraw can be older
+        uint64_t latency = (uint64_t)(micros() - event.micros) * ESP.getCpuFreqMHz();
+        perfInput.record(latency < UINT32_MAX ? (uint32_t)latency : UINT32_MAX);
+        if (uiScreen == SCREEN_DIAGNOSTICS) {
+            if (event.type == TOUCH_TAP) closeDiagnostics();
+        } else if (uiScreen == SCREEN_LIST) {
+            handleListTouch(event);
+        } else if (event.type == TOUCH_TAP) {
+            handleMainTouch(event.x, event.y);
+        }
+    }
+}
+
+void handleMainTouch(int touchX, int touchY) {
+    if (touchY < 35) {
+        // Hidden: a few quick taps on the title open the diagnostics screen
+        static int titleTaps = 0;
+        static unsigned long firstTitleTap = 0;
+        if (titleTaps == 0 || millis() - firstTitleTap > DIAG_TAP_WINDOW) {
+            titleTaps = 0;
+            firstTitleTap = millis();
+        }
+        if (++titleTaps >= DIAG_TITLE_TAPS) {
+            titleTaps = 0;
+            displayDiagnostics();
+        }
+    } else if (touchX >= 120 && touchY > 35 && touchY < 95) {
+        // Either graph: switch both to the next resolution
+        ScanCommand command = COMMAND_NEXT_GRAPH_TIER;
+        xQueueSend(commandQueue, &command, 0);
+    } else if (touchY > 40 && touchY < 60) {
+        displayDeviceList(DEVICE_SEEN, "All Devices");
+    } else if (touchY > 70 && touchY < 90) {
+        displayDeviceList(DEVICE_USABLE, "Usable Devices");
+    } else if (touchY > 110 && touchY < 140) {
+        displayAlertList();
     } else {
-        Serial.println("Shields DOWN");
-        alertDevicesList = "";
-        alertDevices = 0;
-        sessionDevices.clear();
-        if (scanInProgress) {
-            pBLEScan->stop(); // Stop scanning if shields are turned off
-            scanInProgress = false;
-            isScanning = false;
-            Serial.println("Scanning stopped due to shields down");
+        if (touchX > BUTTON_X && touchX < BUTTON_X + BUTTON_WIDTH &&
+            touchY > BUTTON_Y && touchY < BUTTON_Y + BUTTON_HEIGHT) {
+            toggleShields();
         }
     }
-    drawInterface();
 }
 
+void toggleShields() {
+    ScanCommand command = scanStatus.shieldsUp ? COMMAND_SHIELDS_DOWN : COMMAND_SHIELDS_UP;
+    xQueueSend(commandQueue, &command, 0);
+}
+
+// Called from the scan task
 void scanDevices() {
     if (!isScanning && !scanInProgress) {
         isScanning = true;
         scanInProgress = true;
         scanStartTime = millis();
-        
-        Serial.println("Starting BLE scan...");
 
-        tft.fillRect(0, SCREEN_HEIGHT - 30, SCREEN_WIDTH, 30, BT_BACKGROUND);
-        tft.setTextColor(BT_LIGHT_BLUE, BT_BACKGROUND);
-        tft.setTextDatum(MC_DATUM);
-        tft.drawString("Scanning...", SCREEN_WIDTH / 2, SCREEN_HEIGHT - 15, TEXT_FONT);
+        logLine("Starting BLE scan...");
 
-        totalDevices = 0;
-        usableDevices = 0;
-        allDevicesList = "";
-        usableDevicesList = "";
-        // Don't clear alertDevicesList or alertDevices here
+        // In periodic mode, start the scan counts over but keep rows that raised alerts
+        if (!continuousScan) {
+            xSemaphoreTake(tableMutex, portMAX_DELAY);
+            deviceTable.resetFlags(DEVICE_SEEN | DEVICE_USABLE, DEVICE_ALERT);
+            xSemaphoreGive(tableMutex);
+        }
 
-        pBLEScan->start(0, nullptr, false); // Start a continuous scan
+        startScanSource(); // Start a continuous scan
     }
 }
 
+// Called from the scan task. The board reports a radio that didn't confirm
+// rather than logging it, so the failure goes through logLine.
+void startScanSource() {
+    if (!scanSource.start()) logLine("BLE scan start failed (status %d)", scanSource.lastStatus());
+}
+
+void stopScanSource() {
+    if (!scanSource.stop()) logLine("BLE scan stop failed (status %d)", scanSource.lastStatus());
+}
+
 void displayAlertList() {
-    int scrollPosition = 0;
-    int maxScrollPosition = 0;
-    bool redraw = true;
+    displayDeviceList(DEVICE_ALERT, "Alert Devices");
+}
+
+void drawDeviceListHeader(const char* title, bool alertStyle) {
+    uint16_t background = alertStyle ? TFT_RED : BT_BACKGROUND;
 
-    // Count total lines and calculate max scroll position
-    int totalLines = 0;
-    for (int i = 0; i < alertDevicesList.length(); i++) {
-        if (alertDevicesList[i] == '\n') totalLines++;
+    tft.fillScreen(background);
+    tft.setTextColor(alertStyle ? TFT_WHITE : BT_BLUE, background);
+    tft.setTextDatum(MC_DATUM);
+    tft.drawString(title, SCREEN_WIDTH / 2, 15, TITLE_FONT);
+
+    // Sort order and manufacturer filter, tap the left/right half of the header to change
+    char label[48];
+    xSemaphoreTake(tableMutex, portMAX_DELAY);
+    uint16_t manufacturer = deviceListView.manufacturer();
+    ListSort sort = deviceListView.sort();
+    xSemaphoreGive(tableMutex);
+    snprintf(label, sizeof(label), "Sort: %s   Maker: %s", sortLabels[sort],
+             manufacturer == MANUFACTURER_ANY ? "All" : manufacturerName(manufacturer));
+    tft.setTextColor(alertStyle ? TFT_YELLOW : BT_LIGHT_BLUE, background);
+    tft.setTextDatum(TL_DATUM);
+    tft.setTextSize(1);
+    tft.drawString(label, 13, 29, 1);
+}
+
+void drawDeviceListRows(bool alertStyle) {
+    PerfTimer timer(perfList);
+    uint16_t background = alertStyle ? TFT_RED : BT_BACKGROUND;
+    uint16_t scrollColor = alertStyle ? TFT_WHITE : BT_LIGHT_BLUE;
+
+    // Only the visible rows are formatted, under the table lock; drawing happens after
+    char labels[LIST_VISIBLE_ROWS][DEVICE_NAME_LENGTH];
+    char lines[LIST_VISIBLE_ROWS][96];
+    int visible = 0;
+
+    xSemaphoreTake(tableMutex, portMAX_DELAY);
+    int rows = deviceListView.size();
+    listScreen.maxScrollPosition = max(0, rows - LIST_VISIBLE_ROWS);
+    listScroll.setRange(listScreen.maxScrollPosition * LIST_ROW_HEIGHT);
+    listScreen.scrollPosition = constrain(listScreen.scrollPosition, 0, listScreen.maxScrollPosition);
+    for (int position = listScreen.scrollPosition; position < rows && visible < LIST_VISIBLE_ROWS; position++) {
+        int row = deviceListView.rowAt(position);
+        if (alertStyle) {
+            snprintf(labels[visible], DEVICE_NAME_LENGTH, "%s", deviceLabel(row));
+            if (deviceTable.hasFlags(row, DEVICE_FOLLOWING)) {
+                char details[80];
+                formatDeviceDetails(row, details, sizeof(details));
+                snprintf(lines[visible], sizeof(lines[visible]), "FOLLOWING %s", details);
+            } else {
+                formatDeviceDetails(row, lines[visible], sizeof(lines[visible]));
+            }
+        } else {
+            formatDeviceLine(row, lines[visible], sizeof(lines[visible]));
+        }
+        visible++;
     }
-    maxScrollPosition = max(0, totalLines - 8); // Assuming 8 lines fit on screen
+    deviceListView.clearChanged();
+    xSemaphoreGive(tableMutex);
 
-    while (true) {
-        if (redraw) {
-            tft.fillScreen(TFT_RED);
+    tft.fillRect(0, LIST_TOP, SCREEN_WIDTH - 10, SCREEN_HEIGHT - LIST_TOP, background);
+    tft.setTextDatum(TL_DATUM);
+    tft.setTextWrap(false, false);
+
+    int y = LIST_TOP;
+    for (int i = 0; i < visible; i++) {
+        if (alertStyle) {
             tft.setTextColor(TFT_WHITE, TFT_RED);
-            tft.setTextDatum(MC_DATUM);
-            tft.drawString("Alert Devices", SCREEN_WIDTH / 2, 15, TITLE_FONT);
+            tft.setTextSize(2);
+            tft.setCursor(13, y);
+            tft.print(labels[i]);
+
+            tft.setTextColor(TFT_YELLOW, TFT_RED);
+            tft.setTextSize(1);
+            tft.setCursor(13, y + 16);
+            tft.print(lines[i]);
+        } else {
+            tft.setTextColor(BT_WHITE, BT_BACKGROUND);
+            tft.setTextSize(1);
+            tft.setCursor(13, y);
+            tft.print(lines[i]);
+        }
 
-            tft.setTextDatum(TL_DATUM);
-            tft.setTextWrap(false, false);
+        y += LIST_ROW_HEIGHT;
+    }
 
-            int y = 40;
-            int lineHeight = 24; // Adjust based on your font size
-            int linesDisplayed = 0;
-            int index = 0;
+    // Draw scroll bar
+    int maxScrollPosition = listScreen.maxScrollPosition;
+    int scrollBarHeight = SCREEN_HEIGHT - LIST_TOP;
+    int scrollThumbHeight = max(20, scrollBarHeight / (maxScrollPosition + 1));
+    int scrollThumbY = LIST_TOP + (listScreen.scrollPosition * (scrollBarHeight - scrollThumbHeight) / max(1, maxScrollPosition));
+    tft.fillRect(SCREEN_WIDTH - 10, LIST_TOP, 10, scrollBarHeight, background);
+    tft.drawRect(SCREEN_WIDTH - 10, LIST_TOP, 10, scrollBarHeight, scrollColor);
+    tft.fillRect(SCREEN_WIDTH - 8, scrollThumbY, 6, scrollThumbHeight, scrollColor);
+}
 
-            // Find starting position for scrolling
-            for (int i = 0; i < scrollPosition; i++) {
-                index = alertDevicesList.indexOf('\n', index) + 1;
-                if (index == 0) break;
-            }
+void displayDeviceList(uint8_t filter, const char* title) {
+    listScreen.filter = filter;
+    listScreen.title = title;
+    listScreen.alertStyle = filter == DEVICE_ALERT;
+    listScreen.scrollPosition = 0;
+    listScroll.reset();
+    listScreen.redrawHeader = true;
+    listScreen.redrawRows = true;
+    listScreen.lastRowsDrawTime = 0;
+
+    xSemaphoreTake(tableMutex, portMAX_DELAY);
+    deviceListView.open(filter, deviceListView.sort(), MANUFACTURER_ANY);
+    deviceListOpen = true;
+    xSemaphoreGive(tableMutex);
+
+    uiScreen = SCREEN_LIST;
+}
 
-            // Display visible lines
-            while (index < alertDevicesList.length() && linesDisplayed < 8) {
-                int nextIndex = alertDevicesList.indexOf('\n', index);
-                if (nextIndex == -1) nextIndex = alertDevicesList.length();
-                String line = alertDevicesList.substring(index, nextIndex);
-
-                // Split the line into name and details
-                int detailsStart = line.indexOf(" (");
-                String deviceName = line.substring(0, detailsStart);
-                String deviceDetails = line.substring(detailsStart);
-
-                tft.setTextColor(TFT_WHITE, TFT_RED);
-                tft.setTextSize(2);
-                tft.setCursor(13, y);
-                tft.print(deviceName);
-
-                tft.setTextColor(TFT_YELLOW, TFT_RED);
-                tft.setTextSize(1);
-                tft.setCursor(13, y + 16);
-                tft.print(deviceDetails);
-
-                y += lineHeight;
-                index = nextIndex + 1;
-                linesDisplayed++;
-            }
+void closeDeviceList() {
+    xSemaphoreTake(tableMutex, portMAX_DELAY);
+    deviceListOpen = false;
+    xSemaphoreGive(tableMutex);
 
-            // Draw scroll bar
-            int scrollBarHeight = SCREEN_HEIGHT - 40;
-            int scrollThumbHeight = max(20, scrollBarHeight / (maxScrollPosition + 1));
-            int scrollThumbY = 40 + (scrollPosition * (scrollBarHeight - scrollThumbHeight) / max(1, maxScrollPosition));
-            tft.drawRect(SCREEN_WIDTH - 10, 40, 10, scrollBarHeight, TFT_WHITE);
-            tft.fillRect(SCREEN_WIDTH - 8, scrollThumbY, 6, scrollThumbHeight, TFT_WHITE);
+    uiScreen = SCREEN_MAIN;
+    drawInterface();
+}
 
-            redraw = false;
-        }
+// One pass of the list screen; called from loop() while it is open
+void updateDeviceList() {
+    listScroll.update(millis());
+    int position = listScroll.offset() / LIST_ROW_HEIGHT;
+    if (position != listScreen.scrollPosition) {
+        listScreen.scrollPosition = position;
+        listScreen.redrawRows = true;
+    }
 
-        if (ts.touched()) {
-            TS_Point p = ts.getPoint();
-            int touchX = map(p.x, 200, 3800, 0, SCREEN_WIDTH);
-            int touchY = map(p.y, 200, 3800, 0, SCREEN_HEIGHT);
+    if (listScreen.redrawHeader) {
+        drawDeviceListHeader(listScreen.title, listScreen.alertStyle);
+        listScreen.redrawHeader = false;
+        listScreen.redrawRows = true;
+    }
 
-            if (touchX < SCREEN_WIDTH - 20) {
-                // Touch outside scroll bar, exit
-                break;
+    // New sightings refresh the rows at a calmer rate than scrolling does
+    if (millis() - listScreen.lastRowsDrawTime >= LIST_REFRESH_INTERVAL) {
+        xSemaphoreTake(tableMutex, portMAX_DELAY);
+        if (deviceListView.hasChanged()) listScreen.redrawRows = true;
+        xSemaphoreGive(tableMutex);
+    }
+
+    if (listScreen.redrawRows) {
+        drawDeviceListRows(listScreen.alertStyle);
+        listScreen.lastRowsDrawTime = millis();
+        listScreen.redrawRows = false;
+    }
+}
+
+// Rows follow a drag anywhere below the header and coast after a swipe. A
+// drag that starts on the scroll bar moves the thumb instead. Taps: the
+// header halves change the sort and filter, the scroll bar pages, and the
+// rows close the list.
+void handleListTouch(const TouchEvent& event) {
+    int pageHeight = LIST_VISIBLE_ROWS * LIST_ROW_HEIGHT;
+    switch (event.type) {
+        case TOUCH_DOWN:
+            listScreen.caughtFling = listScroll.coasting();
+            listScreen.thumbDrag = event.x >= LIST_SCROLLBAR_X;
+            listScreen.thumbDragOffset = listScroll.offset();
+            listScroll.stop();
+            break;
+
+        case TOUCH_DRAG:
+            if (event.startY < LIST_TOP) break;
+            if (listScreen.thumbDrag) {
+                // The thumb travels the bar's height for the whole range
+                listScroll.scrollTo(listScreen.thumbDragOffset +
+                                    (event.y - event.startY) * listScroll.range() / (SCREEN_HEIGHT - LIST_TOP));
             } else {
-                // Touch on scroll bar, scroll
-                int newScrollPosition = map(touchY, 40, SCREEN_HEIGHT - 20, 0, maxScrollPosition);
-                if (newScrollPosition != scrollPosition) {
-                    scrollPosition = constrain(newScrollPosition, 0, maxScrollPosition);
-                    redraw = true;
+                listScroll.drag(event.dy);
+            }
+            break;
+
+        case TOUCH_SWIPE:
+            if (event.startY < LIST_TOP || listScreen.thumbDrag) break;
+            if (abs(event.vx) > 2 * abs(event.vy)) {
+                closeDeviceList(); // Sideways swipe: back
+            } else {
+                listScroll.fling(event.vy, millis());
+            }
+            break;
+
+        case TOUCH_TAP:
+            if (event.y < LIST_TOP) {
+                // Header: left half cycles the sort order, right half the manufacturer filter
+                xSemaphoreTake(tableMutex, portMAX_DELAY);
+                if (event.x < SCREEN_WIDTH / 2) {
+                    deviceListView.setSort((ListSort)((deviceListView.sort() + 1) % SORT_COUNT));
+                } else {
+                    deviceListView.setManufacturerFilter(deviceListView.nextManufacturer(deviceListView.manufacturer()));
                 }
+                xSemaphoreGive(tableMutex);
+                listScroll.reset();
+                listScreen.redrawHeader = true;
+            } else if (event.x >= LIST_SCROLLBAR_X) {
+                // Scroll bar: page towards the tap
+                int thumbY = LIST_TOP + (SCREEN_HEIGHT - LIST_TOP) * listScroll.offset() / max(1, (int)listScroll.range());
+                listScroll.scrollBy(event.y < thumbY ? -pageHeight : pageHeight);
+            } else if (!listScreen.caughtFling) {
+                closeDeviceList();
             }
-            delay(50); // Shorter debounce time
-        }
+            break;
 
-        // Add a small delay to prevent watchdog timer issues
-        delay(10);
+        case TOUCH_UP:
+            break;
     }
-
-    drawInterface();
 }
 
-void displayDeviceList(String devices, String title) {
-    int scrollPosition = 0;
-    int maxScrollPosition = 0;
-    bool redraw = true;
-
-    // Count total lines and calculate max scroll position
-    int totalLines = 0;
-    for (int i = 0; i < devices.length(); i++) {
-        if (devices[i] == '\n') totalLines++;
-    }
-    maxScrollPosition = max(0, totalLines - 8); // Assuming 8 lines fit on screen
+// Diagnostics screen: timing histograms, heap, stacks and scan duty. Values
+// written by the scan and radio tasks are read without locks; a refresh may
+// be a sample out of step.
+#define DIAG_REFRESH_INTERVAL 1000 // ms
+#define DIAG_TOP              30
+#define DIAG_LINE_HEIGHT      12
+#define DIAG_LINE_LENGTH      128 // The longest line with every counter at its widest; the panel clips it
 
-    while (true) {
-        if (redraw) {
-            tft.fillScreen(BT_BACKGROUND);
-            tft.setTextColor(BT_BLUE, BT_BACKGROUND);
-            tft.setTextDatum(MC_DATUM);
-            tft.drawString(title, SCREEN_WIDTH / 2, 15, TITLE_FONT);
-
-            tft.setTextDatum(TL_DATUM);
-            tft.setTextWrap(false, false);
-
-            int y = 40;
-            int lineHeight = 24; // Adjust based on your font size
-            int linesDisplayed = 0;
-            int index = 0;
-
-            // Find starting position for scrolling
-            for (int i = 0; i < scrollPosition; i++) {
-                index = devices.indexOf('\n', index) + 1;
-                if (index == 0) break;
-            }
+unsigned long lastDiagnosticsDrawTime = 0;
 
-            // Display visible lines
-            while (index < devices.length() && linesDisplayed < 8) {
-                int nextIndex = devices.indexOf('\n', index);
-                if (nextIndex == -1) nextIndex = devices.length();
-                String line = devices.substring(index, nextIndex);
+void displayDiagnostics() {
+    uiScreen = SCREEN_DIAGNOSTICS;
+    tft.fillScreen(BT_BACKGROUND);
+    tft.setTextColor(BT_BLUE, BT_BACKGROUND);
+    tft.setTextDatum(MC_DATUM);
+    tft.drawString("Diagnostics", SCREEN_WIDTH / 2, 15, TITLE_FONT);
+    lastDiagnosticsDrawTime = 0;
+}
 
-                tft.setTextColor(BT_WHITE, BT_BACKGROUND);
-                tft.setTextSize(1);
-                tft.setCursor(13, y);
-                tft.print(line);
+void closeDiagnostics() {
+    uiScreen = SCREEN_MAIN;
+    drawInterface();
+}
 
-                y += lineHeight;
-                index = nextIndex + 1;
-                linesDisplayed++;
-            }
+void updateDiagnostics() {
+    if (lastDiagnosticsDrawTime != 0 && millis() - lastDiagnosticsDrawTime < DIAG_REFRESH_INTERVAL) return;
+    lastDiagnosticsDrawTime = millis();
+
+    const ScanSchedulerStats& scan = scanScheduler.stats();
+    ScanSettings settings = scanScheduler.settings();
+    uint32_t mhz = ESP.getCpuFreqMHz();
+    const TouchGestureStats& touch = touchGestures.stats();
+    char lines[10 + PERF_HISTOGRAM_COUNT][DIAG_LINE_LENGTH];
+    int count = 0;
+    snprintf(lines[count++], sizeof(lines[0]), "Uptime %lu s  Adverts %lu/s  Total %lu",
+             millis() / 1000, (unsigned long)scan.advertRate, (unsigned long)perfAdvert.count);
+    snprintf(lines[count++], sizeof(lines[0]), "Heap free %lu  min %lu  largest %lu",
+             (unsigned long)ESP.getFreeHeap(), (unsigned long)ESP.getMinFreeHeap(), (unsigned long)ESP.getMaxAllocHeap());
+    snprintf(lines[count++], sizeof(lines[0]), "Stack free: loop %lu  scan %lu  radio %lu",
+             (unsigned long)uxTaskGetStackHighWaterMark(nullptr),
+             (unsigned long)uxTaskGetStackHighWaterMark(scanTaskHandle), (unsigned long)radioStackFree);
+    snprintf(lines[count++], sizeof(lines[0]), "Scan %u/%u ms %s  duty %lu%%  active %lu s",
+             settings.window, settings.interval, settings.active ? "active" : "passive",
+             (unsigned long)scan.dutyPercent(), scan.activeMillis / 1000);
+    snprintf(lines[count++], sizeof(lines[0]), "Changes %lu  throttle %lu  boost %lu  quiet %lu",
+             scan.changes, scan.throttles, scan.boosts, scan.quietSteps);
+    snprintf(lines[count++], sizeof(lines[0]), "Dropped: queue %lu  table %lu  capture %lu  log %lu",
+             (unsigned long)sightingQueue.droppedCount(), deviceTable.droppedCount(),
+             (unsigned long)capture.droppedCount(), logSuppressed);
+    snprintf(lines[count++], sizeof(lines[0]), "Touch: strokes %lu  taps %lu  drags %lu  swipes %lu",
+             touch.strokes, touch.taps, touch.drags, touch.swipes);
+    snprintf(lines[count++], sizeof(lines[0]), "Collector: node %u  sent %lu  records %lu  lost %lu",
+             collectorEnabled ? nodeId : 0, nodeReportStats.datagrams, nodeReportStats.records,
+             nodeReportStats.sendFailed);
+    snprintf(lines[count++], sizeof(lines[0]), "%-7s %8s %7s %7s %7s %7s", "us", "count", "mean", "p50", "p99", "max");
+    for (size_t i = 0; i < PERF_HISTOGRAM_COUNT; i++) {
+        const PerfHistogram& h = *perfHistograms[i];
+        snprintf(lines[count++], sizeof(lines[0]), "%-7s %8lu %7lu %7lu %7lu %7lu", h.name, (unsigned long)h.count,
+                 (unsigned long)(h.meanCycles() / mhz), (unsigned long)(h.percentileCycles(50) / mhz),
+                 (unsigned long)(h.percentileCycles(99) / mhz), (unsigned long)(h.maxCycles / mhz));
+    }
+    snprintf(lines[count++], sizeof(lines[0]), "Tap to close, send 'p' on serial for JSON");
 
-            // Draw scroll bar
-            int scrollBarHeight = SCREEN_HEIGHT - 40;
-            int scrollThumbHeight = max(20, scrollBarHeight / (maxScrollPosition + 1));
-            int scrollThumbY = 40 + (scrollPosition * (scrollBarHeight - scrollThumbHeight) / max(1, maxScrollPosition));
-            tft.drawRect(SCREEN_WIDTH - 10, 40, 10, scrollBarHeight, BT_LIGHT_BLUE);
-            tft.fillRect(SCREEN_WIDTH - 8, scrollThumbY, 6, scrollThumbHeight, BT_LIGHT_BLUE);
+    tft.setTextColor(BT_WHITE, BT_BACKGROUND);
+    tft.setTextDatum(TL_DATUM);
+    tft.setTextSize(1);
+    tft.setTextPadding(SCREEN_WIDTH - 26); // Clears what a longer previous line left
+    for (int i = 0; i < count; i++) {
+        tft.drawString(lines[i], 13, DIAG_TOP + i * DIAG_LINE_HEIGHT, 1);
+    }
+    tft.setTextPadding(0);
+}
 
-            redraw = false;
+// One line of JSON with every counter; durations in cycles at cpuMhz
+void dumpPerfCounters(Print& out) {
+    const ScanSchedulerStats& scan = scanScheduler.stats();
+    out.printf("PERF {\"uptime\":%lu,\"cpuMhz\":%lu,", millis(), (unsigned long)ESP.getCpuFreqMHz());
+    out.printf("\"heap\":{\"free\":%lu,\"min\":%lu,\"largest\":%lu},",
+               (unsigned long)ESP.getFreeHeap(), (unsigned long)ESP.getMinFreeHeap(), (unsigned long)ESP.getMaxAllocHeap());
+    out.printf("\"stackFree\":{\"loop\":%lu,\"scan\":%lu,\"radio\":%lu},",
+               (unsigned long)uxTaskGetStackHighWaterMark(nullptr),
+               (unsigned long)uxTaskGetStackHighWaterMark(scanTaskHandle), (unsigned long)radioStackFree);
+    out.printf("\"adverts\":{\"rate\":%lu,\"queueDrops\":%lu,\"tableDrops\":%lu},",
+               (unsigned long)scan.advertRate, (unsigned long)sightingQueue.droppedCount(), deviceTable.droppedCount());
+    out.printf("\"distinct\":{\"hour\":%lu,\"day\":%lu,\"week\":%lu},",
+               (unsigned long)distinctCounts[DISTINCT_HOUR], (unsigned long)distinctCounts[DISTINCT_DAY],
+               (unsigned long)distinctCounts[DISTINCT_WEEK]);
+    out.printf("\"followers\":{\"tracked\":%lu,\"moves\":%lu,\"found\":%lu,\"evicted\":%lu},",
+               (unsigned long)followers.size(), followers.moveTotal(), followers.foundTotal(), followers.evictions());
+    out.printf("\"scan\":{\"level\":%u,\"active\":%s,\"duty\":%lu,\"activeMs\":%lu,\"levelMs\":[",
+               scanScheduler.level(), scanScheduler.scanningActively() ? "true" : "false",
+               (unsigned long)scan.dutyPercent(), scan.activeMillis);
+    for (int i = 0; i < SCAN_LEVEL_COUNT; i++) {
+        out.printf(i == 0 ? "%lu" : ",%lu", scan.levelMillis[i]);
+    }
+    out.printf("],\"changes\":%lu,\"throttles\":%lu,\"boosts\":%lu,\"quietSteps\":%lu,\"activeBursts\":%lu},",
+               scan.changes, scan.throttles, scan.boosts, scan.quietSteps, scan.activeBursts);
+    out.printf("\"capture\":{\"frames\":%lu,\"bytes\":%lu,\"dropped\":%lu},\"logSuppressed\":%lu,",
+               capture.frames(), capture.bytes(), (unsigned long)capture.droppedCount(), logSuppressed);
+    const TouchGestureStats& touch = touchGestures.stats();
+    out.printf("\"touch\":{\"strokes\":%lu,\"taps\":%lu,\"drags\":%lu,\"swipes\":%lu},",
+               touch.strokes, touch.taps, touch.drags, touch.swipes);
+    out.printf("\"collector\":{\"enabled\":%s,\"node\":%u,\"reports\":%lu,\"datagrams\":%lu,\"records\":%lu,"
+               "\"deferred\":%lu,\"sendFailed\":%lu},",
+               collectorEnabled ? "true" : "false", nodeId, nodeReportStats.reports, nodeReportStats.datagrams,
+               nodeReportStats.records, nodeReportStats.deferred, nodeReportStats.sendFailed);
+    out.print("\"timers\":{");
+    for (size_t i = 0; i < PERF_HISTOGRAM_COUNT; i++) {
+        const PerfHistogram& h = *perfHistograms[i];
+        out.printf("%s\"%s\":{\"count\":%lu,\"mean\":%lu,\"max\":%lu,\"buckets\":[", i == 0 ? "" : ",", h.name,
+                   (unsigned long)h.count, (unsigned long)h.meanCycles(), (unsigned long)h.maxCycles);
+        for (int b = 0; b < PERF_BUCKETS; b++) {
+            out.printf(b == 0 ? "%lu" : ",%lu", (unsigned long)h.buckets[b]);
         }
+        out.print("]}");
+    }
+    out.println("}}");
+}
 
-        if (ts.touched()) {
-            TS_Point p = ts.getPoint();
-            int touchX = map(p.x, 200, 3800, 0, SCREEN_WIDTH);
-            int touchY = map(p.y, 200, 3800, 0, SCREEN_HEIGHT);
+// Capture writer: frames queued records onto the serial port, switching it
+// to CAPTURE_BAUD for the length of a capture. The native build calls this
+// directly.
+void serviceCapture() {
+    if (capture.capturing() && !captureBaudActive) {
+        Serial.printf("Capture starting at %lu baud\n", (unsigned long)CAPTURE_BAUD);
+        Serial.flush();
+        Serial.updateBaudRate(CAPTURE_BAUD);
+        captureBaudActive = true;
+    }
+    capture.drain(Serial);
+    if (!capture.capturing() && captureBaudActive) {
+        Serial.flush();
+        Serial.updateBaudRate(SERIAL_BAUD);
+        captureBaudActive = false;
+        Serial.printf("Capture stopped: %lu frames, %lu bytes, %lu dropped\n",
+                      capture.frames(), capture.bytes(), (unsigned long)capture.droppedCount());
+    }
+}
 
-            if (touchX < SCREEN_WIDTH - 20) {
-                // Touch outside scroll bar, exit
-                break;
-            } else {
-                // Touch on scroll bar, scroll
-                int newScrollPosition = map(touchY, 40, SCREEN_HEIGHT - 20, 0, maxScrollPosition);
-                if (newScrollPosition != scrollPosition) {
-                    scrollPosition = constrain(newScrollPosition, 0, maxScrollPosition);
-                    redraw = true;
-                }
-            }
-            delay(50); // Shorter debounce time
-        }
+void captureTask(void* parameter) {
+    (void)parameter;
+    while (true) {
+        serviceCapture();
+        vTaskDelay(pdMS_TO_TICKS(CAPTURE_WRITE_PERIOD));
+    }
+}
 
-        // Add a small delay to prevent watchdog timer issues
-        delay(10);
+void startCapture() {
+    if (captureTaskHandle == nullptr) {
+        xTaskCreatePinnedToCore(captureTask, "capture", CAPTURE_TASK_STACK, nullptr, CAPTURE_TASK_PRIORITY,
+                                &captureTaskHandle, CAPTURE_TASK_CORE);
     }
+    capture.start(CAPTURE_BAUD);
+}
 
-    drawInterface();
-}
\ No newline at end of file
+// UI loop: single-character serial commands. While a capture runs the port
+// belongs to the writer, so only 's' is accepted.
+void serviceSerialCommands() {
+    while (Serial.available() > 0) {
+        char command = Serial.read();
+        if (capture.capturing()) {
+            if (command == 's') capture.stop();
+        } else if (command == 'p') {
+            dumpPerfCounters(Serial);
+        } else if (command == 'c') {
+            startCapture();
+        }
+    }
+}
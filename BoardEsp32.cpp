@@ -0,0 +1,329 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <XPT2046_Touchscreen.h>
+#include <BLEDevice.h>
+#include <BLEScan.h>
+#include <BLEAdvertisedDevice.h>
+#include <esp_gap_ble_api.h>
+#include "DeviceTable.h"
+#include "Hal.h"
+
+// CYD board: Bluedroid scanning and the XPT2046 resistive touch panel
+
+// The CYD touch uses some non-default SPI pins
+#define XPT2046_IRQ 36
+#define XPT2046_MOSI 32
+#define XPT2046_MISO 39
+#define XPT2046_CLK 25
+#define XPT2046_CS 33
+
+// Raw panel readings at the screen edges
+#define TOUCH_RAW_MIN 200
+#define TOUCH_RAW_MAX 3800
+
+// Touch sampling. The pen interrupt wakes the touch task, which reads the
+// panel at a fixed rate until the stroke ends and then sleeps again.
+#define TOUCH_SAMPLE_INTERVAL 10 // ms between reads while pressed
+#define TOUCH_PRESS_READS     2  // Consecutive pressed reads that start a stroke
+#define TOUCH_RELEASE_READS   3  // Consecutive released reads that end one
+#define TOUCH_QUEUE_LENGTH    32 // Samples, about a third of a second of dragging
+#define TOUCH_TASK_STACK      2048
+#define TOUCH_TASK_PRIORITY   2  // Above the UI loop, so redraws do not delay reads
+#define TOUCH_TASK_CORE       1
+
+// Bounded-memory scanning. BLEScan builds a BLEAdvertisedDevice on the heap
+// for every advert, copies it into onResult and, without duplicates, keeps
+// one per address until the next scan; over days that churn fragments the
+// heap the Bluedroid stack allocates from, until its own allocations fail.
+// With BOUNDED_MEMORY the scan source drives the GAP API itself and passes
+// on the stack's scan result buffer, so an advert costs no allocation. Set
+// it to 0 to scan through BLEScan instead.
+#ifndef BOUNDED_MEMORY
+#define BOUNDED_MEMORY 1
+#endif
+
+#if BOUNDED_MEMORY
+
+#define SCAN_COMMAND_TIMEOUT 200 // ms to wait for the stack to confirm a scan command
+#define SCAN_START_ATTEMPTS  3
+
+// What the scan source knows of the controller
+enum ScanState {
+    SCAN_IDLE,
+    SCAN_UNCERTAIN, // A start or stop went unconfirmed; it may be scanning
+    SCAN_RUNNING
+};
+
+class Esp32ScanSource : public ScanSource {
+public:
+    Esp32ScanSource()
+        : handler(nullptr), done(nullptr), awaited(-1), status(ESP_BT_STATUS_SUCCESS), state(SCAN_IDLE) {
+        memset(&params, 0, sizeof(params));
+    }
+
+    void begin(AdvertHandler advertHandler, bool wantDuplicates) {
+        handler = advertHandler;
+        done = xSemaphoreCreateBinary();
+        instance = this;
+        BLEDevice::init("");
+        BLEDevice::setCustomGapHandler(onGapEvent); // BLEScan is never created, so it sees nothing
+        params.own_addr_type = BLE_ADDR_TYPE_PUBLIC;
+        params.scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL;
+        // The controller drops repeats itself, so no per-address state is kept here
+        params.scan_duplicate = wantDuplicates ? BLE_SCAN_DUPLICATE_DISABLE : BLE_SCAN_DUPLICATE_ENABLE;
+    }
+
+    void configure(const ScanSettings& settings) {
+        params.scan_type = settings.active ? BLE_SCAN_TYPE_ACTIVE : BLE_SCAN_TYPE_PASSIVE;
+        params.scan_interval = (uint16_t)(settings.interval / 0.625); // Units of 0.625 ms, as BLEScan
+        params.scan_window = (uint16_t)(settings.window / 0.625);
+    }
+
+    // The stack runs scan commands asynchronously, so each step waits for
+    // its completion event before the next: parameters are only taken while
+    // stopped, and scanning starts once they are. A start that fails or goes
+    // unconfirmed is tried again. Only the scan task calls start and stop.
+    bool start() {
+        if (state == SCAN_RUNNING) return true;
+        for (uint8_t attempt = 0; attempt < SCAN_START_ATTEMPTS; attempt++) {
+            // A start confirmed after its wait timed out left the radio
+            // scanning, and the controller refuses parameters until it stops
+            if (state == SCAN_UNCERTAIN && !halt()) continue;
+            if (!command(ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT,
+                         [this] { return esp_ble_gap_set_scan_params(&params); })) {
+                continue;
+            }
+            state = SCAN_UNCERTAIN;
+            if (command(ESP_GAP_BLE_SCAN_START_COMPLETE_EVT, [] { return esp_ble_gap_start_scanning(0); })) {
+                state = SCAN_RUNNING; // Runs until stopped
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool stop() {
+        return state == SCAN_IDLE || halt();
+    }
+
+    int lastStatus() const { return (int)status; }
+
+private:
+    AdvertHandler handler;
+    esp_ble_scan_params_t params;
+    SemaphoreHandle_t done;          // Given by the awaited completion event
+    volatile int awaited;            // Completion event being waited for, or -1
+    volatile esp_bt_status_t status; // Its status
+    ScanState state;
+    static Esp32ScanSource* instance;
+
+    // Any answer from the stack settles the state: it stopped, or it refused
+    // because it wasn't scanning. Only a timeout leaves it uncertain.
+    bool halt() {
+        bool stopped = command(ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT, [] { return esp_ble_gap_stop_scanning(); });
+        state = stopped || status != ESP_BT_STATUS_TIMEOUT ? SCAN_IDLE : SCAN_UNCERTAIN;
+        return stopped;
+    }
+
+    // Issues a scan command and waits for the stack to complete it. The
+    // awaited event is set first, as the completion can beat issue()'s
+    // return, and only it gives done, so a completion whose wait already
+    // timed out is not taken for the next command's.
+    template <typename Issue>
+    bool command(esp_gap_ble_cb_event_t completion, Issue issue) {
+        xSemaphoreTake(done, 0); // A completion that came just as its wait timed out
+        awaited = completion;
+        esp_err_t err = issue();
+        bool completed = err == ESP_OK && xSemaphoreTake(done, pdMS_TO_TICKS(SCAN_COMMAND_TIMEOUT)) == pdTRUE;
+        awaited = -1;
+        if (err != ESP_OK) status = ESP_BT_STATUS_FAIL;
+        else if (!completed) status = ESP_BT_STATUS_TIMEOUT;
+        return completed && status == ESP_BT_STATUS_SUCCESS;
+    }
+
+    void complete(esp_gap_ble_cb_event_t event, esp_bt_status_t eventStatus) {
+        if (event != awaited) return;
+        status = eventStatus;
+        xSemaphoreGive(done);
+    }
+
+    // Runs on the Bluedroid task. The advert points into the stack's own
+    // event, which stays valid for the call.
+    static void onGapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+        Esp32ScanSource* source = instance;
+        switch (event) {
+        case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
+            source->complete(event, param->scan_param_cmpl.status);
+            return;
+        case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
+            source->complete(event, param->scan_start_cmpl.status);
+            return;
+        case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
+            source->complete(event, param->scan_stop_cmpl.status);
+            return;
+        default:
+            break;
+        }
+        if (event != ESP_GAP_BLE_SCAN_RESULT_EVT || param->scan_rst.search_evt != ESP_GAP_SEARCH_INQ_RES_EVT) return;
+        Advert advert;
+        advert.mac = packMac(param->scan_rst.bda);
+        advert.rssi = (int8_t)param->scan_rst.rssi;
+        // The RPA types carry the identity the controller resolved, public or random
+        advert.randomAddress = param->scan_rst.ble_addr_type == BLE_ADDR_TYPE_RANDOM ||
+                               param->scan_rst.ble_addr_type == BLE_ADDR_TYPE_RPA_RANDOM;
+        advert.payload = param->scan_rst.ble_adv;
+        advert.payloadLength = param->scan_rst.adv_data_len + param->scan_rst.scan_rsp_len;
+        source->handler(advert);
+    }
+};
+
+Esp32ScanSource* Esp32ScanSource::instance = nullptr;
+
+#else
+
+class Esp32ScanSource : public ScanSource, public BLEAdvertisedDeviceCallbacks {
+public:
+    Esp32ScanSource() : handler(nullptr), scan(nullptr) {}
+
+    void begin(AdvertHandler advertHandler, bool wantDuplicates) {
+        handler = advertHandler;
+        BLEDevice::init("");
+        scan = BLEDevice::getScan();
+        scan->setAdvertisedDeviceCallbacks(this, wantDuplicates, false); // The sketch parses the payload itself
+    }
+
+    void configure(const ScanSettings& settings) {
+        scan->setActiveScan(settings.active);
+        scan->setInterval(settings.interval);
+        scan->setWindow(settings.window);
+    }
+
+    bool start() {
+        return scan->start(0, nullptr, false); // Runs until stopped
+    }
+
+    bool stop() {
+        scan->stop();
+        return true;
+    }
+
+    // Runs on the Bluedroid task. Only the raw payload is passed on; the
+    // sketch decodes it in place rather than through the String getters.
+    void onResult(BLEAdvertisedDevice advertisedDevice) {
+        Advert advert;
+        advert.mac = packMac(*advertisedDevice.getAddress().getNative());
+        advert.rssi = advertisedDevice.getRSSI();
+        esp_ble_addr_type_t type = advertisedDevice.getAddressType(); // RPA types carry the resolved identity
+        advert.randomAddress = type == BLE_ADDR_TYPE_RANDOM || type == BLE_ADDR_TYPE_RPA_RANDOM;
+        advert.payload = advertisedDevice.getPayload();
+        advert.payloadLength = advertisedDevice.getPayloadLength();
+        handler(advert);
+    }
+
+private:
+    AdvertHandler handler;
+    BLEScan* scan;
+};
+
+#endif
+
+class Esp32TouchInput : public TouchInput {
+public:
+    // No IRQ pin for the library: the driver handles the pen interrupt itself
+    Esp32TouchInput() : spi(VSPI), ts(XPT2046_CS), queue(nullptr), task(nullptr), sampling(false) {}
+
+    void begin() {
+        spi.begin(XPT2046_CLK, XPT2046_MISO, XPT2046_MOSI, XPT2046_CS);
+        ts.begin(spi);
+        ts.setRotation(1);
+        queue = xQueueCreate(TOUCH_QUEUE_LENGTH, sizeof(TouchSample));
+        xTaskCreatePinnedToCore(touchTask, "touch", TOUCH_TASK_STACK, this, TOUCH_TASK_PRIORITY, &task, TOUCH_TASK_CORE);
+        instance = this;
+        pinMode(XPT2046_IRQ, INPUT);
+        attachInterrupt(digitalPinToInterrupt(XPT2046_IRQ), onPenInterrupt, FALLING);
+    }
+
+    bool read(TouchSample& sample) {
+        return queue != nullptr && xQueueReceive(queue, &sample, 0) == pdTRUE;
+    }
+
+private:
+    SPIClass spi;
+    XPT2046_Touchscreen ts;
+    QueueHandle_t queue;
+    TaskHandle_t task;
+    volatile bool sampling; // Reads pulse the pen line, so its edges are ignored meanwhile
+    static Esp32TouchInput* instance;
+
+    static void IRAM_ATTR onPenInterrupt() {
+        if (instance == nullptr || instance->sampling) return;
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(instance->task, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+
+    static void touchTask(void* parameter) {
+        Esp32TouchInput* input = (Esp32TouchInput*)parameter;
+        while (true) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            input->sampling = true;
+            input->sampleStroke();
+            input->sampling = false;
+            // A press that landed while the last stroke was ending left no edge
+            if (digitalRead(XPT2046_IRQ) == LOW) xTaskNotifyGive(input->task);
+        }
+    }
+
+    // Reads the panel until the finger lifts. A stroke starts after a few
+    // consistent pressed reads and ends after a few released ones, so
+    // bounces never reach the queue. A wake that finds no press just returns.
+    void sampleStroke() {
+        uint8_t pressedReads = 0;
+        uint8_t releasedReads = 0;
+        bool stroke = false;
+        TickType_t wake = xTaskGetTickCount();
+        while (true) {
+            TouchSample sample;
+            sample.pressed = ts.touched();
+            sample.micros = micros();
+            if (sample.pressed) {
+                TS_Point p = ts.getPoint();
+                sample.point.x = constrain(map(p.x, TOUCH_RAW_MIN, TOUCH_RAW_MAX, 0, SCREEN_WIDTH), 0, SCREEN_WIDTH - 1);
+                sample.point.y = constrain(map(p.y, TOUCH_RAW_MIN, TOUCH_RAW_MAX, 0, SCREEN_HEIGHT), 0, SCREEN_HEIGHT - 1);
+                releasedReads = 0;
+                if (stroke || ++pressedReads >= TOUCH_PRESS_READS) {
+                    stroke = true;
+                    push(sample);
+                }
+            } else {
+                pressedReads = 0;
+                if (++releasedReads >= TOUCH_RELEASE_READS) {
+                    if (stroke) push(sample);
+                    return;
+                }
+            }
+            vTaskDelayUntil(&wake, pdMS_TO_TICKS(TOUCH_SAMPLE_INTERVAL));
+        }
+    }
+
+    // A full queue loses its oldest sample, so the latest position and the
+    // release still get through
+    void push(const TouchSample& sample) {
+        if (xQueueSend(queue, &sample, 0) == pdTRUE) return;
+        TouchSample oldest;
+        xQueueReceive(queue, &oldest, 0);
+        xQueueSend(queue, &sample, 0);
+    }
+};
+
+Esp32TouchInput* Esp32TouchInput::instance = nullptr;
+
+ScanSource& boardScanSource() {
+    static Esp32ScanSource source;
+    return source;
+}
+
+TouchInput& boardTouchInput() {
+    static Esp32TouchInput input;
+    return input;
+}
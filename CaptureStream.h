@@ -0,0 +1,210 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include "Hal.h"
+#include "SightingQueue.h"
+
+// Binary capture of every advert for offline analysis. The radio task copies
+// each advert into a ring (no formatting, no serial I/O); a background writer
+// frames the records and writes them to the serial port. tools/capture_decode.py
+// turns the stream into a replay trace CSV or a btsnoop file for Wireshark.
+//
+// Frame: COBS-encoded body followed by a 0x00 delimiter, so a reader can join
+// mid-stream and resynchronise at the next zero. A capture starts with a lone
+// delimiter and a START record. Body, little endian:
+//
+//   u8  type        CAPTURE_RECORD_*
+//   u32 sequence    One counter across all records; a gap is a dropped record
+//   u32 micros      Device clock when the record was taken
+//   ...             Type-specific fields
+//   u16 crc         CRC-16/CCITT-FALSE of everything before it
+//
+// START:  u8 version, u32 baud
+// ADVERT: u8 mac[6] (first octet first), i8 rssi, u8 address type
+//         (0 public, 1 random), u8 length, payload[length]
+// TEXT:   UTF-8 log line, unterminated
+
+#define CAPTURE_VERSION       1
+#define CAPTURE_RECORD_START  0
+#define CAPTURE_RECORD_ADVERT 1
+#define CAPTURE_RECORD_TEXT   2
+
+#define CAPTURE_MAX_PAYLOAD 62  // Advertising data plus scan response
+#define CAPTURE_MAX_TEXT    120 // Including the terminator
+#define CAPTURE_QUEUE_SIZE  64  // Adverts buffered for the writer, a power of two
+#define CAPTURE_TEXT_QUEUE  16  // Log lines buffered for the writer, a power of two
+#define CAPTURE_HEADER      9   // type, sequence, micros
+#define CAPTURE_MAX_BODY    (CAPTURE_HEADER + CAPTURE_MAX_TEXT + 2) // A full log line is the longest record
+#define CAPTURE_MAX_FRAME   (CAPTURE_MAX_BODY + CAPTURE_MAX_BODY / 254 + 2) // COBS overhead and delimiter
+
+inline uint16_t crc16Ccitt(const uint8_t* data, size_t length, uint16_t crc = 0xFFFF) {
+    for (size_t i = 0; i < length; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Consistent overhead byte stuffing: removes every zero from the data, at a
+// cost of one byte per 254. Returns the encoded length; out needs
+// length + length / 254 + 1 bytes.
+inline size_t cobsEncode(const uint8_t* data, size_t length, uint8_t* out) {
+    size_t codeAt = 0;
+    size_t written = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0) {
+            out[written++] = data[i];
+            code++;
+        }
+        if (data[i] == 0 || code == 0xFF) {
+            out[codeAt] = code;
+            codeAt = written++;
+            code = 1;
+        }
+    }
+    out[codeAt] = code;
+    return written;
+}
+
+// Appends the CRC to body (which needs two spare bytes), encodes it and adds
+// the delimiter. Returns the frame length.
+inline size_t encodeCaptureFrame(uint8_t* body, size_t length, uint8_t* frame) {
+    uint16_t crc = crc16Ccitt(body, length);
+    body[length++] = crc & 0xFF;
+    body[length++] = crc >> 8;
+    size_t encoded = cobsEncode(body, length, frame);
+    frame[encoded++] = 0;
+    return encoded;
+}
+
+struct CaptureAdvert {
+    uint32_t sequence;
+    uint32_t micros;
+    uint64_t mac;
+    int8_t rssi;
+    bool randomAddress;
+    uint8_t length;
+    uint8_t payload[CAPTURE_MAX_PAYLOAD];
+};
+
+struct CaptureText {
+    uint32_t sequence;
+    uint32_t micros;
+    char text[CAPTURE_MAX_TEXT];
+};
+
+class CaptureWriter {
+public:
+    CaptureWriter()
+        : active(false), sequence(0), startPending(false), startSequence(0), startMicros(0), baud(0),
+          frameCount(0), byteCount(0) {}
+
+    // Producers check this before copying anything
+    bool capturing() const { return active.load(std::memory_order_relaxed); }
+
+    void start(uint32_t serialBaud) {
+        baud = serialBaud;
+        startSequence = sequence.fetch_add(1, std::memory_order_relaxed);
+        startMicros = micros();
+        startPending.store(true, std::memory_order_relaxed);
+        active.store(true, std::memory_order_release);
+    }
+
+    void stop() { active.store(false, std::memory_order_release); }
+
+    // Radio task. Copies the advert; a full ring drops it, which the
+    // sequence gap shows.
+    void captureAdvert(const Advert& advert) {
+        CaptureAdvert record;
+        record.sequence = sequence.fetch_add(1, std::memory_order_relaxed);
+        record.micros = micros();
+        record.mac = advert.mac;
+        record.rssi = advert.rssi;
+        record.randomAddress = advert.randomAddress;
+        record.length = advert.payloadLength < CAPTURE_MAX_PAYLOAD ? advert.payloadLength : CAPTURE_MAX_PAYLOAD;
+        if (record.length > 0) memcpy(record.payload, advert.payload, record.length);
+        adverts.push(record);
+    }
+
+    // Scan task: a log line carried in the stream while it owns the port
+    void captureText(const char* text) {
+        CaptureText record;
+        record.sequence = sequence.fetch_add(1, std::memory_order_relaxed);
+        record.micros = micros();
+        strncpy(record.text, text, CAPTURE_MAX_TEXT - 1);
+        record.text[CAPTURE_MAX_TEXT - 1] = '\0';
+        texts.push(record);
+    }
+
+    // Writer task: frames and writes everything queued. Blocks only in out.
+    void drain(Print& out) {
+        uint8_t body[CAPTURE_MAX_BODY];
+        uint8_t frame[CAPTURE_MAX_FRAME];
+        if (active.load(std::memory_order_acquire) && startPending.exchange(false)) {
+            out.write((uint8_t)0); // Ends any text written before the capture
+            size_t length = header(body, CAPTURE_RECORD_START, startSequence, startMicros);
+            body[length++] = CAPTURE_VERSION;
+            put32(body + length, baud);
+            length += 4;
+            emit(out, body, length, frame);
+        }
+        CaptureText text;
+        while (texts.pop(text)) {
+            size_t length = header(body, CAPTURE_RECORD_TEXT, text.sequence, text.micros);
+            size_t textLength = strnlen(text.text, CAPTURE_MAX_TEXT);
+            memcpy(body + length, text.text, textLength);
+            emit(out, body, length + textLength, frame);
+        }
+        CaptureAdvert advert;
+        while (adverts.pop(advert)) {
+            size_t length = header(body, CAPTURE_RECORD_ADVERT, advert.sequence, advert.micros);
+            for (int i = 0; i < 6; i++) body[length++] = (uint8_t)(advert.mac >> (40 - 8 * i));
+            body[length++] = (uint8_t)advert.rssi;
+            body[length++] = advert.randomAddress ? 1 : 0;
+            body[length++] = advert.length;
+            memcpy(body + length, advert.payload, advert.length);
+            emit(out, body, length + advert.length, frame);
+        }
+    }
+
+    unsigned long frames() const { return frameCount; }
+    unsigned long bytes() const { return byteCount; }
+    uint32_t droppedCount() const { return adverts.droppedCount() + texts.droppedCount(); }
+    uint32_t queued() const { return adverts.size(); }
+
+private:
+    std::atomic<bool> active;
+    std::atomic<uint32_t> sequence;
+    std::atomic<bool> startPending; // Set by start(), cleared by the writer
+    uint32_t startSequence;
+    uint32_t startMicros;
+    uint32_t baud;
+    unsigned long frameCount;
+    unsigned long byteCount;
+    SpscQueue<CaptureAdvert, CAPTURE_QUEUE_SIZE> adverts; // Radio task to writer
+    SpscQueue<CaptureText, CAPTURE_TEXT_QUEUE> texts;     // Scan task to writer
+
+    static void put32(uint8_t* out, uint32_t value) {
+        for (int i = 0; i < 4; i++) out[i] = (uint8_t)(value >> (8 * i));
+    }
+
+    static size_t header(uint8_t* body, uint8_t type, uint32_t recordSequence, uint32_t recordMicros) {
+        body[0] = type;
+        put32(body + 1, recordSequence);
+        put32(body + 5, recordMicros);
+        return CAPTURE_HEADER;
+    }
+
+    void emit(Print& out, uint8_t* body, size_t length, uint8_t* frame) {
+        size_t frameLength = encodeCaptureFrame(body, length, frame);
+        out.write(frame, frameLength);
+        frameCount++;
+        byteCount += frameLength;
+    }
+};
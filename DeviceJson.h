@@ -0,0 +1,195 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "DeviceTable.h"
+#include "OuiTable.h"
+#include "TieredHistory.h"
+
+// JSON for the web API, written straight from the device table and history
+// into caller-supplied buffers. Large documents are produced by cursors that
+// fill one chunk at a time, so a response never exists in memory as a whole.
+
+#define JSON_PIECE_LENGTH 320 // Longest single element (one device object, name fully escaped)
+
+// Copies s into out as a JSON string body, escaping as needed. Always
+// terminates out; returns the length written.
+inline size_t jsonEscape(const char* s, char* out, size_t length) {
+    size_t used = 0;
+    for (; *s != '\0'; s++) {
+        unsigned char c = (unsigned char)*s;
+        char escaped[7];
+        if (c == '"' || c == '\\') {
+            escaped[0] = '\\';
+            escaped[1] = (char)c;
+            escaped[2] = '\0';
+        } else if (c < 0x20) {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        } else {
+            escaped[0] = (char)c;
+            escaped[1] = '\0';
+        }
+        size_t n = strlen(escaped);
+        if (used + n >= length) break;
+        memcpy(out + used, escaped, n);
+        used += n;
+    }
+    out[used] = '\0';
+    return used;
+}
+
+// One device as a JSON object. Also used for streamed sighting events.
+inline size_t formatDeviceJson(char* out, size_t length, uint64_t mac, const char* name,
+                               uint16_t manufacturer, int rssi, uint8_t flags,
+                               uint32_t firstSeen, uint32_t lastSeen) {
+    char address[MAC_STRING_LENGTH];
+    char escapedName[DEVICE_NAME_LENGTH * 6];
+    char escapedManufacturer[64];
+    formatMac(mac, address);
+    jsonEscape(name, escapedName, sizeof(escapedName));
+    jsonEscape(manufacturerName(manufacturer), escapedManufacturer, sizeof(escapedManufacturer));
+    int n = snprintf(out, length,
+                     "{\"mac\":\"%s\",\"name\":\"%s\",\"manufacturer\":\"%s\",\"rssi\":%d,"
+                     "\"flags\":%u,\"firstSeen\":%lu,\"lastSeen\":%lu}",
+                     address, escapedName, escapedManufacturer, rssi, (unsigned)flags,
+                     (unsigned long)firstSeen, (unsigned long)lastSeen);
+    return n < 0 ? 0 : ((size_t)n < length ? (size_t)n : length - 1);
+}
+
+// The current element of a streamed document, kept across chunks when it
+// does not fit in the rest of the chunk
+struct JsonPiece {
+    char text[JSON_PIECE_LENGTH];
+    size_t length;
+    size_t offset;
+
+    JsonPiece() : length(0), offset(0) {}
+
+    bool empty() const { return offset >= length; }
+
+    void set(size_t n) {
+        length = n;
+        offset = 0;
+    }
+
+    size_t drain(char* out, size_t space) {
+        size_t n = length - offset;
+        if (n > space) n = space;
+        memcpy(out, text + offset, n);
+        offset += n;
+        return n;
+    }
+};
+
+// Streams a JSON array of the rows carrying all of filter's flags. The
+// cursor walks table rows by index, so if the table compacts between chunks
+// a row can be skipped or repeated; each row is always written whole.
+class DeviceJsonCursor {
+public:
+    explicit DeviceJsonCursor(uint8_t filter) : filter(filter), row(0), phase(START), written(0) {}
+
+    // Fills out with up to length bytes. Returns 0 once the document is done.
+    size_t fill(const DeviceTable& table, char* out, size_t length) {
+        size_t used = 0;
+        while (used < length) {
+            if (piece.empty() && !next(table)) break;
+            used += piece.drain(out + used, length - used);
+        }
+        return used;
+    }
+
+private:
+    enum Phase { START, ROWS, FINISHED };
+
+    bool next(const DeviceTable& table) {
+        if (phase == START) {
+            piece.text[0] = '[';
+            piece.set(1);
+            phase = ROWS;
+            return true;
+        }
+        if (phase == FINISHED) return false;
+
+        while (row < table.size() && !table.hasFlags(row, filter)) row++;
+        if (row >= table.size()) {
+            piece.text[0] = ']';
+            piece.set(1);
+            phase = FINISHED;
+            return true;
+        }
+
+        const DeviceRecord& record = table.at(row);
+        size_t n = 0;
+        if (written > 0) piece.text[n++] = ',';
+        n += formatDeviceJson(piece.text + n, sizeof(piece.text) - n, record.mac, table.name(row),
+                              record.manufacturer, (int)record.rssi, (uint8_t)record.flags,
+                              record.firstSeen, record.lastSeen);
+        piece.set(n);
+        row++;
+        written++;
+        return true;
+    }
+
+    uint8_t filter;
+    int row;
+    Phase phase;
+    int written;
+    JsonPiece piece;
+};
+
+// Streams one history tier, oldest sample first:
+// {"tier":"1h","total":[[min,max,avg],...],"usable":[...]}
+// A sample closed between chunks shifts the series by one point.
+class HistoryJsonCursor {
+public:
+    HistoryJsonCursor(HistoryTier tier, const char* label) : tier(tier), label(label), series(-1), points(0), age(0), started(false) {}
+
+    size_t fill(const TieredHistory& history, char* out, size_t length) {
+        size_t used = 0;
+        while (used < length) {
+            if (piece.empty() && !next(history)) break;
+            used += piece.drain(out + used, length - used);
+        }
+        return used;
+    }
+
+private:
+    bool next(const TieredHistory& history) {
+        static const char* const seriesNames[HISTORY_SERIES] = {"total", "usable"};
+        int n;
+        if (series < 0) {
+            n = snprintf(piece.text, sizeof(piece.text), "{\"tier\":\"%s\"", label);
+            series = 0;
+            started = false;
+        } else if (series >= HISTORY_SERIES) {
+            return false;
+        } else if (!started) {
+            n = snprintf(piece.text, sizeof(piece.text), ",\"%s\":[", seriesNames[series]);
+            points = history.count(tier);
+            age = points;
+            started = true;
+        } else if (age > 0) {
+            age--;
+            const HistoryPoint& point = history.get(tier, series, age);
+            n = snprintf(piece.text, sizeof(piece.text), "%s[%u,%u,%u]",
+                         age + 1 == points ? "" : ",",
+                         point.min, point.max, point.avg);
+        } else {
+            series++;
+            started = false;
+            strcpy(piece.text, series >= HISTORY_SERIES ? "]}" : "]");
+            n = strlen(piece.text);
+        }
+        piece.set(n);
+        return true;
+    }
+
+    HistoryTier tier;
+    const char* label;
+    int series; // -1 before the opening brace
+    uint16_t points; // Samples in the tier when the series started
+    uint16_t age;
+    bool started;
+    JsonPiece piece;
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "DeviceTable.h"
+#include "OuiTable.h"
+
+// Sorted, filtered view over the device table. The view keeps an index of
+// matching row numbers in display order, so the row at any scroll position
+// is an O(1) lookup. Rows are repositioned individually as sightings update
+// them; a full rebuild only happens when the sort or filter changes or the
+// table compacts its rows.
+
+enum ListSort {
+    SORT_RSSI,         // Strongest first
+    SORT_LAST_SEEN,    // Most recent first
+    SORT_MANUFACTURER, // Alphabetical, strongest first within a manufacturer
+    SORT_COUNT
+};
+
+#define MANUFACTURER_ANY 0xFFFF
+
+class DeviceListView {
+public:
+    explicit DeviceListView(const DeviceTable& table) : table(table) {
+        open(DEVICE_SEEN, SORT_RSSI, MANUFACTURER_ANY);
+    }
+
+    void open(uint8_t flagFilter, ListSort sort, uint16_t manufacturer) {
+        filter = flagFilter;
+        sortOrder = sort;
+        manufacturerFilter = manufacturer;
+        rebuild();
+    }
+
+    void setSort(ListSort sort) {
+        if (sort == sortOrder) return;
+        sortOrder = sort;
+        rebuild();
+    }
+
+    void setManufacturerFilter(uint16_t manufacturer) {
+        if (manufacturer == manufacturerFilter) return;
+        manufacturerFilter = manufacturer;
+        rebuild();
+    }
+
+    ListSort sort() const { return sortOrder; }
+    uint16_t manufacturer() const { return manufacturerFilter; }
+
+    int size() {
+        refresh();
+        return count;
+    }
+
+    // Table row shown at a display position
+    int rowAt(int position) {
+        refresh();
+        return order[position];
+    }
+
+    // True when the visible order or contents changed since clearChanged()
+    bool hasChanged() {
+        refresh();
+        return changed;
+    }
+
+    void clearChanged() { changed = false; }
+
+    // Call after a sighting updated a row, to move it to its new place
+    void rowChanged(int row) {
+        if (table.layoutVersion() != builtLayout) {
+            rebuild();
+            return;
+        }
+        if (positions[row] >= 0) remove(row);
+        if (matches(row)) insert(row);
+        changed = true;
+    }
+
+    // Next manufacturer (by index) present among the rows matching the flag
+    // filter, for cycling through manufacturer filters. Returns
+    // MANUFACTURER_ANY after the last one.
+    uint16_t nextManufacturer(uint16_t after) const {
+        uint16_t best = MANUFACTURER_ANY;
+        for (int row = 0; row < table.size(); row++) {
+            if (!table.hasFlags(row, filter)) continue;
+            uint16_t candidate = table.at(row).manufacturer;
+            if ((after == MANUFACTURER_ANY || candidate > after) && (best == MANUFACTURER_ANY || candidate < best)) {
+                best = candidate;
+            }
+        }
+        return best;
+    }
+
+private:
+    bool matches(int row) const {
+        return table.hasFlags(row, filter) &&
+               (manufacturerFilter == MANUFACTURER_ANY || table.at(row).manufacturer == manufacturerFilter);
+    }
+
+    // True if row a should be listed before row b
+    bool before(int a, int b) const {
+        const DeviceRecord& ra = table.at(a);
+        const DeviceRecord& rb = table.at(b);
+        switch (sortOrder) {
+            case SORT_LAST_SEEN:
+                if (ra.lastSeen != rb.lastSeen) return (int32_t)(ra.lastSeen - rb.lastSeen) > 0;
+                break;
+            case SORT_MANUFACTURER:
+                if (ra.manufacturer != rb.manufacturer) {
+                    int cmp = strcmp(manufacturerName(ra.manufacturer), manufacturerName(rb.manufacturer));
+                    if (cmp != 0) return cmp < 0;
+                }
+                if (ra.rssi != rb.rssi) return ra.rssi > rb.rssi;
+                break;
+            default:
+                if (ra.rssi != rb.rssi) return ra.rssi > rb.rssi;
+                break;
+        }
+        return a < b;
+    }
+
+    void insert(int row) {
+        int low = 0;
+        int high = count;
+        while (low < high) {
+            int mid = (low + high) / 2;
+            if (before(order[mid], row)) low = mid + 1;
+            else high = mid;
+        }
+        for (int i = count; i > low; i--) {
+            order[i] = order[i - 1];
+            positions[order[i]] = i;
+        }
+        order[low] = row;
+        positions[row] = low;
+        count++;
+    }
+
+    void remove(int row) {
+        for (int i = positions[row]; i < count - 1; i++) {
+            order[i] = order[i + 1];
+            positions[order[i]] = i;
+        }
+        positions[row] = -1;
+        count--;
+    }
+
+    void refresh() {
+        if (table.layoutVersion() != builtLayout) rebuild();
+    }
+
+    void rebuild() {
+        count = 0;
+        for (int row = 0; row < DEVICE_TABLE_SIZE; row++) positions[row] = -1;
+        for (int row = 0; row < table.size(); row++) {
+            if (matches(row)) insert(row);
+        }
+        builtLayout = table.layoutVersion();
+        changed = true;
+    }
+
+    const DeviceTable& table;
+    bool changed;
+    uint8_t filter;
+    ListSort sortOrder;
+    uint16_t manufacturerFilter;
+    uint32_t builtLayout;
+    int count;
+    int16_t order[DEVICE_TABLE_SIZE];     // Table rows in display order
+    int16_t positions[DEVICE_TABLE_SIZE]; // Display position of each table row, or -1
+};
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Fixed-capacity table of the devices the scanner has seen. Each row is a
+// compact record; display text is only built for the rows that get drawn.
+// Rows are found through an open-addressed index from MAC to row, at least
+// twice the table size so probe chains stay short; it is rebuilt whenever
+// rows move.
+
+#ifndef DEVICE_TABLE_SIZE
+#define DEVICE_TABLE_SIZE 256
+#endif
+
+static_assert(DEVICE_TABLE_SIZE <= 0x7FFF, "Rows are indexed with int16_t");
+
+// Smallest power of two not below n
+constexpr uint32_t deviceIndexSize(uint32_t n, uint32_t size = 1) {
+    return size >= n ? size : deviceIndexSize(n, size * 2);
+}
+
+#define DEVICE_INDEX_SIZE deviceIndexSize(DEVICE_TABLE_SIZE * 2)
+
+#define DEVICE_NAME_LENGTH 20
+#define MAC_STRING_LENGTH  18 // "aa:bb:cc:dd:ee:ff" plus terminator
+
+// Row flags. In continuous scan mode there is no current scan: DEVICE_SEEN and
+// DEVICE_USABLE cover the presence window instead, cleared as it slides
+// (expire()).
+#define DEVICE_SEEN    0x01 // Seen during the current scan, or the presence window
+#define DEVICE_USABLE  0x02 // RSSI above the usable threshold during the current scan, or the window
+#define DEVICE_ALERT   0x04 // Raised an alert while shields were up
+#define DEVICE_SESSION 0x08 // Seen during the current shields-up session
+#define DEVICE_COMPANY 0x10 // Manufacturer comes from an advertised company ID
+#define DEVICE_NEW     0x20 // Never seen before it appeared while shields were up
+#define DEVICE_FOLLOWING 0x40 // Raised a following alert (FollowerTracker.h)
+
+struct DeviceRecord {
+    uint64_t mac   : 48; // First octet in the most significant byte
+    uint64_t flags : 8;
+    int64_t  rssi  : 8;
+    uint32_t firstSeen;  // millis()
+    uint32_t lastSeen;   // millis()
+    uint16_t manufacturer;
+    uint16_t cluster;    // Address cluster slot of a rotating address, or 0xFFFF
+    uint32_t lastUsable; // millis() of the last sighting above the usable threshold
+    uint8_t reportAdverts; // Since the last collector report (NodeReport.h), saturating
+    int8_t reportRssiMax;
+    int16_t reportRssiSum;
+};
+
+inline uint64_t packMac(const uint8_t* bytes) {
+    uint64_t mac = 0;
+    for (int i = 0; i < 6; i++) {
+        mac = (mac << 8) | bytes[i];
+    }
+    return mac;
+}
+
+inline void formatMac(uint64_t mac, char* out) {
+    snprintf(out, MAC_STRING_LENGTH, "%02x:%02x:%02x:%02x:%02x:%02x",
+             (unsigned)(mac >> 40) & 0xFF, (unsigned)(mac >> 32) & 0xFF,
+             (unsigned)(mac >> 24) & 0xFF, (unsigned)(mac >> 16) & 0xFF,
+             (unsigned)(mac >> 8) & 0xFF, (unsigned)mac & 0xFF);
+}
+
+class DeviceTable {
+public:
+    DeviceTable() { clear(); }
+
+    void clear() {
+        count = 0;
+        dropped = 0;
+        layout++;
+        memset(flagCounts, 0, sizeof(flagCounts));
+        memset(slots, 0xFF, sizeof(slots));
+    }
+
+    int size() const { return count; }
+    int capacity() const { return DEVICE_TABLE_SIZE; }
+    unsigned long droppedCount() const { return dropped; }
+
+    // Changes whenever rows may have moved or been removed, so anything that
+    // holds row indices knows to rebuild
+    uint32_t layoutVersion() const { return layout; }
+
+    DeviceRecord& at(int index) { return records[index]; }
+    const DeviceRecord& at(int index) const { return records[index]; }
+    const char* name(int index) const { return names[index]; }
+
+    int find(uint64_t mac) const {
+        for (uint32_t slot = homeSlot(mac); slots[slot] >= 0; slot = (slot + 1) & (DEVICE_INDEX_SIZE - 1)) {
+            if (records[slots[slot]].mac == mac) return slots[slot];
+        }
+        return -1;
+    }
+
+    // Returns the row for this MAC, adding it if needed. Returns -1 when the
+    // table is full; the sighting is then only counted as dropped.
+    int upsert(uint64_t mac, int8_t rssi, uint32_t now, bool& added) {
+        added = false;
+        int index = find(mac);
+        if (index < 0) {
+            if (count >= DEVICE_TABLE_SIZE) {
+                dropped++;
+                return -1;
+            }
+            index = count++;
+            DeviceRecord& record = records[index];
+            record.mac = mac;
+            record.flags = 0;
+            record.firstSeen = now;
+            record.manufacturer = 0;
+            record.cluster = 0xFFFF;
+            record.lastUsable = 0;
+            record.reportAdverts = 0;
+            names[index][0] = '\0';
+            indexRow(index);
+            added = true;
+        }
+        DeviceRecord& record = records[index];
+        record.rssi = rssi;
+        record.lastSeen = now;
+        if (record.reportAdverts == 0) {
+            record.reportRssiMax = rssi;
+            record.reportRssiSum = 0;
+        }
+        if (record.reportAdverts < 0xFF) {
+            record.reportAdverts++;
+            record.reportRssiSum += rssi;
+            if (rssi > record.reportRssiMax) record.reportRssiMax = rssi;
+        }
+        return index;
+    }
+
+    void setName(int index, const char* deviceName) {
+        if (deviceName == nullptr || deviceName[0] == '\0') return;
+        size_t length = strnlen(deviceName, DEVICE_NAME_LENGTH - 1);
+        memcpy(names[index], deviceName, length);
+        names[index][length] = '\0';
+    }
+
+    void setFlags(int index, uint8_t flags) {
+        uint8_t added = flags & ~records[index].flags;
+        records[index].flags |= flags;
+        countFlags(added, 1);
+    }
+
+    void clearFlags(int index, uint8_t flags) {
+        uint8_t removed = flags & records[index].flags;
+        records[index].flags &= ~flags;
+        countFlags(removed, -1);
+    }
+
+    bool hasFlags(int index, uint8_t flags) const {
+        return (records[index].flags & flags) == flags;
+    }
+
+    int countWith(uint8_t flag) const {
+        for (int bit = 0; bit < 8; bit++) {
+            if (flag == (1 << bit)) return flagCounts[bit];
+        }
+        return 0;
+    }
+
+    // Clears the given flags on every row, then drops rows left with none of
+    // the flags in keepMask.
+    void resetFlags(uint8_t flags, uint8_t keepMask) {
+        int out = 0;
+        for (int i = 0; i < count; i++) {
+            clearFlags(i, flags);
+            if ((records[i].flags & keepMask) == 0) {
+                countFlags(records[i].flags, -1);
+                continue;
+            }
+            if (out != i) {
+                records[out] = records[i];
+                memcpy(names[out], names[i], DEVICE_NAME_LENGTH);
+            }
+            out++;
+        }
+        count = out;
+        layout++;
+        memset(slots, 0xFF, sizeof(slots));
+        for (int i = 0; i < count; i++) indexRow(i);
+    }
+
+    // Sliding-window presence: clears DEVICE_SEEN on rows not seen within
+    // window and DEVICE_USABLE on rows not usable within window, then drops
+    // rows left with none of the flags in keepMask. Returns the number of
+    // flags cleared. now must not be older than any row's timestamps.
+    int expire(uint32_t now, uint32_t window, uint8_t keepMask) {
+        int cleared = 0;
+        bool drop = false;
+        for (int i = 0; i < count; i++) {
+            DeviceRecord& record = records[i];
+            if ((record.flags & DEVICE_SEEN) && now - record.lastSeen > window) {
+                clearFlags(i, DEVICE_SEEN);
+                cleared++;
+            }
+            if ((record.flags & DEVICE_USABLE) && now - record.lastUsable > window) {
+                clearFlags(i, DEVICE_USABLE);
+                cleared++;
+            }
+            if ((record.flags & keepMask) == 0) drop = true;
+        }
+        if (drop) {
+            resetFlags(0, keepMask);
+        } else if (cleared > 0) {
+            layout++;
+        }
+        return cleared;
+    }
+
+private:
+    static uint32_t homeSlot(uint64_t mac) {
+        return (uint32_t)((mac * 0x9E3779B97F4A7C15ULL) >> 40) & (DEVICE_INDEX_SIZE - 1);
+    }
+
+    void indexRow(int row) {
+        uint32_t slot = homeSlot(records[row].mac);
+        while (slots[slot] >= 0) slot = (slot + 1) & (DEVICE_INDEX_SIZE - 1);
+        slots[slot] = (int16_t)row;
+    }
+
+    void countFlags(uint8_t flags, int delta) {
+        for (int bit = 0; bit < 8; bit++) {
+            if (flags & (1 << bit)) flagCounts[bit] += delta;
+        }
+    }
+
+    DeviceRecord records[DEVICE_TABLE_SIZE];
+    char names[DEVICE_TABLE_SIZE][DEVICE_NAME_LENGTH]; // Kept apart so row scans stay in cache
+    int16_t slots[DEVICE_INDEX_SIZE]; // Row of each index slot, or -1 for an empty one
+    int count;
+    int flagCounts[8];
+    unsigned long dropped;
+    uint32_t layout = 0;
+};
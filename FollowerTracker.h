@@ -0,0 +1,320 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Follower detection. Shields-up alerts fire for devices never seen before,
+// so a tag that has been with us for an hour stays quiet after its first
+// sighting. This keeps a presence bitmap per identity: one bit per
+// FOLLOWER_SLOT_LENGTH over the last FOLLOWER_SLOTS slots (about two hours),
+// bit 0 the newest. A device is following when it has been:
+//
+//   persistent  present in FOLLOWER_PERSIST_SLOTS slots since the shields
+//               went up, in more than one place
+//   recurring   back FOLLOWER_SESSIONS times after gaps of more than
+//               2 * FOLLOWER_SESSION_CLOSE slots, in more than one place
+//   travelling  present in FOLLOWER_PLACES places
+//
+// The scanner has no position, so a place is inferred from the air around
+// it: a slot where most of the previous slot's devices are gone and most of
+// this slot's are new starts a new place, and those slots are kept in a
+// bitmap of their own. A scanner that never moves cannot tell a follower
+// from the neighbours' devices, so every test needs a second place. All the
+// tests are shifts, masks and popcounts on the two bitmaps.
+//
+// Marking is one hash probe per sighting. The detector sweeps the table a
+// bounded batch at a time, so its cost per call does not grow with the number
+// of devices tracked; a sweep also drops identities not heard for a whole
+// horizon. When the table is full, the least present of a sample of entries
+// makes room.
+//
+// Capacity must be a power of two. Memory use is 16 bytes per entry.
+
+#define FOLLOWER_SLOT_LENGTH    120000 // ms per presence bit
+#define FOLLOWER_SLOTS          64     // Bits per bitmap, the horizon
+#define FOLLOWER_PERSIST_SLOTS  30     // An hour, counted from shields up; 0 disables
+#define FOLLOWER_SESSIONS       4      // Separate appearances; 0 disables
+#define FOLLOWER_SESSION_CLOSE  1      // Gaps up to twice this many slots do not end an appearance
+#define FOLLOWER_PLACES         3      // Places it was present in; 0 disables
+#define FOLLOWER_MOVE_DEVICES   4      // Devices both slots need to judge a move
+#define FOLLOWER_EVICTION_SAMPLE 8
+#define FOLLOWER_SWEEP_BATCH    128    // Entries examined per detector call
+
+// Entry state
+#define FOLLOWER_OCCUPIED 0x1
+#define FOLLOWER_ALLOWED  0x2 // Matched an allow rule: never follows
+#define FOLLOWER_REPORTED 0x4 // Already reported this session
+
+// Why a device was found to be following
+#define FOLLOWER_PERSISTENT 0x01
+#define FOLLOWER_RECURRING  0x02
+#define FOLLOWER_TRAVELLING 0x04
+
+struct FollowerEvidence {
+    uint64_t identity;
+    uint8_t reasons; // FOLLOWER_PERSISTENT | FOLLOWER_RECURRING | FOLLOWER_TRAVELLING
+    uint8_t slots;   // Present in this many of the last FOLLOWER_SLOTS
+    uint8_t sessions;
+    uint8_t places;
+};
+
+struct FollowerEntry {
+    uint64_t presence;      // Bit n: heard n slots before lastSlot
+    uint64_t mac      : 48;
+    uint64_t state    : 4;  // FOLLOWER_OCCUPIED | ...
+    uint64_t lastSlot : 12; // Slot of bit 0, modulo 4096
+};
+
+template <uint32_t Capacity>
+class FollowerTracker {
+    static_assert((Capacity & (Capacity - 1)) == 0, "FollowerTracker capacity must be a power of two");
+
+public:
+    FollowerTracker() { clear(0); }
+
+    void clear(uint32_t now) {
+        memset(entries, 0, sizeof(entries));
+        count = 0;
+        hand = 0;
+        cursor = 0;
+        evicted = 0;
+        current = now / FOLLOWER_SLOT_LENGTH;
+        sessionSlot = current;
+        moves = 0;
+        moveCount = 0;
+        slotDevices = 0;
+        slotCarried = 0;
+        previousDevices = 0;
+        found = 0;
+    }
+
+    uint32_t size() const { return count; }
+    uint32_t capacity() const { return Capacity; }
+    uint32_t maxSize() const { return Capacity - Capacity / 4; }
+    unsigned long evictions() const { return evicted; }
+    unsigned long moveTotal() const { return moveCount; }
+    unsigned long foundTotal() const { return found; }
+    static size_t memoryUsed() { return sizeof(FollowerTracker); }
+
+    // Shields up: persistence counts from now and every device can be found
+    // again
+    void startSession(uint32_t now) {
+        advance(now);
+        sessionSlot = current;
+        for (uint32_t i = 0; i < Capacity; i++) entries[i].state &= ~FOLLOWER_REPORTED;
+    }
+
+    // Scan task, per sighting
+    void mark(uint64_t identity, uint32_t now, bool allowed) {
+        advance(now);
+        int index = findSlot(identity);
+        if (index < 0) index = insert(identity);
+        FollowerEntry& entry = entries[index];
+        if (allowed) entry.state |= FOLLOWER_ALLOWED;
+        uint64_t presence = aligned(entry);
+        if (presence & 1) return;
+        // First sighting in this slot: it counts towards judging a move
+        slotDevices++;
+        if (presence & 2) slotCarried++;
+        entry.presence = presence | 1;
+        entry.lastSlot = current & SLOT_MASK;
+    }
+
+    // Scan task, every cycle: closes the slots that have ended. A slot where
+    // fewer than half of the devices on either side carried over is a move.
+    void advance(uint32_t now) {
+        uint32_t slot = now / FOLLOWER_SLOT_LENGTH;
+        if ((int32_t)(slot - current) <= 0) return; // A sighting queued before the last rollover
+        while (current != slot) {
+            bool moved = slotDevices >= FOLLOWER_MOVE_DEVICES && previousDevices >= FOLLOWER_MOVE_DEVICES &&
+                         slotCarried * 2 < slotDevices && slotCarried * 2 < previousDevices;
+            if (moved) {
+                moves |= 1;
+                moveCount++;
+            }
+            previousDevices = slotDevices;
+            slotDevices = 0;
+            slotCarried = 0;
+            if (slot - current > FOLLOWER_SLOTS) {
+                // Idle for a whole horizon
+                moves = 0;
+                previousDevices = 0;
+                current = slot;
+                break;
+            }
+            moves <<= 1;
+            current++;
+        }
+    }
+
+    // Examines up to budget entries from where the last call stopped and calls
+    // report(const FollowerEvidence&) for each device newly found following.
+    // Only devices heard in this slot or the last can be found. Returns the
+    // entries examined.
+    template <typename Fn>
+    uint32_t sweep(uint32_t budget, Fn report) {
+        uint32_t examined = 0;
+        while (examined < budget && count > 0) {
+            examined++;
+            FollowerEntry& entry = entries[cursor];
+            if (!(entry.state & FOLLOWER_OCCUPIED)) {
+                cursor = (cursor + 1) & MASK;
+                continue;
+            }
+            uint32_t idle = (current - entry.lastSlot) & SLOT_MASK;
+            if (idle >= FOLLOWER_SLOTS) {
+                removeAt(cursor); // Something may have shifted into cursor: look again
+                continue;
+            }
+            if (idle <= 1 && !(entry.state & (FOLLOWER_ALLOWED | FOLLOWER_REPORTED))) {
+                FollowerEvidence evidence;
+                if (evaluate(entry.mac, entry.presence << idle, evidence)) {
+                    entry.state |= FOLLOWER_REPORTED;
+                    found++;
+                    report(evidence);
+                }
+            }
+            cursor = (cursor + 1) & MASK;
+        }
+        return examined;
+    }
+
+    // The tests, on a presence bitmap aligned to the current slot
+    bool evaluate(uint64_t identity, uint64_t presence, FollowerEvidence& evidence) const {
+        evidence.identity = identity;
+        evidence.reasons = 0;
+        evidence.slots = (uint8_t)__builtin_popcountll(presence);
+        evidence.sessions = (uint8_t)sessions(presence);
+        evidence.places = (uint8_t)places(presence, moves);
+
+        if (evidence.places < 2) return false;
+        uint32_t sessionSlots = current - sessionSlot + 1;
+        uint64_t session = presence & (sessionSlots >= FOLLOWER_SLOTS ? ~0ULL : (1ULL << sessionSlots) - 1);
+        if (FOLLOWER_PERSIST_SLOTS > 0 && __builtin_popcountll(session) >= FOLLOWER_PERSIST_SLOTS &&
+            places(session, moves) >= 2) {
+            evidence.reasons |= FOLLOWER_PERSISTENT;
+        }
+        if (FOLLOWER_SESSIONS > 0 && evidence.sessions >= FOLLOWER_SESSIONS) evidence.reasons |= FOLLOWER_RECURRING;
+        if (FOLLOWER_PLACES > 0 && evidence.places >= FOLLOWER_PLACES) evidence.reasons |= FOLLOWER_TRAVELLING;
+        return evidence.reasons != 0;
+    }
+
+    // Appearances: runs of presence once short gaps are closed (a dilation
+    // then an erosion, each by FOLLOWER_SESSION_CLOSE slots)
+    static int sessions(uint64_t presence) {
+        uint64_t filled = presence;
+        for (int i = 0; i < FOLLOWER_SESSION_CLOSE; i++) filled |= (filled << 1) | (filled >> 1);
+        for (int i = 0; i < FOLLOWER_SESSION_CLOSE; i++) filled &= (filled << 1) & (filled >> 1);
+        filled |= presence;
+        // A run starts where the next older slot is absent
+        return __builtin_popcountll(filled & ~(filled >> 1));
+    }
+
+    // Places present in: a bit in moves starts a new place, so a place runs
+    // from a move bit towards bit 0 up to the next one
+    static int places(uint64_t presence, uint64_t moves) {
+        int total = 0;
+        while (presence != 0) {
+            total++;
+            int newest = __builtin_ctzll(presence);
+            uint64_t starts = moves & (~0ULL << newest);
+            if (starts == 0) break;
+            int start = __builtin_ctzll(starts);
+            presence = start == 63 ? 0 : presence & (~0ULL << (start + 1));
+        }
+        return total;
+    }
+
+    uint64_t moveBits() const { return moves; }
+
+private:
+    static const uint32_t MASK = Capacity - 1;
+    static const uint32_t SLOT_MASK = 0xFFF;
+
+    static uint32_t homeSlot(uint64_t mac) {
+        // 64-bit finalizer from MurmurHash3
+        mac ^= mac >> 33;
+        mac *= 0xff51afd7ed558ccdULL;
+        mac ^= mac >> 33;
+        mac *= 0xc4ceb9fe1a85ec53ULL;
+        mac ^= mac >> 33;
+        return (uint32_t)mac & MASK;
+    }
+
+    // The entry's bitmap as of the current slot
+    uint64_t aligned(const FollowerEntry& entry) const {
+        uint32_t idle = (current - entry.lastSlot) & SLOT_MASK;
+        return idle >= FOLLOWER_SLOTS ? 0 : entry.presence << idle;
+    }
+
+    int findSlot(uint64_t mac) const {
+        uint32_t slot = homeSlot(mac);
+        while (entries[slot].state & FOLLOWER_OCCUPIED) {
+            if (entries[slot].mac == mac) return slot;
+            slot = (slot + 1) & MASK;
+        }
+        return -1;
+    }
+
+    int insert(uint64_t mac) {
+        if (count >= maxSize()) evictLeastPresent();
+        uint32_t slot = homeSlot(mac);
+        while (entries[slot].state & FOLLOWER_OCCUPIED) slot = (slot + 1) & MASK;
+        FollowerEntry& entry = entries[slot];
+        entry.presence = 0;
+        entry.mac = mac;
+        entry.state = FOLLOWER_OCCUPIED;
+        entry.lastSlot = current & SLOT_MASK;
+        count++;
+        return slot;
+    }
+
+    void evictLeastPresent() {
+        int least = -1;
+        int leastSlots = 0;
+        for (int sampled = 0; sampled < FOLLOWER_EVICTION_SAMPLE;) {
+            hand = (hand + 1) & MASK;
+            if (!(entries[hand].state & FOLLOWER_OCCUPIED)) continue;
+            int slots = __builtin_popcountll(aligned(entries[hand]));
+            if (least < 0 || slots < leastSlots) {
+                least = hand;
+                leastSlots = slots;
+            }
+            sampled++;
+        }
+        removeAt(least);
+        evicted++;
+    }
+
+    // Backward-shift deletion keeps probe chains intact without tombstones
+    void removeAt(uint32_t hole) {
+        uint32_t next = hole;
+        while (true) {
+            next = (next + 1) & MASK;
+            if (!(entries[next].state & FOLLOWER_OCCUPIED)) break;
+            uint32_t home = homeSlot(entries[next].mac);
+            bool stays = (next > hole) ? (home > hole && home <= next)
+                                       : (home > hole || home <= next);
+            if (!stays) {
+                entries[hole] = entries[next];
+                hole = next;
+            }
+        }
+        memset(&entries[hole], 0, sizeof(entries[hole]));
+        count--;
+    }
+
+    FollowerEntry entries[Capacity];
+    uint32_t count;
+    uint32_t hand;   // Eviction sample position
+    uint32_t cursor; // Where the next sweep starts
+    unsigned long evicted;
+    uint32_t current;     // Slot now, millis() / FOLLOWER_SLOT_LENGTH
+    uint32_t sessionSlot; // Slot the shields went up in
+    uint64_t moves;       // Bit n: a new place started n slots ago
+    unsigned long moveCount;
+    uint32_t slotDevices;     // Heard in the current slot
+    uint32_t slotCarried;     // ... that were heard in the previous one too
+    uint32_t previousDevices; // Heard in the previous slot
+    unsigned long found;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Board interfaces. The sketch reaches the scanner radio and the touch panel
+// only through these, so the same aggregation, alert and history code runs
+// on the CYD (BoardEsp32.cpp) and in the native host build (native/). The
+// display is driven through the TFT_eSPI API, which the host build provides
+// as a recording stand-in.
+
+// Screen dimensions
+#define SCREEN_WIDTH  320
+#define SCREEN_HEIGHT 240
+
+// One advertisement as delivered by a scan source
+struct Advert {
+    uint64_t mac; // First octet in the most significant byte
+    int8_t rssi;
+    bool randomAddress;     // Random rather than public address type
+    const uint8_t* payload; // Raw advertising data, including the name if any
+    size_t payloadLength;
+};
+
+// Called for each advert, from the radio's own task on the board. The
+// pointers in the advert are only valid during the call.
+typedef void (*AdvertHandler)(const Advert& advert);
+
+// Radio duty: the radio listens for window ms out of every interval ms
+struct ScanSettings {
+    uint16_t interval; // ms
+    uint16_t window;   // ms, at most interval
+    bool active;       // Send scan requests, so scan responses arrive too
+};
+
+class ScanSource {
+public:
+    virtual ~ScanSource() {}
+
+    // wantDuplicates delivers every advert rather than the first per device
+    virtual void begin(AdvertHandler handler, bool wantDuplicates) = 0;
+
+    // Takes effect at the next start()
+    virtual void configure(const ScanSettings& settings) = 0;
+
+    // Scans until stop(). Both return false if the radio did not confirm
+    // the command, with the board's reason in lastStatus(); the caller logs
+    // it, as only the sketch knows whether the serial port is free.
+    virtual bool start() = 0;
+    virtual bool stop() = 0;
+    virtual int lastStatus() const { return 0; }
+};
+
+// Screen coordinates
+struct TouchPoint {
+    int16_t x;
+    int16_t y;
+};
+
+// One debounced panel reading. While the panel is held the driver queues a
+// pressed sample every few ms; a single released sample ends the stroke.
+struct TouchSample {
+    TouchPoint point; // Unset for a release
+    bool pressed;
+    uint32_t micros;  // When the panel was read
+};
+
+class TouchInput {
+public:
+    virtual ~TouchInput() {}
+
+    virtual void begin() = 0;
+
+    // Takes the oldest queued sample, if any. Never blocks; sampling carries
+    // on in the driver while the caller is busy, so nothing is missed.
+    virtual bool read(TouchSample& sample) = 0;
+};
+
+// Implemented once per board
+ScanSource& boardScanSource();
+TouchInput& boardTouchInput();
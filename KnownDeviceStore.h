@@ -0,0 +1,223 @@
+#pragma once
+
+#include <FS.h>
+#include <stdint.h>
+#include <string.h>
+
+// Known devices persisted in flash as an append-only log, so a reboot does
+// not make every familiar device look new when shields go up.
+//
+// The log is a header followed by 8-byte records: the MAC (first octet
+// first), a tag byte and a CRC-8 over the first seven bytes. New addresses
+// are batched in RAM and appended in one write, which keeps flash wear low.
+// A record cut short by a power failure fails its CRC; loading stops there
+// and the next flush rewrites the log instead of appending to the torn tail.
+//
+// Compaction writes the live set to a temporary file and only then replaces
+// the log, so there is always one complete copy on flash. load() finishes a
+// swap that was interrupted.
+
+#define KNOWN_STORE_PATH        "/known.log"
+#define KNOWN_STORE_TEMP_PATH   "/known.tmp"
+#define KNOWN_STORE_MAGIC       "BLEKNWN1"
+#define KNOWN_STORE_HEADER_SIZE 8
+#define KNOWN_RECORD_SIZE       8
+#define KNOWN_RECORD_TAG        0x4B
+#define KNOWN_STORE_BATCH       64 // Records buffered between writes
+#define KNOWN_STORE_CHUNK       64 // Records per read or write call
+
+class KnownDeviceStore {
+public:
+    explicit KnownDeviceStore(fs::FS& fs)
+        : fs(fs), pendingCount(0), logCount(0), lastFlush(0), needsCompaction(false),
+          writes(0), compactions(0) {}
+
+    // Reads the log, calling add(mac) for each valid record. Returns the
+    // number of records read.
+    template <typename Fn>
+    uint32_t load(Fn add) {
+        recover();
+        pendingCount = 0;
+        logCount = 0;
+        needsCompaction = false;
+
+        File file = fs.open(KNOWN_STORE_PATH, "r");
+        if (!file) {
+            needsCompaction = true; // Nothing stored yet; start a fresh log
+            return 0;
+        }
+
+        uint8_t buffer[KNOWN_STORE_CHUNK * KNOWN_RECORD_SIZE];
+        if (file.read(buffer, KNOWN_STORE_HEADER_SIZE) != KNOWN_STORE_HEADER_SIZE ||
+            memcmp(buffer, KNOWN_STORE_MAGIC, KNOWN_STORE_HEADER_SIZE) != 0) {
+            file.close();
+            needsCompaction = true;
+            return 0;
+        }
+
+        uint32_t loaded = 0;
+        bool torn = false;
+        while (!torn) {
+            int bytes = file.read(buffer, sizeof(buffer));
+            if (bytes <= 0) break;
+            int records = bytes / KNOWN_RECORD_SIZE;
+            for (int i = 0; i < records; i++) {
+                uint64_t mac;
+                if (!decode(buffer + i * KNOWN_RECORD_SIZE, mac)) {
+                    torn = true;
+                    break;
+                }
+                add(mac);
+                loaded++;
+            }
+            if (bytes % KNOWN_RECORD_SIZE != 0) torn = true;
+        }
+        file.close();
+
+        logCount = loaded;
+        if (torn) needsCompaction = true;
+        return loaded;
+    }
+
+    // Queues a newly known device for the next flush. If the batch is full
+    // the address is not queued; the next compaction writes it with the rest
+    // of the set instead.
+    void record(uint64_t mac) {
+        if (pendingCount < KNOWN_STORE_BATCH) {
+            pending[pendingCount++] = mac;
+        } else {
+            needsCompaction = true;
+        }
+    }
+
+    // Due once the batch is half full, leaving room for the devices that
+    // arrive before the flush runs, or once the interval has passed
+    bool shouldFlush(uint32_t now, uint32_t interval) const {
+        if (pendingCount >= KNOWN_STORE_BATCH / 2) return true;
+        return (pendingCount > 0 || needsCompaction) && now - lastFlush >= interval;
+    }
+
+    // Appends the queued records, or rewrites the log from the set when it
+    // has grown well past the set (evicted addresses) or has a bad tail.
+    // Returns false if the write failed; the records stay queued.
+    template <typename Set>
+    bool flush(const Set& set, uint32_t now) {
+        lastFlush = now;
+        if (needsCompaction || logCount + pendingCount > compactionLimit(set.size())) {
+            return compact(set);
+        }
+        if (pendingCount == 0) return true;
+
+        File file = fs.open(KNOWN_STORE_PATH, "a");
+        if (!file) return false;
+        uint8_t buffer[KNOWN_STORE_BATCH * KNOWN_RECORD_SIZE];
+        for (uint32_t i = 0; i < pendingCount; i++) {
+            encode(buffer + i * KNOWN_RECORD_SIZE, pending[i]);
+        }
+        size_t length = pendingCount * KNOWN_RECORD_SIZE;
+        size_t written = file.write(buffer, length);
+        file.close();
+        if (written != length) {
+            needsCompaction = true; // Don't append after a partial record
+            return false;
+        }
+        logCount += pendingCount;
+        pendingCount = 0;
+        writes++;
+        return true;
+    }
+
+    uint32_t pendingRecords() const { return pendingCount; }
+    uint32_t logRecords() const { return logCount; }
+    unsigned long writeCount() const { return writes; }
+    unsigned long compactionCount() const { return compactions; }
+
+private:
+    static uint32_t compactionLimit(uint32_t setSize) {
+        uint32_t limit = setSize * 2;
+        return limit > KNOWN_STORE_BATCH * 4 ? limit : KNOWN_STORE_BATCH * 4;
+    }
+
+    static uint8_t crc8(const uint8_t* data, int length) {
+        uint8_t crc = 0;
+        for (int i = 0; i < length; i++) {
+            crc ^= data[i];
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+            }
+        }
+        return crc;
+    }
+
+    static void encode(uint8_t* out, uint64_t mac) {
+        for (int i = 0; i < 6; i++) {
+            out[i] = (uint8_t)(mac >> (40 - 8 * i));
+        }
+        out[6] = KNOWN_RECORD_TAG;
+        out[7] = crc8(out, 7);
+    }
+
+    static bool decode(const uint8_t* in, uint64_t& mac) {
+        if (in[6] != KNOWN_RECORD_TAG || in[7] != crc8(in, 7)) return false;
+        mac = 0;
+        for (int i = 0; i < 6; i++) {
+            mac = (mac << 8) | in[i];
+        }
+        return true;
+    }
+
+    // Finishes or discards a compaction that a reset interrupted
+    void recover() {
+        if (!fs.exists(KNOWN_STORE_TEMP_PATH)) return;
+        if (fs.exists(KNOWN_STORE_PATH)) {
+            fs.remove(KNOWN_STORE_TEMP_PATH); // Cut off while writing; the old log is intact
+        } else {
+            fs.rename(KNOWN_STORE_TEMP_PATH, KNOWN_STORE_PATH); // Cut off during the swap
+        }
+    }
+
+    template <typename Set>
+    bool compact(const Set& set) {
+        File file = fs.open(KNOWN_STORE_TEMP_PATH, "w");
+        if (!file) return false;
+
+        bool ok = file.write((const uint8_t*)KNOWN_STORE_MAGIC, KNOWN_STORE_HEADER_SIZE) == KNOWN_STORE_HEADER_SIZE;
+        uint8_t buffer[KNOWN_STORE_CHUNK * KNOWN_RECORD_SIZE];
+        uint32_t used = 0;
+        uint32_t records = 0;
+        set.forEach([&](uint64_t mac) {
+            encode(buffer + used * KNOWN_RECORD_SIZE, mac);
+            used++;
+            records++;
+            if (used == KNOWN_STORE_CHUNK) {
+                ok = ok && file.write(buffer, sizeof(buffer)) == sizeof(buffer);
+                used = 0;
+            }
+        });
+        if (used > 0) {
+            ok = ok && file.write(buffer, used * KNOWN_RECORD_SIZE) == used * KNOWN_RECORD_SIZE;
+        }
+        file.close();
+        if (!ok) {
+            fs.remove(KNOWN_STORE_TEMP_PATH);
+            return false;
+        }
+
+        fs.remove(KNOWN_STORE_PATH);
+        fs.rename(KNOWN_STORE_TEMP_PATH, KNOWN_STORE_PATH);
+        logCount = records;
+        pendingCount = 0; // Already in the set, so already written
+        needsCompaction = false;
+        compactions++;
+        return true;
+    }
+
+    fs::FS& fs;
+    uint64_t pending[KNOWN_STORE_BATCH];
+    uint32_t pendingCount;
+    uint32_t logCount;
+    uint32_t lastFlush;
+    bool needsCompaction;
+    unsigned long writes;
+    unsigned long compactions;
+};
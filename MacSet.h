@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Fixed-memory set of 48-bit MAC addresses using open addressing with linear
+// probing. Each entry carries a last-seen stamp; once the set reaches its
+// load limit, inserting a new address evicts the stalest of a small sample of
+// entries, which approximates LRU without any per-lookup bookkeeping.
+//
+// Capacity must be a power of two. Memory use is 12 bytes per slot.
+
+#define MAC_SET_EVICTION_SAMPLE 8
+
+template <uint32_t Capacity>
+class MacSet {
+    static_assert((Capacity & (Capacity - 1)) == 0, "MacSet capacity must be a power of two");
+
+public:
+    MacSet() { clear(); }
+
+    void clear() {
+        memset(keys, 0, sizeof(keys));
+        count = 0;
+        hand = 0;
+        evicted = 0;
+    }
+
+    uint32_t size() const { return count; }
+    uint32_t capacity() const { return Capacity; }
+    uint32_t maxSize() const { return Capacity - Capacity / 4; }
+    unsigned long evictions() const { return evicted; }
+
+    bool contains(uint64_t mac) const {
+        return findSlot(mac) >= 0;
+    }
+
+    // Adds the address or refreshes its stamp. Returns true if it was not
+    // already in the set.
+    bool insert(uint64_t mac, uint32_t now) {
+        uint64_t key = mac | OCCUPIED;
+        uint32_t slot = homeSlot(mac);
+        while (keys[slot] != 0) {
+            if (keys[slot] == key) {
+                stamps[slot] = now;
+                return false;
+            }
+            slot = (slot + 1) & MASK;
+        }
+
+        if (count >= maxSize()) {
+            evictStalest(now);
+            // Eviction may have shifted entries; find the first free slot again
+            slot = homeSlot(mac);
+            while (keys[slot] != 0) slot = (slot + 1) & MASK;
+        }
+
+        keys[slot] = key;
+        stamps[slot] = now;
+        count++;
+        return true;
+    }
+
+    bool remove(uint64_t mac) {
+        int slot = findSlot(mac);
+        if (slot < 0) return false;
+        removeAt(slot);
+        return true;
+    }
+
+    // Calls fn(mac) for every address in the set, in slot order
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (uint32_t slot = 0; slot < Capacity; slot++) {
+            if (keys[slot] != 0) fn(keys[slot] & ~OCCUPIED);
+        }
+    }
+
+    // Removes up to maxVisits slots' worth of entries older than maxAge.
+    // Call periodically to age the set out incrementally.
+    void expire(uint32_t now, uint32_t maxAge, uint32_t maxVisits) {
+        for (uint32_t i = 0; i < maxVisits && count > 0; i++) {
+            hand = (hand + 1) & MASK;
+            if (keys[hand] != 0 && now - stamps[hand] > maxAge) {
+                removeAt(hand);
+            }
+        }
+    }
+
+private:
+    static const uint64_t OCCUPIED = 1ULL << 63;
+    static const uint32_t MASK = Capacity - 1;
+
+    static uint32_t homeSlot(uint64_t mac) {
+        // 64-bit finalizer from MurmurHash3
+        mac ^= mac >> 33;
+        mac *= 0xff51afd7ed558ccdULL;
+        mac ^= mac >> 33;
+        mac *= 0xc4ceb9fe1a85ec53ULL;
+        mac ^= mac >> 33;
+        return (uint32_t)mac & MASK;
+    }
+
+    int findSlot(uint64_t mac) const {
+        uint64_t key = mac | OCCUPIED;
+        uint32_t slot = homeSlot(mac);
+        while (keys[slot] != 0) {
+            if (keys[slot] == key) return slot;
+            slot = (slot + 1) & MASK;
+        }
+        return -1;
+    }
+
+    void evictStalest(uint32_t now) {
+        int stalest = -1;
+        uint32_t stalestAge = 0;
+        for (int sampled = 0; sampled < MAC_SET_EVICTION_SAMPLE; ) {
+            hand = (hand + 1) & MASK;
+            if (keys[hand] == 0) continue;
+            uint32_t age = now - stamps[hand];
+            if (stalest < 0 || age > stalestAge) {
+                stalest = hand;
+                stalestAge = age;
+            }
+            sampled++;
+        }
+        removeAt(stalest);
+        evicted++;
+    }
+
+    // Backward-shift deletion keeps probe chains intact without tombstones
+    void removeAt(uint32_t hole) {
+        uint32_t next = hole;
+        while (true) {
+            next = (next + 1) & MASK;
+            if (keys[next] == 0) break;
+            uint32_t home = homeSlot(keys[next] & ~OCCUPIED);
+            bool stays = (next > hole) ? (home > hole && home <= next)
+                                       : (home > hole || home <= next);
+            if (!stays) {
+                keys[hole] = keys[next];
+                stamps[hole] = stamps[next];
+                hole = next;
+            }
+        }
+        keys[hole] = 0;
+        count--;
+    }
+
+    uint64_t keys[Capacity];   // MAC | OCCUPIED, or 0 for an empty slot
+    uint32_t stamps[Capacity]; // Last seen, in millis()
+    uint32_t count;
+    uint32_t hand;
+    unsigned long evicted;
+};
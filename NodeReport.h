@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fleet reporting. Each scanner on a site sends a collector (tools/collector.py)
+// a summary of what it heard every NODE_REPORT_INTERVAL, as UDP datagrams. A
+// report holds only the devices heard since the previous one: the device table
+// accumulates an advert count and RSSI sum and maximum per row, and reporting a
+// row resets them. The size of a report follows the number of devices in
+// range, not the advert rate.
+//
+// Datagram, little endian:
+//
+//   u16 magic       NODE_REPORT_MAGIC
+//   u8  version
+//   u8  flags       NODE_REPORT_SHIELDS_UP
+//   u16 node        Node ID, unique on the site
+//   u16 count       Records that follow
+//   u32 sequence    Per node, one per datagram; a gap is a lost datagram
+//   u32 millis      Node clock when the report was taken
+//
+// Record:
+//
+//   u8  flags       NODE_RECORD_*
+//   u8  identity[6] The logical device: its address, or the first address of
+//                   its address cluster (first octet first)
+//   u8  address[6]  Only with NODE_RECORD_ADDRESS: the current address
+//   u8  adverts     Heard since the last report, saturating at 255
+//   i8  rssi        Mean over those adverts
+//   i8  rssiMax
+//   ... age         ms from the last advert to the report time, LEB128,
+//                   at most NODE_RECORD_MAX_AGE
+//
+// Every NODE_SKETCH_INTERVAL a node also sends its distinct device sketches
+// (HyperLogLog.h), one per datagram, flagged NODE_REPORT_SKETCH with a count
+// of 1. The collector merges them across nodes. In place of records:
+//
+//   u8  window      DISTINCT_HOUR, DISTINCT_DAY or DISTINCT_WEEK
+//   u8  precision   log2 of the register count
+//   u32 span        ms the window covers
+//   u8  registers[1 << precision]
+
+#define NODE_REPORT_MAGIC     0x4E42   // "BN"
+#define NODE_REPORT_VERSION   1
+#define NODE_REPORT_HEADER    16
+#define NODE_REPORT_DATAGRAM  1200     // Bytes; stays under a typical path MTU
+#define NODE_RECORD_MAX       19       // Flags, identity, address, stats and a 3-byte age
+#define NODE_RECORD_MAX_AGE   0x1FFFFF // ms; longer ages are clamped to fit 3 bytes
+
+// Datagram flags
+#define NODE_REPORT_SHIELDS_UP 0x01
+#define NODE_REPORT_SKETCH     0x02 // Carries a distinct device sketch, not records
+#define NODE_SKETCH_HEADER     6
+
+// Record flags
+#define NODE_RECORD_ALERT   0x01 // The node raised an alert for it
+#define NODE_RECORD_NEW     0x02 // Never seen before it appeared with shields up
+#define NODE_RECORD_USABLE  0x04 // Above the usable threshold within the presence window
+#define NODE_RECORD_ADDRESS 0x08 // A rotating address folded into identity; address follows
+
+struct NodeReportRecord {
+    uint64_t identity;
+    uint64_t address;
+    uint8_t flags;
+    uint8_t adverts;
+    int8_t rssi;
+    int8_t rssiMax;
+    uint32_t age; // ms
+};
+
+// Fills one datagram. add() refuses a record that does not fit, and the
+// caller starts the next datagram with it.
+class NodeReportEncoder {
+public:
+    NodeReportEncoder() : buffer(nullptr), capacity(0), length(0), records(0) {}
+
+    void begin(uint8_t* out, size_t size, uint16_t node, uint32_t sequence, uint32_t now, uint8_t flags) {
+        buffer = out;
+        capacity = size;
+        put16(buffer, NODE_REPORT_MAGIC);
+        buffer[2] = NODE_REPORT_VERSION;
+        buffer[3] = flags;
+        put16(buffer + 4, node);
+        put16(buffer + 6, 0);
+        put32(buffer + 8, sequence);
+        put32(buffer + 12, now);
+        length = NODE_REPORT_HEADER;
+        records = 0;
+    }
+
+    bool add(const NodeReportRecord& record) {
+        uint8_t flags = record.flags & ~NODE_RECORD_ADDRESS;
+        if (record.address != record.identity) flags |= NODE_RECORD_ADDRESS;
+        if (length + NODE_RECORD_MAX > capacity || records == 0xFFFF) return false;
+        buffer[length++] = flags;
+        putMac(record.identity);
+        if (flags & NODE_RECORD_ADDRESS) putMac(record.address);
+        buffer[length++] = record.adverts;
+        buffer[length++] = (uint8_t)record.rssi;
+        buffer[length++] = (uint8_t)record.rssiMax;
+        uint32_t age = record.age < NODE_RECORD_MAX_AGE ? record.age : NODE_RECORD_MAX_AGE;
+        while (age >= 0x80) {
+            buffer[length++] = (uint8_t)(age | 0x80);
+            age >>= 7;
+        }
+        buffer[length++] = (uint8_t)age;
+        records++;
+        return true;
+    }
+
+    // Turns a datagram just begun into a sketch datagram. Returns where the
+    // registers go, or nullptr if they do not fit.
+    uint8_t* beginSketch(uint8_t window, uint8_t precision, uint32_t span) {
+        size_t registers = (size_t)1 << precision;
+        if (records != 0 || length + NODE_SKETCH_HEADER + registers > capacity) return nullptr;
+        buffer[3] |= NODE_REPORT_SKETCH;
+        buffer[length++] = window;
+        buffer[length++] = precision;
+        put32(buffer + length, span);
+        length += 4;
+        uint8_t* out = buffer + length;
+        length += registers;
+        records = 1;
+        return out;
+    }
+
+    // Returns the datagram length
+    size_t finish() {
+        put16(buffer + 6, records);
+        return length;
+    }
+
+    uint16_t count() const { return records; }
+
+private:
+    uint8_t* buffer;
+    size_t capacity;
+    size_t length;
+    uint16_t records;
+
+    static void put16(uint8_t* out, uint16_t value) {
+        out[0] = (uint8_t)value;
+        out[1] = (uint8_t)(value >> 8);
+    }
+
+    static void put32(uint8_t* out, uint32_t value) {
+        for (int i = 0; i < 4; i++) out[i] = (uint8_t)(value >> (8 * i));
+    }
+
+    void putMac(uint64_t mac) {
+        for (int i = 0; i < 6; i++) buffer[length++] = (uint8_t)(mac >> (40 - 8 * i));
+    }
+};
@@ -0,0 +1,51 @@
+// Generated by tools/gen_oui.py from oui_seed.csv and company_seed.yaml. Do not edit.
+
+#include "OuiTable.h"
+
+const uint16_t manufacturerCount = 15;
+const uint32_t ouiCount = 15;
+const uint16_t companyCount = 13;
+
+const char manufacturerPool[] =
+    "Unknown\0"
+    "Microsoft\0"
+    "Samsung\0"
+    "Google\0"
+    "Xiaomi\0"
+    "Apple\0"
+    "Raspberry Pi\0"
+    "Ericsson\0"
+    "Intel\0"
+    "Texas Instruments\0"
+    "Broadcom\0"
+    "Nordic Semiconductor\0"
+    "Garmin\0"
+    "Amazon\0"
+    "Espressif\0";
+
+const uint32_t manufacturerOffsets[] = {
+    0, 8, 18, 26, 33, 40, 46, 59, 68, 74, 92, 101,
+    122, 129, 136,
+};
+
+// Packed 24-bit OUIs, big-endian, sorted
+const uint8_t ouiKeys[] = {
+    0x00, 0x15, 0x5D, 0x00, 0x15, 0x99, 0x00, 0x1A, 0x11, 0x00, 0x1A, 0x7D,
+    0x00, 0x1B, 0x44, 0x00, 0x25, 0x00, 0x00, 0x50, 0xF2, 0x28, 0x11, 0xA5,
+    0x3C, 0xE0, 0x72, 0x94, 0x35, 0x0A, 0xAC, 0xDE, 0x48, 0xB8, 0x27, 0xEB,
+    0xD0, 0x03, 0x4B, 0xD8, 0x3A, 0xDD, 0xF8, 0xA7, 0x63,
+};
+
+const uint16_t ouiManufacturers[] = {
+    1, 2, 3, 4, 2, 5, 1, 3, 5, 2, 5, 6, 5, 3, 4,
+};
+
+// Bluetooth SIG company identifiers, sorted
+const uint16_t companyIds[] = {
+    0x0000, 0x0002, 0x0006, 0x000D, 0x000F, 0x004C, 0x0059, 0x0075, 0x0087, 0x00E0,
+    0x0171, 0x02E5, 0x038F,
+};
+
+const uint16_t companyManufacturers[] = {
+    7, 8, 1, 9, 10, 5, 11, 2, 12, 3, 13, 14, 4,
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+// Manufacturer lookup from the IEEE OUI registry and the Bluetooth SIG
+// company identifier list. The tables live in flash (OuiData.cpp, generated
+// by tools/gen_oui.py) and lookups are allocation-free binary searches.
+// Manufacturer index 0 is "Unknown".
+//
+// The checked-in OuiData.cpp is a placeholder: it is generated from the seed
+// lists in tools/data (the 15 OUIs the old if-chain knew and 13 common
+// company IDs), not from the registries, so most public addresses still
+// come out as "Unknown". Regenerate it from the IEEE and SIG downloads (see
+// the README, Manufacturer Database) before relying on the names.
+
+extern const uint16_t manufacturerCount;
+extern const uint32_t ouiCount;
+extern const uint16_t companyCount;
+extern const char manufacturerPool[];
+extern const uint32_t manufacturerOffsets[];
+extern const uint8_t ouiKeys[];
+extern const uint16_t ouiManufacturers[];
+extern const uint16_t companyIds[];
+extern const uint16_t companyManufacturers[];
+
+inline const char* manufacturerName(uint16_t index) {
+    if (index >= manufacturerCount) index = 0;
+    return manufacturerPool + manufacturerOffsets[index];
+}
+
+// oui is the top 24 bits of the MAC
+inline uint16_t lookupOui(uint32_t oui) {
+    uint32_t low = 0;
+    uint32_t high = ouiCount;
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        const uint8_t* key = ouiKeys + mid * 3;
+        uint32_t value = ((uint32_t)key[0] << 16) | ((uint32_t)key[1] << 8) | key[2];
+        if (value == oui) return ouiManufacturers[mid];
+        if (value < oui) low = mid + 1;
+        else high = mid;
+    }
+    return 0;
+}
+
+inline uint16_t lookupCompany(uint16_t companyId) {
+    uint32_t low = 0;
+    uint32_t high = companyCount;
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        if (companyIds[mid] == companyId) return companyManufacturers[mid];
+        if (companyIds[mid] < companyId) low = mid + 1;
+        else high = mid;
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+
+// Lightweight timing instrumentation, cheap enough to leave on. Durations
+// are CPU cycle counts collected in power-of-two histograms; recording one is
+// a cycle counter read, a count-leading-zeros and a few adds, with no locks.
+// Each histogram has a single writer task. Readers on other tasks see a
+// snapshot that may be a sample or two out of step, which is fine for
+// diagnostics.
+
+#define PERF_BUCKETS 24 // Bucket b holds [2^b, 2^(b+1)) cycles; the last is open ended
+
+inline uint32_t perfCycles() {
+    return ESP.getCycleCount();
+}
+
+struct PerfHistogram {
+    const char* name;
+    uint32_t count;
+    uint64_t totalCycles;
+    uint32_t maxCycles;
+    uint32_t buckets[PERF_BUCKETS];
+
+    explicit PerfHistogram(const char* histogramName) : name(histogramName) { clear(); }
+
+    void clear() {
+        count = 0;
+        totalCycles = 0;
+        maxCycles = 0;
+        for (int i = 0; i < PERF_BUCKETS; i++) buckets[i] = 0;
+    }
+
+    void record(uint32_t cycles) {
+        int bucket = cycles == 0 ? 0 : 31 - __builtin_clz(cycles);
+        if (bucket >= PERF_BUCKETS) bucket = PERF_BUCKETS - 1;
+        buckets[bucket]++;
+        count++;
+        totalCycles += cycles;
+        if (cycles > maxCycles) maxCycles = cycles;
+    }
+
+    uint32_t meanCycles() const {
+        return count > 0 ? (uint32_t)(totalCycles / count) : 0;
+    }
+
+    // Upper bound of the bucket holding the given percentile
+    uint32_t percentileCycles(uint32_t percent) const {
+        if (count == 0) return 0;
+        uint32_t rank = (uint32_t)(((uint64_t)count * percent + 99) / 100);
+        uint32_t seen = 0;
+        for (int i = 0; i < PERF_BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen >= rank) return i == PERF_BUCKETS - 1 ? maxCycles : (2U << i) - 1;
+        }
+        return maxCycles;
+    }
+};
+
+// Times the enclosing scope into a histogram
+class PerfTimer {
+public:
+    explicit PerfTimer(PerfHistogram& target) : histogram(target), start(perfCycles()) {}
+    ~PerfTimer() { histogram.record(perfCycles() - start); }
+
+private:
+    PerfHistogram& histogram;
+    uint32_t start;
+};
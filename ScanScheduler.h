@@ -0,0 +1,226 @@
+#pragma once
+
+#include <stdint.h>
+#include "Hal.h"
+
+// Adaptive scan schedule. Once per period the scan task reports how many
+// adverts arrived, how many devices were new (and whether they had a name),
+// how far the sighting queue backed up and whether it dropped anything. The
+// scheduler then picks a duty level (scan window and interval) and whether
+// to scan actively:
+//
+// - Overload (drops, a deep backlog or more adverts than SCAN_CPU_LIMIT)
+//   turns active scanning off first, since scan responses roughly double
+//   the callback rate, then steps the duty down.
+// - A quiet band (few adverts, no new devices) steps the duty down slowly to
+//   save power, but not below SCAN_QUIET_LEVEL so arrivals are still caught.
+// - Otherwise the duty steps back up, after a few calm periods so it does not
+//   flap, while the projected rate has headroom.
+// - Active scanning runs in short bursts only while newly seen devices have
+//   no name yet, so their scan responses can supply one.
+//
+// The busiest level is capped by SCAN_POWER_LIMIT. Every decision is counted.
+
+#ifndef SCAN_POWER_LIMIT
+#define SCAN_POWER_LIMIT 100 // Highest radio duty in percent
+#endif
+#ifndef SCAN_CPU_LIMIT
+#define SCAN_CPU_LIMIT 1500 // Adverts per second the scan task keeps up with
+#endif
+#define SCHEDULE_PERIOD     2000 // ms between decisions
+#define SCAN_QUIET_RATE     20   // Adverts per second below which the air is quiet
+#define SCAN_QUIET_PERIODS  15   // Quiet periods before each step down
+#define SCAN_QUIET_LEVEL    3    // Lowest duty the quiet band steps down to
+#define SCAN_BACKLOG_HIGH   75   // Percent of the sighting queue
+#define SCAN_BOOST_PERIODS  3    // Calm periods before each step up
+#define SCAN_ACTIVE_BURST   4000 // ms of active scanning per burst
+#define SCAN_ACTIVE_HOLDOFF 10000 // ms between bursts
+
+#define SCAN_LEVEL_COUNT 5
+
+// Duty levels, busiest first. Adverts arrive in a burst during each window,
+// so lower levels shorten the window as well as lengthening the interval.
+inline ScanSettings scanLevelSettings(uint8_t level, bool active) {
+    static const uint16_t windows[SCAN_LEVEL_COUNT] = {99, 50, 30, 30, 30};
+    static const uint16_t intervals[SCAN_LEVEL_COUNT] = {100, 100, 120, 240, 480};
+    ScanSettings settings;
+    settings.window = windows[level];
+    settings.interval = intervals[level];
+    settings.active = active;
+    return settings;
+}
+
+inline uint32_t scanLevelDuty(uint8_t level) {
+    ScanSettings settings = scanLevelSettings(level, false);
+    return (uint32_t)settings.window * 100 / settings.interval;
+}
+
+struct ScanSchedulerStats {
+    uint32_t advertRate;     // Adverts per second over the last period
+    uint32_t newDeviceRate;  // New devices per minute over the last period
+    uint8_t backlogPeak;     // Percent of the queue, last period
+    unsigned long decisions; // Periods evaluated
+    unsigned long changes;   // Settings applied
+    unsigned long throttles; // Steps down or active scans cut short for load
+    unsigned long boosts;    // Steps back up
+    unsigned long quietSteps; // Steps down for quiet
+    unsigned long activeBursts;
+    unsigned long drops;     // Sightings the queue dropped
+    unsigned long levelMillis[SCAN_LEVEL_COUNT]; // Time spent at each level
+    unsigned long activeMillis; // Time spent scanning actively
+
+    // Radio duty over the whole run, in percent
+    uint32_t dutyPercent() const {
+        uint64_t total = 0;
+        uint64_t listening = 0;
+        for (uint8_t i = 0; i < SCAN_LEVEL_COUNT; i++) {
+            total += levelMillis[i];
+            listening += (uint64_t)levelMillis[i] * scanLevelDuty(i);
+        }
+        return total > 0 ? (uint32_t)(listening / total) : scanLevelDuty(0);
+    }
+};
+
+class ScanScheduler {
+public:
+    ScanScheduler() { reset(0); }
+
+    void reset(uint32_t now) {
+        minLevel = 0;
+        while (minLevel < SCAN_LEVEL_COUNT - 1 && scanLevelDuty(minLevel) > SCAN_POWER_LIMIT) minLevel++;
+        currentLevel = minLevel;
+        active = false;
+        periodStart = now;
+        lastAccounted = now;
+        activeUntil = 0;
+        lastBurst = now - SCAN_ACTIVE_HOLDOFF;
+        adverts = 0;
+        newDevices = 0;
+        pendingNames = 0;
+        backlogPeak = 0;
+        lastDropped = 0;
+        droppedThisPeriod = 0;
+        quietPeriods = 0;
+        calmPeriods = 0;
+        counters = ScanSchedulerStats();
+    }
+
+    // Fed by the scan task as it drains the sighting queue
+    void noteAdverts(uint32_t count) { adverts += count; }
+
+    void noteNewDevice(bool named) {
+        newDevices++;
+        if (!named && !active) pendingNames++;
+    }
+
+    void noteBacklog(uint32_t queued, uint32_t capacity) {
+        uint8_t percent = (uint8_t)(queued * 100 / capacity);
+        if (percent > backlogPeak) backlogPeak = percent;
+    }
+
+    // dropped is the queue's running total
+    void noteDropped(unsigned long dropped) {
+        droppedThisPeriod += dropped - lastDropped;
+        lastDropped = dropped;
+    }
+
+    // Decides once per period. Returns true if the settings changed.
+    bool update(uint32_t now) {
+        counters.levelMillis[currentLevel] += now - lastAccounted;
+        if (active) counters.activeMillis += now - lastAccounted;
+        lastAccounted = now;
+
+        if (active && (int32_t)(now - activeUntil) >= 0) {
+            active = false;
+            counters.changes++;
+            return true;
+        }
+        uint32_t elapsed = now - periodStart;
+        if (elapsed < SCHEDULE_PERIOD) return false;
+
+        counters.decisions++;
+        counters.advertRate = adverts * 1000 / elapsed;
+        counters.newDeviceRate = newDevices * 60000 / elapsed;
+        counters.backlogPeak = backlogPeak;
+        counters.drops += droppedThisPeriod;
+
+        uint8_t level = currentLevel;
+        bool wantActive = active;
+        bool overloaded = droppedThisPeriod > 0 || backlogPeak >= SCAN_BACKLOG_HIGH ||
+                          counters.advertRate > SCAN_CPU_LIMIT;
+        bool quiet = counters.advertRate < SCAN_QUIET_RATE && newDevices == 0;
+
+        if (overloaded) {
+            quietPeriods = 0;
+            calmPeriods = 0;
+            if (wantActive) {
+                wantActive = false;
+            } else if (level < SCAN_LEVEL_COUNT - 1) {
+                level++;
+            }
+            counters.throttles++;
+        } else if (quiet) {
+            calmPeriods = 0;
+            if (++quietPeriods >= SCAN_QUIET_PERIODS && level < SCAN_QUIET_LEVEL) {
+                quietPeriods = 0;
+                level++;
+                counters.quietSteps++;
+            }
+        } else {
+            quietPeriods = 0;
+            if (level > minLevel && ++calmPeriods >= SCAN_BOOST_PERIODS) {
+                calmPeriods = 0;
+                uint32_t projected = counters.advertRate * scanLevelDuty(level - 1) / scanLevelDuty(level);
+                if (projected < SCAN_CPU_LIMIT * 3 / 4) {
+                    level--;
+                    counters.boosts++;
+                }
+            }
+        }
+
+        // Scan responses roughly double the rate, so only burst with headroom
+        if (!overloaded && !wantActive && pendingNames > 0 &&
+            counters.advertRate * 2 < SCAN_CPU_LIMIT && now - lastBurst >= SCAN_ACTIVE_HOLDOFF) {
+            wantActive = true;
+            pendingNames = 0;
+            activeUntil = now + SCAN_ACTIVE_BURST;
+            lastBurst = now;
+            counters.activeBursts++;
+        }
+
+        periodStart = now;
+        adverts = 0;
+        newDevices = 0;
+        backlogPeak = 0;
+        droppedThisPeriod = 0;
+
+        if (level == currentLevel && wantActive == active) return false;
+        currentLevel = level;
+        active = wantActive;
+        counters.changes++;
+        return true;
+    }
+
+    ScanSettings settings() const { return scanLevelSettings(currentLevel, active); }
+    uint8_t level() const { return currentLevel; }
+    bool scanningActively() const { return active; }
+    const ScanSchedulerStats& stats() const { return counters; }
+
+private:
+    uint8_t minLevel;     // Busiest level the power limit allows
+    uint8_t currentLevel;
+    bool active;
+    uint32_t periodStart;
+    uint32_t lastAccounted;
+    uint32_t activeUntil;
+    uint32_t lastBurst;
+    uint32_t adverts;
+    uint32_t newDevices;
+    uint32_t pendingNames; // New devices seen without a name while passive
+    uint8_t backlogPeak;
+    unsigned long lastDropped;
+    unsigned long droppedThisPeriod;
+    uint8_t quietPeriods;
+    uint8_t calmPeriods;
+    ScanSchedulerStats counters;
+};
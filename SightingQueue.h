@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+// Lock-free single-producer/single-consumer ring buffer. The BLE callback
+// pushes fixed-size sighting records and the scan task pops them in batches;
+// neither side ever blocks. When the ring is full the new record is dropped
+// and counted instead.
+//
+// Capacity must be a power of two. One slot is never used so that head ==
+// tail always means empty.
+
+template <typename T, uint32_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0), dropped(0) {}
+
+    // Producer side
+    bool push(const T& item) {
+        uint32_t currentHead = head.load(std::memory_order_relaxed);
+        uint32_t nextHead = (currentHead + 1) & MASK;
+        if (nextHead == tail.load(std::memory_order_acquire)) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        items[currentHead] = item;
+        head.store(nextHead, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T& item) {
+        uint32_t currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail == head.load(std::memory_order_acquire)) return false;
+        item = items[currentTail];
+        tail.store((currentTail + 1) & MASK, std::memory_order_release);
+        return true;
+    }
+
+    uint32_t size() const {
+        return (head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire)) & MASK;
+    }
+
+    uint32_t capacity() const { return Capacity - 1; }
+    uint32_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    static const uint32_t MASK = Capacity - 1;
+
+    T items[Capacity];
+    std::atomic<uint32_t> head; // Written only by the producer
+    std::atomic<uint32_t> tail; // Written only by the consumer
+    std::atomic<uint32_t> dropped;
+};
+
+#define SIGHTING_NAME_LENGTH 20
+
+// One advert as seen by the BLE callback
+struct Sighting {
+    uint64_t mac;
+    uint32_t timestamp;   // millis()
+    uint32_t fingerprint; // Stable payload fields of a rotating address, or 0
+    int8_t rssi;
+    uint8_t addressKind;  // AddressKind
+    uint16_t company;     // Advertised company ID, or COMPANY_NONE
+    uint8_t rule;         // Alert rule that decides this device
+    char name[SIGHTING_NAME_LENGTH];
+};
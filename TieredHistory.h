@@ -0,0 +1,171 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Multi-resolution history of device counts in fixed memory. Readings are
+// folded into one-minute samples, and every finer tier is downsampled into
+// the next one (15 minutes, hour, day) as it fills, keeping the minimum,
+// maximum and average of the samples it covers. Each tier is a ring buffer,
+// so any tier can be read back at any time without touching the raw data.
+
+enum HistoryTier {
+    TIER_MINUTE,
+    TIER_QUARTER_HOUR,
+    TIER_HOUR,
+    TIER_DAY,
+    TIER_COUNT
+};
+
+#define HISTORY_SERIES 2 // Total and usable devices
+
+struct HistoryPoint {
+    uint16_t min;
+    uint16_t max;
+    uint16_t avg;
+};
+
+class TieredHistory {
+public:
+    // Samples kept per tier: an hour of minutes, a day of quarter hours,
+    // a week of hours and three months of days
+    static const uint16_t MINUTE_SAMPLES = 60;
+    static const uint16_t QUARTER_HOUR_SAMPLES = 96;
+    static const uint16_t HOUR_SAMPLES = 168;
+    static const uint16_t DAY_SAMPLES = 90;
+    static const uint16_t TOTAL_SAMPLES = MINUTE_SAMPLES + QUARTER_HOUR_SAMPLES + HOUR_SAMPLES + DAY_SAMPLES;
+
+    TieredHistory() { clear(); }
+
+    void clear() {
+        memset(points, 0, sizeof(points));
+        memset(heads, 0, sizeof(heads));
+        memset(counts, 0, sizeof(counts));
+        memset(pending, 0, sizeof(pending));
+        memset(pendingCounts, 0, sizeof(pendingCounts));
+        minuteCount = 0;
+        memset(lastReading, 0, sizeof(lastReading));
+        updates = 0;
+    }
+
+    static uint16_t length(HistoryTier tier) {
+        static const uint16_t lengths[TIER_COUNT] = {MINUTE_SAMPLES, QUARTER_HOUR_SAMPLES, HOUR_SAMPLES, DAY_SAMPLES};
+        return lengths[tier];
+    }
+
+    // Samples of the finer tier that make up one sample of this tier
+    static uint16_t factor(HistoryTier tier) {
+        static const uint16_t factors[TIER_COUNT] = {1, 15, 4, 24};
+        return factors[tier];
+    }
+
+    // Adds an instantaneous reading, one value per series, to the current minute
+    void addReading(const uint16_t* values) {
+        for (int s = 0; s < HISTORY_SERIES; s++) {
+            accumulate(minuteAccumulator[s], minuteCount, values[s], values[s], values[s]);
+        }
+        minuteCount++;
+        memcpy(lastReading, values, sizeof(lastReading));
+    }
+
+    // Closes the current minute and rolls it up through the coarser tiers.
+    // A minute without readings repeats the last reading.
+    void closeMinute() {
+        HistoryPoint minute[HISTORY_SERIES];
+        for (int s = 0; s < HISTORY_SERIES; s++) {
+            if (minuteCount == 0) {
+                minute[s].min = minute[s].max = minute[s].avg = lastReading[s];
+            } else {
+                minute[s] = finish(minuteAccumulator[s], minuteCount);
+            }
+        }
+        minuteCount = 0;
+        push(TIER_MINUTE, minute);
+    }
+
+    // Valid samples in a tier, up to its length
+    uint16_t count(HistoryTier tier) const { return counts[tier]; }
+
+    // age 0 is the newest sample
+    const HistoryPoint& get(HistoryTier tier, int series, uint16_t age) const {
+        uint16_t len = length(tier);
+        uint16_t slot = (heads[tier] + len - 1 - age) % len;
+        return points[series][offset(tier) + slot];
+    }
+
+    // Changes whenever any tier gains a sample
+    uint32_t version() const { return updates; }
+
+    static size_t memoryUsed() { return sizeof(TieredHistory); }
+
+private:
+    struct Accumulator {
+        uint16_t min;
+        uint16_t max;
+        uint32_t sum;
+    };
+
+    static uint16_t offset(HistoryTier tier) {
+        uint16_t total = 0;
+        for (int t = 0; t < tier; t++) total += length((HistoryTier)t);
+        return total;
+    }
+
+    static void accumulate(Accumulator& acc, uint16_t n, uint16_t min, uint16_t max, uint16_t avg) {
+        if (n == 0) {
+            acc.min = min;
+            acc.max = max;
+            acc.sum = avg;
+            return;
+        }
+        if (min < acc.min) acc.min = min;
+        if (max > acc.max) acc.max = max;
+        acc.sum += avg;
+    }
+
+    static HistoryPoint finish(const Accumulator& acc, uint16_t n) {
+        HistoryPoint point;
+        point.min = acc.min;
+        point.max = acc.max;
+        point.avg = (acc.sum + n / 2) / n;
+        return point;
+    }
+
+    void push(HistoryTier tier, const HistoryPoint* sample) {
+        uint16_t len = length(tier);
+        for (int s = 0; s < HISTORY_SERIES; s++) {
+            points[s][offset(tier) + heads[tier]] = sample[s];
+        }
+        heads[tier] = (heads[tier] + 1) % len;
+        if (counts[tier] < len) counts[tier]++;
+        updates++;
+
+        if (tier + 1 >= TIER_COUNT) return;
+
+        // Fold into the next tier; the coarse min/max cover the fine ones and
+        // the coarse average is the mean of the fine averages
+        HistoryTier next = (HistoryTier)(tier + 1);
+        for (int s = 0; s < HISTORY_SERIES; s++) {
+            accumulate(pending[next][s], pendingCounts[next], sample[s].min, sample[s].max, sample[s].avg);
+        }
+        pendingCounts[next]++;
+        if (pendingCounts[next] == factor(next)) {
+            HistoryPoint rolled[HISTORY_SERIES];
+            for (int s = 0; s < HISTORY_SERIES; s++) {
+                rolled[s] = finish(pending[next][s], pendingCounts[next]);
+            }
+            pendingCounts[next] = 0;
+            push(next, rolled);
+        }
+    }
+
+    HistoryPoint points[HISTORY_SERIES][TOTAL_SAMPLES];
+    uint16_t heads[TIER_COUNT];
+    uint16_t counts[TIER_COUNT];
+    Accumulator pending[TIER_COUNT][HISTORY_SERIES];
+    uint16_t pendingCounts[TIER_COUNT];
+    Accumulator minuteAccumulator[HISTORY_SERIES];
+    uint16_t minuteCount;
+    uint16_t lastReading[HISTORY_SERIES];
+    uint32_t updates;
+};
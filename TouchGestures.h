@@ -0,0 +1,235 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "Hal.h"
+
+// Gesture recognition and kinetic scrolling, fed by the debounced samples the
+// touch driver queues (Hal.h). A stroke is a run of pressed samples ended by
+// one release. It starts with a down event; once it moves further than
+// TOUCH_SLOP it becomes a drag and reports its movement as it goes. The
+// release turns a stroke that never moved into a tap, and a drag still
+// moving fast enough into a swipe carrying its velocity.
+
+#define TOUCH_SLOP            8     // px a press may wander and still be a tap
+#define TOUCH_TAP_MAX         600   // ms a tap may be held
+#define TOUCH_SWIPE_VELOCITY  250   // px/s at release for a drag to end as a swipe
+#define TOUCH_VELOCITY_WINDOW 60000 // us of samples before the release that set its velocity
+#define TOUCH_HISTORY         8     // Samples kept for the velocity, a power of two
+
+#define KINETIC_TIME_CONSTANT 325  // ms for a fling to lose about two thirds of its speed
+#define KINETIC_STOP_VELOCITY 20   // px/s below which a fling stops
+#define KINETIC_MAX_VELOCITY  4000 // px/s
+#define KINETIC_MAX_STEP      100  // ms advanced per update, so a stall does not jump
+
+enum TouchEventType {
+    TOUCH_DOWN,  // Stroke started
+    TOUCH_DRAG,  // Moved by dx, dy since the last drag event
+    TOUCH_TAP,   // Released without moving
+    TOUCH_SWIPE, // Released while moving at vx, vy
+    TOUCH_UP     // Released: a drag that had slowed down, or a long press
+};
+
+struct TouchEvent {
+    TouchEventType type;
+    int16_t x;      // Current position; where the finger left for releases
+    int16_t y;
+    int16_t startX; // Where the stroke started
+    int16_t startY;
+    int16_t dx;
+    int16_t dy;
+    int32_t vx;     // px/s
+    int32_t vy;
+    uint32_t micros; // When the sample behind the event was taken
+};
+
+struct TouchGestureStats {
+    unsigned long strokes;
+    unsigned long taps;
+    unsigned long drags;
+    unsigned long swipes;
+};
+
+class TouchGestures {
+public:
+    TouchGestures() : down(false), dragging(false), historyCount(0), counters() {}
+
+    // Returns true with an event if the sample completed one
+    bool feed(const TouchSample& sample, TouchEvent& event) {
+        if (sample.pressed) {
+            if (!down) {
+                down = true;
+                dragging = false;
+                start = sample;
+                lastReported = sample.point;
+                historyCount = 0;
+                remember(sample);
+                counters.strokes++;
+                return report(TOUCH_DOWN, sample.point, sample.micros, event);
+            }
+            remember(sample);
+            if (!dragging) {
+                if (abs(sample.point.x - start.point.x) <= TOUCH_SLOP &&
+                    abs(sample.point.y - start.point.y) <= TOUCH_SLOP) return false;
+                dragging = true;
+                counters.drags++;
+            }
+            if (sample.point.x == lastReported.x && sample.point.y == lastReported.y) return false;
+            report(TOUCH_DRAG, sample.point, sample.micros, event);
+            event.dx = sample.point.x - lastReported.x;
+            event.dy = sample.point.y - lastReported.y;
+            lastReported = sample.point;
+            return true;
+        }
+
+        if (!down) return false;
+        down = false;
+        // A release carries no position; the stroke ends where it was last seen
+        const TouchSample& last = history[(historyCount - 1) % TOUCH_HISTORY];
+        if (!dragging) {
+            bool tap = sample.micros - start.micros <= TOUCH_TAP_MAX * 1000UL;
+            if (tap) counters.taps++;
+            return report(tap ? TOUCH_TAP : TOUCH_UP, last.point, sample.micros, event);
+        }
+        report(TOUCH_UP, last.point, sample.micros, event);
+        releaseVelocity(event.vx, event.vy);
+        if ((int64_t)event.vx * event.vx + (int64_t)event.vy * event.vy >=
+            (int64_t)TOUCH_SWIPE_VELOCITY * TOUCH_SWIPE_VELOCITY) {
+            event.type = TOUCH_SWIPE;
+            counters.swipes++;
+        }
+        return true;
+    }
+
+    bool pressed() const { return down; }
+    const TouchGestureStats& stats() const { return counters; }
+
+private:
+    bool down;
+    bool dragging;
+    TouchSample start;
+    TouchPoint lastReported;
+    TouchSample history[TOUCH_HISTORY]; // Ring of the latest pressed samples
+    uint32_t historyCount;
+    TouchGestureStats counters;
+
+    void remember(const TouchSample& sample) {
+        history[historyCount % TOUCH_HISTORY] = sample;
+        historyCount++;
+    }
+
+    bool report(TouchEventType type, TouchPoint point, uint32_t micros, TouchEvent& event) const {
+        event.type = type;
+        event.x = point.x;
+        event.y = point.y;
+        event.startX = start.point.x;
+        event.startY = start.point.y;
+        event.dx = 0;
+        event.dy = 0;
+        event.vx = 0;
+        event.vy = 0;
+        event.micros = micros;
+        return true;
+    }
+
+    // Average velocity over the samples in the window before the last one,
+    // so a finger that stopped before lifting does not fling
+    void releaseVelocity(int32_t& vx, int32_t& vy) const {
+        const TouchSample& last = history[(historyCount - 1) % TOUCH_HISTORY];
+        uint32_t kept = historyCount < TOUCH_HISTORY ? historyCount : TOUCH_HISTORY;
+        const TouchSample* first = &last;
+        for (uint32_t i = 2; i <= kept; i++) {
+            const TouchSample& older = history[(historyCount - i) % TOUCH_HISTORY];
+            if (last.micros - older.micros > TOUCH_VELOCITY_WINDOW) break;
+            first = &older;
+        }
+        uint32_t elapsed = last.micros - first->micros;
+        vx = 0;
+        vy = 0;
+        if (elapsed == 0) return;
+        vx = (int32_t)((int64_t)(last.point.x - first->point.x) * 1000000 / elapsed);
+        vy = (int32_t)((int64_t)(last.point.y - first->point.y) * 1000000 / elapsed);
+    }
+};
+
+// Scroll offset in pixels over [0, range], moved directly by drags and
+// coasting after a swipe with exponentially decaying speed
+class KineticScroll {
+public:
+    KineticScroll() : position(0), velocity(0), maxOffset(0), lastUpdate(0) {}
+
+    void reset() {
+        position = 0;
+        velocity = 0;
+    }
+
+    void setRange(int32_t range) {
+        maxOffset = range > 0 ? range : 0;
+        clamp();
+    }
+
+    void stop() { velocity = 0; }
+
+    // Content follows the finger: dragging up (negative dy) scrolls down
+    void drag(int32_t dy) {
+        velocity = 0;
+        position -= dy;
+        clamp();
+    }
+
+    // Moves without coasting, e.g. by a page or with the scroll bar thumb
+    void scrollTo(int32_t target) {
+        velocity = 0;
+        position = (float)target;
+        clamp();
+    }
+
+    void scrollBy(int32_t distance) { scrollTo(offset() + distance); }
+
+    // Starts coasting at the finger's velocity
+    void fling(int32_t fingerVelocity, uint32_t now) {
+        float speed = -(float)fingerVelocity;
+        if (speed > KINETIC_MAX_VELOCITY) speed = KINETIC_MAX_VELOCITY;
+        if (speed < -KINETIC_MAX_VELOCITY) speed = -KINETIC_MAX_VELOCITY;
+        velocity = fabsf(speed) < KINETIC_STOP_VELOCITY ? 0 : speed;
+        lastUpdate = now;
+    }
+
+    // Advances a fling to now (ms). Returns true while coasting.
+    bool update(uint32_t now) {
+        uint32_t elapsed = now - lastUpdate;
+        lastUpdate = now;
+        if (velocity == 0) return false;
+        if (elapsed > KINETIC_MAX_STEP) elapsed = KINETIC_MAX_STEP;
+
+        // Exact distance under exponential decay, so the path does not depend
+        // on how often this is called
+        float decay = expf(-(float)elapsed / KINETIC_TIME_CONSTANT);
+        position += velocity * KINETIC_TIME_CONSTANT / 1000 * (1 - decay);
+        velocity *= decay;
+        if (fabsf(velocity) < KINETIC_STOP_VELOCITY) velocity = 0;
+        clamp();
+        return true;
+    }
+
+    int32_t offset() const { return (int32_t)(position + 0.5f); }
+    int32_t range() const { return maxOffset; }
+    bool coasting() const { return velocity != 0; }
+
+private:
+    float position; // px
+    float velocity; // px/s, positive scrolls down
+    int32_t maxOffset;
+    uint32_t lastUpdate;
+
+    void clamp() {
+        if (position <= 0) {
+            position = 0;
+            if (velocity < 0) velocity = 0;
+        } else if (position >= maxOffset) {
+            position = (float)maxOffset;
+            if (velocity > 0) velocity = 0;
+        }
+    }
+};
@@ -0,0 +1,1280 @@
+#include <Arduino.h>
+#include <ctype.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AddressClusters.h"
+#include "AdvertData.h"
+#include "AlertRules.h"
+#include "Checks.h"
+#include "DeviceJson.h"
+#include "DeviceTable.h"
+#include "KnownDeviceStore.h"
+#include "MacSet.h"
+#include "NativeBoard.h"
+#include "OuiTable.h"
+#include "SightingQueue.h"
+#include "TieredHistory.h"
+
+typedef std::chrono::steady_clock CheckClock;
+
+static double elapsedNanos(CheckClock::time_point start) {
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(CheckClock::now() - start).count();
+}
+
+static std::vector<uint64_t> randomMacs(std::mt19937_64& random, size_t count) {
+    std::vector<uint64_t> macs(count);
+    for (size_t i = 0; i < count; i++) macs[i] = random() & 0xFFFFFFFFFFFFULL;
+    return macs;
+}
+
+// MacSet
+
+// Inserts entries distinct addresses into a set sized to hold them, looks
+// each up again and looks up as many absent ones. The std::set<String> it
+// replaced is timed alongside, with its heap counted by the native operator
+// new.
+template <uint32_t Capacity>
+static bool benchMacSetSize(uint32_t entries, std::mt19937_64& random) {
+    static MacSet<Capacity> set;
+    std::vector<uint64_t> macs = randomMacs(random, entries);
+    std::vector<uint64_t> absent = randomMacs(random, entries);
+
+    set.clear();
+    CheckClock::time_point start = CheckClock::now();
+    for (uint32_t i = 0; i < entries; i++) set.insert(macs[i], i);
+    double insertNanos = elapsedNanos(start);
+    uint32_t hits = 0;
+    start = CheckClock::now();
+    for (uint32_t i = 0; i < entries; i++) hits += set.contains(macs[i]);
+    double hitNanos = elapsedNanos(start);
+    uint32_t misses = 0;
+    start = CheckClock::now();
+    for (uint32_t i = 0; i < entries; i++) misses += !set.contains(absent[i]);
+    double missNanos = elapsedNanos(start);
+
+    std::vector<std::string> keys(entries);
+    for (uint32_t i = 0; i < entries; i++) {
+        char text[MAC_STRING_LENGTH];
+        formatMac(macs[i], text);
+        keys[i] = text;
+    }
+    size_t heapBefore = nativeHeapInUse();
+    bool tracking = nativeTrackHeap(true);
+    std::set<std::string>* tree = new std::set<std::string>();
+    start = CheckClock::now();
+    for (uint32_t i = 0; i < entries; i++) tree->insert(keys[i]);
+    double treeInsertNanos = elapsedNanos(start);
+    size_t treeBytes = nativeHeapInUse() - heapBefore;
+    nativeTrackHeap(tracking);
+    uint32_t treeHits = 0;
+    start = CheckClock::now();
+    for (uint32_t i = 0; i < entries; i++) treeHits += tree->count(keys[i]);
+    double treeHitNanos = elapsedNanos(start);
+    delete tree;
+
+    bool ok = hits == entries && misses == entries && set.size() == entries && set.evictions() == 0 &&
+              treeHits == entries;
+    printf("%8u %9u %8.1f%% %10zu %8.1f %8.1f %8.1f %11zu %8.1f %8.1f %s\n", entries, Capacity,
+           100.0 * set.size() / Capacity, sizeof(set), insertNanos / entries, hitNanos / entries,
+           missNanos / entries, treeBytes, treeInsertNanos / entries, treeHitNanos / entries, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+// At the sketch's capacity, a stream of new addresses must keep the set at
+// its load limit and keep the recently inserted ones
+static bool checkMacSetEviction(std::mt19937_64& random) {
+    static MacSet<2048> set;
+    const uint32_t inserts = 50000;
+    const uint32_t recent = 256;
+    std::vector<uint64_t> macs = randomMacs(random, inserts);
+    set.clear();
+    CheckClock::time_point start = CheckClock::now();
+    for (uint32_t i = 0; i < inserts; i++) set.insert(macs[i], i);
+    double insertNanos = elapsedNanos(start);
+    uint32_t kept = 0;
+    for (uint32_t i = inserts - recent; i < inserts; i++) kept += set.contains(macs[i]);
+    bool ok = set.size() == set.maxSize() && set.evictions() == inserts - set.maxSize() && kept == recent;
+    printf("Eviction at capacity %u: %u inserts, %u kept, %lu evicted, %.1f ns/insert, last %u all kept: %s\n",
+           set.capacity(), inserts, set.size(), set.evictions(), insertNanos / inserts, recent,
+           kept == recent ? "yes" : "no");
+    return ok;
+}
+
+int benchMacSet(unsigned seed) {
+    std::mt19937_64 random(seed);
+    printf("MacSet against a std::set of MAC strings (the String set it replaced): ns per operation, bytes\n");
+    printf("%8s %9s %9s %10s %8s %8s %8s %11s %8s %8s\n", "entries", "capacity", "occupancy", "bytes",
+           "insert", "hit", "miss", "set bytes", "insert", "hit");
+    bool ok = benchMacSetSize<2048>(1000, random);
+    ok = benchMacSetSize<16384>(10000, random) && ok;
+    ok = benchMacSetSize<131072>(50000, random) && ok;
+    ok = checkMacSetEviction(random) && ok;
+    return ok ? 0 : 1;
+}
+
+// OuiTable
+
+// The manufacturer lookup the table replaced: a String per call and one
+// compare per known OUI
+static std::string ifChainManufacturer(const std::string& macAddress) {
+    std::string oui = macAddress.substr(0, 8);
+    for (size_t i = 0; i < oui.size(); i++) oui[i] = (char)toupper(oui[i]);
+
+    if (oui == "D0:03:4B") return "Apple";
+    if (oui == "AC:DE:48") return "Apple";
+    if (oui == "00:25:00") return "Apple";
+    if (oui == "3C:E0:72") return "Apple";
+    if (oui == "B8:27:EB") return "Raspberry Pi";
+    if (oui == "00:1A:7D") return "Xiaomi";
+    if (oui == "F8:A7:63") return "Xiaomi";
+    if (oui == "00:50:F2") return "Microsoft";
+    if (oui == "00:15:5D") return "Microsoft";
+    if (oui == "28:11:A5") return "Google";
+    if (oui == "00:1A:11") return "Google";
+    if (oui == "D8:3A:DD") return "Google";
+    if (oui == "00:1B:44") return "Samsung";
+    if (oui == "00:15:99") return "Samsung";
+    if (oui == "94:35:0A") return "Samsung";
+
+    return "Unknown";
+}
+
+// The same search as lookupOui over keys packed the same way, for a table
+// the size of the full registry
+static uint32_t searchPacked(const std::vector<uint8_t>& keys, uint32_t count, uint32_t oui) {
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        const uint8_t* key = &keys[mid * 3];
+        uint32_t value = ((uint32_t)key[0] << 16) | ((uint32_t)key[1] << 8) | key[2];
+        if (value == oui) return mid + 1;
+        if (value < oui) low = mid + 1;
+        else high = mid;
+    }
+    return 0;
+}
+
+#define OUI_REGISTRY_SIZE 38000 // Roughly the IEEE MA-L registry
+#define OUI_BENCH_LOOKUPS 1000000
+
+int benchOuiTable(unsigned seed) {
+    std::mt19937_64 random(seed);
+    // Half the lookups hit an OUI the table knows, as in a room of phones
+    std::vector<uint64_t> macs = randomMacs(random, OUI_BENCH_LOOKUPS);
+    for (size_t i = 0; i < macs.size(); i += 2) {
+        const uint8_t* key = ouiKeys + (random() % ouiCount) * 3;
+        uint64_t oui = ((uint64_t)key[0] << 16) | ((uint64_t)key[1] << 8) | key[2];
+        macs[i] = (oui << 24) | (macs[i] & 0xFFFFFF);
+    }
+    std::vector<std::string> texts(macs.size());
+    for (size_t i = 0; i < macs.size(); i++) {
+        char text[MAC_STRING_LENGTH];
+        formatMac(macs[i], text);
+        texts[i] = text;
+    }
+
+    // Both must name every MAC the same way
+    uint32_t mismatches = 0;
+    for (size_t i = 0; i < macs.size(); i++) {
+        if (ifChainManufacturer(texts[i]) != manufacturerName(lookupOui((uint32_t)(macs[i] >> 24)))) mismatches++;
+    }
+
+    size_t length = 0;
+    CheckClock::time_point start = CheckClock::now();
+    for (size_t i = 0; i < texts.size(); i++) length += ifChainManufacturer(texts[i]).size();
+    double chainNanos = elapsedNanos(start);
+    unsigned long allocationsBefore = nativeAllocations();
+    bool tracking = nativeTrackHeap(true);
+    start = CheckClock::now();
+    for (size_t i = 0; i < macs.size(); i++) length += strlen(manufacturerName(lookupOui((uint32_t)(macs[i] >> 24))));
+    double tableNanos = elapsedNanos(start);
+    nativeTrackHeap(tracking);
+    unsigned long tableAllocations = nativeAllocations() - allocationsBefore;
+
+    std::vector<uint8_t> registry(OUI_REGISTRY_SIZE * 3);
+    uint32_t step = 0xFFFFFF / OUI_REGISTRY_SIZE;
+    for (uint32_t i = 0; i < OUI_REGISTRY_SIZE; i++) {
+        uint32_t oui = i * step + (uint32_t)(random() % step);
+        registry[i * 3] = (uint8_t)(oui >> 16);
+        registry[i * 3 + 1] = (uint8_t)(oui >> 8);
+        registry[i * 3 + 2] = (uint8_t)oui;
+    }
+    uint32_t found = 0;
+    start = CheckClock::now();
+    for (size_t i = 0; i < macs.size(); i++) found += searchPacked(registry, OUI_REGISTRY_SIZE, (uint32_t)(macs[i] >> 24)) != 0;
+    double registryNanos = elapsedNanos(start);
+
+    printf("Manufacturer lookup, %d MACs, half from known OUIs\n", OUI_BENCH_LOOKUPS);
+    printf("  if-chain          %.1f ns per lookup\n", chainNanos / macs.size());
+    printf("  table             %.1f ns per lookup over %u OUIs, %lu allocations\n", tableNanos / macs.size(), ouiCount,
+           tableAllocations);
+    printf("  registry size     %.1f ns per search over %d synthetic OUIs (%u found)\n", registryNanos / macs.size(),
+           OUI_REGISTRY_SIZE, found);
+    printf("  agreement         %u mismatches over %zu name bytes\n", mismatches, length);
+    return mismatches == 0 && tableAllocations == 0 ? 0 : 1;
+}
+
+// SpscQueue
+
+#define SPSC_STRESS_ITEMS    1000000
+#define SPSC_STRESS_CAPACITY 256 // As SIGHTING_QUEUE_SIZE
+
+// What the producer writes into a sighting for a sequence number, so a
+// torn or stale slot shows up as a mismatch
+static void fillSighting(Sighting& sighting, uint32_t sequence) {
+    sighting.mac = sequence;
+    sighting.timestamp = sequence * 2654435761U;
+    sighting.fingerprint = ~sequence;
+    sighting.rssi = (int8_t)(sequence & 0x7F);
+    for (size_t i = 0; i < sizeof(sighting.name) - 1; i++) sighting.name[i] = (char)('a' + (sequence + i) % 26);
+    sighting.name[sizeof(sighting.name) - 1] = '\0';
+}
+
+static bool sightingIntact(const Sighting& sighting) {
+    Sighting expected;
+    fillSighting(expected, (uint32_t)sighting.mac);
+    return sighting.timestamp == expected.timestamp && sighting.fingerprint == expected.fingerprint &&
+           sighting.rssi == expected.rssi && strcmp(sighting.name, expected.name) == 0;
+}
+
+// One producer thread pushes numbered sightings, yielding every yieldEvery
+// items, while a consumer thread pops them, sleeping every pauseEvery items
+// so the ring fills and overflows (0: never). Every pushed sighting must
+// come out once, in order and intact, and every refused one must be
+// counted as dropped.
+static bool stressSpscQueue(const char* label, uint32_t yieldEvery, uint32_t pauseEvery) {
+    SpscQueue<Sighting, SPSC_STRESS_CAPACITY>& queue = *new SpscQueue<Sighting, SPSC_STRESS_CAPACITY>();
+    std::atomic<bool> done(false);
+    uint32_t pushed = 0;
+    uint32_t refused = 0;
+
+    CheckClock::time_point start = CheckClock::now();
+    std::thread producer([&]() {
+        Sighting sighting;
+        memset(&sighting, 0, sizeof(sighting));
+        for (uint32_t sequence = 1; sequence <= SPSC_STRESS_ITEMS; sequence++) {
+            fillSighting(sighting, sequence);
+            if (queue.push(sighting)) pushed++;
+            else refused++;
+            if (yieldEvery > 0 && sequence % yieldEvery == 0) std::this_thread::yield();
+        }
+        done.store(true, std::memory_order_release);
+    });
+
+    uint32_t popped = 0;
+    uint32_t lastSequence = 0;
+    uint32_t outOfOrder = 0;
+    uint32_t torn = 0;
+    uint32_t maxSize = 0;
+    Sighting sighting;
+    while (true) {
+        bool finished = done.load(std::memory_order_acquire);
+        uint32_t size = queue.size();
+        if (size > maxSize) maxSize = size;
+        bool any = false;
+        while (queue.pop(sighting)) {
+            any = true;
+            popped++;
+            if ((uint32_t)sighting.mac <= lastSequence) outOfOrder++;
+            lastSequence = (uint32_t)sighting.mac;
+            if (!sightingIntact(sighting)) torn++;
+            if (pauseEvery > 0 && popped % pauseEvery == 0) std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        if (finished && !any) break;
+        if (!any) std::this_thread::yield(); // Let the producer run on a single core
+    }
+    producer.join();
+    double nanos = elapsedNanos(start);
+
+    bool ok = popped == pushed && pushed + refused == SPSC_STRESS_ITEMS && queue.droppedCount() == refused &&
+              outOfOrder == 0 && torn == 0 && maxSize <= queue.capacity() && queue.size() == 0;
+    printf("%-10s %9u %9u %9u %9lu %8u %5u %5u %7.1f %s\n", label, pushed, popped, refused,
+           (unsigned long)queue.droppedCount(), maxSize, outOfOrder, torn, nanos / SPSC_STRESS_ITEMS, ok ? "ok" : "FAIL");
+    delete &queue;
+    return ok;
+}
+
+int stressSightingQueue() {
+    printf("Sighting queue: %u slots, %d sightings from a producer thread to a consumer thread\n",
+           SPSC_STRESS_CAPACITY - 1, SPSC_STRESS_ITEMS);
+    printf("%-10s %9s %9s %9s %9s %8s %5s %5s %7s\n", "threads", "pushed", "popped", "refused", "dropped",
+           "max size", "order", "torn", "ns/item");
+    bool ok = stressSpscQueue("paced", 8, 0);
+    ok = stressSpscQueue("free", 0, 0) && ok;
+    ok = stressSpscQueue("stalling", 8, 256) && ok;
+    return ok ? 0 : 1;
+}
+
+// TieredHistory
+
+// The rollup a coarse sample should hold: min of the mins, max of the maxes
+// and the rounded mean of the averages of the fine samples it covers
+static HistoryPoint rollUp(const std::vector<HistoryPoint>& fine, size_t first, size_t count) {
+    HistoryPoint point = fine[first];
+    uint32_t sum = 0;
+    for (size_t i = first; i < first + count; i++) {
+        point.min = min(point.min, fine[i].min);
+        point.max = max(point.max, fine[i].max);
+        sum += fine[i].avg;
+    }
+    point.avg = (uint16_t)((sum + count / 2) / count);
+    return point;
+}
+
+// Compares every stored sample of every tier with a reference built
+// independently from all the minutes so far. Returns the mismatches.
+static uint32_t compareHistory(const TieredHistory& history, const std::vector<HistoryPoint> (&minutes)[HISTORY_SERIES],
+                               bool& countsOk) {
+    uint32_t mismatches = 0;
+    countsOk = true;
+    for (int s = 0; s < HISTORY_SERIES; s++) {
+        std::vector<HistoryPoint> tier = minutes[s];
+        for (int t = 0; t < TIER_COUNT; t++) {
+            HistoryTier current = (HistoryTier)t;
+            if (t > 0) {
+                std::vector<HistoryPoint> coarse;
+                uint16_t factor = TieredHistory::factor(current);
+                for (size_t first = 0; first + factor <= tier.size(); first += factor) {
+                    coarse.push_back(rollUp(tier, first, factor));
+                }
+                tier.swap(coarse);
+            }
+            uint16_t expected = (uint16_t)min(tier.size(), (size_t)TieredHistory::length(current));
+            if (history.count(current) != expected) countsOk = false;
+            for (uint16_t age = 0; age < history.count(current) && age < tier.size(); age++) {
+                const HistoryPoint& stored = history.get(current, s, age);
+                const HistoryPoint& want = tier[tier.size() - 1 - age];
+                if (stored.min != want.min || stored.max != want.max || stored.avg != want.avg) mismatches++;
+            }
+        }
+    }
+    return mismatches;
+}
+
+#define HISTORY_CHECK_DAYS 100 // Past the day tier's 90 samples, so every ring wraps
+
+int checkHistory(unsigned seed) {
+    static TieredHistory history;
+    std::mt19937 random(seed);
+    std::vector<HistoryPoint> minutes[HISTORY_SERIES];
+    history.clear();
+
+    printf("Tiered history: %u minute, %u quarter hour, %u hour and %u day samples, factors %u/%u/%u\n",
+           TieredHistory::MINUTE_SAMPLES, TieredHistory::QUARTER_HOUR_SAMPLES, TieredHistory::HOUR_SAMPLES,
+           TieredHistory::DAY_SAMPLES, TieredHistory::factor(TIER_QUARTER_HOUR), TieredHistory::factor(TIER_HOUR),
+           TieredHistory::factor(TIER_DAY));
+    printf("%6s %8s %8s %8s %8s %11s %7s\n", "day", "minutes", "quarter", "hours", "days", "mismatches", "counts");
+    bool ok = true;
+    uint16_t last[HISTORY_SERIES] = {0, 0};
+    const uint32_t totalMinutes = HISTORY_CHECK_DAYS * 24 * 60;
+    for (uint32_t minute = 1; minute <= totalMinutes; minute++) {
+        // A daily swing with noise; one minute in fifty has no readings and
+        // must repeat the last one
+        int readings = random() % 50 == 0 ? 0 : 1 + (int)(random() % 12);
+        HistoryPoint points[HISTORY_SERIES];
+        uint32_t sums[HISTORY_SERIES] = {0, 0};
+        for (int r = 0; r < readings; r++) {
+            uint16_t base = (uint16_t)(120 + 100 * sin(minute * 2 * M_PI / 1440));
+            uint16_t values[HISTORY_SERIES] = {(uint16_t)(base + random() % 40), (uint16_t)(random() % (base / 2 + 1))};
+            history.addReading(values);
+            for (int s = 0; s < HISTORY_SERIES; s++) {
+                if (r == 0) points[s].min = points[s].max = values[s];
+                points[s].min = min(points[s].min, values[s]);
+                points[s].max = max(points[s].max, values[s]);
+                sums[s] += values[s];
+                last[s] = values[s];
+            }
+        }
+        for (int s = 0; s < HISTORY_SERIES; s++) {
+            if (readings == 0) {
+                points[s].min = points[s].max = points[s].avg = last[s];
+            } else {
+                points[s].avg = (uint16_t)((sums[s] + readings / 2) / readings);
+            }
+            minutes[s].push_back(points[s]);
+        }
+        uint32_t version = history.version();
+        history.closeMinute();
+        if (history.version() == version) ok = false;
+
+        // Checked after the first hours, as each ring first wraps, and daily
+        bool checkpoint = minute == 61 || minute == 15 * 97 || minute == 60 * 169 || minute % 1440 == 0;
+        if (checkpoint) {
+            bool countsOk;
+            uint32_t mismatches = compareHistory(history, minutes, countsOk);
+            if (minute % (10 * 1440) == 0 || minute < 1440 || mismatches > 0 || !countsOk) {
+                printf("%6.1f %8u %8u %8u %8u %11u %7s\n", minute / 1440.0, history.count(TIER_MINUTE),
+                       history.count(TIER_QUARTER_HOUR), history.count(TIER_HOUR), history.count(TIER_DAY), mismatches,
+                       countsOk ? "ok" : "FAIL");
+            }
+            if (mismatches > 0 || !countsOk) ok = false;
+        }
+    }
+
+    size_t expectedBytes = sizeof(HistoryPoint) * HISTORY_SERIES * TieredHistory::TOTAL_SAMPLES;
+    bool memoryOk = TieredHistory::memoryUsed() == sizeof(TieredHistory) && TieredHistory::memoryUsed() < 5 * 1024 &&
+                    TieredHistory::memoryUsed() - expectedBytes < 128;
+    printf("Memory: %zu bytes (%zu of samples), within 5 KB: %s\n", TieredHistory::memoryUsed(), expectedBytes,
+           memoryOk ? "ok" : "FAIL");
+    return ok && memoryOk ? 0 : 1;
+}
+
+// KnownDeviceStore
+
+#define KNOWN_CHECK_SET_SIZE   2048  // As KNOWN_DEVICE_CAPACITY in BLEMonitor.cpp
+#define KNOWN_CHECK_LOAD_COUNT 10000
+#define KNOWN_CHECK_LOAD_RUNS  100
+#define KNOWN_STORE_FLUSH_CHECK_INTERVAL 60000 // As KNOWN_STORE_FLUSH_INTERVAL
+
+static std::vector<uint8_t> readStoreFile(fs::FS& flash, const char* path) {
+    std::vector<uint8_t> bytes;
+    File file = flash.open(path, "r");
+    if (!file) return bytes;
+    bytes.resize(file.size());
+    file.read(bytes.data(), bytes.size());
+    return bytes;
+}
+
+// The addresses in a log's records, in file order, up to the first bad one
+static std::vector<uint64_t> decodeStoreFile(const std::vector<uint8_t>& bytes) {
+    std::vector<uint64_t> macs;
+    for (size_t at = KNOWN_STORE_HEADER_SIZE; at + KNOWN_RECORD_SIZE <= bytes.size(); at += KNOWN_RECORD_SIZE) {
+        uint64_t mac = 0;
+        for (int i = 0; i < 6; i++) mac = (mac << 8) | bytes[at + i];
+        macs.push_back(mac);
+    }
+    return macs;
+}
+
+static void writeStoreFile(fs::FS& flash, const char* path, const std::vector<uint8_t>& bytes) {
+    File file = flash.open(path, "w");
+    file.write(bytes.data(), bytes.size());
+}
+
+// Loads the log into a fresh set, as boot does, and checks it holds exactly
+// the expected addresses
+template <uint32_t Capacity>
+static bool loadsExactly(fs::FS& flash, const std::vector<uint64_t>& expected, uint32_t* loaded = nullptr) {
+    static MacSet<Capacity> set;
+    set.clear();
+    KnownDeviceStore store(flash);
+    uint32_t count = store.load([&](uint64_t mac) { set.insert(mac, 0); });
+    if (loaded) *loaded = count;
+    if (set.size() != expected.size()) return false;
+    for (uint64_t mac : expected) {
+        if (!set.contains(mac)) return false;
+    }
+    return true;
+}
+
+static void reportKnown(const char* label, bool ok) {
+    printf("  %-44s %s\n", label, ok ? "ok" : "FAIL");
+}
+
+int checkKnownDeviceStore(unsigned seed) {
+    std::mt19937_64 random(seed);
+    bool allOk = true;
+    printf("Known device store:\n");
+
+    // Appends: the first batch starts the log and the second is appended to
+    // it, and a reboot reads both back
+    {
+        fs::FS flash;
+        static MacSet<KNOWN_CHECK_SET_SIZE> set;
+        set.clear();
+        KnownDeviceStore store(flash);
+        store.load([&](uint64_t mac) { set.insert(mac, 0); });
+        std::vector<uint64_t> macs = randomMacs(random, 2 * (KNOWN_STORE_BATCH / 2));
+        bool ok = true;
+        for (size_t i = 0; i < macs.size(); i++) {
+            set.insert(macs[i], 0);
+            store.record(macs[i]);
+            if (store.shouldFlush(i, KNOWN_STORE_FLUSH_CHECK_INTERVAL)) ok = ok && store.flush(set, i);
+        }
+        ok = ok && store.pendingRecords() == 0 && store.writeCount() == 1 && store.compactionCount() == 1;
+        ok = ok && readStoreFile(flash, KNOWN_STORE_PATH).size() == KNOWN_STORE_HEADER_SIZE + macs.size() * KNOWN_RECORD_SIZE;
+        ok = ok && loadsExactly<KNOWN_CHECK_SET_SIZE>(flash, macs);
+        reportKnown("append, then reload", ok);
+        allOk = allOk && ok;
+    }
+
+    // A record torn by a power cut, and one with a bad CRC: loading stops at
+    // the damage and the next flush rewrites the log from the set
+    for (int damage = 0; damage < 2; damage++) {
+        fs::FS flash;
+        static MacSet<KNOWN_CHECK_SET_SIZE> set;
+        set.clear();
+        KnownDeviceStore writer(flash);
+        writer.load([&](uint64_t mac) { set.insert(mac, 0); });
+        std::vector<uint64_t> macs = randomMacs(random, 40);
+        for (uint64_t mac : macs) {
+            set.insert(mac, 0);
+            writer.record(mac);
+        }
+        bool ok = writer.flush(set, 0);
+
+        std::vector<uint8_t> bytes = readStoreFile(flash, KNOWN_STORE_PATH);
+        std::vector<uint64_t> logged = decodeStoreFile(bytes);
+        const size_t goodRecords = damage == 0 ? macs.size() : 25;
+        if (damage == 0) {
+            uint8_t torn[3] = {0x12, 0x34, 0x56}; // Half of another record
+            bytes.insert(bytes.end(), torn, torn + sizeof(torn));
+        } else {
+            bytes[KNOWN_STORE_HEADER_SIZE + goodRecords * KNOWN_RECORD_SIZE + 2] ^= 0x20;
+        }
+        writeStoreFile(flash, KNOWN_STORE_PATH, bytes);
+
+        std::vector<uint64_t> survivors(logged.begin(), logged.begin() + goodRecords);
+        uint32_t loaded = 0;
+        ok = ok && loadsExactly<KNOWN_CHECK_SET_SIZE>(flash, survivors, &loaded) && loaded == goodRecords;
+
+        // The board's set after that boot holds the survivors and the device
+        // seen since; the flush must compact rather than append to the tail
+        set.clear();
+        KnownDeviceStore store(flash);
+        store.load([&](uint64_t mac) { set.insert(mac, 0); });
+        uint64_t next = randomMacs(random, 1)[0];
+        set.insert(next, 0);
+        store.record(next);
+        survivors.push_back(next);
+        ok = ok && store.shouldFlush(0, KNOWN_STORE_FLUSH_CHECK_INTERVAL) == false &&
+             store.shouldFlush(KNOWN_STORE_FLUSH_CHECK_INTERVAL, KNOWN_STORE_FLUSH_CHECK_INTERVAL);
+        ok = ok && store.flush(set, KNOWN_STORE_FLUSH_CHECK_INTERVAL) && store.compactionCount() == 1;
+        ok = ok && readStoreFile(flash, KNOWN_STORE_PATH).size() ==
+                       KNOWN_STORE_HEADER_SIZE + survivors.size() * KNOWN_RECORD_SIZE;
+        ok = ok && loadsExactly<KNOWN_CHECK_SET_SIZE>(flash, survivors);
+        reportKnown(damage == 0 ? "torn last record, then compaction" : "bad CRC, then compaction", ok);
+        allOk = allOk && ok;
+    }
+
+    // Compaction: a small set that keeps evicting grows the log past twice
+    // its size, which must be rewritten to just the live addresses
+    {
+        fs::FS flash;
+        static MacSet<256> set;
+        set.clear();
+        KnownDeviceStore store(flash);
+        store.load([&](uint64_t mac) { set.insert(mac, 0); });
+        std::vector<uint64_t> macs = randomMacs(random, 5000);
+        bool ok = true;
+        uint32_t largestLog = 0;
+        for (size_t i = 0; i < macs.size(); i++) {
+            if (set.insert(macs[i], i)) store.record(macs[i]);
+            if (store.shouldFlush(i, KNOWN_STORE_FLUSH_CHECK_INTERVAL)) ok = ok && store.flush(set, i);
+            largestLog = max(largestLog, store.logRecords());
+        }
+        ok = ok && store.flush(set, macs.size()) && store.compactionCount() > 1 &&
+             largestLog <= max<uint32_t>(2 * set.maxSize(), KNOWN_STORE_BATCH * 4);
+        std::vector<uint64_t> live;
+        set.forEach([&](uint64_t mac) { live.push_back(mac); });
+        // The last flush may have appended after the last compaction, so
+        // the log can hold evicted addresses too, but never miss a live one
+        std::vector<uint64_t> logged = decodeStoreFile(readStoreFile(flash, KNOWN_STORE_PATH));
+        std::set<uint64_t> inLog(logged.begin(), logged.end());
+        for (uint64_t mac : live) ok = ok && inLog.count(mac) > 0;
+        printf("  %u records written for %u live, %lu compactions, log at most %u records\n",
+               (unsigned)macs.size(), (unsigned)live.size(), store.compactionCount(), (unsigned)largestLog);
+        reportKnown("compaction keeps the live set", ok);
+        allOk = allOk && ok;
+    }
+
+    // Recovery from a compaction cut short: while writing the temporary
+    // file (the old log is kept), and during the swap (the new log is used)
+    {
+        fs::FS flash;
+        static MacSet<KNOWN_CHECK_SET_SIZE> set;
+        set.clear();
+        KnownDeviceStore store(flash);
+        store.load([&](uint64_t mac) { set.insert(mac, 0); });
+        std::vector<uint64_t> macs = randomMacs(random, 100);
+        for (uint64_t mac : macs) {
+            set.insert(mac, 0);
+            store.record(mac);
+        }
+        bool ok = store.flush(set, 0);
+        std::vector<uint8_t> log = readStoreFile(flash, KNOWN_STORE_PATH);
+
+        std::vector<uint8_t> partial(log.begin(), log.begin() + log.size() / 2);
+        writeStoreFile(flash, KNOWN_STORE_TEMP_PATH, partial);
+        ok = ok && loadsExactly<KNOWN_CHECK_SET_SIZE>(flash, macs) && !flash.exists(KNOWN_STORE_TEMP_PATH);
+        reportKnown("cut off while writing the new log", ok);
+        allOk = allOk && ok;
+
+        ok = flash.rename(KNOWN_STORE_PATH, KNOWN_STORE_TEMP_PATH);
+        ok = ok && loadsExactly<KNOWN_CHECK_SET_SIZE>(flash, macs) && flash.exists(KNOWN_STORE_PATH) &&
+             !flash.exists(KNOWN_STORE_TEMP_PATH);
+        reportKnown("cut off during the swap", ok);
+        allOk = allOk && ok;
+    }
+
+    // Boot time for a 10k record log. The board's set keeps at most
+    // maxSize() of them, evicting the rest as it loads.
+    {
+        fs::FS flash;
+        static MacSet<16384> large;
+        large.clear();
+        std::vector<uint64_t> macs = randomMacs(random, KNOWN_CHECK_LOAD_COUNT);
+        for (uint64_t mac : macs) large.insert(mac, 0);
+        KnownDeviceStore writer(flash);
+        writer.load([](uint64_t) {});
+        bool ok = writer.flush(large, 0) && writer.logRecords() == KNOWN_CHECK_LOAD_COUNT;
+
+        CheckClock::time_point start = CheckClock::now();
+        for (int run = 0; run < KNOWN_CHECK_LOAD_RUNS; run++) {
+            large.clear();
+            KnownDeviceStore store(flash);
+            ok = ok && store.load([&](uint64_t mac) { large.insert(mac, 0); }) == KNOWN_CHECK_LOAD_COUNT;
+        }
+        double largeNanos = elapsedNanos(start) / KNOWN_CHECK_LOAD_RUNS;
+        ok = ok && large.size() == KNOWN_CHECK_LOAD_COUNT;
+
+        static MacSet<KNOWN_CHECK_SET_SIZE> board;
+        start = CheckClock::now();
+        for (int run = 0; run < KNOWN_CHECK_LOAD_RUNS; run++) {
+            board.clear();
+            KnownDeviceStore store(flash);
+            store.load([&](uint64_t mac) { board.insert(mac, 0); });
+        }
+        double boardNanos = elapsedNanos(start) / KNOWN_CHECK_LOAD_RUNS;
+        ok = ok && board.size() == board.maxSize();
+
+        printf("  load %u records: %.0f us into a set of %u, %.0f us into the board's %u (keeps %u)\n",
+               KNOWN_CHECK_LOAD_COUNT, largeNanos / 1000, large.capacity(), boardNanos / 1000, board.capacity(),
+               board.maxSize());
+        reportKnown("10k record load", ok);
+        allOk = allOk && ok;
+    }
+    return allOk ? 0 : 1;
+}
+
+// DeviceJson
+
+// Just enough of a JSON parser to check the cursors' documents: strict on
+// syntax, and keeps strings, numbers, arrays and objects for comparison
+struct JsonValue {
+    enum Type { NONE, STRING, NUMBER, ARRAY, OBJECT } type;
+    std::string text; // String contents, unescaped
+    double number;
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue> > members;
+
+    JsonValue() : type(NONE), number(0) {}
+
+    const JsonValue* member(const char* key) const {
+        for (size_t i = 0; i < members.size(); i++) {
+            if (members[i].first == key) return &members[i].second;
+        }
+        return nullptr;
+    }
+};
+
+class JsonParser {
+public:
+    explicit JsonParser(const std::string& text) : text(text), at(0) {}
+
+    // Parses the whole text as one value; false on any syntax error or
+    // trailing bytes
+    bool parse(JsonValue& value) {
+        return parseValue(value) && (skipSpace(), at == text.size());
+    }
+
+private:
+    void skipSpace() {
+        while (at < text.size() && strchr(" \t\r\n", text[at]) != nullptr) at++;
+    }
+
+    bool take(char c) {
+        skipSpace();
+        if (at >= text.size() || text[at] != c) return false;
+        at++;
+        return true;
+    }
+
+    bool parseValue(JsonValue& value) {
+        skipSpace();
+        if (at >= text.size()) return false;
+        char c = text[at];
+        if (c == '"') {
+            value.type = JsonValue::STRING;
+            return parseString(value.text);
+        }
+        if (c == '[') {
+            value.type = JsonValue::ARRAY;
+            at++;
+            if (take(']')) return true;
+            do {
+                value.items.push_back(JsonValue());
+                if (!parseValue(value.items.back())) return false;
+            } while (take(','));
+            return take(']');
+        }
+        if (c == '{') {
+            value.type = JsonValue::OBJECT;
+            at++;
+            if (take('}')) return true;
+            do {
+                std::string key;
+                skipSpace();
+                if (!parseString(key) || !take(':')) return false;
+                value.members.push_back(std::make_pair(key, JsonValue()));
+                if (!parseValue(value.members.back().second)) return false;
+            } while (take(','));
+            return take('}');
+        }
+        const char* start = text.c_str() + at;
+        char* end;
+        value.number = strtod(start, &end);
+        if (end == start || !(c == '-' || isdigit((unsigned char)c))) return false;
+        value.type = JsonValue::NUMBER;
+        at += end - start;
+        return true;
+    }
+
+    bool parseString(std::string& out) {
+        if (at >= text.size() || text[at] != '"') return false;
+        at++;
+        while (at < text.size()) {
+            unsigned char c = (unsigned char)text[at++];
+            if (c == '"') return true;
+            if (c < 0x20) return false; // Control characters must be escaped
+            if (c != '\\') {
+                out += (char)c;
+                continue;
+            }
+            if (at >= text.size()) return false;
+            char escape = text[at++];
+            const char* simple = strchr("\"\\/bfnrt", escape);
+            if (simple != nullptr && escape != '\0') {
+                out += "\"\\/\b\f\n\r\t"[simple - "\"\\/bfnrt"];
+            } else if (escape == 'u' && at + 4 <= text.size()) {
+                unsigned code = 0;
+                for (int i = 0; i < 4; i++) {
+                    char h = text[at++];
+                    if (!isxdigit((unsigned char)h)) return false;
+                    code = code * 16 + (isdigit((unsigned char)h) ? h - '0' : tolower(h) - 'a' + 10);
+                }
+                if (code >= 0x80) return false; // The cursors only escape control characters
+                out += (char)code;
+            } else {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    const std::string& text;
+    size_t at;
+};
+
+// Chunk sizes from one byte up to past the longest piece
+static const size_t jsonChunkSizes[] = {1, 2, 3, 5, 7, 16, 64, 127, JSON_PIECE_LENGTH - 1, JSON_PIECE_LENGTH,
+                                        JSON_PIECE_LENGTH + 1, 1024, 4096};
+#define JSON_CHUNK_GUARD 16 // Bytes past each chunk that must stay untouched
+
+// Drains a cursor in chunks of one size into a string. Fails if a chunk
+// writes past its length or the cursor never finishes.
+template <typename Cursor, typename Source>
+static bool drainJson(Cursor cursor, const Source& source, size_t chunk, std::string& document) {
+    std::vector<char> buffer(chunk + JSON_CHUNK_GUARD);
+    for (int calls = 0; calls < 1000000; calls++) {
+        memset(buffer.data(), 0x5A, buffer.size());
+        size_t n = cursor.fill(source, buffer.data(), chunk);
+        for (size_t i = chunk; i < buffer.size(); i++) {
+            if (buffer[i] != 0x5A) return false;
+        }
+        if (n > chunk) return false;
+        if (n == 0) return true;
+        document.append(buffer.data(), n);
+    }
+    return false;
+}
+
+static bool deviceJsonMatches(const JsonValue& document, const DeviceTable& table, uint8_t filter) {
+    if (document.type != JsonValue::ARRAY) return false;
+    size_t item = 0;
+    for (int row = 0; row < table.size(); row++) {
+        if (!table.hasFlags(row, filter)) continue;
+        if (item >= document.items.size()) return false;
+        const JsonValue& device = document.items[item++];
+        const DeviceRecord& record = table.at(row);
+        char address[MAC_STRING_LENGTH];
+        formatMac(record.mac, address);
+        const JsonValue* mac = device.member("mac");
+        const JsonValue* name = device.member("name");
+        const JsonValue* manufacturer = device.member("manufacturer");
+        const JsonValue* rssi = device.member("rssi");
+        const JsonValue* flags = device.member("flags");
+        const JsonValue* firstSeen = device.member("firstSeen");
+        const JsonValue* lastSeen = device.member("lastSeen");
+        if (device.members.size() != 7 || !mac || !name || !manufacturer || !rssi || !flags || !firstSeen ||
+            !lastSeen) {
+            return false;
+        }
+        if (mac->text != address || name->text != table.name(row) ||
+            manufacturer->text != manufacturerName(record.manufacturer) || rssi->number != record.rssi ||
+            flags->number != record.flags || firstSeen->number != record.firstSeen ||
+            lastSeen->number != record.lastSeen) {
+            return false;
+        }
+    }
+    return item == document.items.size();
+}
+
+static bool historyJsonMatches(const JsonValue& document, const TieredHistory& history, HistoryTier tier,
+                               const char* label) {
+    static const char* const seriesNames[HISTORY_SERIES] = {"total", "usable"};
+    const JsonValue* tierName = document.member("tier");
+    if (document.type != JsonValue::OBJECT || document.members.size() != 1 + HISTORY_SERIES || !tierName ||
+        tierName->text != label) {
+        return false;
+    }
+    for (int s = 0; s < HISTORY_SERIES; s++) {
+        const JsonValue* series = document.member(seriesNames[s]);
+        if (!series || series->type != JsonValue::ARRAY || series->items.size() != history.count(tier)) return false;
+        for (uint16_t i = 0; i < history.count(tier); i++) {
+            // Oldest first
+            const HistoryPoint& point = history.get(tier, s, history.count(tier) - 1 - i);
+            const JsonValue& sample = series->items[i];
+            if (sample.items.size() != 3 || sample.items[0].number != point.min ||
+                sample.items[1].number != point.max || sample.items[2].number != point.avg) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int checkDeviceJson(unsigned seed) {
+    std::mt19937_64 random(seed);
+    static DeviceTable table;
+    table.clear();
+
+    // Names that need escaping, up to a full name of escapes, which makes the
+    // longest device object
+    std::string quotes(DEVICE_NAME_LENGTH - 1, '"');
+    std::string controls(DEVICE_NAME_LENGTH - 1, '\x01');
+    const char* names[] = {"", "Phone", "Say \"hi\"", "back\\slash", "tab\tnew\nline", "Caf\xc3\xa9",
+                           quotes.c_str(), controls.c_str(), "/slash/", "0123456789abcdefghijkl"};
+    const int nameCount = sizeof(names) / sizeof(names[0]);
+    std::vector<uint64_t> macs = randomMacs(random, DEVICE_TABLE_SIZE);
+    for (int i = 0; i < DEVICE_TABLE_SIZE; i++) {
+        bool added;
+        int row = table.upsert(macs[i], (int8_t)(-30 - (int)(random() % 70)), (uint32_t)random(), added);
+        table.setName(row, names[i % nameCount]);
+        table.at(row).manufacturer = (uint16_t)(random() % 4 == 0 ? random() % 0x1000 : 0);
+        table.setFlags(row, (uint8_t)(random() & (DEVICE_SEEN | DEVICE_USABLE | DEVICE_COMPANY)));
+    }
+
+    bool ok = true;
+    printf("Device JSON, %d rows, chunks of %u to %u bytes:\n", table.size(), (unsigned)jsonChunkSizes[0],
+           (unsigned)jsonChunkSizes[sizeof(jsonChunkSizes) / sizeof(jsonChunkSizes[0]) - 1]);
+    const uint8_t filters[] = {DEVICE_SEEN, DEVICE_USABLE, DEVICE_ALERT};
+    const char* const filterNames[] = {"seen", "usable", "alert"};
+    for (int f = 0; f < 3; f++) {
+        std::string reference;
+        bool filterOk = true;
+        for (size_t chunk : jsonChunkSizes) {
+            std::string document;
+            filterOk = filterOk && drainJson(DeviceJsonCursor(filters[f]), table, chunk, document);
+            if (reference.empty()) reference = document;
+            filterOk = filterOk && document == reference;
+        }
+        JsonValue parsed;
+        filterOk = filterOk && JsonParser(reference).parse(parsed) && deviceJsonMatches(parsed, table, filters[f]);
+        printf("  %-8s %4u devices, %6u bytes  %s\n", filterNames[f], (unsigned)parsed.items.size(),
+               (unsigned)reference.size(), filterOk ? "ok" : "FAIL");
+        ok = ok && filterOk;
+    }
+
+    // History tiers, empty and after the rings have wrapped
+    static TieredHistory history;
+    history.clear();
+    const HistoryTier tiers[] = {TIER_MINUTE, TIER_QUARTER_HOUR, TIER_HOUR, TIER_DAY};
+    const char* const labels[] = {"1m", "15m", "1h", "1d"}; // As tierLabels in BLEMonitor.cpp
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            for (uint32_t minute = 0; minute < 10 * 24 * 60; minute++) {
+                uint16_t values[HISTORY_SERIES] = {(uint16_t)(random() % 300), (uint16_t)(random() % 100)};
+                history.addReading(values);
+                history.closeMinute();
+            }
+        }
+        for (int t = 0; t < TIER_COUNT; t++) {
+            std::string reference;
+            bool tierOk = true;
+            for (size_t chunk : jsonChunkSizes) {
+                std::string document;
+                tierOk = tierOk && drainJson(HistoryJsonCursor(tiers[t], labels[t]), history, chunk, document);
+                if (reference.empty()) reference = document;
+                tierOk = tierOk && document == reference;
+            }
+            JsonValue parsed;
+            tierOk = tierOk && JsonParser(reference).parse(parsed) &&
+                     historyJsonMatches(parsed, history, tiers[t], labels[t]);
+            printf("  history %-4s %3u samples, %5u bytes  %s\n", labels[t], history.count(tiers[t]),
+                   (unsigned)reference.size(), tierOk ? "ok" : "FAIL");
+            ok = ok && tierOk;
+        }
+    }
+    return ok ? 0 : 1;
+}
+
+// AdvertData
+
+#define ADVERT_FUZZ_PAYLOADS 1000000
+#define ADVERT_FUZZ_GUARD    16 // Bytes either side of a payload the parser must not touch
+
+// A payload the parser must cope with: random bytes, well-formed structures
+// cut short at a random point, or well-formed structures with a few bytes
+// changed. Lengths run past the 31 bytes of a legacy advert.
+static void fuzzPayload(std::mt19937& random, std::vector<uint8_t>& payload) {
+    static const uint8_t types[] = {AD_FLAGS, AD_UUID16_INCOMPLETE, AD_UUID16_COMPLETE, AD_UUID32_COMPLETE,
+                                    AD_UUID128_INCOMPLETE, AD_UUID128_COMPLETE, AD_NAME_SHORT, AD_NAME_COMPLETE,
+                                    AD_TX_POWER, AD_SERVICE_DATA16, AD_APPEARANCE, AD_MANUFACTURER_DATA, 0x00, 0x2A};
+    payload.clear();
+    int kind = random() % 3;
+    if (kind == 0) {
+        size_t length = random() % 64 == 0 ? random() % 256 : random() % 40;
+        for (size_t i = 0; i < length; i++) payload.push_back((uint8_t)random());
+        return;
+    }
+    size_t limit = random() % 8 == 0 ? 255 : 31;
+    while (payload.size() < limit) {
+        uint8_t dataLength = (uint8_t)(random() % 4 == 0 ? random() % 40 : random() % 8);
+        payload.push_back((uint8_t)(dataLength + 1));
+        payload.push_back(types[random() % sizeof(types)]);
+        for (uint8_t i = 0; i < dataLength; i++) payload.push_back((uint8_t)random());
+        if (random() % 6 == 0) break;
+    }
+    if (kind == 1) {
+        payload.resize(random() % (payload.size() + 1));
+    } else {
+        for (int edits = 1 + random() % 3; edits > 0 && !payload.empty(); edits--) {
+            payload[random() % payload.size()] = (uint8_t)(random() % 2 == 0 ? random() : random() % 4);
+        }
+    }
+}
+
+// Whether view..view+length lies within the payload
+static bool inPayload(const void* view, size_t length, const uint8_t* payload, size_t payloadLength) {
+    const uint8_t* start = (const uint8_t*)view;
+    return start >= payload && start + length <= payload + payloadLength;
+}
+
+// Checks one parse against the payload it came from: every view inside the
+// payload, every count and length within its field, and the present bits
+// consistent with the fields, as walked separately here
+static bool advertWithinBounds(const AdvertData& advert, const uint8_t* payload, size_t length) {
+    size_t uuid16Total = 0;
+    size_t uuid128Total = 0;
+    size_t uuid32Total = 0;
+    bool truncated = false;
+    for (size_t pos = 0; pos < length;) {
+        size_t fieldLength = payload[pos];
+        if (fieldLength == 0) break;
+        if (pos + 1 + fieldLength > length) {
+            truncated = true;
+            break;
+        }
+        uint8_t type = payload[pos + 1];
+        size_t dataLength = fieldLength - 1;
+        if (type == AD_UUID16_INCOMPLETE || type == AD_UUID16_COMPLETE) uuid16Total += dataLength / 2;
+        if (type == AD_UUID128_INCOMPLETE || type == AD_UUID128_COMPLETE) uuid128Total += dataLength / 16;
+        if (type == AD_UUID32_INCOMPLETE || type == AD_UUID32_COMPLETE) uuid32Total += dataLength / 4;
+        pos += 1 + fieldLength;
+    }
+
+    if (advert.has(ADVERT_TRUNCATED) != truncated) return false;
+    if (advert.uuid16Count != min(uuid16Total, (size_t)255) || advert.uuid128Count != min(uuid128Total, (size_t)255) ||
+        advert.uuid32Count != (uint8_t)uuid32Total) {
+        return false;
+    }
+    for (uint8_t i = 0; i < min(advert.uuid128Count, (uint8_t)ADVERT_MAX_UUID128); i++) {
+        if (!inPayload(advert.uuid128[i], 16, payload, length)) return false;
+    }
+    if (advert.has(ADVERT_HAS_NAME)) {
+        if (advert.nameLength == 0 || advert.nameLength > ADVERT_MAX_NAME ||
+            !inPayload(advert.name, advert.nameLength, payload, length)) {
+            return false;
+        }
+    } else if (advert.name != nullptr || advert.nameLength != 0 || advert.has(ADVERT_NAME_COMPLETE)) {
+        return false;
+    }
+    if (advert.has(ADVERT_HAS_MANUFACTURER)) {
+        if (!inPayload(advert.manufacturerData, advert.manufacturerDataLength, payload, length) ||
+            !inPayload(advert.manufacturerData - 2, 2, payload, length)) {
+            return false;
+        }
+    } else if (advert.manufacturerData != nullptr || advert.manufacturerDataLength != 0 ||
+               advert.company != COMPANY_NONE) {
+        return false;
+    }
+    if (!advert.has(ADVERT_HAS_FLAGS) && advert.flags != 0) return false;
+    if (!advert.has(ADVERT_HAS_TX_POWER) && advert.txPower != 0) return false;
+    if (!advert.has(ADVERT_HAS_APPEARANCE) && advert.appearance != 0) return false;
+    if (!advert.has(ADVERT_HAS_SERVICE_DATA) && advert.serviceDataUuid != 0) return false;
+
+    // The name copy stays within every buffer size and is terminated
+    for (size_t size = 0; size <= ADVERT_MAX_NAME + 2; size++) {
+        char name[ADVERT_MAX_NAME + 2 + ADVERT_FUZZ_GUARD];
+        memset(name, 0x5A, sizeof(name));
+        copyAdvertName(advert, name, size);
+        for (size_t i = size; i < sizeof(name); i++) {
+            if (name[i] != 0x5A) return false;
+        }
+        if (size > 0 && strnlen(name, size) != min((size_t)advert.nameLength, size - 1)) return false;
+    }
+    return true;
+}
+
+int fuzzAdvertParser(unsigned seed) {
+    std::mt19937 random(seed);
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> buffer;
+    unsigned long failures = 0;
+    unsigned long truncated = 0;
+    unsigned long named = 0;
+    unsigned long withManufacturer = 0;
+    uint32_t fingerprints = 0;
+    CheckClock::time_point start = CheckClock::now();
+    for (uint32_t i = 0; i < ADVERT_FUZZ_PAYLOADS; i++) {
+        fuzzPayload(random, payload);
+        // Guard bytes either side; the parser must never read them into a
+        // field, and they must come back unchanged
+        buffer.assign(payload.size() + 2 * ADVERT_FUZZ_GUARD, 0xA5);
+        std::copy(payload.begin(), payload.end(), buffer.begin() + ADVERT_FUZZ_GUARD);
+        const uint8_t* data = buffer.data() + ADVERT_FUZZ_GUARD;
+
+        AdvertData advert;
+        memset(&advert, 0xEE, sizeof(advert)); // The parser must set every field
+        parseAdvert(data, payload.size(), advert);
+        fingerprints ^= advertFingerprint(advert);
+        bool ok = advertWithinBounds(advert, data, payload.size());
+        for (size_t g = 0; g < ADVERT_FUZZ_GUARD; g++) {
+            if (buffer[g] != 0xA5 || buffer[buffer.size() - 1 - g] != 0xA5) ok = false;
+        }
+        if (!ok) {
+            if (failures < 5) {
+                printf("  out of bounds:");
+                for (uint8_t byte : payload) printf(" %02x", byte);
+                printf("\n");
+            }
+            failures++;
+        }
+        if (advert.has(ADVERT_TRUNCATED)) truncated++;
+        if (advert.has(ADVERT_HAS_NAME)) named++;
+        if (advert.has(ADVERT_HAS_MANUFACTURER)) withManufacturer++;
+    }
+    double nanos = elapsedNanos(start);
+
+    // No payload at all
+    AdvertData empty;
+    parseAdvert(nullptr, 10, empty);
+    bool emptyOk = empty.present == 0 && empty.name == nullptr && empty.manufacturerData == nullptr;
+
+    printf("Advert parser: %u fuzzed payloads, %.0f ns each with the checks (fingerprints %08x)\n",
+           ADVERT_FUZZ_PAYLOADS, nanos / ADVERT_FUZZ_PAYLOADS, (unsigned)fingerprints);
+    printf("  %lu truncated, %lu with a name, %lu with manufacturer data\n", truncated, named, withManufacturer);
+    printf("  fields within bounds: %s (%lu failures), null payload: %s\n", failures == 0 ? "ok" : "FAIL",
+           failures, emptyOk ? "ok" : "FAIL");
+    return failures == 0 && emptyOk ? 0 : 1;
+}
+
+// AlertRules
+
+#define RULES_CHECK_ABSENT     100000 // Absent addresses looked up per table size
+#define RULES_CHECK_BLOOM_RATE 0.03   // False positives allowed; about 1.2% expected at 10 bits and 4 hashes
+#define RULES_CHECK_MAC        0x112233445566ULL
+#define RULES_CHECK_SERVICE    0xFD5A
+#define RULES_CHECK_COMPANY    0x004C
+
+static const uint32_t rulesCheckSizes[] = {1, 100, 5000, 20000};
+
+// A rules file for the parsing cases, its first bad line and the entries
+// that should load from it
+struct RulesCase {
+    const char* label;
+    const char* text;
+    uint32_t errorLine;
+    uint32_t entries;
+};
+
+static const RulesCase rulesCases[] = {
+    {"rssi without its value", "alert company 0x004c rssi\nalert service 0xfd5a\n", 1, 1},
+    {"dwell without its value", "alert service 0xfd5a new dwell\n", 1, 0},
+    {"default option without its value", "default rssi\n", 1, 0},
+    {"option value not a number", "alert company 0x004c rssi new\n", 1, 0},
+    {"selector without its value", "allow mac\nallow oui 24:0a:c4\n", 1, 1},
+    {"value out of range", "alert company 0xffff\nalert service 0xfd5a rssi 21\n", 1, 0},
+    {"more words than a rule takes", "alert company 0x004c rssi -60 dwell 30 new\n"
+                                     "alert company 0x0006 rssi -60 dwell 30 new new\n", 2, 1},
+    // Cut at ALERT_RULE_LINE, the dwell would read 3
+    {"line past ALERT_RULE_LINE", "alert service 0xfd5a                                   "
+                                  "                                  dwell 300\nallow oui 24:0a:c4\n", 1, 1},
+    {"comments and blank lines", "# fleet\n\n   \nallow oui 24:0a:c4 # ours\n", 0, 1},
+    {"selector listed twice", "allow mac 24:0a:c4:12:34:56\nalert mac 24:0a:c4:12:34:56 rssi -50\n"
+                              "alert mac 24:0a:c4:12:34:57\n", 0, 2},
+};
+
+static void writeRulesFile(fs::FS& flash, const std::string& text) {
+    File file = flash.open(ALERT_RULES_PATH, "w");
+    file.write((const uint8_t*)text.data(), text.size());
+    file.close();
+}
+
+static std::string macRuleLine(const char* action, uint64_t mac, const char* options) {
+    char line[64];
+    snprintf(line, sizeof(line), "%s mac %02x:%02x:%02x:%02x:%02x:%02x%s\n", action, (unsigned)(mac >> 40) & 0xFF,
+             (unsigned)(mac >> 32) & 0xFF, (unsigned)(mac >> 24) & 0xFF, (unsigned)(mac >> 16) & 0xFF,
+             (unsigned)(mac >> 8) & 0xFF, (unsigned)mac & 0xFF, options);
+    return line;
+}
+
+static void reportRules(const char* label, bool ok) {
+    printf("  %-44s %s\n", label, ok ? "ok" : "FAIL");
+}
+
+// Every mix of address, address type, services and company against one rule
+// per selector kind: the most specific match must win. Rules are interned in
+// file order, so the MAC rule is 1, the OUI rule 2, the service rule 3 and
+// the company rule 4.
+static bool checkRulePrecedence(fs::FS& flash) {
+    writeRulesFile(flash, "alert mac 11:22:33:44:55:66 dwell 1\n"
+                          "alert oui 11:22:33 dwell 2\n"
+                          "alert service 0xfd5a dwell 3\n"
+                          "alert company 0x004c dwell 4\n");
+    AlertRules rules;
+    uint32_t errorLine;
+    if (!rules.load(flash, ALERT_RULES_PATH, errorLine) || errorLine != 0 || rules.ruleSetCount() != 5) return false;
+
+    static const uint64_t macs[] = {RULES_CHECK_MAC, 0x112233000001ULL, 0x665544332211ULL};
+    bool ok = true;
+    for (int m = 0; m < 3; m++) {
+        for (int isPublic = 0; isPublic < 2; isPublic++) {
+            for (int services = 0; services < 3; services++) {
+                for (int company = 0; company < 3; company++) {
+                    AdvertData advert;
+                    parseAdvert(nullptr, 0, advert);
+                    // No services, the rule's last of those kept, or more
+                    // than are kept with the rule's not among them
+                    if (services > 0) {
+                        for (uint8_t i = 0; i < ADVERT_MAX_UUID16; i++) advert.uuid16[i] = (uint16_t)(0x1800 + i);
+                        advert.uuid16Count = services == 1 ? ADVERT_MAX_UUID16 : ADVERT_MAX_UUID16 + 4;
+                        if (services == 1) advert.uuid16[ADVERT_MAX_UUID16 - 1] = RULES_CHECK_SERVICE;
+                    }
+                    if (company > 0) advert.company = company == 1 ? RULES_CHECK_COMPANY : 0x0006;
+
+                    uint8_t expected = RULE_DEFAULT;
+                    if (m == 0) expected = 1;
+                    else if (m == 1 && isPublic) expected = 2;
+                    else if (services == 1) expected = 3;
+                    else if (company == 1) expected = 4;
+                    uint8_t rule = rules.match(macs[m], isPublic != 0, advert);
+                    if (rule != expected) {
+                        printf("  address %012llx %s, services %d, company %d: rule %u, expected %u\n",
+                               (unsigned long long)macs[m], isPublic ? "public" : "random", services, company,
+                               rule, expected);
+                        ok = false;
+                    }
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+int checkAlertRules(unsigned seed) {
+    std::mt19937_64 random(seed);
+    fs::FS flash;
+    bool allOk = true;
+    printf("Alert rules:\n");
+
+    // Parsing: the first bad line is reported, it adds nothing, and the
+    // lines around it still load
+    for (const RulesCase& test : rulesCases) {
+        writeRulesFile(flash, test.text);
+        AlertRules rules;
+        uint32_t errorLine;
+        bool ok = rules.load(flash, ALERT_RULES_PATH, errorLine) && errorLine == test.errorLine &&
+                  rules.entryCount() == test.entries;
+        reportRules(test.label, ok);
+        allOk = allOk && ok;
+    }
+
+    // A bad default line leaves the built-in default, and a selector listed
+    // twice keeps its first rule
+    {
+        writeRulesFile(flash, "default rssi\n");
+        AlertRules rules;
+        uint32_t errorLine;
+        rules.load(flash, ALERT_RULES_PATH, errorLine);
+        bool ok = rules.alerts(RULE_DEFAULT, ALERT_FACT_NEW, -69, 0) &&
+                  !rules.alerts(RULE_DEFAULT, ALERT_FACT_NEW, -71, 0) && !rules.alerts(RULE_DEFAULT, 0, -40, 0);
+        reportRules("bad default line keeps the built-in one", ok);
+        allOk = allOk && ok;
+    }
+    {
+        writeRulesFile(flash, rulesCases[sizeof(rulesCases) / sizeof(rulesCases[0]) - 1].text);
+        AlertRules rules;
+        uint32_t errorLine;
+        rules.load(flash, ALERT_RULES_PATH, errorLine);
+        AdvertData advert;
+        parseAdvert(nullptr, 0, advert);
+        bool ok = rules.allows(rules.match(0x240AC4123456ULL, true, advert)) &&
+                  !rules.allows(rules.match(0x240AC4123457ULL, true, advert));
+        reportRules("first rule wins for a selector listed twice", ok);
+        allOk = allOk && ok;
+    }
+
+    bool precedenceOk = checkRulePrecedence(flash);
+    reportRules("precedence: mac, oui, service, company", precedenceOk);
+    allOk = allOk && precedenceOk;
+
+    // Bloom filter: every loaded address must match (no false negatives),
+    // with every fourth listed again under another rule, and few absent
+    // addresses may get past the filter to a probe
+    for (uint32_t size : rulesCheckSizes) {
+        std::vector<uint64_t> macs = randomMacs(random, size);
+        std::set<uint64_t> loaded(macs.begin(), macs.end());
+        std::string text;
+        for (uint64_t mac : macs) text += macRuleLine("allow", mac, "");
+        for (size_t i = 0; i < macs.size(); i += 4) text += macRuleLine("alert", macs[i], " rssi -50");
+        writeRulesFile(flash, text);
+
+        AlertRules rules;
+        uint32_t errorLine;
+        bool ok = rules.load(flash, ALERT_RULES_PATH, errorLine) && errorLine == 0 &&
+                  rules.entryCount() == loaded.size();
+        AdvertData advert;
+        parseAdvert(nullptr, 0, advert);
+        unsigned long misses = 0;
+        for (uint64_t mac : macs) {
+            if (!rules.allows(rules.match(mac, false, advert))) misses++;
+        }
+
+        unsigned long passesBefore = rules.bloomPassCount();
+        uint32_t absent = 0;
+        CheckClock::time_point start = CheckClock::now();
+        while (absent < RULES_CHECK_ABSENT) {
+            uint64_t mac = random() & 0xFFFFFFFFFFFFULL;
+            if (loaded.count(mac) > 0) continue;
+            if (rules.match(mac, false, advert) != RULE_DEFAULT) misses++;
+            absent++;
+        }
+        double nanos = elapsedNanos(start);
+        double falsePositives = (double)(rules.bloomPassCount() - passesBefore) / absent;
+        ok = ok && misses == 0 && falsePositives <= RULES_CHECK_BLOOM_RATE;
+        printf("  %6u selectors: %lu wrong matches, %.2f%% false positives, %.0f ns per absent match  %s\n", size,
+               misses, falsePositives * 100, nanos / absent, ok ? "ok" : "FAIL");
+        allOk = allOk && ok;
+    }
+    return allOk ? 0 : 1;
+}
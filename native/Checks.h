@@ -0,0 +1,14 @@
+#pragma once
+
+// Host checks and benchmarks of the sketch's building blocks, run by the
+// native harness (main.cpp) instead of a replay. Each prints a report and
+// returns the process exit code: 0 if every check passed, 1 otherwise.
+
+int benchMacSet(unsigned seed);
+int benchOuiTable(unsigned seed);
+int stressSightingQueue();
+int checkHistory(unsigned seed);
+int checkKnownDeviceStore(unsigned seed);
+int checkDeviceJson(unsigned seed);
+int fuzzAdvertParser(unsigned seed);
+int checkAlertRules(unsigned seed);
@@ -0,0 +1,183 @@
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <TFT_eSPI.h>
+#include <WiFi.h>
+#include <chrono>
+#include <new>
+#include <vector>
+#include "NativeBoard.h"
+
+// Definitions behind the native stand-ins in native/include
+
+HardwareSerial Serial;
+EspClass ESP;
+TftStats tftStats = {0, 0, 0, 0};
+LittleFSFS LittleFS;
+WiFiClass WiFi;
+
+// Simulated clock
+
+static uint64_t clockMicros = 0;
+
+void nativeSetMicros(uint64_t now) { clockMicros = now; }
+unsigned long millis() { return (unsigned long)(clockMicros / 1000); }
+unsigned long micros() { return (unsigned long)clockMicros; }
+void delay(unsigned long) {}
+
+// Heap accounting. Only blocks allocated while tracking is on are counted,
+// so the harness's own bookkeeping stays out of the figures. Each block
+// carries its size and whether it was counted in front of it.
+
+struct BlockHeader {
+    size_t size;
+    bool tracked;
+};
+
+static_assert(sizeof(BlockHeader) <= sizeof(max_align_t), "Block header must fit the alignment padding");
+
+static bool trackHeap = true;
+static size_t heapInUse = 0;
+static size_t heapPeak = 0;
+static unsigned long allocations = 0;
+
+bool nativeTrackHeap(bool on) {
+    bool was = trackHeap;
+    trackHeap = on;
+    return was;
+}
+
+size_t nativeHeapInUse() { return heapInUse; }
+size_t nativeHeapPeak() { return heapPeak; }
+unsigned long nativeAllocations() { return allocations; }
+
+void nativeResetHeapPeak() {
+    heapPeak = heapInUse;
+    allocations = 0;
+}
+
+static void* allocate(size_t size) {
+    BlockHeader* block = (BlockHeader*)malloc(size + sizeof(max_align_t));
+    if (block == nullptr) throw std::bad_alloc();
+    block->size = size;
+    block->tracked = trackHeap;
+    if (trackHeap) {
+        heapInUse += size;
+        if (heapInUse > heapPeak) heapPeak = heapInUse;
+        allocations++;
+    }
+    return (uint8_t*)block + sizeof(max_align_t);
+}
+
+static void release(void* p) {
+    if (p == nullptr) return;
+    BlockHeader* block = (BlockHeader*)((uint8_t*)p - sizeof(max_align_t));
+    if (block->tracked) heapInUse -= block->size;
+    free(block);
+}
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+// The alert rules allocate with nothrow; without these a sanitizer's own
+// nothrow new would pair with the delete above
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return allocate(size);
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept { return operator new(size, tag); }
+void operator delete(void* p) noexcept { release(p); }
+void operator delete[](void* p) noexcept { release(p); }
+void operator delete(void* p, size_t) noexcept { release(p); }
+void operator delete[](void* p, size_t) noexcept { release(p); }
+
+#define NATIVE_HEAP_SIZE 327680 // ESP32 DRAM, for getFreeHeap()
+
+uint32_t EspClass::getFreeHeap() { return NATIVE_HEAP_SIZE - (uint32_t)heapInUse; }
+uint32_t EspClass::getMinFreeHeap() { return NATIVE_HEAP_SIZE - (uint32_t)heapPeak; }
+
+uint32_t EspClass::getCycleCount() {
+    uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return (uint32_t)(nanos * 240 / 1000);
+}
+
+// FreeRTOS
+
+struct NativeQueue {
+    std::vector<uint8_t> storage;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    NativeQueue* queue = new NativeQueue();
+    queue->storage.resize((size_t)length * itemSize);
+    queue->length = length;
+    queue->itemSize = itemSize;
+    queue->head = 0;
+    queue->count = 0;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t) {
+    if (queue->count == queue->length) return pdFALSE;
+    UBaseType_t slot = (queue->head + queue->count) % queue->length;
+    memcpy(&queue->storage[(size_t)slot * queue->itemSize], item, queue->itemSize);
+    queue->count++;
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void* item, BaseType_t* woken) {
+    if (woken != nullptr) *woken = pdFALSE;
+    return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void* item, TickType_t) {
+    if (queue->count == 0) return pdFALSE;
+    memcpy(item, &queue->storage[(size_t)queue->head * queue->itemSize], queue->itemSize);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t) {
+    if (xQueuePeek(queue, item, 0) != pdTRUE) return pdFALSE;
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    return pdTRUE;
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void* item) {
+    queue->head = 0;
+    queue->count = 0;
+    return xQueueSend(queue, item, 0);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) { return queue->count; }
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t,
+                                   TaskHandle_t* handle, BaseType_t) {
+    if (handle != nullptr) *handle = nullptr;
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t) {}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) { return 0; }
+
+// Board inputs
+
+ReplayScanSource& nativeScanSource() {
+    static ReplayScanSource source;
+    return source;
+}
+
+ScriptedTouch& nativeTouchInput() {
+    static ScriptedTouch input;
+    return input;
+}
+
+ScanSource& boardScanSource() { return nativeScanSource(); }
+TouchInput& boardTouchInput() { return nativeTouchInput(); }
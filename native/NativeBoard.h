@@ -0,0 +1,123 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <deque>
+#include <set>
+#include "Hal.h"
+
+// Host board for the native build: a simulated clock, a scan source fed by
+// the replay harness and a touch panel driven by scripted taps and swipes.
+
+void nativeSetMicros(uint64_t now);
+
+// Bytes currently allocated with operator new while tracking was on, the
+// peak since the last reset, and the number of allocations since the last
+// reset. nativeTrackHeap returns whether tracking was on before.
+bool nativeTrackHeap(bool on);
+size_t nativeHeapInUse();
+size_t nativeHeapPeak();
+unsigned long nativeAllocations();
+void nativeResetHeapPeak();
+
+class ReplayScanSource : public ScanSource {
+public:
+    ReplayScanSource() : handler(nullptr), duplicates(false), running(false), starts(0), startTime(0) {
+        settings.interval = 100;
+        settings.window = 100;
+        settings.active = true;
+    }
+
+    void begin(AdvertHandler advertHandler, bool wantDuplicates) {
+        handler = advertHandler;
+        duplicates = wantDuplicates;
+    }
+
+    void configure(const ScanSettings& scanSettings) { settings = scanSettings; }
+
+    bool start() {
+        running = true;
+        starts++;
+        startTime = millis();
+        reported.clear();
+        return true;
+    }
+
+    bool stop() {
+        running = false;
+        return true;
+    }
+
+    // Hands an advert to the sketch as the radio would: only while scanning,
+    // only inside the scan window, scan responses only to an active scan, and
+    // only once per device per scan unless duplicates were requested.
+    // Returns true if it was delivered.
+    bool deliver(const Advert& advert, bool scanResponse) {
+        if (!running || handler == nullptr) return false;
+        if (scanResponse && !settings.active) return false;
+        if ((millis() - startTime) % settings.interval >= settings.window) return false;
+        if (!duplicates && !reported.insert(advert.mac).second) return false;
+        handler(advert);
+        return true;
+    }
+
+    bool scanning() const { return running; }
+    const ScanSettings& currentSettings() const { return settings; }
+    unsigned long startCount() const { return starts; }
+
+private:
+    AdvertHandler handler;
+    bool duplicates;
+    bool running;
+    unsigned long starts;
+    uint32_t startTime;
+    ScanSettings settings;
+    std::set<uint64_t> reported;
+};
+
+#define SCRIPTED_SAMPLE_INTERVAL 10 // ms between samples, as the board's driver
+#define SCRIPTED_TAP_HOLD        60 // ms a scripted tap is held
+
+// Queues the samples the board's driver would for scripted strokes: pressed
+// samples every SCRIPTED_SAMPLE_INTERVAL along a straight line, then a
+// release. Each sample becomes readable once the clock reaches it.
+class ScriptedTouch : public TouchInput {
+public:
+    void begin() {}
+
+    bool read(TouchSample& sample) {
+        if (samples.empty() || (int32_t)(micros() - samples.front().micros) < 0) return false;
+        sample = samples.front();
+        samples.pop_front();
+        return true;
+    }
+
+    void press(int16_t x, int16_t y) { stroke(x, y, x, y, SCRIPTED_TAP_HOLD); }
+
+    // From x1,y1 to x2,y2 over duration ms, starting now
+    void stroke(int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint32_t duration) {
+        uint32_t start = micros();
+        if (!samples.empty() && (int32_t)(start - samples.back().micros) <= 0) {
+            start = samples.back().micros + SCRIPTED_SAMPLE_INTERVAL * 1000; // After the stroke before
+        }
+        uint32_t steps = duration / SCRIPTED_SAMPLE_INTERVAL;
+        if (steps == 0) steps = 1;
+        TouchSample sample;
+        sample.pressed = true;
+        for (uint32_t i = 0; i <= steps; i++) {
+            sample.point.x = (int16_t)(x1 + (int32_t)(x2 - x1) * (int32_t)i / (int32_t)steps);
+            sample.point.y = (int16_t)(y1 + (int32_t)(y2 - y1) * (int32_t)i / (int32_t)steps);
+            sample.micros = start + i * SCRIPTED_SAMPLE_INTERVAL * 1000;
+            samples.push_back(sample);
+        }
+        sample.pressed = false;
+        sample.micros += SCRIPTED_SAMPLE_INTERVAL * 1000;
+        samples.push_back(sample);
+    }
+
+private:
+    std::deque<TouchSample> samples;
+};
+
+ReplayScanSource& nativeScanSource();
+ScriptedTouch& nativeTouchInput();
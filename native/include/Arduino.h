@@ -0,0 +1,146 @@
+#pragma once
+
+// Host stand-in for the parts of the Arduino ESP32 core the sketch uses.
+// Time is simulated: millis() and micros() return the clock set by the
+// replay harness (NativeBoard.h), and delay() does not sleep.
+
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#define PI         3.1415926535897932384626433832795
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define RAD_TO_DEG 57.295779513082320876798154814105
+
+#define HIGH 1
+#define LOW  0
+#define INPUT  0x01
+#define OUTPUT 0x03
+#define RISING  0x01
+#define FALLING 0x02
+#define CHANGE  0x03
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define PROGMEM
+
+using std::max;
+using std::min;
+
+template <typename T, typename A, typename B>
+T constrain(T x, A low, B high) { return x < low ? low : (x > high ? high : x); }
+
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+    return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return HIGH; }
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalPinToInterrupt(int pin) { return pin; }
+inline void attachInterrupt(int, void (*)(), int) {}
+inline void detachInterrupt(int) {}
+
+class String {
+public:
+    String() {}
+    String(const char* s) : text(s ? s : "") {}
+    String(const std::string& s) : text(s) {}
+    String(int value) : text(std::to_string(value)) {}
+    String(unsigned value) : text(std::to_string(value)) {}
+    String(long value) : text(std::to_string(value)) {}
+    String(unsigned long value) : text(std::to_string(value)) {}
+
+    const char* c_str() const { return text.c_str(); }
+    size_t length() const { return text.size(); }
+    bool isEmpty() const { return text.empty(); }
+    char operator[](size_t i) const { return text[i]; }
+    bool operator==(const char* s) const { return text == s; }
+    bool operator==(const String& s) const { return text == s.text; }
+    String& operator+=(const String& s) { text += s.text; return *this; }
+    String operator+(const String& s) const { return String(text + s.text); }
+    int toInt() const { return atoi(text.c_str()); }
+
+private:
+    std::string text;
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(const uint8_t* buffer, size_t size) = 0;
+
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+    size_t print(const String& s) { return print(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value) { return printf("%d", value); }
+    size_t print(unsigned value) { return printf("%u", value); }
+    size_t print(long value) { return printf("%ld", value); }
+    size_t print(unsigned long value) { return printf("%lu", value); }
+    size_t print(double value, int digits = 2) { return printf("%.*f", digits, value); }
+    size_t println() { return print("\n"); }
+
+    template <typename T>
+    size_t println(T value) { return print(value) + println(); }
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        char buffer[256];
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        if (n < 0) return 0;
+        return write((const uint8_t*)buffer, min((size_t)n, sizeof(buffer) - 1));
+    }
+};
+
+// Writes to stdout, or a file the harness chooses, when enabled
+class HardwareSerial : public Print {
+public:
+    HardwareSerial() : enabled(true), output(nullptr) {}
+    void begin(unsigned long) {}
+    void updateBaudRate(unsigned long) {}
+    void setTxBufferSize(size_t) {}
+    void flush() {}
+    void setEnabled(bool on) { enabled = on; }
+    void setOutput(FILE* file) { output = file; }
+    int available() { return 0; } // No serial input on the host
+    int read() { return -1; }
+    size_t write(const uint8_t* buffer, size_t size) {
+        if (enabled) fwrite(buffer, 1, size, output != nullptr ? output : stdout);
+        return size;
+    }
+    using Print::write;
+
+private:
+    bool enabled;
+    FILE* output;
+};
+
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+    uint32_t getFreeHeap();
+    uint32_t getMinFreeHeap();
+    uint32_t getMaxAllocHeap() { return getFreeHeap(); }
+    uint32_t getCpuFreqMHz() { return 240; }
+    uint32_t getCycleCount(); // From the host's real clock, at 240 MHz
+    uint64_t getEfuseMac() { return 0xCDAB00000000ULL; } // Node ID 0xCDAB when reporting
+};
+
+extern EspClass ESP;
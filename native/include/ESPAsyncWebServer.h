@@ -0,0 +1,57 @@
+#pragma once
+
+// Inert stand-in for ESPAsyncWebServer: handlers are accepted and never run
+
+#include <Arduino.h>
+#include <functional>
+
+#define HTTP_GET  0x01
+#define HTTP_POST 0x02
+#define HTTP_ANY  0x7F
+
+class AsyncWebParameter {
+public:
+    const String& value() const { return text; }
+
+private:
+    String text;
+};
+
+class AsyncWebServerResponse {
+public:
+    void addHeader(const String&, const String&) {}
+};
+
+typedef std::function<size_t(uint8_t*, size_t, size_t)> AwsResponseFiller;
+
+class AsyncWebServerRequest {
+public:
+    bool hasParam(const String&, bool = false, bool = false) const { return false; }
+    AsyncWebParameter* getParam(const String&, bool = false, bool = false) const { return nullptr; }
+    void send(int, const String& = String(), const String& = String()) {}
+    void send(AsyncWebServerResponse*) {}
+    AsyncWebServerResponse* beginChunkedResponse(const String&, AwsResponseFiller) { return nullptr; }
+};
+
+typedef std::function<void(AsyncWebServerRequest*)> ArRequestHandlerFunction;
+
+class AsyncWebHandler {
+public:
+    virtual ~AsyncWebHandler() {}
+};
+
+class AsyncEventSource : public AsyncWebHandler {
+public:
+    explicit AsyncEventSource(const String&) {}
+    void send(const char*, const char* = nullptr, uint32_t = 0, uint32_t = 0) {}
+    size_t count() const { return 0; }
+};
+
+class AsyncWebServer {
+public:
+    explicit AsyncWebServer(uint16_t) {}
+    void begin() {}
+    void on(const char*, int, ArRequestHandlerFunction) {}
+    void onNotFound(ArRequestHandlerFunction) {}
+    AsyncWebHandler& addHandler(AsyncWebHandler* handler) { return *handler; }
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+// In-memory stand-in for the Arduino FS API, so the known-device store runs
+// unchanged on the host. Contents last for the life of the process.
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The stand-in's storage is flash on the board, not heap, so the heap
+// accounting (NativeBoard.h) leaves it out
+bool nativeTrackHeap(bool on);
+
+namespace fs {
+
+struct FlashStorage {
+    FlashStorage() : tracking(nativeTrackHeap(false)) {}
+    ~FlashStorage() { nativeTrackHeap(tracking); }
+    bool tracking;
+};
+
+typedef std::shared_ptr<std::vector<uint8_t> > FileData;
+
+class File {
+public:
+    File() : position(0) {}
+    File(const FileData& data, size_t position) : data(data), position(position) {}
+
+    explicit operator bool() const { return data != nullptr; }
+
+    size_t read(uint8_t* buffer, size_t size) {
+        if (!data || position >= data->size()) return 0;
+        size_t n = min(size, data->size() - position);
+        memcpy(buffer, data->data() + position, n);
+        position += n;
+        return n;
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) {
+        if (!data) return 0;
+        FlashStorage flash;
+        if (data->size() < position + size) data->resize(position + size);
+        memcpy(data->data() + position, buffer, size);
+        position += size;
+        return size;
+    }
+
+    size_t size() const { return data ? data->size() : 0; }
+    void flush() {}
+    void close() { data.reset(); }
+
+private:
+    FileData data;
+    size_t position;
+};
+
+class FS {
+public:
+    File open(const char* path, const char* mode = "r") {
+        FlashStorage flash;
+        std::map<std::string, FileData>::iterator it = files.find(path);
+        if (mode[0] == 'r') {
+            return it == files.end() ? File() : File(it->second, 0);
+        }
+        if (it == files.end() || mode[0] == 'w') {
+            files[path] = FileData(new std::vector<uint8_t>());
+            it = files.find(path);
+        }
+        return File(it->second, mode[0] == 'a' ? it->second->size() : 0);
+    }
+
+    bool exists(const char* path) const { return files.count(path) > 0; }
+    bool remove(const char* path) { return files.erase(path) > 0; }
+
+    bool rename(const char* from, const char* to) {
+        FlashStorage flash;
+        std::map<std::string, FileData>::iterator it = files.find(from);
+        if (it == files.end()) return false;
+        files[to] = it->second;
+        files.erase(from);
+        return true;
+    }
+
+    size_t usedBytes() const {
+        size_t total = 0;
+        for (std::map<std::string, FileData>::const_iterator it = files.begin(); it != files.end(); ++it) {
+            total += it->second->size();
+        }
+        return total;
+    }
+
+private:
+    std::map<std::string, FileData> files;
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <FS.h>
+
+class LittleFSFS : public fs::FS {
+public:
+    bool begin(bool formatOnFail = false) {
+        (void)formatOnFail;
+        return true;
+    }
+    size_t totalBytes() const { return 0x30000; }
+};
+
+extern LittleFSFS LittleFS;
@@ -0,0 +1,147 @@
+#pragma once
+
+// Recording stand-in for TFT_eSPI. Nothing is rasterised; every draw call and
+// every pixel pushed to the panel is counted in tftStats so the benchmark can
+// report render work per frame.
+
+#include <Arduino.h>
+
+#define TFT_BLACK     0x0000
+#define TFT_NAVY      0x000F
+#define TFT_DARKGREEN 0x03E0
+#define TFT_DARKGREY  0x7BEF
+#define TFT_BLUE      0x001F
+#define TFT_GREEN     0x07E0
+#define TFT_CYAN      0x07FF
+#define TFT_RED       0xF800
+#define TFT_MAGENTA   0xF81F
+#define TFT_YELLOW    0xFFE0
+#define TFT_WHITE     0xFFFF
+#define TFT_ORANGE    0xFDA0
+
+#define TL_DATUM 0
+#define TC_DATUM 1
+#define TR_DATUM 2
+#define ML_DATUM 3
+#define MC_DATUM 4
+#define MR_DATUM 5
+#define BL_DATUM 6
+#define BC_DATUM 7
+#define BR_DATUM 8
+
+struct TftStats {
+    unsigned long drawCalls;    // Primitives and text, on the panel or a sprite
+    unsigned long panelCalls;   // Primitives drawn directly on the panel
+    unsigned long pushes;       // Image pushes to the panel
+    unsigned long pushedPixels; // Pixels sent to the panel, by pushes or direct draws
+};
+
+extern TftStats tftStats;
+
+class TFT_eSPI : public Print {
+public:
+    TFT_eSPI(int16_t w = 320, int16_t h = 240) : panelWidth(w), panelHeight(h), sprite(false) {}
+    virtual ~TFT_eSPI() {}
+
+    void begin() {}
+    void init() {}
+    void setRotation(uint8_t) {}
+    void initDMA(bool = false) {}
+    void startWrite() {}
+    void endWrite() {}
+    void dmaWait() {}
+    bool dmaBusy() { return false; }
+    void setSwapBytes(bool) {}
+
+    uint16_t color565(uint8_t r, uint8_t g, uint8_t b) {
+        return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+    }
+
+    void setTextColor(uint16_t) {}
+    void setTextColor(uint16_t, uint16_t, bool = false) {}
+    void setTextSize(uint8_t) {}
+    void setTextDatum(uint8_t) {}
+    void setTextWrap(bool, bool = false) {}
+    void setTextPadding(uint16_t) {}
+    void setCursor(int16_t, int16_t) {}
+    int16_t textWidth(const char* s, uint8_t font = 1) { return (int16_t)(strlen(s) * (font > 1 ? 8 : 6)); }
+    int16_t fontHeight(uint8_t font = 1) { return font > 1 ? 16 : 8; }
+
+    int16_t drawString(const char* s, int32_t, int32_t, uint8_t font = 1) {
+        draw(textWidth(s, font) * fontHeight(font));
+        return textWidth(s, font);
+    }
+    int16_t drawString(const String& s, int32_t x, int32_t y, uint8_t font = 1) { return drawString(s.c_str(), x, y, font); }
+
+    void fillScreen(uint32_t) { draw((long)panelWidth * panelHeight); }
+    void drawPixel(int32_t, int32_t, uint32_t) { draw(1); }
+    void drawFastHLine(int32_t, int32_t, int32_t w, uint32_t) { draw(w); }
+    void drawFastVLine(int32_t, int32_t, int32_t h, uint32_t) { draw(h); }
+    void drawLine(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t) { draw(max(abs(x1 - x0), abs(y1 - y0)) + 1); }
+    void drawRect(int32_t, int32_t, int32_t w, int32_t h, uint32_t) { draw(2 * (w + h)); }
+    void fillRect(int32_t, int32_t, int32_t w, int32_t h, uint32_t) { draw((long)w * h); }
+    void drawRoundRect(int32_t, int32_t, int32_t w, int32_t h, int32_t, uint32_t) { draw(2 * (w + h)); }
+    void fillRoundRect(int32_t, int32_t, int32_t w, int32_t h, int32_t, uint32_t) { draw((long)w * h); }
+    void drawCircle(int32_t, int32_t, int32_t r, uint32_t) { draw(6 * r); }
+    void fillCircle(int32_t, int32_t, int32_t r, uint32_t) { draw(3 * r * r); }
+    void fillTriangle(int32_t, int32_t, int32_t, int32_t, int32_t, int32_t, uint32_t) { draw(0); }
+
+    void pushImage(int32_t, int32_t, int32_t w, int32_t h, const uint16_t*) { push((long)w * h); }
+    void pushImageDMA(int32_t, int32_t, int32_t w, int32_t h, uint16_t*, uint16_t* = nullptr) { push((long)w * h); }
+
+    size_t write(const uint8_t*, size_t size) {
+        draw((long)size * 48);
+        return size;
+    }
+    using Print::write;
+
+protected:
+    void draw(long pixels) {
+        tftStats.drawCalls++;
+        if (!sprite) {
+            tftStats.panelCalls++;
+            tftStats.pushedPixels += pixels;
+        }
+    }
+
+    void push(long pixels) {
+        tftStats.pushes++;
+        tftStats.pushedPixels += pixels;
+    }
+
+    int16_t panelWidth;
+    int16_t panelHeight;
+    bool sprite;
+};
+
+class TFT_eSprite : public TFT_eSPI {
+public:
+    explicit TFT_eSprite(TFT_eSPI*) : pixels(nullptr), spriteWidth(0), spriteHeight(0) { sprite = true; }
+    ~TFT_eSprite() { deleteSprite(); }
+
+    void setColorDepth(int8_t) {}
+
+    void* createSprite(int16_t w, int16_t h, uint8_t = 1) {
+        deleteSprite();
+        pixels = (uint16_t*)calloc((size_t)w * h, sizeof(uint16_t));
+        spriteWidth = w;
+        spriteHeight = h;
+        return pixels;
+    }
+
+    void deleteSprite() {
+        free(pixels);
+        pixels = nullptr;
+    }
+
+    bool created() const { return pixels != nullptr; }
+    void* getPointer() { return pixels; }
+    int16_t width() const { return spriteWidth; }
+    int16_t height() const { return spriteHeight; }
+    void pushSprite(int32_t, int32_t) { push((long)spriteWidth * spriteHeight); }
+
+private:
+    uint16_t* pixels;
+    int16_t spriteWidth;
+    int16_t spriteHeight;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+// The native build's network is the host's: begin() connects at once, and
+// WiFiUdp.h sends real datagrams, so the harness can report to a collector
+// on the same machine. The web API stays disabled unless WIFI_SSID is
+// defined.
+
+#include <Arduino.h>
+
+#define WIFI_OFF 0
+#define WIFI_STA 1
+#define WL_CONNECTED    3
+#define WL_DISCONNECTED 6
+
+class IPAddress {
+public:
+    String toString() const { return String("127.0.0.1"); }
+};
+
+class WiFiClass {
+public:
+    WiFiClass() : wifiMode(WIFI_OFF), connected(false) {}
+    void mode(int m) { wifiMode = m; }
+    int getMode() { return wifiMode; }
+    void begin(const char*, const char*) { connected = true; }
+    int status() { return connected ? WL_CONNECTED : WL_DISCONNECTED; }
+    IPAddress localIP() { return IPAddress(); }
+
+private:
+    int wifiMode;
+    bool connected;
+};
+
+extern WiFiClass WiFi;
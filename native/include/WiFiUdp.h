@@ -0,0 +1,61 @@
+#pragma once
+
+// WiFiUDP over a host UDP socket. Only sending is supported.
+
+#include <Arduino.h>
+#include <netdb.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define WIFI_UDP_MAX_PACKET 1500
+
+class WiFiUDP {
+public:
+    WiFiUDP() : fd(-1), length(0), targetLength(0) {}
+    ~WiFiUDP() {
+        if (fd >= 0) close(fd);
+    }
+
+    // The local port is left to the host; the board's is not significant either
+    uint8_t begin(uint16_t) {
+        if (fd < 0) fd = socket(AF_INET, SOCK_DGRAM, 0);
+        return fd >= 0 ? 1 : 0;
+    }
+
+    int beginPacket(const char* host, uint16_t port) {
+        if (fd < 0) return 0;
+        char service[8];
+        snprintf(service, sizeof(service), "%u", port);
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo* result = nullptr;
+        if (getaddrinfo(host, service, &hints, &result) != 0 || result == nullptr) return 0;
+        memcpy(&target, result->ai_addr, result->ai_addrlen);
+        targetLength = result->ai_addrlen;
+        freeaddrinfo(result);
+        length = 0;
+        return 1;
+    }
+
+    size_t write(const uint8_t* data, size_t size) {
+        if (size > WIFI_UDP_MAX_PACKET - length) size = WIFI_UDP_MAX_PACKET - length;
+        memcpy(packet + length, data, size);
+        length += size;
+        return size;
+    }
+
+    int endPacket() {
+        if (fd < 0 || targetLength == 0) return 0;
+        return sendto(fd, packet, length, 0, (const sockaddr*)&target, targetLength) == (ssize_t)length ? 1 : 0;
+    }
+
+private:
+    int fd;
+    uint8_t packet[WIFI_UDP_MAX_PACKET];
+    size_t length;
+    sockaddr_storage target;
+    socklen_t targetLength;
+};
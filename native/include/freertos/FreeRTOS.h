@@ -0,0 +1,19 @@
+#pragma once
+
+// Host stand-in for the FreeRTOS API the sketch uses. The native build is
+// single threaded: tasks are not started (the harness runs their cycle
+// functions), mutexes always succeed and queues never block.
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdFAIL  0
+#define pdPASS  1
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portYIELD_FROM_ISR(x) ((void)(x))
@@ -0,0 +1,929 @@
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <TFT_eSPI.h>
+#include <WiFi.h>
+#include <chrono>
+#include <functional>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AddressClusters.h"
+#include "AdvertData.h"
+#include "AlertRules.h"
+#include "CaptureStream.h"
+#include "Checks.h"
+#include "DeviceTable.h"
+#include "FollowerTracker.h"
+#include "HyperLogLog.h"
+#include "MacSet.h"
+#include "NativeBoard.h"
+
+// Native replay harness and benchmark. Feeds a recorded or synthetic
+// advertisement trace through the same onAdvert path the radio uses, runs the
+// scan task cycle and the UI loop on a simulated clock, and reports ingest
+// cost, heap use and render work.
+//
+//   pio run -e native && .pio/build/native/program [options]
+//
+//   --trace FILE     Replay FILE: one advert per line,
+//                    time_ms,aa:bb:cc:dd:ee:ff,rssi[,name[,payload hex[,random]]]
+//   --devices N      Synthetic trace: N devices (default 200, within DEVICE_TABLE_SIZE)
+//   --rate R         ... about R adverts per second in total (default 2000)
+//   --seconds S      ... for S seconds (default 120)
+//   --rotate S       ... each device uses a resolvable private address and changes
+//                        it every S seconds (default 0: public addresses); the
+//                        replay then exits 1 unless the known devices and the
+//                        folded rotations match the trace and nothing alerted
+//   --seed N         ... random seed (default 1)
+//   --rules FILE     Install FILE as the alert rules on the simulated flash
+//   --allowlist N    Add N random "allow mac" rules, plus every fourth
+//                    synthetic device as our own fleet
+//   --tap MS,X,Y     Touch the screen at X,Y at MS into the replay (repeatable)
+//   --swipe MS,X1,Y1,X2,Y2,D
+//                    Drag from X1,Y1 to X2,Y2 over D ms, starting at MS (repeatable)
+//   --capture FILE   Write the binary capture stream (CaptureStream.h) of the
+//                    replay to FILE, for tools/capture_decode.py
+//   --collector HOST:PORT
+//                    Send fleet reports (NodeReport.h) to a collector, as a node
+//   --node N         ... with node ID N (default 1)
+//   --attenuate DB   Weaken every advert by DB dB, to place this node further
+//                    from the devices than another
+//   --realtime       Run at the speed of the host's clock, as a board would
+//   --distinct-error Instead of a replay, measure the distinct device
+//                    sketches' estimation error from 10^3 to 10^6 devices and
+//                    check merging and window roll-over; exits 1 on a failure
+//   --follower-bench Instead of a replay, time the follower detector
+//                    (FollowerTracker.h) at 1024 to 16384 tracked devices on a
+//                    scanner carried between places, and check what it finds;
+//                    exits 1 if it misses a follower or flags a bystander
+//   --macset-bench   Instead of a replay, time MacSet insert and lookup at 1k,
+//                    10k and 50k addresses against std::set<String>, and check
+//                    eviction at the sketch's capacity; exits 1 on a failure
+//   --oui-bench      Instead of a replay, time the manufacturer table lookup
+//                    against the String if-chain it replaced; exits 1 if they
+//                    disagree or the table allocates
+//   --queue-stress   Instead of a replay, push sightings through the SPSC
+//                    sighting queue from one thread to another, with the
+//                    consumer free-running and stalling; exits 1 if one is
+//                    lost, reordered, torn or dropped without being counted
+//   --history-check  Instead of a replay, feed 100 days of minutes through the
+//                    tiered history and check every tier's min/max/avg
+//                    rollups, ring wrap and memory; exits 1 on a mismatch
+//   --known-check    Instead of a replay, check the known-device store's
+//                    appends, torn and corrupt records, compaction and
+//                    recovery on the flash stand-in, and time a 10k load
+//   --json-check     Instead of a replay, drain the device and history JSON
+//                    cursors in chunks from 1 byte up and check each
+//                    document parses and matches the table and history
+//   --advert-fuzz    Instead of a replay, feed random, truncated and corrupted
+//                    payloads to the advert parser and check every field it
+//                    returns stays within the payload; exits 1 if one doesn't
+//   --rules-check    Instead of a replay, load alert rules files with bad,
+//                    overlong and duplicate lines, check rule precedence, and
+//                    check the Bloom filter never turns away a loaded selector
+//   --soak H         Replay H hours (a synthetic trace runs that long), tour the
+//                    screens and toggle the shields every SOAK_TOUR_INTERVAL,
+//                    and sample the heap hourly; exits 1 if the sketch
+//                    allocates or its peak heap grows after the first hour
+//   --verbose        Show the sketch's serial output
+
+void setup();
+void loop();
+void runScanCycle();
+void logScanSummary();
+void dumpPerfCounters(Print& out);
+void startCapture();
+void serviceCapture();
+extern CaptureWriter capture;
+extern DeviceTable deviceTable;
+extern MacSet<2048> allKnownDevices; // KNOWN_DEVICE_CAPACITY
+extern AddressClusters<256> addressClusters; // ADDRESS_CLUSTER_CAPACITY
+extern const char* collectorHost;
+extern uint16_t collectorPort;
+extern uint16_t nodeId;
+
+#define REPLAY_SCAN_PERIOD 10 // ms, as SCAN_TASK_PERIOD
+#define REPLAY_LOOP_PERIOD 5  // ms, the UI loop's delay
+#define REPLAY_SETTLE      2000 // ms run after the last advert
+#define SYNTHETIC_MODELS   16   // Distinct manufacturer data prefixes
+#define SYNTHETIC_JITTER   10   // ms of random delay added to each advert, as in the spec
+#define SOAK_SAMPLE_INTERVAL 3600000 // ms of simulated time between heap samples
+#define SOAK_WARMUP_SAMPLES  1       // Samples taken before the heap must stay flat
+#define SOAK_TOUR_INTERVAL   600000  // ms between tours of the screens
+#define MAC_DEDUPE_BATCH     (1 << 20) // Addresses collected before duplicates are dropped
+#define ROTATION_TOLERANCE   20        // Known devices and folds may be off by 1 in this many
+
+struct TraceAdvert {
+    uint32_t time; // ms
+    uint64_t mac;
+    int8_t rssi;
+    bool randomAddress;
+    bool scanResponse; // Only delivered to an active scan
+    std::vector<uint8_t> payload;
+};
+
+struct Tap {
+    uint32_t time;
+    int16_t x;
+    int16_t y;
+    int16_t toX; // Swipes only
+    int16_t toY;
+    uint32_t duration; // ms; 0 for a tap
+};
+
+class TraceReader {
+public:
+    virtual ~TraceReader() {}
+    virtual bool next(TraceAdvert& advert) = 0;
+};
+
+class FileTrace : public TraceReader {
+public:
+    explicit FileTrace(FILE* file) : file(file), line(0) {}
+
+    bool next(TraceAdvert& advert) {
+        char text[512];
+        while (fgets(text, sizeof(text), file) != nullptr) {
+            line++;
+            if (text[0] == '#' || text[0] == '\n') continue;
+            if (parse(text, advert)) return true;
+            fprintf(stderr, "Skipping malformed trace line %lu\n", line);
+        }
+        return false;
+    }
+
+private:
+    static bool parse(char* text, TraceAdvert& advert) {
+        text[strcspn(text, "\r\n")] = '\0';
+        char* fields[6] = {nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+        int count = 0;
+        for (char* field = text; field != nullptr && count < 6; count++) {
+            fields[count] = field;
+            field = strchr(field, ',');
+            if (field != nullptr) *field++ = '\0';
+        }
+        if (count < 3) return false;
+
+        unsigned int bytes[6];
+        if (sscanf(fields[1], "%x:%x:%x:%x:%x:%x", &bytes[0], &bytes[1], &bytes[2],
+                   &bytes[3], &bytes[4], &bytes[5]) != 6) {
+            return false;
+        }
+        advert.time = (uint32_t)strtoul(fields[0], nullptr, 10);
+        advert.mac = 0;
+        for (int i = 0; i < 6; i++) advert.mac = (advert.mac << 8) | (bytes[i] & 0xFF);
+        advert.rssi = (int8_t)atoi(fields[2]);
+        advert.randomAddress = fields[5] != nullptr && strcmp(fields[5], "random") == 0;
+        advert.scanResponse = false;
+        advert.payload.clear();
+        for (const char* hex = fields[4]; hex != nullptr && hex[0] != '\0' && hex[1] != '\0'; hex += 2) {
+            unsigned int value;
+            if (sscanf(hex, "%2x", &value) != 1) return false;
+            advert.payload.push_back((uint8_t)value);
+        }
+        // Without a payload, the name column becomes a complete local name
+        size_t nameLength = fields[3] != nullptr ? strlen(fields[3]) : 0;
+        if (advert.payload.empty() && nameLength > 0) {
+            if (nameLength > ADVERT_MAX_NAME - 1) nameLength = ADVERT_MAX_NAME - 1;
+            advert.payload.push_back((uint8_t)(nameLength + 1));
+            advert.payload.push_back(AD_NAME_COMPLETE);
+            advert.payload.insert(advert.payload.end(), fields[3], fields[3] + nameLength);
+        }
+        return true;
+    }
+
+    FILE* file;
+    unsigned long line;
+};
+
+// Devices advertising at their own fixed interval with a little jitter, each
+// with a fixed signal strength and a manufacturer data record whose prefix
+// depends on the device model, so unrelated devices of one model share a
+// fingerprint. Intervals are spread around the one that gives the requested
+// total rate. Named devices, like most phones, only give their name in a
+// scan response. Optionally the devices use rotating resolvable private
+// addresses.
+class SyntheticTrace : public TraceReader {
+public:
+    SyntheticTrace(int devices, int rate, int seconds, int rotateSeconds, unsigned seed)
+        : random(seed), endTime((uint32_t)seconds * 1000), rotateMillis((uint32_t)rotateSeconds * 1000),
+          responder(nullptr), rotated(0) {
+        static const uint16_t companies[] = {0x004C, 0x0006, 0x0075, 0x00E0, 0x0059, 0x02E5, 0x038F};
+        uint32_t baseInterval = max(1U, (uint32_t)((uint64_t)devices * 1000 / rate));
+        for (int i = 0; i < devices; i++) {
+            Device device;
+            device.mac = randomMac();
+            device.rssi = (int8_t)(-95 + (int)(random() % 56));
+            device.company = companies[random() % (sizeof(companies) / sizeof(companies[0]))];
+            device.model = (uint8_t)(random() % SYNTHETIC_MODELS);
+            device.named = random() % 4 == 0;
+            device.interval = max(1U, baseInterval / 2 + (uint32_t)(random() % (baseInterval + 1)));
+            device.rotateOffset = rotateMillis > 0 ? random() % rotateMillis : 0;
+            device.epoch = 0;
+            snprintf(device.name, sizeof(device.name), "dev-%d", i);
+            this->devices.push_back(device);
+            schedule.push(Pending(random() % device.interval, i));
+        }
+    }
+
+    // Initial addresses of every nth device
+    void sampleMacs(size_t every, std::vector<uint64_t>& macs) const {
+        for (size_t i = 0; i < devices.size(); i += every) macs.push_back(devices[i].mac);
+    }
+
+    size_t deviceCount() const { return devices.size(); }
+    unsigned long rotations() const { return rotated; } // Address changes so far
+
+    bool next(TraceAdvert& advert) {
+        if (responder != nullptr) {
+            // The scan response follows its advert; time, address and
+            // signal are still the advert's
+            size_t nameLength = strlen(responder->name);
+            advert.scanResponse = true;
+            advert.payload.assign({(uint8_t)(nameLength + 1), AD_NAME_COMPLETE});
+            advert.payload.insert(advert.payload.end(), responder->name, responder->name + nameLength);
+            responder = nullptr;
+            return true;
+        }
+        if (schedule.empty() || schedule.top().first >= endTime) return false;
+        uint32_t time = schedule.top().first;
+        Device& device = devices[schedule.top().second];
+        schedule.pop();
+        schedule.push(Pending(time + device.interval + random() % SYNTHETIC_JITTER, &device - &devices[0]));
+
+        if (rotateMillis > 0) {
+            uint32_t epoch = (time + device.rotateOffset) / rotateMillis;
+            if (epoch != device.epoch) {
+                device.epoch = epoch;
+                device.mac = randomMac();
+                rotated++;
+            }
+        }
+
+        advert.time = time;
+        advert.mac = device.mac;
+        advert.randomAddress = rotateMillis > 0;
+        advert.rssi = (int8_t)(device.rssi + (int)(random() % 7) - 3);
+        advert.scanResponse = false;
+        advert.payload.assign({0x02, AD_FLAGS, 0x06});
+        if (device.named) responder = &device;
+        uint8_t manufacturerData[] = {7, AD_MANUFACTURER_DATA, (uint8_t)device.company, (uint8_t)(device.company >> 8),
+                                      device.model, 0x05, (uint8_t)random(), (uint8_t)random()};
+        advert.payload.insert(advert.payload.end(), manufacturerData, manufacturerData + sizeof(manufacturerData));
+        return true;
+    }
+
+private:
+    struct Device {
+        uint64_t mac;
+        int8_t rssi;
+        uint16_t company;
+        uint8_t model;
+        bool named;
+        uint32_t interval; // ms
+        uint32_t rotateOffset;
+        uint32_t epoch;
+        char name[16];
+    };
+
+    // Next advert time and device index, earliest first
+    typedef std::pair<uint32_t, size_t> Pending;
+    typedef std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending> > Schedule;
+
+    // Resolvable private addresses have 01 as their top bits
+    uint64_t randomMac() {
+        uint64_t mac = (((uint64_t)random() << 32) | random()) & 0xFFFFFFFFFFFFULL;
+        return rotateMillis > 0 ? (mac & 0x3FFFFFFFFFFFULL) | 0x400000000000ULL : mac;
+    }
+
+    std::mt19937 random;
+    std::vector<Device> devices;
+    Schedule schedule;
+    uint32_t endTime;
+    uint32_t rotateMillis;
+    Device* responder; // Device whose scan response is next
+    unsigned long rotated;
+};
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double elapsedNanos(BenchClock::time_point start) {
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now() - start).count();
+}
+
+// Simulated time, and the host time spent in each side
+struct Replay {
+    uint32_t now;
+    uint32_t nextScan;
+    uint32_t nextLoop;
+    size_t nextTap;
+    std::vector<Tap> taps;
+    double ingestNanos;
+    double renderNanos;
+    unsigned long scanCycles;
+    unsigned long loopPasses;
+    bool realtime; // Pace the simulated clock to the host's
+    BenchClock::time_point wallStart;
+};
+
+// Runs the scan cycle and UI loop passes that fall due up to time
+static void runUntil(Replay& replay, uint32_t time) {
+    while (true) {
+        uint32_t due = min(replay.nextScan, replay.nextLoop);
+        if (due > time) break;
+        if (replay.realtime) std::this_thread::sleep_until(replay.wallStart + std::chrono::milliseconds(due));
+        replay.now = due;
+        nativeSetMicros((uint64_t)due * 1000);
+
+        if (due == replay.nextScan) {
+            nativeTrackHeap(true);
+            BenchClock::time_point start = BenchClock::now();
+            runScanCycle();
+            replay.ingestNanos += elapsedNanos(start);
+            replay.scanCycles++;
+            serviceCapture(); // The writer task's pass
+            nativeTrackHeap(false);
+            replay.nextScan += REPLAY_SCAN_PERIOD;
+        }
+        if (due == replay.nextLoop) {
+            while (replay.nextTap < replay.taps.size() && replay.taps[replay.nextTap].time <= due) {
+                const Tap& tap = replay.taps[replay.nextTap++];
+                if (tap.duration == 0) {
+                    nativeTouchInput().press(tap.x, tap.y);
+                } else {
+                    nativeTouchInput().stroke(tap.x, tap.y, tap.toX, tap.toY, tap.duration);
+                }
+            }
+            nativeTrackHeap(true);
+            BenchClock::time_point start = BenchClock::now();
+            loop();
+            replay.renderNanos += elapsedNanos(start);
+            nativeTrackHeap(false);
+            replay.loopPasses++;
+            replay.nextLoop += REPLAY_LOOP_PERIOD;
+        }
+    }
+    replay.now = time;
+    nativeSetMicros((uint64_t)time * 1000);
+}
+
+// Heap state at one point of a soak
+struct SoakSample {
+    uint32_t time; // ms
+    unsigned long adverts;
+    unsigned long allocations; // Since setup
+    size_t inUse;
+    size_t peak;
+};
+
+// Every SOAK_TOUR_INTERVAL: open the all devices list, fling it, tap a row
+// to return, and toggle the shields, so the list views, the alert path and
+// the follower sessions are all exercised along with the main screen
+static void addSoakTours(std::vector<Tap>& taps, uint32_t endTime) {
+    for (uint32_t start = SOAK_TOUR_INTERVAL / 2; start < endTime; start += SOAK_TOUR_INTERVAL) {
+        Tap tour[] = {{start, 60, 50, 0, 0, 0},
+                      {start + 3000, 150, 200, 150, 60, 150},
+                      {start + 8000, 150, 150, 0, 0, 0},
+                      {start + 12000, SCREEN_WIDTH / 2, SCREEN_HEIGHT - 50, 0, 0, 0}};
+        taps.insert(taps.end(), tour, tour + sizeof(tour) / sizeof(tour[0]));
+    }
+}
+
+// Prints the hourly samples. After the warm-up the sketch must make no
+// allocations and its peak heap must not grow.
+static bool reportSoak(const std::vector<SoakSample>& samples) {
+    printf("Soak (heap per hour)\n");
+    printf("  %6s %12s %12s %10s %10s\n", "hour", "adverts", "allocations", "in use", "peak");
+    for (size_t i = 0; i < samples.size(); i++) {
+        const SoakSample& sample = samples[i];
+        const SoakSample* before = i > 0 ? &samples[i - 1] : nullptr;
+        printf("  %6.1f %12lu %12lu %10zu %10zu\n", sample.time / 3600000.0,
+               sample.adverts - (before != nullptr ? before->adverts : 0),
+               sample.allocations - (before != nullptr ? before->allocations : 0), sample.inUse, sample.peak);
+    }
+    if (samples.size() <= SOAK_WARMUP_SAMPLES) {
+        printf("  too short: the heap is checked after %d h of warm-up\n", SOAK_WARMUP_SAMPLES);
+        return false;
+    }
+    const SoakSample& warm = samples[SOAK_WARMUP_SAMPLES - 1];
+    const SoakSample& last = samples.back();
+    bool flat = last.allocations == warm.allocations && last.peak == warm.peak && last.inUse <= warm.inUse;
+    printf("  after warm-up     %lu allocations, peak %+ld bytes, in use %+ld bytes: %s\n",
+           last.allocations - warm.allocations, (long)last.peak - (long)warm.peak,
+           (long)last.inUse - (long)warm.inUse, flat ? "flat" : "FAIL");
+    return flat;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: program [--trace FILE] [--devices N] [--rate R] [--seconds S] [--rotate S]\n"
+            "               [--seed N] [--rules FILE] [--allowlist N] [--tap MS,X,Y]...\n"
+            "               [--swipe MS,X1,Y1,X2,Y2,D]... [--capture FILE]\n"
+            "               [--collector HOST:PORT [--node N]] [--attenuate DB] [--realtime]\n"
+            "               [--soak HOURS] [--verbose]\n"
+            "       program --distinct-error [--seed N]\n"
+            "       program --follower-bench [--seed N]\n"
+            "       program --macset-bench [--seed N]\n"
+            "       program --oui-bench [--seed N]\n"
+            "       program --queue-stress\n"
+            "       program --history-check [--seed N]\n"
+            "       program --known-check [--seed N]\n"
+            "       program --json-check [--seed N]\n"
+            "       program --advert-fuzz [--seed N]\n"
+            "       program --rules-check [--seed N]\n");
+}
+
+// The scanner is carried around PLACES places, FOLLOWER_VISIT_SLOTS at each,
+// for three horizons. Each place has its own devices, with passers-by on
+// top, enough to fill the tracker. Eight followers travel along; one device
+// turns up every twelve slots wherever we are. The detector sweeps the whole
+// tracker in FOLLOWER_SWEEP_BATCH batches every slot.
+#define FOLLOWER_BENCH_PLACES 6
+#define FOLLOWER_VISIT_SLOTS  10
+#define FOLLOWER_BENCH_FOLLOWERS 8
+
+template <uint32_t Capacity>
+static bool benchFollowers(unsigned seed) {
+    static FollowerTracker<Capacity> tracker;
+    std::mt19937_64 random(seed);
+    auto randomMac = [&]() { return random() & 0xFFFFFFFFFFFFULL; };
+    uint32_t perPlace = Capacity / 10;
+    std::vector<uint64_t> ambient[FOLLOWER_BENCH_PLACES];
+    for (int p = 0; p < FOLLOWER_BENCH_PLACES; p++) {
+        for (uint32_t i = 0; i < perPlace; i++) ambient[p].push_back(randomMac());
+    }
+    std::vector<uint64_t> following;
+    for (int i = 0; i < FOLLOWER_BENCH_FOLLOWERS; i++) following.push_back(randomMac());
+    uint64_t recurring = randomMac();
+
+    tracker.clear(0);
+    tracker.startSession(0);
+    std::vector<uint64_t> present;
+    unsigned long marks = 0;
+    double markNanos = 0;
+    unsigned long batches = 0;
+    double batchNanos = 0;
+    double batchMax = 0;
+    double sweepNanos = 0;
+    unsigned long sweeps = 0;
+    int foundFollowers = 0;
+    int firstFoundSlot = -1;
+    int lastFoundSlot = -1;
+    bool foundRecurring = false;
+    int bystanders = 0;
+    const int slots = 3 * FOLLOWER_SLOTS;
+    for (int slot = 0; slot < slots; slot++) {
+        int place = (slot / FOLLOWER_VISIT_SLOTS) % FOLLOWER_BENCH_PLACES;
+        present.clear();
+        for (uint64_t mac : ambient[place]) {
+            if (random() % 10 != 0) present.push_back(mac);
+        }
+        for (uint32_t i = 0; i < perPlace / 5; i++) present.push_back(randomMac()); // Passers-by
+        for (uint64_t mac : following) {
+            if (random() % 20 != 0) present.push_back(mac);
+        }
+        if (slot % 12 < 2) present.push_back(recurring);
+        std::shuffle(present.begin(), present.end(), random);
+
+        // Three adverts from each device over the slot
+        uint32_t start = (uint32_t)slot * FOLLOWER_SLOT_LENGTH;
+        BenchClock::time_point begin = BenchClock::now();
+        for (int round = 0; round < 3; round++) {
+            uint32_t now = start + round * (FOLLOWER_SLOT_LENGTH / 3);
+            for (uint64_t mac : present) tracker.mark(mac, now, false);
+        }
+        markNanos += elapsedNanos(begin);
+        marks += present.size() * 3;
+
+        tracker.advance(start + FOLLOWER_SLOT_LENGTH - 1);
+        BenchClock::time_point sweepBegin = BenchClock::now();
+        uint32_t left = Capacity;
+        while (left > 0) {
+            BenchClock::time_point batchBegin = BenchClock::now();
+            uint32_t examined = tracker.sweep(min((uint32_t)FOLLOWER_SWEEP_BATCH, left),
+                                              [&](const FollowerEvidence& evidence) {
+                bool follower = std::find(following.begin(), following.end(), evidence.identity) != following.end();
+                if (follower) {
+                    foundFollowers++;
+                    if (firstFoundSlot < 0) firstFoundSlot = slot;
+                    lastFoundSlot = slot;
+                } else if (evidence.identity == recurring) {
+                    foundRecurring = true;
+                } else {
+                    bystanders++;
+                }
+            });
+            double nanos = elapsedNanos(batchBegin);
+            batchNanos += nanos;
+            if (nanos > batchMax) batchMax = nanos;
+            batches++;
+            left = examined == 0 ? 0 : left - examined;
+        }
+        sweepNanos += elapsedNanos(sweepBegin);
+        sweeps++;
+    }
+    bool ok = foundFollowers == FOLLOWER_BENCH_FOLLOWERS && foundRecurring && bystanders == 0;
+    printf("%8u %8u %7.1f %9.2f %9.2f %9.1f %5d/%d %4d-%-3d %9s %10d %8lu %s\n", Capacity,
+           (unsigned)tracker.size(), markNanos / marks, batchNanos / batches / 1000, batchMax / 1000,
+           sweepNanos / sweeps / 1000, foundFollowers, FOLLOWER_BENCH_FOLLOWERS, firstFoundSlot, lastFoundSlot,
+           foundRecurring ? "yes" : "no", bystanders, tracker.evictions(), ok ? "ok" : "FAIL");
+    return ok;
+}
+
+static int checkFollowers(unsigned seed) {
+    printf("Follower detector: %d places, %d slots of %d s each, batches of %d\n", FOLLOWER_BENCH_PLACES,
+           3 * FOLLOWER_SLOTS, FOLLOWER_SLOT_LENGTH / 1000, FOLLOWER_SWEEP_BATCH);
+    printf("%8s %8s %7s %9s %9s %9s %7s %8s %9s %10s %8s\n", "capacity", "tracked", "ns/mark", "batch us",
+           "max us", "sweep us", "found", "at slot", "recurring", "bystanders", "evicted");
+    bool ok = benchFollowers<1024>(seed);
+    ok = benchFollowers<4096>(seed) && ok;
+    ok = benchFollowers<16384>(seed) && ok;
+    return ok ? 0 : 1;
+}
+
+// Estimation error of HyperLogLog<DISTINCT_PRECISION> over random 48-bit
+// addresses, against the standard error of 1.04 / sqrt(registers)
+static int checkDistinctError(unsigned seed) {
+    typedef HyperLogLog<DISTINCT_PRECISION> Sketch;
+    const int TRIALS = 50;
+    const double expected = 1.04 / sqrt((double)Sketch::REGISTERS);
+    std::mt19937_64 random(seed);
+    bool ok = true;
+    Sketch sketch;
+    Sketch halves[2];
+    printf("Distinct device sketch: %u registers, %u bytes, standard error %.2f%%\n", Sketch::REGISTERS,
+           (unsigned)sizeof(Sketch), expected * 100);
+    printf("%10s %8s %8s %8s %8s %10s\n", "devices", "bias", "rms", "worst", "merge", "ns/add");
+    for (uint32_t devices = 1000; devices <= 1000000; devices *= 10) {
+        double sum = 0;
+        double squares = 0;
+        double worst = 0;
+        double addNanos = 0;
+        bool merged = true;
+        for (int trial = 0; trial < TRIALS; trial++) {
+            sketch.clear();
+            halves[0].clear();
+            halves[1].clear();
+            uint64_t keySeed = random();
+            std::mt19937_64 keys(keySeed);
+            BenchClock::time_point start = BenchClock::now();
+            for (uint32_t i = 0; i < devices; i++) sketch.add(keys() & 0xFFFFFFFFFFFFULL);
+            addNanos += elapsedNanos(start);
+            uint32_t estimate = sketch.estimate();
+            // The same devices again, split between two sketches as two nodes
+            // would hear them: merged, they must give the same registers, and
+            // hearing them again must not count
+            keys.seed(keySeed);
+            for (uint32_t i = 0; i < devices; i++) {
+                uint64_t key = keys() & 0xFFFFFFFFFFFFULL;
+                halves[i & 1].add(key);
+                sketch.add(key);
+            }
+            halves[0].merge(halves[1]);
+            if (memcmp(halves[0].registers, sketch.registers, Sketch::REGISTERS) != 0 ||
+                sketch.estimate() != estimate) {
+                merged = false;
+            }
+            double error = ((double)estimate - devices) / devices;
+            sum += error;
+            squares += error * error;
+            if (fabs(error) > fabs(worst)) worst = error;
+        }
+        double bias = sum / TRIALS;
+        double rms = sqrt(squares / TRIALS);
+        printf("%10lu %+7.2f%% %7.2f%% %+7.2f%% %8s %10.1f\n", (unsigned long)devices, bias * 100, rms * 100,
+               worst * 100, merged ? "ok" : "FAIL", addNanos / ((double)devices * TRIALS));
+        if (fabs(bias) > expected / 2 || rms > expected * 1.5 || !merged) ok = false;
+    }
+
+    // Windows: devices heard now leave the hour after it and a pane, the day
+    // after a day and a pane; a union is one sketch of the whole window
+    static RollingDistinct<DISTINCT_PRECISION> rolling;
+    std::mt19937_64 keys(random());
+    rolling.clear(0);
+    for (int i = 0; i < 5000; i++) rolling.add(keys() & 0xFFFFFFFFFFFFULL);
+    Sketch window;
+    rolling.unionInto(DISTINCT_WEEK, window.registers);
+    bool windows = window.estimate() == rolling.estimate(DISTINCT_WEEK);
+    uint32_t day = rolling.paneLength(DISTINCT_DAY);
+    uint32_t checks[][2] = {{rolling.windowLength(DISTINCT_HOUR), 5000},
+                            {rolling.windowLength(DISTINCT_HOUR) + rolling.paneLength(DISTINCT_HOUR), 0},
+                            {rolling.windowLength(DISTINCT_DAY) + day - 1, 5000},
+                            {rolling.windowLength(DISTINCT_DAY) + day, 0}};
+    DistinctWindow checkWindows[] = {DISTINCT_HOUR, DISTINCT_HOUR, DISTINCT_DAY, DISTINCT_DAY};
+    for (int i = 0; i < 4; i++) {
+        rolling.advance(checks[i][0]);
+        uint32_t estimate = rolling.estimate(checkWindows[i]);
+        if (checks[i][1] == 0 ? estimate != 0 : fabs((double)estimate - checks[i][1]) > checks[i][1] * expected * 4) {
+            windows = false;
+        }
+    }
+    if (rolling.estimate(DISTINCT_WEEK) == 0) windows = false;
+    printf("Windows: %s; %u bytes for the hour, day and week\n", windows ? "ok" : "FAIL",
+           (unsigned)rolling.memoryUsed());
+    if (!windows) ok = false;
+    return ok ? 0 : 1;
+}
+
+// After a synthetic replay with rotating addresses, every device should be
+// known once under its first address, nearly every rotation folded, and
+// nothing alerted, as no device is new after the first few seconds
+static bool reportRotation(const SyntheticTrace& trace) {
+    unsigned long devices = trace.deviceCount();
+    unsigned long rotations = trace.rotations();
+    unsigned long known = allKnownDevices.size();
+    unsigned long folded = addressClusters.rotationsFolded();
+    int alerts = deviceTable.countWith(DEVICE_ALERT);
+    auto near = [](unsigned long value, unsigned long expected) {
+        unsigned long slack = expected / ROTATION_TOLERANCE + 1;
+        return value + slack >= expected && value <= expected + slack;
+    };
+    bool ok = near(known, devices) && near(folded, rotations) && alerts == 0;
+    printf("Rotation\n");
+    printf("  known devices     %lu of %lu\n", known, devices);
+    printf("  rotations folded  %lu of %lu (%lu undone)\n", folded, rotations, addressClusters.linksUndone());
+    printf("  alerts            %d: %s\n", alerts, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+// Writes the alert rules the sketch loads at setup: the rules file, then the
+// generated allowlist
+static bool installRules(const char* rulesPath, int allowlist, const std::vector<uint64_t>& fleet, unsigned seed) {
+    File file = LittleFS.open(ALERT_RULES_PATH, "w");
+    if (rulesPath != nullptr) {
+        FILE* rules = fopen(rulesPath, "r");
+        if (rules == nullptr) {
+            perror(rulesPath);
+            return false;
+        }
+        uint8_t buffer[512];
+        size_t bytes;
+        while ((bytes = fread(buffer, 1, sizeof(buffer), rules)) > 0) file.write(buffer, bytes);
+        fclose(rules);
+        file.write((const uint8_t*)"\n", 1);
+    }
+    std::mt19937 random(seed ^ 0xA11CE);
+    std::vector<uint64_t> macs(fleet);
+    for (int i = 0; i < allowlist; i++) {
+        macs.push_back((((uint64_t)random() << 32) | random()) & 0xFFFFFFFFFFFFULL);
+    }
+    for (size_t i = 0; i < macs.size(); i++) {
+        char line[40];
+        int n = snprintf(line, sizeof(line), "allow mac %02x:%02x:%02x:%02x:%02x:%02x\n",
+                         (unsigned)(macs[i] >> 40) & 0xFF, (unsigned)(macs[i] >> 32) & 0xFF,
+                         (unsigned)(macs[i] >> 24) & 0xFF, (unsigned)(macs[i] >> 16) & 0xFF,
+                         (unsigned)(macs[i] >> 8) & 0xFF, (unsigned)macs[i] & 0xFF);
+        file.write((const uint8_t*)line, n);
+    }
+    file.close();
+    return true;
+}
+
+int main(int argc, char** argv) {
+    nativeTrackHeap(false); // The harness's own trace and scripts stay out of the figures
+    const char* tracePath = nullptr;
+    int devices = 200;
+    int rate = 2000;
+    int seconds = 120;
+    int rotate = 0;
+    unsigned seed = 1;
+    const char* rulesPath = nullptr;
+    int allowlist = 0;
+    const char* capturePath = nullptr;
+    std::string collector;
+    int node = 1;
+    int attenuate = 0;
+    bool verbose = false;
+    bool distinctError = false;
+    bool followerBench = false;
+    bool macSetBench = false;
+    bool ouiBench = false;
+    bool queueStress = false;
+    bool historyCheck = false;
+    bool knownCheck = false;
+    bool jsonCheck = false;
+    bool advertFuzz = false;
+    bool rulesCheck = false;
+    int soakHours = 0;
+    Replay replay = {};
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--trace" && hasValue) tracePath = argv[++i];
+        else if (arg == "--devices" && hasValue) devices = atoi(argv[++i]);
+        else if (arg == "--rate" && hasValue) rate = atoi(argv[++i]);
+        else if (arg == "--seconds" && hasValue) seconds = atoi(argv[++i]);
+        else if (arg == "--rotate" && hasValue) rotate = atoi(argv[++i]);
+        else if (arg == "--seed" && hasValue) seed = (unsigned)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--rules" && hasValue) rulesPath = argv[++i];
+        else if (arg == "--allowlist" && hasValue) allowlist = atoi(argv[++i]);
+        else if (arg == "--capture" && hasValue) capturePath = argv[++i];
+        else if (arg == "--collector" && hasValue) collector = argv[++i];
+        else if (arg == "--node" && hasValue) node = atoi(argv[++i]);
+        else if (arg == "--attenuate" && hasValue) attenuate = atoi(argv[++i]);
+        else if (arg == "--realtime") replay.realtime = true;
+        else if (arg == "--distinct-error") distinctError = true;
+        else if (arg == "--follower-bench") followerBench = true;
+        else if (arg == "--macset-bench") macSetBench = true;
+        else if (arg == "--oui-bench") ouiBench = true;
+        else if (arg == "--queue-stress") queueStress = true;
+        else if (arg == "--history-check") historyCheck = true;
+        else if (arg == "--known-check") knownCheck = true;
+        else if (arg == "--json-check") jsonCheck = true;
+        else if (arg == "--advert-fuzz") advertFuzz = true;
+        else if (arg == "--rules-check") rulesCheck = true;
+        else if (arg == "--soak" && hasValue) soakHours = atoi(argv[++i]);
+        else if (arg == "--verbose") verbose = true;
+        else if (arg == "--tap" && hasValue) {
+            Tap tap = {};
+            int x, y;
+            if (sscanf(argv[++i], "%u,%d,%d", &tap.time, &x, &y) != 3) {
+                usage();
+                return 2;
+            }
+            tap.x = (int16_t)x;
+            tap.y = (int16_t)y;
+            replay.taps.push_back(tap);
+        } else if (arg == "--swipe" && hasValue) {
+            Tap tap = {};
+            int x, y, toX, toY;
+            if (sscanf(argv[++i], "%u,%d,%d,%d,%d,%u", &tap.time, &x, &y, &toX, &toY, &tap.duration) != 6 ||
+                tap.duration == 0) {
+                usage();
+                return 2;
+            }
+            tap.x = (int16_t)x;
+            tap.y = (int16_t)y;
+            tap.toX = (int16_t)toX;
+            tap.toY = (int16_t)toY;
+            replay.taps.push_back(tap);
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (distinctError) return checkDistinctError(seed);
+    if (followerBench) return checkFollowers(seed);
+    if (macSetBench) return benchMacSet(seed);
+    if (ouiBench) return benchOuiTable(seed);
+    if (queueStress) return stressSightingQueue();
+    if (historyCheck) return checkHistory(seed);
+    if (knownCheck) return checkKnownDeviceStore(seed);
+    if (jsonCheck) return checkDeviceJson(seed);
+    if (advertFuzz) return fuzzAdvertParser(seed);
+    if (rulesCheck) return checkAlertRules(seed);
+    if (rate <= 0) rate = 1;
+    if (soakHours > 0) {
+        seconds = soakHours * 3600;
+        addSoakTours(replay.taps, (uint32_t)soakHours * 3600000);
+    }
+    std::stable_sort(replay.taps.begin(), replay.taps.end(),
+                     [](const Tap& a, const Tap& b) { return a.time < b.time; });
+
+    TraceReader* trace;
+    SyntheticTrace* rotating = nullptr; // Checked after the replay
+    FILE* traceFile = nullptr;
+    std::vector<uint64_t> fleet;
+    if (tracePath != nullptr) {
+        traceFile = fopen(tracePath, "r");
+        if (traceFile == nullptr) {
+            perror(tracePath);
+            return 1;
+        }
+        trace = new FileTrace(traceFile);
+    } else {
+        SyntheticTrace* synthetic = new SyntheticTrace(devices, rate, seconds, rotate, seed);
+        if (allowlist > 0) synthetic->sampleMacs(4, fleet);
+        if (rotate > 0) rotating = synthetic;
+        trace = synthetic;
+    }
+    if ((rulesPath != nullptr || allowlist > 0) && !installRules(rulesPath, allowlist, fleet, seed)) return 1;
+
+    // A node joins the host's network before setup, as the board joins WIFI_SSID
+    if (!collector.empty()) {
+        size_t colon = collector.rfind(':');
+        if (colon == std::string::npos || node <= 0 || node > 0xFFFF) {
+            usage();
+            return 2;
+        }
+        collectorPort = (uint16_t)atoi(collector.c_str() + colon + 1);
+        collector.resize(colon);
+        collectorHost = collector.c_str();
+        nodeId = (uint16_t)node;
+        WiFi.mode(WIFI_STA);
+        WiFi.begin("native", "");
+    }
+
+    Serial.setEnabled(verbose);
+    nativeSetMicros(0);
+    nativeTrackHeap(true);
+    setup();
+    size_t setupHeap = nativeHeapInUse();
+    nativeResetHeapPeak();
+    nativeTrackHeap(false); // Only the sketch's own calls are tracked from here
+    tftStats = TftStats();
+    replay.wallStart = BenchClock::now();
+
+    // The capture owns the serial port, as with 'c' on the board
+    FILE* captureFile = nullptr;
+    if (capturePath != nullptr) {
+        captureFile = fopen(capturePath, "wb");
+        if (captureFile == nullptr) {
+            perror(capturePath);
+            return 1;
+        }
+        Serial.setOutput(captureFile);
+        Serial.setEnabled(true);
+        startCapture();
+    }
+
+    unsigned long adverts = 0;
+    unsigned long delivered = 0;
+    std::vector<uint64_t> macs;
+    std::vector<SoakSample> soak;
+    uint32_t nextSoakSample = SOAK_SAMPLE_INTERVAL;
+    TraceAdvert advert;
+    uint32_t lastTime = 0;
+    while (trace->next(advert)) {
+        if (advert.time < lastTime) advert.time = lastTime; // Keep the clock monotonic
+        lastTime = advert.time;
+        while (soakHours > 0 && advert.time >= nextSoakSample) {
+            runUntil(replay, nextSoakSample);
+            SoakSample sample = {nextSoakSample, adverts, nativeAllocations(), nativeHeapInUse(), nativeHeapPeak()};
+            soak.push_back(sample);
+            nextSoakSample += SOAK_SAMPLE_INTERVAL;
+        }
+        runUntil(replay, advert.time);
+
+        Advert radio;
+        radio.mac = advert.mac;
+        radio.rssi = (int8_t)max(-127, advert.rssi - attenuate);
+        radio.randomAddress = advert.randomAddress;
+        radio.payload = advert.payload.data();
+        radio.payloadLength = advert.payload.size();
+        nativeTrackHeap(true);
+        BenchClock::time_point start = BenchClock::now();
+        if (nativeScanSource().deliver(radio, advert.scanResponse)) delivered++;
+        replay.ingestNanos += elapsedNanos(start);
+        nativeTrackHeap(false);
+        adverts++;
+        macs.push_back(advert.mac);
+        if (macs.size() >= MAC_DEDUPE_BATCH) {
+            std::sort(macs.begin(), macs.end());
+            macs.erase(std::unique(macs.begin(), macs.end()), macs.end());
+        }
+    }
+    runUntil(replay, lastTime + REPLAY_SETTLE);
+    if (soakHours > 0) {
+        SoakSample sample = {replay.now, adverts, nativeAllocations(), nativeHeapInUse(), nativeHeapPeak()};
+        soak.push_back(sample);
+    }
+    if (captureFile != nullptr) {
+        capture.stop();
+        serviceCapture();
+        Serial.setOutput(nullptr);
+        fclose(captureFile);
+    }
+    Serial.setEnabled(true);
+
+    std::sort(macs.begin(), macs.end());
+    size_t uniqueMacs = std::unique(macs.begin(), macs.end()) - macs.begin();
+    double replaySeconds = (lastTime + REPLAY_SETTLE) / 1000.0;
+
+    printf("\nReplay\n");
+    printf("  adverts           %lu (%lu delivered) from %zu addresses over %.1f s, %.0f adverts/s\n",
+           adverts, delivered, uniqueMacs, replaySeconds, adverts / max(replaySeconds, 0.001));
+    if (deviceTable.droppedCount() > 0) {
+        printf("  warning           the device table (%d rows) was full: %lu sightings dropped, counts are capped\n",
+               deviceTable.capacity(), deviceTable.droppedCount());
+    }
+    printf("Ingest (onAdvert + scan task)\n");
+    printf("  per advert        %.0f ns\n", replay.ingestNanos / max(delivered, 1UL));
+    printf("  per scan cycle    %.0f ns over %lu cycles\n", replay.ingestNanos / max(replay.scanCycles, 1UL),
+           replay.scanCycles);
+    printf("Scan summary\n");
+    nativeTrackHeap(true);
+    logScanSummary();
+    dumpPerfCounters(Serial);
+    nativeTrackHeap(false);
+    printf("Heap (operator new)\n");
+    printf("  after setup       %zu bytes\n", setupHeap);
+    printf("  peak in replay    %zu bytes (+%zu)\n", nativeHeapPeak(), nativeHeapPeak() - setupHeap);
+    printf("  allocations       %lu in replay, %.3f per advert\n", nativeAllocations(),
+           (double)nativeAllocations() / max(delivered, 1UL));
+    printf("Render (UI loop)\n");
+    printf("  loop passes       %lu, %.0f ns each\n", replay.loopPasses, replay.renderNanos / max(replay.loopPasses, 1UL));
+    printf("  draw calls        %lu (%lu on the panel), %.1f per loop pass\n", tftStats.drawCalls, tftStats.panelCalls,
+           (double)tftStats.drawCalls / max(replay.loopPasses, 1UL));
+    printf("  image pushes      %lu, %lu pixels to the panel\n", tftStats.pushes, tftStats.pushedPixels);
+
+    bool flat = soakHours == 0 || reportSoak(soak);
+    bool folded = rotating == nullptr || reportRotation(*rotating);
+
+    delete trace;
+    if (traceFile != nullptr) fclose(traceFile);
+    return flat && folded ? 0 : 1;
+}
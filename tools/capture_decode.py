@@ -0,0 +1,281 @@
+#!/usr/bin/env python3
+"""Decode the binary advert capture stream (CaptureStream.h).
+
+Read a saved stream, or capture live from the board:
+
+    python3 tools/capture_decode.py capture.bin --csv trace.csv
+    python3 tools/capture_decode.py --port /dev/ttyUSB0 --csv trace.csv --btsnoop capture.log
+
+With --port the board is sent 'c', the port follows it to the capture baud
+rate, and Ctrl-C sends 's' to stop (pyserial is needed for this only). --raw
+also keeps the undecoded bytes.
+
+The CSV is the native harness's trace format, so a capture can be replayed
+with `program --trace trace.csv`. The btsnoop file holds each advert as an
+HCI LE Advertising Report event and opens in Wireshark. Log lines carried in
+the stream, and any text the board printed outside frames, go to stderr.
+A summary of frames, CRC failures and sequence gaps is printed at the end.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+RECORD_START = 0
+RECORD_ADVERT = 1
+RECORD_TEXT = 2
+HEADER = struct.Struct("<BII")  # type, sequence, micros
+
+AD_NAME_SHORT = 0x08
+AD_NAME_COMPLETE = 0x09
+
+# btsnoop: H4 framing; timestamps are microseconds since 0 AD
+BTSNOOP_DATALINK_H4 = 1002
+BTSNOOP_EPOCH_DELTA = 0x00DCDDB30F2F8000
+BTSNOOP_FLAGS_EVENT_RECEIVED = 0x03
+
+
+def crc16_ccitt(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def advert_name(payload):
+    """Complete or shortened local name from the AD structures, if any."""
+    name = None
+    pos = 0
+    while pos < len(payload):
+        length = payload[pos]
+        if length == 0 or pos + 1 + length > len(payload):
+            break
+        kind = payload[pos + 1]
+        if kind in (AD_NAME_SHORT, AD_NAME_COMPLETE) and (name is None or kind == AD_NAME_COMPLETE):
+            name = payload[pos + 2:pos + 1 + length].decode("utf-8", "replace")
+        pos += 1 + length
+    return name
+
+
+class Decoder:
+    def __init__(self, csv_out, btsnoop_out, quiet):
+        self.csv_out = csv_out
+        self.btsnoop_out = btsnoop_out
+        self.quiet = quiet
+        self.pending = bytearray()
+        self.frames = 0
+        self.bad = 0
+        self.adverts = 0
+        self.texts = 0
+        self.starts = 0
+        self.gaps = 0
+        self.span_start = None
+        self.span_end = 0
+        self.span_records = 0
+        self.base_micros = None
+        self.last_micros = 0
+        self.wraps = 0
+        self.wall_start = int(time.time() * 1000000)
+        if csv_out:
+            csv_out.write("# time_ms,mac,rssi,name,payload,address type\n")
+        if btsnoop_out:
+            btsnoop_out.write(b"btsnoop\0" + struct.pack(">II", 1, BTSNOOP_DATALINK_H4))
+
+    def feed(self, data):
+        self.pending += data
+        while True:
+            end = self.pending.find(b"\0")
+            if end < 0:
+                return
+            chunk = bytes(self.pending[:end])
+            del self.pending[:end + 1]
+            if chunk:
+                self.frame(chunk)
+
+    def finish(self):
+        if self.pending:
+            self.outside(bytes(self.pending))
+            self.pending.clear()
+
+    def outside(self, chunk):
+        """Bytes that are not a frame: text the board printed around a capture."""
+        text = chunk.decode("utf-8", "replace")
+        if not self.quiet:
+            for line in text.splitlines():
+                if line.strip():
+                    print("serial: " + line, file=sys.stderr)
+
+    def frame(self, chunk):
+        body = cobs_decode(chunk)
+        if body is None or len(body) < HEADER.size + 2 or \
+                crc16_ccitt(body[:-2]) != struct.unpack_from("<H", body, len(body) - 2)[0]:
+            if all(32 <= b < 127 or b in (9, 10, 13) for b in chunk):
+                self.outside(chunk)
+            else:
+                self.bad += 1
+            return
+        self.frames += 1
+        kind, sequence, micros = HEADER.unpack_from(body)
+        fields = body[HEADER.size:-2]
+        if kind == RECORD_START:
+            self.starts += 1
+            self.close_span()
+            self.span_start = sequence
+            return
+        self.count_sequence(sequence)
+        elapsed = self.elapsed_micros(micros)
+        if kind == RECORD_TEXT:
+            self.texts += 1
+            if not self.quiet:
+                print("[%10.3f] %s" % (elapsed / 1e6, fields.decode("utf-8", "replace")), file=sys.stderr)
+        elif kind == RECORD_ADVERT and len(fields) >= 9:
+            mac = fields[0:6]
+            rssi = struct.unpack_from("b", fields, 6)[0]
+            random_address = fields[7] == 1
+            payload = fields[9:9 + fields[8]]
+            self.adverts += 1
+            self.advert(elapsed, mac, rssi, random_address, payload)
+
+    # The sequence counts records of every type from the START record on. Log
+    # lines and adverts are written from separate rings, so they arrive out
+    # of order; whatever is missing from the span was dropped on the board
+    # because the writer fell behind.
+    def count_sequence(self, sequence):
+        if self.span_start is None:
+            self.span_start = sequence - 1  # Joined mid-stream
+        offset = (sequence - self.span_start) & 0xFFFFFFFF
+        self.span_end = max(self.span_end, offset)
+        self.span_records += 1
+
+    def close_span(self):
+        if self.span_start is not None:
+            self.gaps += self.span_end - self.span_records
+        self.span_start = None
+        self.span_end = 0
+        self.span_records = 0
+
+    # micros() wraps every 71 minutes
+    def elapsed_micros(self, micros):
+        if self.base_micros is None:
+            self.base_micros = micros
+        if micros < self.last_micros and self.last_micros - micros > 0x80000000:
+            self.wraps += 1
+        self.last_micros = micros
+        return micros + (self.wraps << 32) - self.base_micros
+
+    def advert(self, elapsed, mac, rssi, random_address, payload):
+        if self.csv_out:
+            name = advert_name(payload) or ""
+            name = "".join(c if c.isprintable() and c != "," else " " for c in name)
+            self.csv_out.write("%d,%s,%d,%s,%s%s\n" % (
+                elapsed // 1000, ":".join("%02x" % b for b in mac), rssi, name, payload.hex(),
+                ",random" if random_address else ""))
+        if self.btsnoop_out:
+            # HCI LE Meta event, LE Advertising Report with one ADV_IND report;
+            # the address is little endian on the wire
+            report = struct.pack("<BBBB6sB", 0x02, 1, 0x00, 1 if random_address else 0,
+                                 bytes(reversed(mac)), len(payload)) + payload + struct.pack("b", rssi)
+            packet = struct.pack("<BBB", 0x04, 0x3E, len(report)) + report
+            timestamp = BTSNOOP_EPOCH_DELTA + self.wall_start + elapsed
+            self.btsnoop_out.write(struct.pack(">IIIIq", len(packet), len(packet),
+                                               BTSNOOP_FLAGS_EVENT_RECEIVED, 0, timestamp) + packet)
+
+    def summary(self):
+        self.close_span()
+        print("%d frames: %d adverts, %d log lines, %d starts; %d bad frames, %d records dropped on the board"
+              % (self.frames, self.adverts, self.texts, self.starts, self.bad, self.gaps), file=sys.stderr)
+
+
+def read_port(args, decoder, raw):
+    try:
+        import serial
+    except ImportError:
+        sys.exit("--port needs pyserial: pip install pyserial")
+    port = serial.Serial(args.port, args.baud, timeout=0.1)
+    port.reset_input_buffer()
+    port.write(b"c")
+    # The board confirms at the old rate, then switches
+    line = port.readline()
+    deadline = time.time() + 2
+    while not line.startswith(b"Capture starting") and time.time() < deadline:
+        line = port.readline()
+    if not line.startswith(b"Capture starting"):
+        sys.exit("No reply from the board; is it running and at %d baud?" % args.baud)
+    port.baudrate = int(line.split()[3])
+    print("Capturing at %d baud, Ctrl-C to stop" % port.baudrate, file=sys.stderr)
+    try:
+        while True:
+            data = port.read(4096)
+            if raw:
+                raw.write(data)
+            decoder.feed(data)
+    except KeyboardInterrupt:
+        port.write(b"s")
+        port.flush()
+        time.sleep(0.2)
+        data = port.read(65536)
+        if raw:
+            raw.write(data)
+        decoder.feed(data)
+        port.baudrate = args.baud
+    port.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("input", nargs="?", help="saved capture stream (default: stdin)")
+    parser.add_argument("--port", help="capture live from this serial port")
+    parser.add_argument("--baud", type=int, default=115200, help="the board's normal rate (default 115200)")
+    parser.add_argument("--csv", help="write adverts as a replay trace CSV ('-' for stdout)")
+    parser.add_argument("--btsnoop", help="write adverts as a btsnoop file for Wireshark")
+    parser.add_argument("--raw", help="also save the undecoded stream (with --port)")
+    parser.add_argument("--quiet", action="store_true", help="do not print log lines")
+    args = parser.parse_args()
+
+    csv_out = None
+    if args.csv == "-":
+        csv_out = sys.stdout
+    elif args.csv:
+        csv_out = open(args.csv, "w")
+    btsnoop_out = open(args.btsnoop, "wb") if args.btsnoop else None
+    decoder = Decoder(csv_out, btsnoop_out, args.quiet)
+
+    if args.port:
+        raw = open(args.raw, "wb") if args.raw else None
+        read_port(args, decoder, raw)
+        if raw:
+            raw.close()
+    else:
+        source = open(args.input, "rb") if args.input else sys.stdin.buffer
+        while True:
+            data = source.read(65536)
+            if not data:
+                break
+            decoder.feed(data)
+    decoder.finish()
+    decoder.summary()
+    for out in (csv_out, btsnoop_out):
+        if out and out is not sys.stdout:
+            out.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,839 @@
+#!/usr/bin/env python3
+"""Fleet collector: merges the sighting reports of several scanners.
+
+Each node set up with COLLECTOR_HOST sends a UDP report of the devices it
+heard every two seconds (NodeReport.h). The collector merges them into one
+presence table, estimates which node, and so which zone, each device is
+closest to, and passes on each device's alert once however many nodes raise
+it:
+
+    python3 tools/collector.py --zones zones.txt --snapshot presence.json
+
+Alerts and zone changes are written to stdout as JSON lines; a summary goes to
+stderr every --interval seconds. A zones file maps node IDs to names, one
+"ID name" per line; nodes without one are their own zone.
+
+A device is known to a node by its address, or for a rotating address by the
+first address of its cluster. Reports carry both, so the collector links the
+names different nodes use for one device and follows it through rotations.
+Each node's RSSI for a device is smoothed; the zone is that of the strongest
+node heard within --zone-window, and only moves to another node once it is
+--hysteresis dB stronger.
+
+Every minute each node also sends HyperLogLog sketches of the devices it has
+heard in the last hour, day and week (HyperLogLog.h). Merged, they count the
+distinct devices the whole site has seen, shown in the summary and snapshot. A
+sketch only sees identities: a rotating device that two nodes first heard at
+different addresses counts twice.
+
+Everything can be tested on one host. --simulate N runs N nodes in a grid
+with devices walking between them on a simulated clock, feeds their reports
+straight in and reports throughput, zone accuracy and alert counts:
+
+    python3 tools/collector.py --simulate 300 --devices 3000 --seconds 60
+
+With --send HOST:PORT the simulated nodes send real datagrams, in real time,
+to a collector started separately. The native harness reports as a node too:
+`program --realtime --collector 127.0.0.1:47800 --node 2`.
+"""
+
+import argparse
+import json
+import math
+import os
+import random
+import signal
+import socket
+import struct
+import sys
+import time
+
+NODE_REPORT_MAGIC = 0x4E42
+NODE_REPORT_VERSION = 1
+NODE_REPORT_DATAGRAM = 1200
+NODE_REPORT_SHIELDS_UP = 0x01
+NODE_REPORT_SKETCH = 0x02
+HEADER = struct.Struct("<HBBHHII")  # magic, version, flags, node, count, sequence, millis
+SKETCH_HEADER = struct.Struct("<BBI")  # window, precision, span
+DISTINCT_WINDOWS = ("hour", "day", "week")
+SKETCH_MAX_AGE = 300.0  # s a node's sketch still counts without a newer one
+
+RECORD_ALERT = 0x01
+RECORD_NEW = 0x02
+RECORD_USABLE = 0x04
+RECORD_ADDRESS = 0x08
+RECORD_MAX = 19
+RECORD_MAX_AGE = 0x1FFFFF
+
+DEFAULT_PORT = 47800
+SETTLE_INTERVAL = 0.25  # s between zone updates while datagrams keep arriving
+
+
+def format_mac(mac):
+    return ":".join("%02x" % b for b in mac)
+
+
+def decode_report(data):
+    """Returns (node, sequence, millis, flags, records); records are
+    (flags, identity, address, adverts, rssi, rssi_max, age_ms) with the
+    addresses as 6-byte strings."""
+    if len(data) < HEADER.size:
+        raise ValueError("short datagram")
+    magic, version, flags, node, count, sequence, millis = HEADER.unpack_from(data)
+    if magic != NODE_REPORT_MAGIC or version != NODE_REPORT_VERSION:
+        raise ValueError("not a node report")
+    records = []
+    pos = HEADER.size
+    for _ in range(count):
+        record_flags = data[pos]
+        identity = data[pos + 1:pos + 7]
+        pos += 7
+        if record_flags & RECORD_ADDRESS:
+            address = data[pos:pos + 6]
+            pos += 6
+        else:
+            address = identity
+        adverts, rssi, rssi_max = data[pos], data[pos + 1], data[pos + 2]
+        pos += 3
+        age = 0
+        shift = 0
+        while True:
+            byte = data[pos]
+            pos += 1
+            age |= (byte & 0x7F) << shift
+            if byte < 0x80:
+                break
+            shift += 7
+        if len(identity) != 6 or len(address) != 6:
+            raise ValueError("truncated record")
+        records.append((record_flags, identity, address, adverts,
+                        rssi - 256 if rssi > 127 else rssi, rssi_max - 256 if rssi_max > 127 else rssi_max, age))
+    return node, sequence, millis, flags, records
+
+
+def decode_sketch(data):
+    """Returns (node, window, precision, span_ms, registers) of a sketch datagram"""
+    magic, version, flags, node, count, sequence, millis = HEADER.unpack_from(data)
+    if magic != NODE_REPORT_MAGIC or version != NODE_REPORT_VERSION:
+        raise ValueError("not a node report")
+    window, precision, span = SKETCH_HEADER.unpack_from(data, HEADER.size)
+    registers = data[HEADER.size + SKETCH_HEADER.size:]
+    if not flags & NODE_REPORT_SKETCH or window >= len(DISTINCT_WINDOWS) or not 4 <= precision <= 16 \
+            or len(registers) != 1 << precision:
+        raise ValueError("bad sketch")
+    return node, window, precision, span, bytes(registers)
+
+
+def encode_sketch(node, sequence, millis, window, precision, span, registers):
+    return HEADER.pack(NODE_REPORT_MAGIC, NODE_REPORT_VERSION, NODE_REPORT_SKETCH, node, 1, sequence,
+                       millis) + SKETCH_HEADER.pack(window, precision, span) + bytes(registers)
+
+
+# HyperLogLog, as HyperLogLog.h
+def distinct_hash(identity):
+    z = (int.from_bytes(identity, "big") + 0x9E3779B97F4A7C15) & 0xFFFFFFFFFFFFFFFF
+    z = ((z ^ (z >> 30)) * 0xBF58476D1CE4E5B9) & 0xFFFFFFFFFFFFFFFF
+    z = ((z ^ (z >> 27)) * 0x94D049BB133111EB) & 0xFFFFFFFFFFFFFFFF
+    return z ^ (z >> 31)
+
+
+def sketch_add(registers, precision, identity):
+    value = distinct_hash(identity)
+    index = value >> (64 - precision)
+    rest = ((value << precision) & 0xFFFFFFFFFFFFFFFF) | (1 << (precision - 1))
+    rank = 65 - rest.bit_length()
+    if rank > registers[index]:
+        registers[index] = rank
+
+
+def sketch_fold(registers, precision, target):
+    """The same sketch at a lower precision, to merge with one"""
+    shift = precision - target
+    folded = bytearray(1 << target)
+    for index, rank in enumerate(registers):
+        if rank == 0:
+            continue
+        low = index & ((1 << shift) - 1)
+        rank = shift - low.bit_length() + 1 if low else rank + shift
+        if rank > folded[index >> shift]:
+            folded[index >> shift] = rank
+    return folded
+
+
+def sketch_estimate(registers, precision):
+    """Ertl's improved estimator, as HyperLogLog::estimate"""
+    m = float(1 << precision)
+    top = 64 - precision + 1
+    histogram = [0] * (top + 1)
+    for rank in registers:
+        histogram[rank] += 1
+    if histogram[0] == m:
+        return 0
+    z = m * _tau(1.0 - histogram[top] / m)
+    for k in range(top - 1, 0, -1):
+        z = 0.5 * (z + histogram[k])
+    z += m * _sigma(histogram[0] / m)
+    return int(m * m / (2.0 * math.log(2.0)) / z + 0.5)
+
+
+def _sigma(x):
+    y = 1.0
+    z = x
+    while True:
+        x *= x
+        previous = z
+        z += x * y
+        y += y
+        if z == previous:
+            return z
+
+
+def _tau(x):
+    if x in (0.0, 1.0):
+        return 0.0
+    y = 1.0
+    z = 1.0 - x
+    while True:
+        x = math.sqrt(x)
+        previous = z
+        y *= 0.5
+        z -= (1.0 - x) * (1.0 - x) * y
+        if z == previous:
+            return z / 3.0
+
+
+def encode_reports(node, sequence, millis, flags, records):
+    """Splits records into datagrams as the node does. Returns the datagrams
+    and the next sequence number."""
+    datagrams = []
+    body = bytearray()
+    count = 0
+    for record_flags, identity, address, adverts, rssi, rssi_max, age in records:
+        if HEADER.size + len(body) + RECORD_MAX > NODE_REPORT_DATAGRAM:
+            datagrams.append(HEADER.pack(NODE_REPORT_MAGIC, NODE_REPORT_VERSION, flags, node, count,
+                                         sequence, millis) + body)
+            sequence = (sequence + 1) & 0xFFFFFFFF
+            body = bytearray()
+            count = 0
+        record_flags &= ~RECORD_ADDRESS
+        if address != identity:
+            record_flags |= RECORD_ADDRESS
+        body.append(record_flags)
+        body += identity
+        if address != identity:
+            body += address
+        body += struct.pack("<Bbb", adverts, rssi, rssi_max)
+        age = min(age, RECORD_MAX_AGE)
+        while age >= 0x80:
+            body.append((age & 0x7F) | 0x80)
+            age >>= 7
+        body.append(age)
+        count += 1
+    if count:
+        datagrams.append(HEADER.pack(NODE_REPORT_MAGIC, NODE_REPORT_VERSION, flags, node, count,
+                                     sequence, millis) + body)
+        sequence = (sequence + 1) & 0xFFFFFFFF
+    return datagrams, sequence
+
+
+class Node:
+    __slots__ = ("node", "sequence", "datagrams", "records", "lost", "shields_up", "last_report")
+
+    def __init__(self, node):
+        self.node = node
+        self.sequence = None
+        self.datagrams = 0
+        self.records = 0
+        self.lost = 0
+        self.shields_up = False
+        self.last_report = 0.0
+
+
+class Device:
+    """A device as the whole fleet sees it. id is the first address any node
+    reported it with."""
+    __slots__ = ("id", "addresses", "keys", "nodes", "first_seen", "last_seen", "zone_node",
+                 "alerted", "alert_nodes", "pending", "usable")
+
+    def __init__(self, device_id, now):
+        self.id = device_id
+        self.addresses = set()
+        self.keys = set()   # (node, identity) names nodes use for it
+        self.nodes = {}     # node -> [smoothed rssi, last seen, adverts]
+        self.first_seen = now
+        self.last_seen = now
+        self.zone_node = None
+        self.alerted = None  # Node whose alert was passed on
+        self.alert_nodes = set()  # Nodes that raised one
+        self.pending = None  # (node, when, event fields) of an alert not passed on yet
+        self.usable = False
+
+
+class Collector:
+    def __init__(self, zones=None, presence=60.0, zone_window=6.0, hysteresis=4.0, smoothing=0.4,
+                 alert_hold=3600.0, alert_delay=2.0, events=("alert", "zone"), out=sys.stdout):
+        self.zones = zones or {}
+        self.presence = presence
+        self.zone_window = zone_window
+        self.hysteresis = hysteresis
+        self.smoothing = smoothing
+        self.alert_hold = alert_hold
+        self.alert_delay = alert_delay
+        self.events = set(events)
+        self.out = out
+        self.nodes = {}
+        self.by_address = {}
+        self.by_key = {}
+        self.devices = set()
+        self.alerted_addresses = {}  # address -> when its alert was passed on
+        self.pending_alerts = []
+        self.changed = set()  # Devices whose zone needs another look
+        self.sketches = {}  # (node, window) -> (precision, registers, received)
+        self.datagrams = 0
+        self.records = 0
+        self.bad = 0
+        self.alerts = 0
+        self.duplicates = 0
+        self.merges = 0
+        self.zone_changes = 0
+        self.now = 0.0
+
+    def zone_name(self, node):
+        return self.zones.get(node, "node %d" % node) if node is not None else None
+
+    def emit(self, kind, **fields):
+        if kind in self.events and self.out is not None:
+            fields["event"] = kind
+            fields["t"] = round(self.now, 3)
+            self.out.write(json.dumps(fields) + "\n")
+
+    def ingest(self, data, now):
+        """One datagram received at now (seconds)"""
+        try:
+            sketch = len(data) >= HEADER.size and data[3] & NODE_REPORT_SKETCH
+            if sketch:
+                node_id, window, precision, span, registers = decode_sketch(data)
+                sequence = HEADER.unpack_from(data)[5]
+            else:
+                node_id, sequence, millis, flags, records = decode_report(data)
+        except (ValueError, IndexError, struct.error):
+            self.bad += 1
+            return
+        self.now = now
+        self.datagrams += 1
+        node = self.nodes.get(node_id)
+        if node is None:
+            node = self.nodes[node_id] = Node(node_id)
+        if node.sequence is not None:
+            gap = (sequence - node.sequence - 1) & 0xFFFFFFFF
+            if gap < 0x80000000:
+                node.lost += gap
+            # Otherwise a reordered datagram, or a node that restarted
+        node.sequence = sequence
+        node.datagrams += 1
+        if sketch:
+            self.sketches[(node_id, window)] = (precision, registers, now)
+            return
+        node.records += len(records)
+        node.shields_up = bool(flags & NODE_REPORT_SHIELDS_UP)
+        node.last_report = now
+        self.records += len(records)
+        for record in records:
+            self.record(node_id, record, now)
+
+    def record(self, node_id, record, now):
+        record_flags, identity, address, adverts, rssi, rssi_max, age = record
+        key = (node_id, identity)
+        device = self.by_key.get(key)
+        other = self.by_address.get(address)
+        if device is None:
+            device = other if other is not None else self.by_address.get(identity)
+        elif other is not None and other is not device:
+            device = self.merge(device, other)
+        if device is None:
+            device = Device(identity, now)
+            self.devices.add(device)
+            if identity in self.alerted_addresses:
+                device.alerted = -1  # Alerted before it last went quiet
+        if key not in device.keys:
+            device.keys.add(key)
+            self.by_key[key] = device
+        for mac in (identity, address):
+            if mac not in device.addresses:
+                existing = self.by_address.get(mac)
+                if existing is not None and existing is not device:
+                    device = self.merge(device, existing)
+                device.addresses.add(mac)
+                self.by_address[mac] = device
+
+        seen = now - age / 1000.0
+        if seen > device.last_seen:
+            device.last_seen = seen
+        if record_flags & RECORD_USABLE:
+            device.usable = True
+        state = device.nodes.get(node_id)
+        if state is None:
+            device.nodes[node_id] = [float(rssi), seen, adverts]
+        else:
+            # A long quiet spell restarts the average
+            if seen - state[1] > self.zone_window:
+                state[0] = float(rssi)
+            else:
+                state[0] += (rssi - state[0]) * self.smoothing
+            if seen > state[1]:
+                state[1] = seen
+            state[2] += adverts
+        self.changed.add(device)
+
+        if record_flags & RECORD_ALERT and node_id not in device.alert_nodes:
+            device.alert_nodes.add(node_id)
+            if device.alerted is None and device.pending is None:
+                device.pending = (node_id, now, {"address": format_mac(address), "rssi": rssi,
+                                                 "new": bool(record_flags & RECORD_NEW)})
+                self.pending_alerts.append(device)
+            else:
+                self.duplicates += 1
+
+    # An alert waits one report from every node before it is passed on: a
+    # node that only knows a device's new address reports it as a new device
+    # until another node's report links the two.
+    def flush_alerts(self, now):
+        waiting = []
+        for device in self.pending_alerts:
+            if device.pending is None:
+                continue  # Merged into a device that was already alerted
+            node_id, raised, fields = device.pending
+            if now - raised < self.alert_delay and device in self.devices:
+                waiting.append(device)
+                continue
+            device.pending = None
+            if device not in self.devices or device.alerted is not None:
+                continue
+            device.alerted = node_id
+            self.alerts += 1
+            for mac in device.addresses:
+                self.alerted_addresses[mac] = now
+            self.emit("alert", device=format_mac(device.id), node=node_id, zone=self.zone_name(device.zone_node),
+                      **fields)
+        self.pending_alerts = waiting
+
+    def settle(self, now):
+        """Brings zones up to date and passes on alerts that have waited long
+        enough. Runs after a batch of datagrams rather than per record, so a
+        device heard by many nodes is looked at once."""
+        self.now = now
+        for device in self.changed:
+            if device in self.devices:
+                self.update_zone(device, now)
+        self.changed.clear()
+        self.flush_alerts(now)
+
+    def update_zone(self, device, now):
+        best = None
+        best_rssi = -1000.0
+        current_rssi = None
+        horizon = now - self.zone_window
+        stale = now - self.presence
+        for node_id, state in list(device.nodes.items()):
+            if state[1] < horizon:
+                if state[1] < stale:
+                    del device.nodes[node_id]
+                continue
+            if state[0] > best_rssi:
+                best, best_rssi = node_id, state[0]
+            if node_id == device.zone_node:
+                current_rssi = state[0]
+        if best is None or best == device.zone_node:
+            return
+        if current_rssi is not None and best_rssi < current_rssi + self.hysteresis:
+            return
+        previous = device.zone_node
+        device.zone_node = best
+        if previous is not None:
+            self.zone_changes += 1
+        if previous is None or self.zone_name(previous) != self.zone_name(best):
+            self.emit("zone", device=format_mac(device.id), zone=self.zone_name(best), node=best,
+                      rssi=round(best_rssi), **({"from": self.zone_name(previous)} if previous is not None else {}))
+
+    # Two names turned out to be one device: keep the older entry
+    def merge(self, a, b):
+        if b.first_seen < a.first_seen:
+            a, b = b, a
+        self.merges += 1
+        for mac in b.addresses:
+            a.addresses.add(mac)
+            self.by_address[mac] = a
+        for key in b.keys:
+            a.keys.add(key)
+            self.by_key[key] = a
+        for node_id, state in b.nodes.items():
+            mine = a.nodes.get(node_id)
+            if mine is None or state[1] > mine[1]:
+                a.nodes[node_id] = state
+        a.last_seen = max(a.last_seen, b.last_seen)
+        a.usable = a.usable or b.usable
+        if a.alerted is None:
+            a.alerted = b.alerted
+        elif b.alerted is not None and b.alerted != -1:
+            # Both were passed on before the link was found; count the later one
+            self.duplicates += 1
+        if b.pending is not None:
+            if a.alerted is None and a.pending is None:
+                a.pending = b.pending
+                self.pending_alerts.append(a)
+            else:
+                self.duplicates += 1
+            b.pending = None
+        a.alert_nodes |= b.alert_nodes
+        if a.zone_node is None:
+            a.zone_node = b.zone_node
+        self.devices.discard(b)
+        return a
+
+    def expire(self, now):
+        """Drops devices no node has heard within the presence window"""
+        cutoff = now - self.presence
+        for device in [d for d in self.devices if d.last_seen < cutoff]:
+            self.devices.discard(device)
+            for mac in device.addresses:
+                if self.by_address.get(mac) is device:
+                    del self.by_address[mac]
+            for key in device.keys:
+                if self.by_key.get(key) is device:
+                    del self.by_key[key]
+        hold = now - self.alert_hold
+        for mac in [m for m, t in self.alerted_addresses.items() if t < hold]:
+            del self.alerted_addresses[mac]
+
+    def distinct(self, window):
+        """Distinct devices the fleet has seen in a window: the union of every
+        node's latest sketch for it, or None without one"""
+        fresh = [(p, r) for (node, w), (p, r, received) in self.sketches.items()
+                 if w == window and self.now - received <= SKETCH_MAX_AGE]
+        if not fresh:
+            return None
+        precision = min(p for p, _ in fresh)
+        merged = bytearray(1 << precision)
+        for p, registers in fresh:
+            if p != precision:
+                registers = sketch_fold(registers, p, precision)
+            merged = bytearray(map(max, merged, registers))
+        return sketch_estimate(merged, precision)
+
+    def snapshot(self):
+        rows = []
+        for device in sorted(self.devices, key=lambda d: d.id):
+            rows.append({
+                "device": format_mac(device.id),
+                "addresses": sorted(format_mac(m) for m in device.addresses),
+                "zone": self.zone_name(device.zone_node),
+                "node": device.zone_node,
+                "rssi": {str(n): round(s[0], 1) for n, s in sorted(device.nodes.items())},
+                "firstSeen": round(device.first_seen, 3),
+                "lastSeen": round(device.last_seen, 3),
+                "usable": device.usable,
+                "alert": device.alerted is not None,
+            })
+        return {"time": round(self.now, 3), "nodes": {str(n.node): {"datagrams": n.datagrams, "records": n.records,
+                                                                     "lost": n.lost, "shieldsUp": n.shields_up}
+                                                       for n in self.nodes.values()},
+                "distinct": {name: self.distinct(w) for w, name in enumerate(DISTINCT_WINDOWS)},
+                "devices": rows}
+
+    def summary(self):
+        lost = sum(n.lost for n in self.nodes.values())
+        text = ("%d nodes, %d datagrams (%d lost, %d bad), %d records; %d devices present; "
+                "%d alerts, %d duplicates suppressed; %d zone changes, %d merges"
+                % (len(self.nodes), self.datagrams, lost, self.bad, self.records, len(self.devices),
+                   self.alerts, self.duplicates, self.zone_changes, self.merges))
+        distinct = [(name, self.distinct(w)) for w, name in enumerate(DISTINCT_WINDOWS)]
+        if any(count is not None for _, count in distinct):
+            text += "; distinct " + ", ".join("%s %s" % (count if count is not None else "-", name)
+                                              for name, count in distinct)
+        return text
+
+
+def write_snapshot(collector, path):
+    temporary = path + ".tmp"
+    with open(temporary, "w") as out:
+        json.dump(collector.snapshot(), out)
+    os.replace(temporary, path)
+
+
+def load_zones(path):
+    zones = {}
+    with open(path) as source:
+        for line in source:
+            line = line.split("#", 1)[0].strip()
+            if line:
+                node, name = line.split(None, 1)
+                zones[int(node)] = name.strip()
+    return zones
+
+
+def stop(signum, frame):
+    raise KeyboardInterrupt
+
+
+def listen(args, collector):
+    signal.signal(signal.SIGTERM, stop)
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 << 20)
+    sock.bind((args.bind, args.port))
+    sock.settimeout(0.5)
+    print("Listening on %s:%d" % (args.bind, args.port), file=sys.stderr)
+    start = time.monotonic()
+    next_summary = args.interval
+    last_records = 0
+    last_settle = 0
+    try:
+        while True:
+            try:
+                data, _ = sock.recvfrom(65535)
+            except socket.timeout:
+                data = None
+            if data is not None:
+                collector.ingest(data, time.monotonic() - start)
+            now = time.monotonic() - start
+            if data is None or now - last_settle >= SETTLE_INTERVAL:
+                collector.settle(now)
+                last_settle = now
+            if now >= next_summary:
+                collector.now = now
+                collector.expire(now)
+                print("%.0f s: %s, %.0f records/s" % (now, collector.summary(),
+                                                      (collector.records - last_records) / args.interval),
+                      file=sys.stderr)
+                last_records = collector.records
+                next_summary = now + args.interval
+                if args.snapshot:
+                    write_snapshot(collector, args.snapshot)
+    except KeyboardInterrupt:
+        pass
+    print(collector.summary(), file=sys.stderr)
+    if args.snapshot:
+        write_snapshot(collector, args.snapshot)
+
+
+# Simulation: nodes on a square grid, devices walking at random among them.
+# RSSI follows a log-distance path loss with noise; a node hears devices down
+# to SIM_SENSITIVITY. Rotating devices change address every --rotate seconds
+# and each node folds the new address into the first one it heard, as the
+# board's address clustering does.
+SIM_SPACING = 15.0        # m between nodes
+SIM_TX_POWER = -45.0      # dBm at 1 m
+SIM_PATH_LOSS = 3.0       # Exponent, indoors
+SIM_NOISE = 4.0           # dB standard deviation per report
+SIM_SENSITIVITY = -95.0   # dBm
+SIM_ADVERT_RATE = 10      # Adverts per second per device
+SIM_REPORT_INTERVAL = 2.0 # s, as NODE_REPORT_INTERVAL
+SIM_SKETCH_INTERVAL = 60.0  # s, as NODE_SKETCH_INTERVAL
+SIM_PRECISION = 10        # As DISTINCT_PRECISION
+SIM_SPEED = 1.2           # m/s, top walking speed
+SIM_RANGE = SIM_SPACING * 2.5  # Nodes further away are not considered
+
+
+class SimDevice:
+    __slots__ = ("x", "y", "heading", "speed", "address", "rotates", "next_rotation", "alert", "identities")
+
+    def __init__(self, rng, width, height, rotate, alert_fraction, rotating_fraction):
+        self.x = rng.uniform(0, width)
+        self.y = rng.uniform(0, height)
+        self.heading = rng.uniform(0, 2 * math.pi)
+        self.speed = rng.uniform(0, SIM_SPEED)
+        self.rotates = rotate > 0 and rng.random() < rotating_fraction
+        self.address = random_address(rng, self.rotates)
+        self.next_rotation = rng.uniform(0, rotate) if self.rotates else None
+        self.alert = rng.random() < alert_fraction
+        self.identities = {}  # node -> identity that node knows it by
+
+
+def random_address(rng, resolvable):
+    mac = bytearray(rng.getrandbits(8) for _ in range(6))
+    if resolvable:
+        mac[0] = (mac[0] & 0x3F) | 0x40
+    return bytes(mac)
+
+
+def simulate(args):
+    rng = random.Random(args.seed)
+    count = args.simulate
+    columns = int(math.ceil(math.sqrt(count)))
+    rows = int(math.ceil(count / float(columns)))
+    nodes = [(i + 1, (i % columns) * SIM_SPACING, (i // columns) * SIM_SPACING) for i in range(count)]
+    width = max(columns - 1, 1) * SIM_SPACING
+    height = max(rows - 1, 1) * SIM_SPACING
+    grid = {}
+    for node in nodes:
+        grid.setdefault((int(node[1] // SIM_RANGE), int(node[2] // SIM_RANGE)), []).append(node)
+    devices = [SimDevice(rng, width, height, args.rotate, args.alerts, 0.7) for _ in range(args.devices or count * 10)]
+    sequences = {node[0]: 0 for node in nodes}
+    heard = {node[0]: set() for node in nodes}  # Identities for each node's hour sketch
+
+    sender = None
+    if args.send:
+        host, port = args.send.rsplit(":", 1)
+        sender = (socket.socket(socket.AF_INET, socket.SOCK_DGRAM), (host, int(port)))
+    collector = Collector(presence=args.presence, zone_window=args.zone_window, hysteresis=args.hysteresis,
+                          alert_delay=args.alert_delay, events=args.events.split(",") if args.events else (),
+                          out=sys.stdout if args.verbose else None)
+
+    steps = int(args.seconds / SIM_REPORT_INTERVAL)
+    adverts_per_report = int(SIM_ADVERT_RATE * SIM_REPORT_INTERVAL)
+    ingest_seconds = 0.0
+    encode_seconds = 0.0
+    datagram_bytes = 0
+    datagram_count = 0
+    alert_devices = set()
+    wall_start = time.monotonic()
+    for step in range(1, steps + 1):
+        now = step * SIM_REPORT_INTERVAL
+        reports = {node[0]: [] for node in nodes}
+        for index, device in enumerate(devices):
+            walk(device, rng, width, height)
+            if device.rotates and now >= device.next_rotation:
+                device.address = random_address(rng, True)
+                device.next_rotation = now + args.rotate
+            cell_x = int(device.x // SIM_RANGE)
+            cell_y = int(device.y // SIM_RANGE)
+            for gx in (cell_x - 1, cell_x, cell_x + 1):
+                for gy in (cell_y - 1, cell_y, cell_y + 1):
+                    for node_id, nx, ny in grid.get((gx, gy), ()):
+                        distance = max(math.hypot(device.x - nx, device.y - ny), 1.0)
+                        rssi = SIM_TX_POWER - 10 * SIM_PATH_LOSS * math.log10(distance) + rng.gauss(0, SIM_NOISE)
+                        if rssi < SIM_SENSITIVITY:
+                            continue
+                        identity = device.identities.setdefault(node_id, device.address)
+                        heard[node_id].add(identity)
+                        flags = (RECORD_USABLE if rssi > -70 else 0) | (RECORD_ALERT if device.alert else 0)
+                        if device.alert:
+                            alert_devices.add(index)
+                        mean = int(round(rssi))
+                        peak = min(int(round(rssi + abs(rng.gauss(0, SIM_NOISE / 2)))), -20)
+                        reports[node_id].append((flags, identity, device.address, adverts_per_report, max(mean, -127),
+                                                 max(peak, -127), rng.randrange(0, 200)))
+
+        started = time.perf_counter()
+        datagrams = []
+        for node_id, records in reports.items():
+            encoded, sequences[node_id] = encode_reports(node_id, sequences[node_id], int(now * 1000),
+                                                         NODE_REPORT_SHIELDS_UP, records)
+            datagrams.extend(encoded)
+        if now % SIM_SKETCH_INTERVAL < SIM_REPORT_INTERVAL or step == steps:
+            for node_id, identities in heard.items():
+                registers = bytearray(1 << SIM_PRECISION)
+                for identity in identities:
+                    sketch_add(registers, SIM_PRECISION, identity)
+                datagrams.append(encode_sketch(node_id, sequences[node_id], int(now * 1000), 0, SIM_PRECISION,
+                                               3600000, registers))
+                sequences[node_id] = (sequences[node_id] + 1) & 0xFFFFFFFF
+        encode_seconds += time.perf_counter() - started
+        datagram_count += len(datagrams)
+        datagram_bytes += sum(len(d) for d in datagrams)
+
+        if sender is not None:
+            delay = wall_start + now - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+            for datagram in datagrams:
+                sender[0].sendto(datagram, sender[1])
+            continue
+        started = time.perf_counter()
+        for datagram in datagrams:
+            collector.ingest(datagram, now)
+        collector.settle(now)
+        collector.expire(now)
+        ingest_seconds += time.perf_counter() - started
+
+    collector.flush_alerts(float("inf"))
+    records = sum(n.records for n in collector.nodes.values())
+    print("Simulated %d nodes, %d devices for %.0f s: %d datagrams, %.0f bytes/s per node"
+          % (count, len(devices), steps * SIM_REPORT_INTERVAL, datagram_count,
+             datagram_bytes / max(steps * SIM_REPORT_INTERVAL, 1) / count))
+    if sender is not None:
+        return
+    offered = records / (steps * SIM_REPORT_INTERVAL)
+    capacity = records / max(ingest_seconds, 1e-9)
+    print("Collector: %d records, %.0f records/s offered (%.0f adverts/s), ingest %.0f records/s (%.1fx headroom), "
+          "%.2f us per record" % (records, offered, offered * adverts_per_report, capacity, capacity / max(offered, 1),
+                                  ingest_seconds / max(records, 1) * 1e6))
+    print("  " + collector.summary())
+
+    # Zone accuracy against the true nearest node, for devices heard now
+    exact = 0
+    near = 0
+    scored = 0
+    for device in devices:
+        fleet = collector.by_address.get(device.address)
+        if fleet is None or fleet.zone_node is None:
+            continue
+        nearest = min(nodes, key=lambda n: math.hypot(device.x - n[1], device.y - n[2]))
+        chosen = nodes[fleet.zone_node - 1]
+        scored += 1
+        if chosen[0] == nearest[0]:
+            exact += 1
+        if math.hypot(chosen[1] - nearest[1], chosen[2] - nearest[2]) <= SIM_SPACING * 1.5:
+            near += 1
+    heard = len({id(collector.by_address[d.address]) for d in devices if d.address in collector.by_address})
+    print("  Devices: %d simulated, %d present in the fleet table as %d entries" % (len(devices), heard,
+                                                                                    len(collector.devices)))
+    print("  Zones: %.1f%% nearest node, %.1f%% nearest or a neighbour (of %d)"
+          % (100.0 * exact / max(scored, 1), 100.0 * near / max(scored, 1), scored))
+    print("  Alerts: %d devices raised them; %d passed on, %d duplicates from other nodes suppressed"
+          % (len(alert_devices), collector.alerts, collector.duplicates))
+    identities = len({identity for d in devices for identity in d.identities.values()})
+    estimate = collector.distinct(0)
+    print("  Distinct: fleet estimate %d for the hour, from %d node sketches; %d devices heard under %d identities "
+          "(%+.1f%%)" % (estimate or 0, len(nodes), sum(1 for d in devices if d.identities), identities,
+                         100.0 * ((estimate or 0) - identities) / max(identities, 1)))
+    print("  Encoding (the nodes' side, in Python): %.2f us per record" % (encode_seconds / max(records, 1) * 1e6))
+
+
+def walk(device, rng, width, height):
+    device.heading += rng.gauss(0, 0.3)
+    step = device.speed * SIM_REPORT_INTERVAL
+    device.x += math.cos(device.heading) * step
+    device.y += math.sin(device.heading) * step
+    if device.x < 0 or device.x > width:
+        device.heading = math.pi - device.heading
+        device.x = min(max(device.x, 0), width)
+    if device.y < 0 or device.y > height:
+        device.heading = -device.heading
+        device.y = min(max(device.y, 0), height)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--port", type=int, default=DEFAULT_PORT, help="UDP port (default %d)" % DEFAULT_PORT)
+    parser.add_argument("--bind", default="0.0.0.0", help="address to listen on")
+    parser.add_argument("--zones", help="file of 'node-id zone-name' lines")
+    parser.add_argument("--snapshot", help="rewrite this JSON file with the presence table every interval")
+    parser.add_argument("--interval", type=float, default=10, help="seconds between summaries (default 10)")
+    parser.add_argument("--presence", type=float, default=60, help="seconds a device stays present (default 60)")
+    parser.add_argument("--zone-window", type=float, default=6, help="seconds a node's RSSI counts for the zone")
+    parser.add_argument("--hysteresis", type=float, default=4, help="dB a node must lead by to take over a zone")
+    parser.add_argument("--alert-delay", type=float, default=2,
+                        help="seconds an alert waits for other nodes' reports to link the device (default 2)")
+    parser.add_argument("--events", default="alert,zone", help="event lines to print: alert, zone or both")
+    parser.add_argument("--simulate", type=int, metavar="N", help="simulate N nodes instead of listening")
+    parser.add_argument("--devices", type=int, default=0, help="simulated devices (default 10 per node)")
+    parser.add_argument("--seconds", type=float, default=60, help="simulated time (default 60)")
+    parser.add_argument("--rotate", type=float, default=300,
+                        help="seconds between address rotations for 70%% of devices, 0 for none (default 300)")
+    parser.add_argument("--alerts", type=float, default=0.02, help="fraction of devices that raise alerts")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--send", metavar="HOST:PORT", help="send the simulated reports to a running collector")
+    parser.add_argument("--verbose", action="store_true", help="print event lines in a simulation")
+    args = parser.parse_args()
+
+    if args.simulate:
+        simulate(args)
+        return
+    collector = Collector(zones=load_zones(args.zones) if args.zones else None, presence=args.presence,
+                          zone_window=args.zone_window, hysteresis=args.hysteresis, alert_delay=args.alert_delay,
+                          events=[e for e in args.events.split(",") if e])
+    listen(args, collector)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""Generate OuiData.cpp, the flash-resident manufacturer lookup tables.
+
+Inputs are the public IEEE MA-L registry and the Bluetooth SIG company
+identifier list:
+
+    curl -o oui.csv https://standards-oui.ieee.org/oui/oui.csv
+    curl -o company_identifiers.yaml \\
+        https://bitbucket.org/bluetooth-SIG/public/raw/main/assigned_numbers/company_identifiers/company_identifiers.yaml
+    python3 tools/gen_oui.py --oui oui.csv --companies company_identifiers.yaml
+
+Without arguments the small seed lists in tools/data are used, which is what
+the checked-in OuiData.cpp was generated from.
+
+Names are shortened (corporate suffixes dropped, length capped) and stored
+once in a shared string pool. OUIs are stored as packed 3-byte big-endian keys
+sorted for binary search; company IDs as sorted 16-bit keys. A size report is
+printed so the flash cost can be checked against the app partition.
+"""
+
+import argparse
+import csv
+import os
+import re
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(HERE)
+
+# App partition size in min_spiffs.csv (0x1E0000)
+APP_PARTITION_BYTES = 0x1E0000
+
+SUFFIXES = [
+    r",?\s+inc\.?", r",?\s+incorporated", r",?\s+corp\.?", r",?\s+corporation",
+    r",?\s+co\.?,?\s*ltd\.?", r",?\s+co\.?", r",?\s+ltd\.?", r",?\s+limited",
+    r",?\s+llc", r",?\s+gmbh", r",?\s+ag", r",?\s+asa", r",?\s+s\.?a\.?",
+    r",?\s+b\.?v\.?", r",?\s+plc", r",?\s+communications", r",?\s+electronics",
+    r",?\s+technology licensing", r",?\s+international", r",?\s+services",
+    r",?\s+foundation", r",?\s+systems", r"\s+\(.*\)",
+]
+SUFFIX_RE = re.compile("(" + "|".join(SUFFIXES) + r")\s*$", re.IGNORECASE)
+
+
+def short_name(name, max_length):
+    name = " ".join(name.split())
+    while True:
+        stripped = SUFFIX_RE.sub("", name).rstrip(" ,.")
+        if stripped == name or not stripped:
+            break
+        name = stripped
+    if name.lower().endswith(".com"):
+        name = name[:-4]
+    return name[:max_length].rstrip()
+
+
+def read_ouis(path):
+    entries = {}
+    with open(path, newline="", encoding="utf-8") as f:
+        for row in csv.DictReader(f):
+            if row.get("Registry", "MA-L") != "MA-L":
+                continue
+            entries[int(row["Assignment"], 16)] = row["Organization Name"]
+    return entries
+
+
+def read_companies(path):
+    # The SIG file is a flat list of value/name pairs; avoid a YAML dependency
+    entries = {}
+    value = None
+    with open(path, encoding="utf-8") as f:
+        for line in f:
+            match = re.match(r"\s*-?\s*value:\s*(0x[0-9A-Fa-f]+|\d+)", line)
+            if match:
+                value = int(match.group(1), 0)
+                continue
+            match = re.match(r"\s*name:\s*(['\"])(.*)\1\s*$", line)
+            if match and value is not None:
+                entries[value] = match.group(2).replace("''", "'")
+                value = None
+    return entries
+
+
+def c_string(text):
+    return '"' + text.replace("\\", "\\\\").replace('"', '\\"') + '\\0"'
+
+
+def wrap(items, per_line):
+    lines = []
+    for i in range(0, len(items), per_line):
+        lines.append("    " + ", ".join(items[i:i + per_line]) + ",")
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--oui", default=os.path.join(HERE, "data", "oui_seed.csv"))
+    parser.add_argument("--companies", default=os.path.join(HERE, "data", "company_seed.yaml"))
+    parser.add_argument("--max-name", type=int, default=24, help="longest stored name")
+    parser.add_argument("--output", default=os.path.join(ROOT, "OuiData.cpp"))
+    args = parser.parse_args()
+
+    ouis = read_ouis(args.oui)
+    companies = read_companies(args.companies)
+
+    # Deduplicated string pool; index 0 is always "Unknown"
+    names = ["Unknown"]
+    name_index = {"Unknown": 0}
+
+    def intern(name):
+        name = short_name(name, args.max_name) or "Unknown"
+        if name not in name_index:
+            name_index[name] = len(names)
+            names.append(name)
+        return name_index[name]
+
+    oui_rows = [(oui, intern(ouis[oui])) for oui in sorted(ouis)]
+    company_rows = [(cid, intern(companies[cid])) for cid in sorted(companies)]
+    if len(names) > 0xFFFF:
+        sys.exit("too many distinct names for 16-bit manufacturer indices")
+
+    offsets = []
+    pool_bytes = 0
+    for name in names:
+        offsets.append(pool_bytes)
+        pool_bytes += len(name.encode("utf-8")) + 1
+
+    out = []
+    out.append("// Generated by tools/gen_oui.py from %s and %s. Do not edit."
+               % (os.path.basename(args.oui), os.path.basename(args.companies)))
+    out.append("")
+    out.append('#include "OuiTable.h"')
+    out.append("")
+    out.append("const uint16_t manufacturerCount = %d;" % len(names))
+    out.append("const uint32_t ouiCount = %d;" % len(oui_rows))
+    out.append("const uint16_t companyCount = %d;" % len(company_rows))
+    out.append("")
+    out.append("const char manufacturerPool[] =")
+    out.extend("    " + c_string(name) for name in names)
+    out[-1] += ";"
+    out.append("")
+    out.append("const uint32_t manufacturerOffsets[] = {")
+    out.append(wrap([str(o) for o in offsets], 12))
+    out.append("};")
+    out.append("")
+    out.append("// Packed 24-bit OUIs, big-endian, sorted")
+    out.append("const uint8_t ouiKeys[] = {")
+    out.append(wrap(["0x%02X, 0x%02X, 0x%02X" % (o >> 16, (o >> 8) & 0xFF, o & 0xFF)
+                     for o, _ in oui_rows], 4))
+    out.append("};")
+    out.append("")
+    out.append("const uint16_t ouiManufacturers[] = {")
+    out.append(wrap([str(n) for _, n in oui_rows], 16))
+    out.append("};")
+    out.append("")
+    out.append("// Bluetooth SIG company identifiers, sorted")
+    out.append("const uint16_t companyIds[] = {")
+    out.append(wrap(["0x%04X" % c for c, _ in company_rows], 10))
+    out.append("};")
+    out.append("")
+    out.append("const uint16_t companyManufacturers[] = {")
+    out.append(wrap([str(n) for _, n in company_rows], 16))
+    out.append("};")
+    out.append("")
+
+    with open(args.output, "w", encoding="utf-8") as f:
+        f.write("\n".join(out))
+
+    oui_bytes = len(oui_rows) * 5
+    company_bytes = len(company_rows) * 4
+    offset_bytes = len(offsets) * 4
+    total = pool_bytes + oui_bytes + company_bytes + offset_bytes
+    print("OUI entries:       %7d  %9d bytes" % (len(oui_rows), oui_bytes))
+    print("Company entries:   %7d  %9d bytes" % (len(company_rows), company_bytes))
+    print("Distinct names:    %7d  %9d bytes (pool) + %d bytes (offsets)"
+          % (len(names), pool_bytes, offset_bytes))
+    print("Total flash:                %9d bytes (%.1f%% of the %d byte app partition)"
+          % (total, 100.0 * total / APP_PARTITION_BYTES, APP_PARTITION_BYTES))
+
+
+if __name__ == "__main__":
+    main()